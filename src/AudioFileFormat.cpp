@@ -0,0 +1,418 @@
+/* 
+    Real Time File Streaming copyright (c) 2014 Ross Bencina
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+#include "AudioFileFormat.h"
+
+#undef min
+#undef max
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cmath> // ldexp
+#include <cstring>
+
+#ifndef NOERROR
+#define NOERROR (0)
+#endif
+
+// Byte order helpers. Headers are read and written byte by byte, so they don't depend on the host byte order.
+
+static uint16_t readLittleEndian16( const uint8_t *p ) { return (uint16_t)(p[0] | (p[1] << 8)); }
+static uint32_t readLittleEndian32( const uint8_t *p ) { return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24); }
+static uint64_t readLittleEndian64( const uint8_t *p ) { return (uint64_t)readLittleEndian32(p) | ((uint64_t)readLittleEndian32(p + 4) << 32); }
+static uint16_t readBigEndian16( const uint8_t *p ) { return (uint16_t)((p[0] << 8) | p[1]); }
+static uint32_t readBigEndian32( const uint8_t *p ) { return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3]; }
+static uint64_t readBigEndian64( const uint8_t *p ) { return ((uint64_t)readBigEndian32(p) << 32) | (uint64_t)readBigEndian32(p + 4); }
+
+static void writeLittleEndian16( uint8_t *p, uint16_t x ) { p[0] = (uint8_t)x; p[1] = (uint8_t)(x >> 8); }
+static void writeLittleEndian32( uint8_t *p, uint32_t x ) { writeLittleEndian16(p, (uint16_t)x); writeLittleEndian16(p + 2, (uint16_t)(x >> 16)); }
+static void writeLittleEndian64( uint8_t *p, uint64_t x ) { writeLittleEndian32(p, (uint32_t)x); writeLittleEndian32(p + 4, (uint32_t)(x >> 32)); }
+
+static bool isFourCC( const uint8_t *p, const char *fourCC ) { return std::memcmp(p, fourCC, 4) == 0; }
+
+// 80-bit IEEE 754 extended precision, as used for the AIFF sample rate
+static double extendedToDouble( const uint8_t *p )
+{
+    int exponent = ((p[0] & 0x7F) << 8) | p[1];
+    uint64_t mantissa = readBigEndian64(p + 2); // (with an explicit integer bit)
+    if (exponent == 0 && mantissa == 0)
+        return 0.;
+
+    double result = std::ldexp((double)mantissa, exponent - 16383 - 63);
+    return (p[0] & 0x80) ? -result : result;
+}
+
+static double bigEndianDouble( const uint8_t *p )
+{
+    uint64_t x = readBigEndian64(p);
+    double result;
+    std::memcpy(&result, &x, sizeof(result));
+    return result;
+}
+
+static uint32_t roundSampleRate( double sampleRate )
+{
+    return (sampleRate > 0. && sampleRate < 4294967295.) ? (uint32_t)(sampleRate + .5) : 0;
+}
+
+static int integerSampleFormat( std::size_t sampleSizeBytes, bool isBigEndian )
+{
+    switch (sampleSizeBytes) {
+    case 2: return (isBigEndian) ? SAMPLE_FORMAT_INT16_BIG_ENDIAN : SAMPLE_FORMAT_INT16;
+    case 3: return (isBigEndian) ? SAMPLE_FORMAT_INT24_BIG_ENDIAN : SAMPLE_FORMAT_INT24;
+    }
+    return IO_UNKNOWN_SAMPLE_FORMAT;
+}
+
+static int floatSampleFormat( std::size_t sampleSizeBytes, bool isBigEndian )
+{
+    if (sampleSizeBytes == 4)
+        return (isBigEndian) ? SAMPLE_FORMAT_FLOAT32_BIG_ENDIAN : SAMPLE_FORMAT_FLOAT32;
+    return IO_UNKNOWN_SAMPLE_FORMAT;
+}
+
+void initHeaderlessAudioFormat( FileIoAudioFormat *format )
+{
+    format->containerType = CONTAINER_TYPE_NONE;
+    format->sampleFormat = IO_UNKNOWN_SAMPLE_FORMAT;
+    format->sampleRate = 0;
+    format->channelCount = 0;
+    format->dataOffsetBytes = 0;
+    format->dataSizeBytes = IO_UNKNOWN_DATA_SIZE;
+}
+
+// Header parsing. Each parser walks the chunks from the start of the file, reading only
+// the chunk headers and the format chunk, and stops at the sample data once it has the format.
+
+namespace {
+    struct HeaderReader {
+        AudioFileHeaderReadFunc read;
+        void *context;
+        uint64_t fileSizeBytes;
+
+        bool readExactly( uint64_t position, void *dest, std::size_t sizeBytes )
+        {
+            return (read(context, position, dest, sizeBytes) == (int)sizeBytes);
+        }
+    };
+} // end anonymous namespace
+
+// WAV, RF64 and BW64. Little-endian. Chunks have 32-bit sizes and are padded to even lengths. 
+// In RF64 files the sizes that don't fit are 0xFFFFFFFF, and are found in the ds64 chunk instead.
+static int parseWaveFileHeader( HeaderReader& reader, bool isRf64, FileIoAudioFormat *result )
+{
+    enum { WAVE_FORMAT_PCM = 1, WAVE_FORMAT_IEEE_FLOAT = 3, WAVE_FORMAT_EXTENSIBLE = 0xFFFE };
+
+    bool hasFormat = false, hasData = false;
+    uint64_t ds64DataSizeBytes = IO_UNKNOWN_DATA_SIZE;
+
+    uint64_t position = 12;
+    while (position + 8 <= reader.fileSizeBytes && !(hasFormat && hasData)) {
+        uint8_t chunkHeader[8];
+        if (!reader.readExactly(position, chunkHeader, 8))
+            return EINVAL;
+        uint64_t chunkSizeBytes = readLittleEndian32(chunkHeader + 4);
+        uint64_t bodyPosition = position + 8;
+
+        if (isFourCC(chunkHeader, "ds64")) {
+            uint8_t ds64[24]; // riff size, data size, sample count (the table isn't needed)
+            if (chunkSizeBytes < 24 || !reader.readExactly(bodyPosition, ds64, 24))
+                return EINVAL;
+            ds64DataSizeBytes = readLittleEndian64(ds64 + 8);
+
+        } else if (isFourCC(chunkHeader, "fmt ")) {
+            uint8_t fmt[40];
+            std::size_t fmtSizeBytes = (std::size_t)std::min<uint64_t>(chunkSizeBytes, sizeof(fmt));
+            if (fmtSizeBytes < 16 || !reader.readExactly(bodyPosition, fmt, fmtSizeBytes))
+                return EINVAL;
+
+            unsigned int formatTag = readLittleEndian16(fmt);
+            if (formatTag == WAVE_FORMAT_EXTENSIBLE && fmtSizeBytes >= 40)
+                formatTag = readLittleEndian16(fmt + 24); // the first two bytes of the SubFormat GUID
+            result->channelCount = readLittleEndian16(fmt + 2);
+            result->sampleRate = readLittleEndian32(fmt + 4);
+            std::size_t sampleSizeBytes = (readLittleEndian16(fmt + 14) + 7) / 8; // (container size, not valid bits)
+            if (formatTag == WAVE_FORMAT_PCM)
+                result->sampleFormat = integerSampleFormat(sampleSizeBytes, false);
+            else if (formatTag == WAVE_FORMAT_IEEE_FLOAT)
+                result->sampleFormat = floatSampleFormat(sampleSizeBytes, false);
+            else
+                result->sampleFormat = IO_UNKNOWN_SAMPLE_FORMAT;
+            hasFormat = true;
+
+        } else if (isFourCC(chunkHeader, "data")) {
+            result->dataOffsetBytes = bodyPosition;
+            if (chunkSizeBytes == 0xFFFFFFFF) // RF64, or a RIFF file that was never finalized
+                result->dataSizeBytes = (isRf64) ? ds64DataSizeBytes : IO_UNKNOWN_DATA_SIZE;
+            else
+                result->dataSizeBytes = chunkSizeBytes;
+            hasData = true;
+
+            if (result->dataSizeBytes == IO_UNKNOWN_DATA_SIZE)
+                break; // the data extends to the end of the file
+            chunkSizeBytes = result->dataSizeBytes;
+        }
+
+        position = bodyPosition + chunkSizeBytes + (chunkSizeBytes & 1);
+    }
+
+    if (!(hasFormat && hasData))
+        return EINVAL;
+
+    result->containerType = CONTAINER_TYPE_WAV;
+    return NOERROR;
+}
+
+// AIFF and AIFF-C. Big-endian. The sample rate is an 80-bit float. AIFF-C adds a 
+// compression type to the COMM chunk: only the uncompressed types are sample formats.
+static int parseAiffFileHeader( HeaderReader& reader, bool isAifc, FileIoAudioFormat *result )
+{
+    bool hasFormat = false, hasData = false;
+
+    uint64_t position = 12;
+    while (position + 8 <= reader.fileSizeBytes && !(hasFormat && hasData)) {
+        uint8_t chunkHeader[8];
+        if (!reader.readExactly(position, chunkHeader, 8))
+            return EINVAL;
+        uint64_t chunkSizeBytes = readBigEndian32(chunkHeader + 4);
+        uint64_t bodyPosition = position + 8;
+
+        if (isFourCC(chunkHeader, "COMM")) {
+            uint8_t comm[22];
+            std::size_t commSizeBytes = (isAifc) ? 22 : 18;
+            if (chunkSizeBytes < commSizeBytes || !reader.readExactly(bodyPosition, comm, commSizeBytes))
+                return EINVAL;
+
+            result->channelCount = readBigEndian16(comm);
+            std::size_t sampleSizeBytes = (readBigEndian16(comm + 6) + 7) / 8;
+            result->sampleRate = roundSampleRate(extendedToDouble(comm + 8));
+            if (!isAifc || isFourCC(comm + 18, "NONE") || isFourCC(comm + 18, "twos"))
+                result->sampleFormat = integerSampleFormat(sampleSizeBytes, true);
+            else if (isFourCC(comm + 18, "sowt"))
+                result->sampleFormat = integerSampleFormat(sampleSizeBytes, false);
+            else if (isFourCC(comm + 18, "fl32") || isFourCC(comm + 18, "FL32"))
+                result->sampleFormat = floatSampleFormat(4, true);
+            else
+                result->sampleFormat = IO_UNKNOWN_SAMPLE_FORMAT;
+            hasFormat = true;
+
+        } else if (isFourCC(chunkHeader, "SSND")) {
+            uint8_t ssnd[8]; // offset, block size
+            if (chunkSizeBytes < 8 || !reader.readExactly(bodyPosition, ssnd, 8))
+                return EINVAL;
+            uint64_t offsetBytes = readBigEndian32(ssnd);
+            if (offsetBytes > chunkSizeBytes - 8)
+                return EINVAL;
+            result->dataOffsetBytes = bodyPosition + 8 + offsetBytes;
+            result->dataSizeBytes = chunkSizeBytes - 8 - offsetBytes;
+            hasData = true;
+        }
+
+        position = bodyPosition + chunkSizeBytes + (chunkSizeBytes & 1);
+    }
+
+    if (!(hasFormat && hasData))
+        return EINVAL;
+
+    result->containerType = CONTAINER_TYPE_AIFF;
+    return NOERROR;
+}
+
+// Core Audio Format. Big-endian, 64-bit chunk sizes. A data chunk size of -1 means that 
+// the data extends to the end of the file. The data chunk starts with a 4-byte edit count.
+static int parseCafFileHeader( HeaderReader& reader, FileIoAudioFormat *result )
+{
+    enum { kCAFLinearPCMFormatFlagIsFloat = 1, kCAFLinearPCMFormatFlagIsLittleEndian = 2 };
+
+    bool hasFormat = false, hasData = false;
+
+    uint64_t position = 8;
+    while (position + 12 <= reader.fileSizeBytes && !(hasFormat && hasData)) {
+        uint8_t chunkHeader[12];
+        if (!reader.readExactly(position, chunkHeader, 12))
+            return EINVAL;
+        uint64_t chunkSizeBytes = readBigEndian64(chunkHeader + 4);
+        uint64_t bodyPosition = position + 12;
+
+        if (isFourCC(chunkHeader, "desc")) {
+            uint8_t desc[32];
+            if (chunkSizeBytes < 32 || !reader.readExactly(bodyPosition, desc, 32))
+                return EINVAL;
+
+            result->sampleRate = roundSampleRate(bigEndianDouble(desc));
+            uint32_t formatFlags = readBigEndian32(desc + 12);
+            uint32_t bytesPerPacket = readBigEndian32(desc + 16);
+            uint32_t framesPerPacket = readBigEndian32(desc + 20);
+            result->channelCount = readBigEndian32(desc + 24);
+
+            result->sampleFormat = IO_UNKNOWN_SAMPLE_FORMAT;
+            if (isFourCC(desc + 8, "lpcm") && framesPerPacket == 1 && result->channelCount > 0) {
+                std::size_t sampleSizeBytes = bytesPerPacket / result->channelCount;
+                bool isBigEndian = !(formatFlags & kCAFLinearPCMFormatFlagIsLittleEndian);
+                result->sampleFormat = (formatFlags & kCAFLinearPCMFormatFlagIsFloat) 
+                        ? floatSampleFormat(sampleSizeBytes, isBigEndian) : integerSampleFormat(sampleSizeBytes, isBigEndian);
+            }
+            hasFormat = true;
+
+        } else if (isFourCC(chunkHeader, "data")) {
+            result->dataOffsetBytes = bodyPosition + 4;
+            if (chunkSizeBytes == (uint64_t)-1) {
+                result->dataSizeBytes = IO_UNKNOWN_DATA_SIZE;
+                hasData = true;
+                break; // the data extends to the end of the file
+            }
+            if (chunkSizeBytes < 4)
+                return EINVAL;
+            result->dataSizeBytes = chunkSizeBytes - 4;
+            hasData = true;
+        }
+
+        if (chunkSizeBytes > reader.fileSizeBytes)
+            break; // (also guards against overflow)
+        position = bodyPosition + chunkSizeBytes;
+    }
+
+    if (!(hasFormat && hasData))
+        return EINVAL;
+
+    result->containerType = CONTAINER_TYPE_CAF;
+    return NOERROR;
+}
+
+int parseAudioFileHeader( AudioFileHeaderReadFunc read, void *context, uint64_t fileSizeBytes, FileIoAudioFormat *result )
+{
+    initHeaderlessAudioFormat(result);
+
+    HeaderReader reader;
+    reader.read = read;
+    reader.context = context;
+    reader.fileSizeBytes = fileSizeBytes;
+
+    uint8_t fileHeader[12];
+    if (fileSizeBytes < 12 || !reader.readExactly(0, fileHeader, 12))
+        return NOERROR; // too short to have a header
+
+    int error = NOERROR;
+    if ((isFourCC(fileHeader, "RIFF") || isFourCC(fileHeader, "RF64") || isFourCC(fileHeader, "BW64")) && isFourCC(fileHeader + 8, "WAVE"))
+        error = parseWaveFileHeader(reader, !isFourCC(fileHeader, "RIFF"), result);
+    else if (isFourCC(fileHeader, "FORM") && (isFourCC(fileHeader + 8, "AIFF") || isFourCC(fileHeader + 8, "AIFC")))
+        error = parseAiffFileHeader(reader, isFourCC(fileHeader + 8, "AIFC"), result);
+    else if (isFourCC(fileHeader, "caff") && readBigEndian16(fileHeader + 4) == 1)
+        error = parseCafFileHeader(reader, result);
+    else if (isFourCC(fileHeader, "fLaC")) {
+        result->containerType = CONTAINER_TYPE_FLAC; // (parsed by the decoder)
+        return NOERROR;
+    }
+    else
+        return NOERROR; // headerless
+
+    if (error != NOERROR) {
+        initHeaderlessAudioFormat(result);
+        return error;
+    }
+
+    // The data can't extend past the end of the file (e.g. a recording that wasn't finalized)
+    uint64_t availableBytes = (result->dataOffsetBytes < fileSizeBytes) ? fileSizeBytes - result->dataOffsetBytes : 0;
+    result->dataSizeBytes = std::min(result->dataSizeBytes, availableBytes);
+    return NOERROR;
+}
+
+// Header writing.
+//
+// Layout: RIFF/RF64 header (12 bytes), JUNK chunk reserving space for a ds64 chunk (36 bytes), 
+// fmt chunk with cbSize (26 bytes), JUNK chunk padding to alignment (if needed), data chunk header (8 bytes).
+// The reserved JUNK chunk is replaced by ds64 if the file needs RF64 sizes.
+
+#define IO_WAVE_DS64_CHUNK_OFFSET       (12)
+#define IO_WAVE_DS64_CHUNK_SIZE_BYTES   (28)
+#define IO_WAVE_FMT_CHUNK_OFFSET        (IO_WAVE_DS64_CHUNK_OFFSET + 8 + IO_WAVE_DS64_CHUNK_SIZE_BYTES)
+#define IO_WAVE_FMT_CHUNK_SIZE_BYTES    (18)
+#define IO_WAVE_PADDING_CHUNK_OFFSET    (IO_WAVE_FMT_CHUNK_OFFSET + 8 + IO_WAVE_FMT_CHUNK_SIZE_BYTES)
+#define IO_WAVE_MIN_HEADER_SIZE_BYTES   (IO_WAVE_PADDING_CHUNK_OFFSET + 8)
+
+bool canWriteWaveFileHeader( const FileIoAudioFormat& format )
+{
+    return (format.containerType == CONTAINER_TYPE_WAV 
+            && (format.sampleFormat == SAMPLE_FORMAT_INT16 || format.sampleFormat == SAMPLE_FORMAT_INT24 || format.sampleFormat == SAMPLE_FORMAT_FLOAT32)
+            && format.channelCount > 0 && format.channelCount <= 0xFFFF && format.sampleRate > 0);
+}
+
+std::size_t waveFileHeaderSizeBytes( std::size_t alignment )
+{
+    alignment = std::max<std::size_t>(alignment, 2); // (chunks are word aligned)
+    std::size_t result = ((IO_WAVE_MIN_HEADER_SIZE_BYTES + alignment - 1) / alignment) * alignment;
+    if (result != IO_WAVE_MIN_HEADER_SIZE_BYTES && result - IO_WAVE_MIN_HEADER_SIZE_BYTES < 8)
+        result += alignment; // no room for the padding chunk's header
+    return result;
+}
+
+void buildWaveFileHeader( void *dest, std::size_t headerSizeBytes, const FileIoAudioFormat& format, uint64_t dataSizeBytes )
+{
+    assert( canWriteWaveFileHeader(format) );
+    assert( headerSizeBytes >= IO_WAVE_MIN_HEADER_SIZE_BYTES && (headerSizeBytes % 2) == 0 );
+
+    uint8_t *p = static_cast<uint8_t*>(dest);
+    std::memset(p, 0, headerSizeBytes);
+
+    // Unknown sizes (while recording) are written as 0xFFFFFFFF, which parseAudioFileHeader() 
+    // reads as data that extends to the end of the file.
+    bool isSizeKnown = (dataSizeBytes != IO_UNKNOWN_DATA_SIZE);
+    uint64_t riffSizeBytes = (isSizeKnown) ? headerSizeBytes - 8 + dataSizeBytes : IO_UNKNOWN_DATA_SIZE;
+    bool isRf64 = isSizeKnown && (riffSizeBytes > 0xFFFFFFFF);
+
+    const std::size_t sampleSizeBytes = bytesPerSample((FileIoSampleFormat)format.sampleFormat);
+    const std::size_t frameSizeBytes = sampleSizeBytes * format.channelCount;
+
+    std::memcpy(p, (isRf64) ? "RF64" : "RIFF", 4);
+    writeLittleEndian32(p + 4, (isRf64 || !isSizeKnown) ? 0xFFFFFFFF : (uint32_t)riffSizeBytes);
+    std::memcpy(p + 8, "WAVE", 4);
+
+    uint8_t *ds64 = p + IO_WAVE_DS64_CHUNK_OFFSET;
+    std::memcpy(ds64, (isRf64) ? "ds64" : "JUNK", 4);
+    writeLittleEndian32(ds64 + 4, IO_WAVE_DS64_CHUNK_SIZE_BYTES);
+    if (isRf64) {
+        writeLittleEndian64(ds64 + 8, riffSizeBytes);
+        writeLittleEndian64(ds64 + 16, dataSizeBytes);
+        writeLittleEndian64(ds64 + 24, dataSizeBytes / frameSizeBytes); // sample (frame) count
+        // (table length is 0)
+    }
+
+    uint8_t *fmt = p + IO_WAVE_FMT_CHUNK_OFFSET;
+    std::memcpy(fmt, "fmt ", 4);
+    writeLittleEndian32(fmt + 4, IO_WAVE_FMT_CHUNK_SIZE_BYTES);
+    writeLittleEndian16(fmt + 8, (format.sampleFormat == SAMPLE_FORMAT_FLOAT32) ? 3 : 1); // WAVE_FORMAT_IEEE_FLOAT or WAVE_FORMAT_PCM
+    writeLittleEndian16(fmt + 10, (uint16_t)format.channelCount);
+    writeLittleEndian32(fmt + 12, format.sampleRate);
+    writeLittleEndian32(fmt + 16, (uint32_t)(format.sampleRate * frameSizeBytes)); // byte rate
+    writeLittleEndian16(fmt + 20, (uint16_t)frameSizeBytes); // block align
+    writeLittleEndian16(fmt + 22, (uint16_t)(sampleSizeBytes * 8));
+    // (cbSize is 0)
+
+    if (headerSizeBytes > IO_WAVE_MIN_HEADER_SIZE_BYTES) {
+        uint8_t *padding = p + IO_WAVE_PADDING_CHUNK_OFFSET;
+        std::memcpy(padding, "JUNK", 4);
+        writeLittleEndian32(padding + 4, (uint32_t)(headerSizeBytes - IO_WAVE_MIN_HEADER_SIZE_BYTES - 8));
+    }
+
+    uint8_t *data = p + headerSizeBytes - 8;
+    std::memcpy(data, "data", 4);
+    writeLittleEndian32(data + 4, (isRf64 || !isSizeKnown) ? 0xFFFFFFFF : (uint32_t)dataSizeBytes);
+}
@@ -0,0 +1,95 @@
+/* 
+    Real Time File Streaming copyright (c) 2014 Ross Bencina
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+#ifndef INCLUDED_AUDIOFILEFORMAT_H
+#define INCLUDED_AUDIOFILEFORMAT_H
+
+#include <cstddef> // size_t
+#include <stdint.h>
+
+#include "SampleFormatConversion.h"
+
+/*
+    Audio file container headers.
+
+    OPEN_FILE parses the header of files opened for reading on the server thread, 
+    and returns the format and the location of the sample data (see FileIoRequest::openFile). 
+    Streams offset their block positions by dataOffsetBytes, so stream positions are 
+    relative to the first sample frame, and blocks are aligned to the data start. 
+    Reads are clamped to the end of the data, so chunks that follow the sample data 
+    are never returned.
+
+    Recognised containers: WAV (PCM, IEEE float and WAVE_FORMAT_EXTENSIBLE, including 
+    RF64/BW64 for files larger than 4GB), AIFF and AIFF-C (uncompressed, 'sowt' and 'fl32'), 
+    and CAF (linear PCM). Files that don't start with one of these headers are 
+    headerless: the whole file is sample data, as before.
+
+    Write streams can be given a WAV format when they are opened. The server writes 
+    the header when the file is opened, and rewrites it with the final sizes when the 
+    file is closed, switching to RF64 if the data outgrew a RIFF file.
+
+    FLAC files are compressed. parseAudioFileHeader() only identifies them: the server 
+    decodes them into the blocks that it returns (see FlacDecoder.h), so their stream 
+    positions are positions in the decoded data, and dataOffsetBytes is 0.
+*/
+
+enum FileIoContainerType {
+    CONTAINER_TYPE_NONE, // headerless. sampleFormat, sampleRate and channelCount are unknown
+    CONTAINER_TYPE_WAV,
+    CONTAINER_TYPE_AIFF,
+    CONTAINER_TYPE_CAF,
+    CONTAINER_TYPE_FLAC // decoded by the server
+};
+
+#define IO_UNKNOWN_SAMPLE_FORMAT    (-1) // the container holds samples that aren't a FileIoSampleFormat (e.g. compressed data)
+#define IO_UNKNOWN_DATA_SIZE        ((uint64_t)-1) // the sample data extends to the end of the file
+
+struct FileIoAudioFormat {
+    int containerType;          // FileIoContainerType
+    int sampleFormat;           // FileIoSampleFormat, or IO_UNKNOWN_SAMPLE_FORMAT
+    uint32_t sampleRate;        // (rounded to an integer)
+    uint32_t channelCount;
+    uint64_t dataOffsetBytes;   // file position of the first sample frame (0 for decoded files)
+    uint64_t dataSizeBytes;     // or IO_UNKNOWN_DATA_SIZE. the decoded size for decoded files
+};
+
+void initHeaderlessAudioFormat( FileIoAudioFormat *format );
+
+// Header parsing. read() reads sizeBytes at position, and returns the number of bytes read 
+// (short at the end of the file), or -1 on error. Returns an errno value: EINVAL if the 
+// file has a recognised header that can't be parsed. Files with no recognised header 
+// are returned as CONTAINER_TYPE_NONE. dataSizeBytes is clamped to the file size. 
+// FLAC files are returned as CONTAINER_TYPE_FLAC, with the rest of the format unknown.
+typedef int (*AudioFileHeaderReadFunc)( void *context, uint64_t position, void *dest, std::size_t sizeBytes );
+
+int parseAudioFileHeader( AudioFileHeaderReadFunc read, void *context, uint64_t fileSizeBytes, FileIoAudioFormat *result );
+
+// Header writing (WAV only). The header is padded with a JUNK chunk to 
+// waveFileHeaderSizeBytes(alignment), which is a multiple of alignment, so that the 
+// sample data starts on an alignment boundary (e.g. for unbuffered I/O).
+bool canWriteWaveFileHeader( const FileIoAudioFormat& format );
+
+std::size_t waveFileHeaderSizeBytes( std::size_t alignment );
+
+// Write the header for dataSizeBytes of sample data into dest, which holds headerSizeBytes.
+void buildWaveFileHeader( void *dest, std::size_t headerSizeBytes, const FileIoAudioFormat& format, uint64_t dataSizeBytes );
+
+#endif /* INCLUDED_AUDIOFILEFORMAT_H */
@@ -24,9 +24,32 @@
 
 #include <cstdlib> // size_t
 
-#define IO_DATA_BLOCK_DATA_CAPACITY_BYTES  (32*1024)
+#define IO_DATA_BLOCK_DATA_CAPACITY_BYTES  (32*1024) // default block size
+
+// Streams may use any power-of-two block size from IO_MIN_DATA_BLOCK_CAPACITY_BYTES to 
+// IO_MAX_DATA_BLOCK_CAPACITY_BYTES. Each size is a size class with its own data block pool.
+#define IO_MIN_DATA_BLOCK_CAPACITY_BYTES   (4*1024)
+#define IO_MAX_DATA_BLOCK_CAPACITY_BYTES   (1024*1024)
+#define IO_DATA_BLOCK_SIZE_CLASS_COUNT     (9) // 4k, 8k, 16k, 32k, 64k, 128k, 256k, 512k, 1M
+
+// Map a block size to a size class, rounding up to the next supported size
+inline int dataBlockSizeClassForCapacity( std::size_t capacityBytes )
+{
+    int sizeClass = 0;
+    while (sizeClass < IO_DATA_BLOCK_SIZE_CLASS_COUNT - 1 
+            && ((std::size_t)IO_MIN_DATA_BLOCK_CAPACITY_BYTES << sizeClass) < capacityBytes)
+        ++sizeClass;
+    return sizeClass;
+}
+
+inline std::size_t dataBlockCapacityForSizeClass( int sizeClass )
+{
+    return (std::size_t)IO_MIN_DATA_BLOCK_CAPACITY_BYTES << sizeClass;
+}
 
 struct DataBlock{
+    DataBlock *links_[1]; // server internal use. links the block into the free list of a DataBlockPool
+
     std::size_t capacityBytes;
     std::size_t validCountBytes;
     void *data;
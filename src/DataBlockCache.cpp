@@ -0,0 +1,252 @@
+/* 
+    Real Time File Streaming copyright (c) 2014 Ross Bencina
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+#include "DataBlockCache.h"
+
+#include <cassert>
+
+DataBlockCache::DataBlockCache( DataBlockPool **pools, std::size_t capacityBytes, std::size_t maxPinnedBlockCount )
+    : pools_( pools )
+    , capacityBytes_( capacityBytes )
+    , unpinnedBytes_( 0 )
+    , entries_( 0 )
+    , entryCount_( 0 )
+    , freeEntries_( 0 )
+    , buckets_( 0 )
+    , bucketMask_( 0 )
+    , nextLruSequence_( 0 )
+{
+    for (int i=0; i < IO_DATA_BLOCK_SIZE_CLASS_COUNT; ++i) {
+        lruFront_[i] = 0;
+        lruBack_[i] = 0;
+    }
+
+    // Unpinned bytes never exceed the capacity after a release, so at most 
+    // capacityBytes / IO_MIN_DATA_BLOCK_CAPACITY_BYTES entries are retained.
+    entryCount_ = maxPinnedBlockCount + capacityBytes / IO_MIN_DATA_BLOCK_CAPACITY_BYTES;
+    entries_ = new Entry[entryCount_];
+    for (std::size_t i=0; i < entryCount_; ++i) {
+        entries_[i].hashNext = freeEntries_;
+        freeEntries_ = &entries_[i];
+    }
+
+    // round the bucket count up to a power of two
+    std::size_t n = 1;
+    while (n < entryCount_)
+        n <<= 1;
+
+    buckets_ = new Entry*[n];
+    for (std::size_t i=0; i < n; ++i)
+        buckets_[i] = 0;
+    bucketMask_ = n - 1;
+}
+
+DataBlockCache::~DataBlockCache()
+{
+    while (Entry *e = leastRecentlyUsed())
+        destroy(e);
+
+    delete [] buckets_;
+    delete [] entries_;
+}
+
+std::size_t DataBlockCache::bucketIndex( const DataBlockCacheFileId& fileId, int sizeClass, uint64_t blockIndex ) const
+{
+    // FNV-1a style mixing of the key fields
+    uint64_t h = 14695981039346656037ULL;
+    h = (h ^ fileId.device) * 1099511628211ULL;
+    h = (h ^ fileId.file) * 1099511628211ULL;
+    h = (h ^ fileId.sizeBytes) * 1099511628211ULL;
+    h = (h ^ fileId.modificationTime) * 1099511628211ULL;
+    h = (h ^ (uint64_t)sizeClass) * 1099511628211ULL;
+    h = (h ^ blockIndex) * 1099511628211ULL;
+    return (std::size_t)(h ^ (h >> 32)) & bucketMask_;
+}
+
+DataBlockCache::Entry *DataBlockCache::find( const DataBlockCacheFileId& fileId, int sizeClass, uint64_t blockIndex ) const
+{
+    for (Entry *e = buckets_[bucketIndex(fileId, sizeClass, blockIndex)]; e; e = e->hashNext) {
+        if (e->blockIndex == blockIndex && e->sizeClass == sizeClass && isSameCacheFile(e->fileId, fileId))
+            return e;
+    }
+    return 0;
+}
+
+void DataBlockCache::unlinkFromIndex( Entry *e )
+{
+    assert( e->isIndexed );
+
+    Entry **p = &buckets_[bucketIndex(e->fileId, e->sizeClass, e->blockIndex)];
+    while (*p != e)
+        p = &(*p)->hashNext;
+    *p = e->hashNext;
+
+    e->hashNext = 0;
+    e->isIndexed = false;
+}
+
+void DataBlockCache::unlinkFromLru( Entry *e )
+{
+    if (e->lruPrev)
+        e->lruPrev->lruNext = e->lruNext;
+    else
+        lruFront_[e->sizeClass] = e->lruNext;
+
+    if (e->lruNext)
+        e->lruNext->lruPrev = e->lruPrev;
+    else
+        lruBack_[e->sizeClass] = e->lruPrev;
+
+    e->lruPrev = 0;
+    e->lruNext = 0;
+    unpinnedBytes_ -= e->block.capacityBytes;
+}
+
+void DataBlockCache::destroy( Entry *e )
+{
+    assert( e->pinCount == 0 );
+
+    if (e->isIndexed) { // unpinned indexed entries are in the LRU list
+        unlinkFromLru(e);
+        unlinkFromIndex(e);
+    }
+
+    pools_[e->sizeClass]->deallocate(e->poolBlock);
+    e->hashNext = freeEntries_;
+    freeEntries_ = e;
+}
+
+DataBlockCache::Entry *DataBlockCache::leastRecentlyUsed() const
+{
+    Entry *result = 0;
+    for (int i=0; i < IO_DATA_BLOCK_SIZE_CLASS_COUNT; ++i) {
+        Entry *e = lruBack_[i];
+        if (e && (!result || e->lruSequence < result->lruSequence))
+            result = e;
+    }
+    return result;
+}
+
+void DataBlockCache::trimToCapacity()
+{
+    while (unpinnedBytes_ > capacityBytes_)
+        destroy(leastRecentlyUsed());
+}
+
+DataBlock *DataBlockCache::acquire( const DataBlockCacheFileId& fileId, int sizeClass, uint64_t blockIndex )
+{
+    Entry *e = find(fileId, sizeClass, blockIndex);
+    if (!e)
+        return 0;
+
+    if (e->pinCount++ == 0)
+        unlinkFromLru(e);
+
+    return &e->block;
+}
+
+DataBlock *DataBlockCache::allocate( const DataBlockCacheFileId& fileId, int sizeClass, uint64_t blockIndex )
+{
+    if (!freeEntries_) // (not expected, see the constructor)
+        return 0;
+
+    DataBlockPool *pool = pools_[sizeClass];
+    if (pool->isArenaExhausted())
+        evictLeastRecentlyUsed(sizeClass);
+
+    DataBlock *poolBlock = pool->allocate();
+    if (!poolBlock)
+        return 0;
+
+    Entry *e = freeEntries_;
+    freeEntries_ = e->hashNext;
+
+    e->block.links_[0] = 0;
+    e->block.capacityBytes = poolBlock->capacityBytes;
+    e->block.validCountBytes = 0;
+    e->block.data = poolBlock->data;
+    e->poolBlock = poolBlock;
+    e->fileId = fileId;
+    e->sizeClass = sizeClass;
+    e->blockIndex = blockIndex;
+    e->pinCount = 1;
+    e->isIndexed = false;
+    e->hashNext = 0;
+    e->lruPrev = 0;
+    e->lruNext = 0;
+    e->lruSequence = 0;
+
+    return &e->block;
+}
+
+void DataBlockCache::insert( DataBlock *b )
+{
+    Entry *e = entryForBlock(b);
+    assert( e->pinCount > 0 );
+
+    // If the same block was read twice concurrently (e.g. by two streams with reads 
+    // in flight at once) the first copy wins. The other is freed when it is released.
+    if (e->isIndexed || find(e->fileId, e->sizeClass, e->blockIndex))
+        return;
+
+    Entry **bucket = &buckets_[bucketIndex(e->fileId, e->sizeClass, e->blockIndex)];
+    e->hashNext = *bucket;
+    *bucket = e;
+    e->isIndexed = true;
+}
+
+void DataBlockCache::release( DataBlock *b )
+{
+    Entry *e = entryForBlock(b);
+    assert( e->pinCount > 0 );
+
+    if (--e->pinCount > 0)
+        return;
+
+    if (!e->isIndexed) {
+        destroy(e);
+        return;
+    }
+
+    // retain as the most recently used block
+    Entry *&front = lruFront_[e->sizeClass];
+    e->lruPrev = 0;
+    e->lruNext = front;
+    if (front)
+        front->lruPrev = e;
+    else
+        lruBack_[e->sizeClass] = e;
+    front = e;
+    e->lruSequence = nextLruSequence_++;
+    unpinnedBytes_ += e->block.capacityBytes;
+
+    trimToCapacity();
+}
+
+bool DataBlockCache::evictLeastRecentlyUsed( int sizeClass )
+{
+    Entry *e = lruBack_[sizeClass];
+    if (!e)
+        return false;
+
+    destroy(e);
+    return true;
+}
@@ -0,0 +1,151 @@
+/* 
+    Real Time File Streaming copyright (c) 2014 Ross Bencina
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+#ifndef INCLUDED_DATABLOCKCACHE_H
+#define INCLUDED_DATABLOCKCACHE_H
+
+#include <cstddef> // size_t
+#include <stdint.h>
+
+#include "DataBlock.h"
+#include "DataBlockPool.h"
+
+/*
+    Cache of read-only file blocks, shared between streams that read the same file.
+
+    Blocks are keyed by file identity, block size class and block index. Streams 
+    that open the same file get the same DataBlock for the same block. A block 
+    is pinned while any stream holds it, and is never evicted while pinned. 
+    Unpinned blocks are retained in least-recently-used order for as long as 
+    they fit within the capacity (which may be 0: blocks are then shared 
+    while pinned, but not retained).
+
+    Block data comes from the worker's data block pools. When a pool's arena runs
+    out, unpinned blocks of that size class are evicted to make room (see 
+    evictLeastRecentlyUsed()). There is one LRU list per size class, so finding
+    that block doesn't walk the other size classes.
+
+    The entries (block headers and cache metadata) are allocated up front, enough
+    for maxPinnedBlockCount pinned blocks plus a full cache of the smallest block
+    size. So cache misses and releases don't touch the heap.
+
+    There is one cache per server worker. It is only accessed by the worker thread.
+    Client threads only read the data of the blocks that they have been given.
+*/
+
+// Identifies a file and its version. A file that has been modified since its 
+// blocks were cached gets a different identity, so stale blocks are never returned.
+struct DataBlockCacheFileId {
+    uint64_t device;
+    uint64_t file; // inode, or file index on Windows
+    uint64_t sizeBytes;
+    uint64_t modificationTime;
+};
+
+inline bool isSameCacheFile( const DataBlockCacheFileId& a, const DataBlockCacheFileId& b )
+{
+    return (a.file == b.file && a.device == b.device 
+            && a.sizeBytes == b.sizeBytes && a.modificationTime == b.modificationTime);
+}
+
+class DataBlockCache {
+    struct Entry {
+        DataBlock block; // the block given to clients. points at poolBlock's data. (must be the first member)
+        DataBlock *poolBlock;
+
+        DataBlockCacheFileId fileId;
+        int sizeClass;
+        uint64_t blockIndex;
+
+        int pinCount;
+        bool isIndexed; // false until the block has been read, or if it was superseded by another entry
+
+        Entry *hashNext; // also links the free entries
+        Entry *lruPrev, *lruNext; // only unpinned entries are in the LRU lists
+        uint64_t lruSequence; // when the entry was last released. orders the LRU lists against each other
+    };
+
+    DataBlockPool **pools_; // indexed by size class. not owned
+    std::size_t capacityBytes_;
+    std::size_t unpinnedBytes_;
+
+    Entry *entries_;
+    std::size_t entryCount_;
+    Entry *freeEntries_;
+
+    Entry **buckets_;
+    std::size_t bucketMask_;
+
+    // one list per size class
+    Entry *lruFront_[IO_DATA_BLOCK_SIZE_CLASS_COUNT]; // most recently used
+    Entry *lruBack_[IO_DATA_BLOCK_SIZE_CLASS_COUNT];
+    uint64_t nextLruSequence_;
+
+    static Entry *entryForBlock( DataBlock *b ) { return reinterpret_cast<Entry*>(b); }
+
+    std::size_t bucketIndex( const DataBlockCacheFileId& fileId, int sizeClass, uint64_t blockIndex ) const;
+    Entry *find( const DataBlockCacheFileId& fileId, int sizeClass, uint64_t blockIndex ) const;
+    void unlinkFromIndex( Entry *e );
+    void unlinkFromLru( Entry *e );
+    void destroy( Entry *e );
+    Entry *leastRecentlyUsed() const; // over all size classes
+    void trimToCapacity();
+
+    DataBlockCache( const DataBlockCache& ); // not copyable
+    DataBlockCache& operator=( const DataBlockCache& );
+
+public:
+    DataBlockCache( DataBlockPool **pools, std::size_t capacityBytes, std::size_t maxPinnedBlockCount );
+    ~DataBlockCache(); // frees unpinned blocks. blocks that are still pinned are leaked
+
+    std::size_t capacityBytes() const { return capacityBytes_; }
+
+    // true if the block was returned by acquire() or allocate(), rather than allocated from a pool directly
+    bool owns( const DataBlock *b ) const
+    {
+        const Entry *e = reinterpret_cast<const Entry*>(b);
+        return (e >= entries_ && e < entries_ + entryCount_);
+    }
+
+    // If the block is cached, pin it and return it. Otherwise return 0.
+    DataBlock *acquire( const DataBlockCacheFileId& fileId, int sizeClass, uint64_t blockIndex );
+
+    // true if the block is cached (doesn't pin it)
+    bool contains( const DataBlockCacheFileId& fileId, int sizeClass, uint64_t blockIndex ) const
+    {
+        return (find(fileId, sizeClass, blockIndex) != 0);
+    }
+
+    // Allocate a pinned block for a block that isn't cached. Read into it, then call insert() 
+    // if the read succeeded, or release() if it failed. Returns 0 if no pool block (or entry) is available.
+    DataBlock *allocate( const DataBlockCacheFileId& fileId, int sizeClass, uint64_t blockIndex );
+
+    // Make a block returned by allocate() available to acquire(). Set validCountBytes first.
+    void insert( DataBlock *b );
+
+    // Unpin a block returned by acquire() or allocate().
+    void release( DataBlock *b );
+
+    // Evict the least recently used unpinned block of the size class. Returns false if there is none.
+    bool evictLeastRecentlyUsed( int sizeClass );
+};
+
+#endif /* INCLUDED_DATABLOCKCACHE_H */
@@ -0,0 +1,165 @@
+/* 
+    Real Time File Streaming copyright (c) 2014 Ross Bencina
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+#include "DataBlockPool.h"
+
+#include <cassert>
+#include <cstdlib>
+#include <new> // nothrow
+
+#ifdef WIN32
+#define NOMINMAX // suppress windows.h min/max
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+
+static void* allocatePageAlignedArena( std::size_t sizeBytes )
+{
+#ifdef WIN32
+    // VirtualAlloc always returns page aligned memory
+    return VirtualAlloc( NULL, sizeBytes, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE );
+#else
+    // mmap always returns page aligned memory
+    void *result = mmap( 0, sizeBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0 );
+    return (result == MAP_FAILED) ? 0 : result;
+#endif
+}
+
+static void freePageAlignedArena( void *p, std::size_t sizeBytes )
+{
+#ifdef WIN32
+    (void)sizeBytes;
+    VirtualFree( p, 0, MEM_RELEASE );
+#else
+    munmap( p, sizeBytes );
+#endif
+}
+
+
+DataBlockPool::DataBlockPool( std::size_t blockCount, std::size_t blockCapacityBytes, DataBlockPoolExhaustedPolicy exhaustedPolicy )
+    : blockCapacityBytes_( blockCapacityBytes )
+    , blockCount_( blockCount )
+    , exhaustedPolicy_( exhaustedPolicy )
+    , arena_( 0 )
+    , arenaSizeBytes_( 0 )
+{
+    allocatedBlockCount_._nonatomic = 0;
+    highWaterMarkBlockCount_._nonatomic = 0;
+    heapFallbackCount_._nonatomic = 0;
+    failedAllocationCount_._nonatomic = 0;
+
+    if (blockCount_ > 0) {
+        // Arena layout: [ data 0 ][ data 1 ] ... [ data N-1 ][ header 0 ][ header 1 ] ... [ header N-1 ]
+        // Keeping the headers after the data ensures that the data of every block is page aligned.
+
+        arenaSizeBytes_ = blockCount_ * (blockCapacityBytes_ + sizeof(DataBlock));
+        arena_ = allocatePageAlignedArena( arenaSizeBytes_ );
+        if (!arena_) {
+            // Degrade to an empty arena. The exhausted policy applies to every allocation.
+            arenaSizeBytes_ = 0;
+            blockCount_ = 0;
+            return;
+        }
+
+        char *data = static_cast<char*>(arena_);
+        DataBlock *headers = reinterpret_cast<DataBlock*>(data + blockCount_ * blockCapacityBytes_);
+
+        // Push in reverse order so that allocations proceed through the arena in address order
+        for (std::size_t i = blockCount_; i > 0; --i) {
+            DataBlock *b = &headers[i - 1];
+            b->capacityBytes = blockCapacityBytes_;
+            b->validCountBytes = 0;
+            b->data = data + (i - 1) * blockCapacityBytes_;
+            freeList_.push_front(b);
+        }
+    }
+}
+
+DataBlockPool::~DataBlockPool()
+{
+    // Any blocks that are still allocated when the pool is destroyed are invalidated.
+    // (Heap fallback blocks that have not been returned are leaked.)
+
+    if (arena_)
+        freePageAlignedArena( arena_, arenaSizeBytes_ );
+}
+
+DataBlock* DataBlockPool::allocate()
+{
+    DataBlock *result = 0;
+
+    if (!freeList_.empty()) {
+        result = freeList_.front();
+        freeList_.pop_front();
+    } else if (exhaustedPolicy_ == DATA_BLOCK_POOL_EXHAUSTED_FALLBACK_TO_HEAP) {
+        result = new (std::nothrow) DataBlock;
+        if (result) {
+            // page align heap blocks too, so that they can be used for unbuffered I/O
+            result->capacityBytes = blockCapacityBytes_;
+            result->data = allocatePageAlignedArena( blockCapacityBytes_ );
+            if (result->data) {
+                incrementCounter(&heapFallbackCount_);
+            } else {
+                delete result;
+                result = 0;
+            }
+        }
+    }
+
+    if (result) {
+        result->links_[0] = 0;
+        result->validCountBytes = 0;
+
+        uint32_t allocatedCount = mint_load_32_relaxed(&allocatedBlockCount_) + 1;
+        mint_store_32_relaxed(&allocatedBlockCount_, allocatedCount);
+        if (allocatedCount > mint_load_32_relaxed(&highWaterMarkBlockCount_))
+            mint_store_32_relaxed(&highWaterMarkBlockCount_, allocatedCount);
+    } else {
+        incrementCounter(&failedAllocationCount_);
+    }
+
+    return result;
+}
+
+void DataBlockPool::deallocate( DataBlock *b )
+{
+    assert( b != 0 );
+    
+    if (isArenaBlock(b)) {
+        freeList_.push_front(b);
+    } else {
+        freePageAlignedArena( b->data, b->capacityBytes );
+        delete b;
+    }
+
+    mint_store_32_relaxed(&allocatedBlockCount_, mint_load_32_relaxed(&allocatedBlockCount_) - 1);
+}
+
+void DataBlockPool::getStats( DataBlockPoolStats *result )
+{
+    result->capacityBlockCount = blockCount_;
+    result->allocatedBlockCount = mint_load_32_relaxed(&allocatedBlockCount_);
+    result->highWaterMarkBlockCount = mint_load_32_relaxed(&highWaterMarkBlockCount_);
+    result->heapFallbackCount = mint_load_32_relaxed(&heapFallbackCount_);
+    result->failedAllocationCount = mint_load_32_relaxed(&failedAllocationCount_);
+}
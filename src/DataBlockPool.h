@@ -0,0 +1,109 @@
+/* 
+    Real Time File Streaming copyright (c) 2014 Ross Bencina
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+#ifndef INCLUDED_DATABLOCKPOOL_H
+#define INCLUDED_DATABLOCKPOOL_H
+
+#include <cstddef> // size_t
+
+#include "mintomic/mintomic.h"
+#include "QwSList.h"
+
+#include "DataBlock.h"
+
+/*
+    Fixed-capacity pool of DataBlocks.
+
+    All blocks are carved out of a single page-aligned arena that is allocated
+    when the pool is constructed (at startFileIoServer() time). The arena holds
+    the block data followed by the DataBlock headers, so allocating a block
+    never touches the heap. Each block's data is page aligned, provided that
+    the block capacity is a multiple of the page size. Heap fallback blocks
+    are also page aligned.
+
+    allocate() and deallocate() are only called by the server thread that owns
+    the pool (each server worker has its own pool). getStats() may be called 
+    from any thread.
+*/
+
+enum DataBlockPoolExhaustedPolicy {
+    // When the arena is exhausted, allocate() falls back to new/delete.
+    DATA_BLOCK_POOL_EXHAUSTED_FALLBACK_TO_HEAP,
+
+    // When the arena is exhausted, allocate() returns 0. 
+    // The server returns ENOMEM to the client.
+    DATA_BLOCK_POOL_EXHAUSTED_FAIL
+};
+
+struct DataBlockPoolStats {
+    std::size_t capacityBlockCount;         // number of blocks in the arena
+    std::size_t allocatedBlockCount;        // blocks currently allocated (arena and heap)
+    std::size_t highWaterMarkBlockCount;    // maximum of allocatedBlockCount since the pool was created
+    std::size_t heapFallbackCount;          // number of allocations that were satisfied from the heap
+    std::size_t failedAllocationCount;      // number of allocations that returned 0
+};
+
+class DataBlockPool {
+    typedef QwSList<DataBlock*, 0> free_list_t;
+
+    std::size_t blockCapacityBytes_;
+    std::size_t blockCount_;
+    DataBlockPoolExhaustedPolicy exhaustedPolicy_;
+
+    void *arena_;
+    std::size_t arenaSizeBytes_;
+    free_list_t freeList_;
+
+    // counters are only written by the server thread, but may be read by any thread
+    mint_atomic32_t allocatedBlockCount_;
+    mint_atomic32_t highWaterMarkBlockCount_;
+    mint_atomic32_t heapFallbackCount_;
+    mint_atomic32_t failedAllocationCount_;
+
+    bool isArenaBlock( const DataBlock *b ) const
+    {
+        const char *p = reinterpret_cast<const char*>(b);
+        const char *arena = static_cast<const char*>(arena_);
+        return (p >= arena && p < arena + arenaSizeBytes_);
+    }
+
+    void incrementCounter( mint_atomic32_t *counter )
+    {
+        mint_store_32_relaxed(counter, mint_load_32_relaxed(counter) + 1);
+    }
+
+    DataBlockPool( const DataBlockPool& ); // not copyable
+    DataBlockPool& operator=( const DataBlockPool& );
+
+public:
+    DataBlockPool( std::size_t blockCount, std::size_t blockCapacityBytes, DataBlockPoolExhaustedPolicy exhaustedPolicy );
+    ~DataBlockPool();
+
+    DataBlock *allocate(); // returns 0 if no block is available
+    void deallocate( DataBlock *b );
+
+    // true if the pool has an arena and all of its blocks are allocated
+    bool isArenaExhausted() const { return (blockCount_ > 0 && freeList_.empty()); }
+
+    void getStats( DataBlockPoolStats *result );
+};
+
+#endif /* INCLUDED_DATABLOCKPOOL_H */
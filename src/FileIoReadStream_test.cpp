@@ -1,13 +1,70 @@
+#include "FileIoServer.h"
 #include "FileIoStreams.h"
 
 #include <cassert>
 #include <cstdio>
+#include <cstring>
 
 #ifndef WIN32
 #include <unistd.h> // for usleep
 #define Sleep(milliseconds) usleep((milliseconds)*1000)
 #endif
 
+// A minimal FLAC encoder (verbatim and constant subframes) for testing the server's decoder
+
+static const int flacTestFrameCount_ = 20000;
+static const int flacTestBlockSize_ = 4096;
+
+static int16_t flacTestSample( int i )
+{
+    return (i / flacTestBlockSize_ == 2) ? 1000 : (int16_t)(i * 3); // (block 2 is coded as a constant)
+}
+
+static unsigned flacTestCrc( const unsigned char *p, size_t n, unsigned polynomial, int bits )
+{
+    unsigned topBit = 1u << (bits - 1), mask = (topBit << 1) - 1;
+    unsigned crc = 0;
+    for (size_t i=0; i < n; ++i) {
+        crc ^= (unsigned)p[i] << (bits - 8);
+        for (int j=0; j < 8; ++j)
+            crc = ((crc & topBit) ? (crc << 1) ^ polynomial : crc << 1) & mask;
+    }
+    return crc;
+}
+
+// Mono 16-bit frame n. Returns its size
+static size_t buildFlacTestFrame( int n, unsigned char *frame )
+{
+    int first = n * flacTestBlockSize_;
+    int count = (flacTestFrameCount_ - first < flacTestBlockSize_) ? flacTestFrameCount_ - first : flacTestBlockSize_;
+
+    size_t size = 0;
+    frame[size++] = 0xFF; // sync, fixed block size
+    frame[size++] = 0xF8;
+    frame[size++] = (count == flacTestBlockSize_) ? 0xC0 : 0x70; // 4096, or a 16-bit block size below. STREAMINFO sample rate
+    frame[size++] = 0x08; // mono, 16 bits
+    frame[size++] = (unsigned char)n; // frame number (UTF-8 coded, one byte if it's less than 128)
+    if (count != flacTestBlockSize_) {
+        frame[size++] = (unsigned char)((count - 1) >> 8);
+        frame[size++] = (unsigned char)((count - 1) & 0xFF);
+    }
+    frame[size] = (unsigned char)flacTestCrc(frame, size, 0x07, 8);
+    ++size;
+
+    bool isConstant = (flacTestSample(first) == flacTestSample(first + count - 1));
+    frame[size++] = (isConstant) ? 0x00 : 0x02; // subframe type
+    for (int i=0; i < ((isConstant) ? 1 : count); ++i) {
+        int16_t x = flacTestSample(first + i);
+        frame[size++] = (unsigned char)((x >> 8) & 0xFF);
+        frame[size++] = (unsigned char)(x & 0xFF);
+    }
+
+    unsigned crc = flacTestCrc(frame, size, 0x8005, 16);
+    frame[size++] = (unsigned char)(crc >> 8);
+    frame[size++] = (unsigned char)(crc & 0xFF);
+    return size;
+}
+
 
 void FileIoReadStream_test()
 {
@@ -24,7 +81,6 @@ void FileIoReadStream_test()
     SharedBuffer *path = SharedBufferAllocator::alloc(pathString); // print out the source code of this file
 
     READSTREAM *fp = FileIoReadStream_open(path, FileIoRequest::READ_ONLY_OPEN_MODE);
-    path->release();
     assert( fp != 0 );
 
     while (FileIoReadStream_pollState(fp) == STREAM_STATE_OPENING) {
@@ -51,6 +107,7 @@ void FileIoReadStream_test()
 
     printf( "reading:\n" );
 
+    size_t totalBytesRead = 0;
     while (FileIoReadStream_pollState(fp) == STREAM_STATE_OPEN_STREAMING || FileIoReadStream_pollState(fp) == STREAM_STATE_OPEN_BUFFERING) {
 
         /*
@@ -61,19 +118,509 @@ void FileIoReadStream_test()
         }
         */
 
-        char c[512];
         size_t bytesToRead = rand() & 0xFF;
-        size_t bytesRead = FileIoReadStream_read( c, 1, bytesToRead, fp );
-        if (bytesRead>0) {
-            fwrite(c, 1, bytesRead, stdout);
+        if (rand() & 1) {
+            char c[512];
+            size_t bytesRead = FileIoReadStream_read( c, 1, bytesToRead, fp );
+            if (bytesRead>0) {
+                fwrite(c, 1, bytesRead, stdout);
+                totalBytesRead += bytesRead;
+            }
+        } else {
+            // zero-copy read
+            const void *data = 0;
+            size_t byteCount = 0;
+            FileIoReadStream_peek( fp, &data, &byteCount );
+            if (byteCount>0) {
+                size_t bytesRead = (bytesToRead < byteCount) ? bytesToRead : byteCount;
+                fwrite(data, 1, bytesRead, stdout);
+                size_t bytesAdvanced = FileIoReadStream_advance( fp, bytesRead );
+                assert( bytesAdvanced == bytesRead );
+                totalBytesRead += bytesRead;
+            }
         }
     }
 
     assert( FileIoReadStream_pollState(fp) == STREAM_STATE_OPEN_EOF );
 
+    FileIoStreamStats stats;
+    FileIoReadStream_getStats(fp, &stats);
+    assert( stats.maxResultQueueDepth > 0 ); // (the initial seek requested a queue's worth of blocks)
+
     printf( "\nclosing.\n" );
 
     FileIoReadStream_close(fp);
 
+    // Sample handle: a stream opened from the handle is streaming immediately
+
+    printf( "loading sample handle " );
+
+    SAMPLEHANDLE *handle = FileIoSampleHandle_open(path, 1024, 1.0, IO_MIN_DATA_BLOCK_CAPACITY_BYTES); // (a two block head)
+    path->release();
+    assert( handle != 0 );
+
+    while (FileIoSampleHandle_pollState(handle) == STREAM_STATE_OPENING) {
+        printf(".");
+        Sleep(10);
+    }
+
+    assert( FileIoSampleHandle_pollState(handle) == STREAM_STATE_OPEN_STREAMING );
+
+    printf( "\ndone.\n" );
+
+    for (int i=0; i < 2; ++i) { // (twice, the head is shared by all streams opened from the handle)
+        fp = FileIoReadStream_openFromSampleHandle(handle, 1024, 1.0);
+        assert( fp != 0 );
+        assert( FileIoReadStream_pollState(fp) == STREAM_STATE_OPEN_STREAMING );
+
+        size_t sampleBytesRead = 0;
+        while (FileIoReadStream_pollState(fp) == STREAM_STATE_OPEN_STREAMING || FileIoReadStream_pollState(fp) == STREAM_STATE_OPEN_BUFFERING) {
+            char c[512];
+            sampleBytesRead += FileIoReadStream_read( c, 1, rand() & 0xFF, fp );
+        }
+
+        assert( FileIoReadStream_pollState(fp) == STREAM_STATE_OPEN_EOF );
+        assert( sampleBytesRead == totalBytesRead );
+
+        FileIoReadStream_close(fp);
+    }
+
+    FileIoSampleHandle_close(handle);
+
+    // Sequence stream: the next file is prefetched behind the end of the current file, reads 
+    // continue across the junction. This file twice over, then once more, set after the stream reached EOF
+
+    printf( "sequence stream\n" );
+
+    {
+        static char fileBytes[65536];
+        FILE *file = std::fopen(pathString, "rb");
+        assert( file != 0 );
+        size_t fileSizeBytes = std::fread(fileBytes, 1, sizeof(fileBytes), file);
+        std::fclose(file);
+        assert( fileSizeBytes == totalBytesRead );
+
+        path = SharedBufferAllocator::alloc(pathString);
+        SharedBuffer *internedPath = SharedBufferAllocator::alloc(pathString);
+        assert( internedPath == path ); // (short paths are interned while they're live)
+        internedPath->release();
+
+        fp = FileIoReadStream_open(path, FileIoRequest::READ_ONLY_OPEN_MODE, 1024, 1.0, IO_MIN_DATA_BLOCK_CAPACITY_BYTES);
+        assert( fp != 0 );
+        assert( FileIoReadStream_setNextFile(fp, path) != 0 ); // (the stream isn't open yet)
+
+        while (FileIoReadStream_pollState(fp) == STREAM_STATE_OPENING)
+            Sleep(10);
+
+        int result = FileIoReadStream_setNextFile(fp, path);
+        assert( result == 0 );
+        assert( FileIoReadStream_setNextFile(fp, path) != 0 ); // (one next file at a time)
+
+        FileIoReadStream_seek(fp, 0);
+        size_t sequenceBytesRead = 0;
+        for (int i=0; i < 2; ++i) {
+            FileIoStreamState state;
+            while ((state = FileIoReadStream_pollState(fp)) == STREAM_STATE_OPEN_STREAMING || state == STREAM_STATE_OPEN_BUFFERING) {
+                char c[512];
+                size_t bytesRead = FileIoReadStream_read( c, 1, rand() & 0xFF, fp );
+                for (size_t j=0; j < bytesRead; ++j, ++sequenceBytesRead)
+                    assert( c[j] == fileBytes[sequenceBytesRead % fileSizeBytes] );
+            }
+            assert( state == STREAM_STATE_OPEN_EOF );
+
+            if (i == 0) {
+                result = FileIoReadStream_setNextFile(fp, path);
+                assert( result == 0 );
+            }
+        }
+        assert( sequenceBytesRead == 3*fileSizeBytes );
+        (void)result;
+
+        path->release();
+        FileIoReadStream_close(fp);
+    }
+
+    // Reverse playback: the prefetch queue steps back a block at a time, and each block is read 
+    // forwards. Then every other block forwards, changing the stride part way through a block.
+
+    printf( "reverse playback\n" );
+
+    {
+        static char fileBytes[65536];
+        FILE *file = std::fopen(pathString, "rb");
+        assert( file != 0 );
+        size_t fileSizeBytes = std::fread(fileBytes, 1, sizeof(fileBytes), file);
+        std::fclose(file);
+        assert( fileSizeBytes == totalBytesRead );
+
+        const size_t blockSizeBytes = IO_MIN_DATA_BLOCK_CAPACITY_BYTES;
+        assert( fileSizeBytes > 3*blockSizeBytes );
+
+        path = SharedBufferAllocator::alloc(pathString);
+        fp = FileIoReadStream_open(path, FileIoRequest::READ_ONLY_OPEN_MODE, 1024, 1.0, blockSizeBytes);
+        path->release();
+        assert( fp != 0 );
+
+        while (FileIoReadStream_pollState(fp) == STREAM_STATE_OPENING)
+            Sleep(10);
+
+        int result = FileIoReadStream_setBlockStride(fp, 0);
+        assert( result != 0 );
+        result = FileIoReadStream_setBlockStride(fp, -1);
+        assert( result == 0 );
+
+        size_t blockPos = ((fileSizeBytes - 1) / blockSizeBytes) * blockSizeBytes; // the final block
+        FileIoReadStream_seek(fp, blockPos);
+
+        size_t blockBytesRead = 0;
+        size_t reverseBytesRead = 0;
+        FileIoStreamState state;
+        while ((state = FileIoReadStream_pollState(fp)) == STREAM_STATE_OPEN_STREAMING || state == STREAM_STATE_OPEN_BUFFERING) {
+            const void *data = 0;
+            size_t byteCount = 0;
+            FileIoReadStream_peek( fp, &data, &byteCount );
+            if (byteCount > 0) {
+                size_t bytesToRead = rand() & 0xFF;
+                size_t bytesRead = (bytesToRead < byteCount) ? bytesToRead : byteCount;
+                for (size_t j=0; j < bytesRead; ++j)
+                    assert( static_cast<const char*>(data)[j] == fileBytes[blockPos + blockBytesRead + j] );
+                size_t bytesAdvanced = FileIoReadStream_advance( fp, bytesRead );
+                assert( bytesAdvanced == bytesRead );
+
+                blockBytesRead += bytesRead;
+                reverseBytesRead += bytesRead;
+                if (blockPos + blockBytesRead == fileSizeBytes || blockBytesRead == blockSizeBytes) {
+                    blockPos -= blockSizeBytes; // (wraps after the first block, the stream is at EOF)
+                    blockBytesRead = 0;
+                }
+            }
+        }
+        assert( state == STREAM_STATE_OPEN_EOF );
+        assert( reverseBytesRead == fileSizeBytes );
+
+        result = FileIoReadStream_setBlockStride(fp, 1);
+        assert( result == 0 );
+        FileIoReadStream_seek(fp, 0);
+
+        char c[512];
+        size_t bytesRead = 0;
+        while (bytesRead < 100 && FileIoReadStream_pollState(fp) != STREAM_STATE_ERROR)
+            bytesRead += FileIoReadStream_read( c + bytesRead, 1, 100 - bytesRead, fp );
+        assert( std::memcmp(c, fileBytes, 100) == 0 );
+
+        result = FileIoReadStream_setBlockStride(fp, 2);
+        assert( result == 0 );
+
+        size_t expectedBytesRead = 0; // every other block
+        for (size_t pos=0; pos < fileSizeBytes; pos += 2*blockSizeBytes)
+            expectedBytesRead += (fileSizeBytes - pos < blockSizeBytes) ? fileSizeBytes - pos : blockSizeBytes;
+
+        while ((state = FileIoReadStream_pollState(fp)) == STREAM_STATE_OPEN_STREAMING || state == STREAM_STATE_OPEN_BUFFERING) {
+            size_t n = FileIoReadStream_read( c, 1, rand() & 0xFF, fp );
+            for (size_t j=0; j < n; ++j, ++bytesRead) {
+                size_t pos = (bytesRead / blockSizeBytes) * 2*blockSizeBytes + (bytesRead % blockSizeBytes);
+                assert( c[j] == fileBytes[pos] );
+            }
+        }
+        assert( state == STREAM_STATE_OPEN_EOF );
+        assert( bytesRead == expectedBytesRead );
+        (void)result;
+
+        FileIoReadStream_close(fp);
+    }
+
+    // AIFF file: the header is parsed by the server, and the big-endian samples are converted by readFrames()
+
+    printf( "AIFF file\n" );
+
+    {
+#ifdef WIN32
+        const char *aiffFileName = "..\\..\\..\\FileIoReadStream_test_output.aiff";
+#else
+        const char *aiffFileName = "../../../FileIoReadStream_test_output.aiff";
+#endif
+        const int frameCount = 20000;
+
+        FILE *file = std::fopen(aiffFileName, "wb");
+        assert( file != 0 );
+        const unsigned char header[] = {
+            'F','O','R','M', 0,0,0,0 /* (not checked) */, 'A','I','F','F',
+            'C','O','M','M', 0,0,0,18, 0,1 /* channels */, 0,0,(frameCount >> 8) & 0xFF,frameCount & 0xFF, 0,16 /* bits */, 
+                0x40,0x0E,0xAC,0x44,0,0,0,0,0,0 /* 44100 */,
+            'S','S','N','D', 0,0,((frameCount*2 + 8) >> 8) & 0xFF,(frameCount*2 + 8) & 0xFF, 0,0,0,0, 0,0,0,0 };
+        std::fwrite(header, 1, sizeof(header), file);
+        for (int i=0; i < frameCount; ++i) {
+            unsigned char sample[2] = { (unsigned char)((i >> 8) & 0xFF), (unsigned char)(i & 0xFF) };
+            std::fwrite(sample, 1, 2, file);
+        }
+        std::fclose(file);
+
+        path = SharedBufferAllocator::alloc(aiffFileName);
+        fp = FileIoReadStream_open(path, FileIoRequest::READ_ONLY_OPEN_MODE);
+        path->release();
+        assert( fp != 0 );
+
+        while (FileIoReadStream_pollState(fp) == STREAM_STATE_OPENING)
+            Sleep(10);
+
+        FileIoAudioFormat format;
+        int result = FileIoReadStream_getAudioFormat(fp, &format);
+        assert( result == 0 );
+        assert( format.containerType == CONTAINER_TYPE_AIFF && format.sampleFormat == SAMPLE_FORMAT_INT16_BIG_ENDIAN );
+        assert( format.sampleRate == 44100 && format.channelCount == 1 );
+        assert( format.dataOffsetBytes == sizeof(header) && format.dataSizeBytes == frameCount*2 );
+        (void)result;
+
+        FileIoReadStream_seek(fp, 0);
+        int i = 0;
+        FileIoStreamState state;
+        while ((state = FileIoReadStream_pollState(fp)) == STREAM_STATE_OPEN_STREAMING || state == STREAM_STATE_OPEN_BUFFERING) {
+            float samples[100];
+            float *dest[1] = { samples };
+            size_t framesRead = FileIoReadStream_readFrames( dest, CHANNEL_LAYOUT_INTERLEAVED, 
+                    (FileIoSampleFormat)format.sampleFormat, format.channelCount, 100, fp );
+            for (size_t j=0; j < framesRead; ++j, ++i)
+                assert( samples[j] == (float)(int16_t)i / 32768.f );
+        }
+        assert( state == STREAM_STATE_OPEN_EOF );
+        assert( i == frameCount );
+
+        FileIoReadStream_close(fp);
+
+        // Sequence stream: the file three times over. Each next file is set as soon as the stream 
+        // has entered the file before it. The junctions fall part way through a block (the data follows the header)
+
+        path = SharedBufferAllocator::alloc(aiffFileName);
+        fp = FileIoReadStream_open(path, FileIoRequest::READ_ONLY_OPEN_MODE, 44100*2, 0.1, IO_MIN_DATA_BLOCK_CAPACITY_BYTES);
+        assert( fp != 0 );
+
+        while (FileIoReadStream_pollState(fp) == STREAM_STATE_OPENING)
+            Sleep(10);
+
+        FileIoReadStream_seek(fp, 0);
+        int nextFileCount = 0;
+        i = 0;
+        while ((state = FileIoReadStream_pollState(fp)) == STREAM_STATE_OPEN_STREAMING || state == STREAM_STATE_OPEN_BUFFERING) {
+            if (nextFileCount < 2 && FileIoReadStream_setNextFile(fp, path) == 0)
+                ++nextFileCount;
+
+            float samples[100];
+            float *dest[1] = { samples };
+            size_t framesRead = FileIoReadStream_readFrames( dest, CHANNEL_LAYOUT_INTERLEAVED, 
+                    (FileIoSampleFormat)format.sampleFormat, format.channelCount, 100, fp );
+            for (size_t j=0; j < framesRead; ++j, ++i)
+                assert( samples[j] == (float)(int16_t)(i % frameCount) / 32768.f );
+        }
+        assert( state == STREAM_STATE_OPEN_EOF );
+        assert( i == 3*frameCount );
+
+        path->release();
+        FileIoReadStream_close(fp);
+    }
+
+    // FLAC file: the server decodes it into the blocks that it returns. Positions are in the decoded data
+
+    printf( "FLAC file\n" );
+
+    {
+#ifdef WIN32
+        const char *flacFileName = "..\\..\\..\\FileIoReadStream_test_output.flac";
+#else
+        const char *flacFileName = "../../../FileIoReadStream_test_output.flac";
+#endif
+        const int flacFrameCount = (flacTestFrameCount_ + flacTestBlockSize_ - 1) / flacTestBlockSize_;
+        static unsigned char frames[flacFrameCount][flacTestBlockSize_*2 + 32];
+        size_t frameSizes[flacFrameCount];
+        for (int i=0; i < flacFrameCount; ++i)
+            frameSizes[i] = buildFlacTestFrame(i, frames[i]);
+
+        unsigned char header[4 + 4 + 34 + 4 + 18];
+        std::memset(header, 0, sizeof(header));
+        std::memcpy(header, "fLaC", 4);
+        header[7] = 34; // STREAMINFO
+        header[8] = header[10] = flacTestBlockSize_ >> 8; // min and max block size
+        uint64_t streamInfo = ((uint64_t)44100 << 44) | ((uint64_t)(16 - 1) << 36) | flacTestFrameCount_; // rate, channels, bits, samples
+        for (int i=0; i < 8; ++i)
+            header[18 + i] = (unsigned char)(streamInfo >> (56 - 8*i));
+        header[42] = 0x83; // last block, SEEKTABLE
+        header[45] = 18;
+        header[52] = flacTestBlockSize_ * 3 >> 8; // one point: frame 3 (sample number, offset from the first frame, sample count)
+        size_t offset = frameSizes[0] + frameSizes[1] + frameSizes[2];
+        header[60] = (unsigned char)(offset >> 8);
+        header[61] = (unsigned char)(offset & 0xFF);
+
+        FILE *file = std::fopen(flacFileName, "wb");
+        assert( file != 0 );
+        std::fwrite(header, 1, sizeof(header), file);
+        for (int i=0; i < flacFrameCount; ++i)
+            std::fwrite(frames[i], 1, frameSizes[i], file);
+        std::fclose(file);
+
+        path = SharedBufferAllocator::alloc(flacFileName);
+        fp = FileIoReadStream_open(path, FileIoRequest::READ_ONLY_OPEN_MODE);
+        path->release();
+        assert( fp != 0 );
+
+        while (FileIoReadStream_pollState(fp) == STREAM_STATE_OPENING)
+            Sleep(10);
+
+        FileIoAudioFormat format;
+        int result = FileIoReadStream_getAudioFormat(fp, &format);
+        assert( result == 0 );
+        assert( format.containerType == CONTAINER_TYPE_FLAC && format.sampleFormat == SAMPLE_FORMAT_INT16 );
+        assert( format.sampleRate == 44100 && format.channelCount == 1 );
+        assert( format.dataOffsetBytes == 0 && format.dataSizeBytes == flacTestFrameCount_*2 );
+        (void)result;
+
+        for (int seekFrame=13000; seekFrame >= 0; seekFrame -= 13000) { // (the first seek uses the seek table)
+            FileIoReadStream_seek(fp, seekFrame*2);
+            int i = seekFrame;
+            FileIoStreamState state;
+            while ((state = FileIoReadStream_pollState(fp)) == STREAM_STATE_OPEN_STREAMING || state == STREAM_STATE_OPEN_BUFFERING) {
+                int16_t samples[100];
+                size_t framesRead = FileIoReadStream_read(samples, 2, 100, fp);
+                for (size_t j=0; j < framesRead; ++j, ++i)
+                    assert( samples[j] == flacTestSample(i) );
+            }
+            assert( state == STREAM_STATE_OPEN_EOF );
+            assert( i == flacTestFrameCount_ );
+        }
+
+        FileIoReadStream_close(fp);
+    }
+
+    // Batch reads: two streams on different workers read through readBatch(), and get the same 
+    // data as read(). The server is restarted with two workers, then with the default configuration
+
+    printf( "batch reads\n" );
+
+    {
+#ifdef WIN32
+        const char *batchPathStrings[2] = { pathString, "..\\..\\..\\FileIoReadStream_test_output.aiff" };
+        const FileIoServerVolume volumes[2] = { { "..\\..\\..\\src\\", 0 }, { "..\\..\\..\\", 1 } };
+#else
+        const char *batchPathStrings[2] = { pathString, "../../../FileIoReadStream_test_output.aiff" }; // (written by the AIFF section)
+        const FileIoServerVolume volumes[2] = { { "../../../src/", 0 }, { "../../../", 1 } };
+#endif
+        shutDownFileIoServer();
+        FileIoServerConfig config;
+        config.workerCount = 2;
+        config.volumes = volumes;
+        config.volumeCount = 2;
+        startFileIoServer(config);
+
+        READSTREAM *streams[2];
+        for (int i=0; i < 2; ++i) {
+            path = SharedBufferAllocator::alloc(batchPathStrings[i]);
+            streams[i] = FileIoReadStream_open(path, FileIoRequest::READ_ONLY_OPEN_MODE);
+            path->release();
+            assert( streams[i] != 0 );
+        }
+
+        // read() each file in turn
+        static char expectedBytes[2][65536];
+        size_t expectedSizeBytes[2] = { 0, 0 };
+        for (int i=0; i < 2; ++i) {
+            while (FileIoReadStream_pollState(streams[i]) == STREAM_STATE_OPENING)
+                Sleep(10);
+
+            FileIoReadStream_seek(streams[i], 0);
+            FileIoStreamState state;
+            while ((state = FileIoReadStream_pollState(streams[i])) == STREAM_STATE_OPEN_STREAMING || state == STREAM_STATE_OPEN_BUFFERING) {
+                assert( expectedSizeBytes[i] + 0xFF <= sizeof(expectedBytes[i]) );
+                expectedSizeBytes[i] += FileIoReadStream_read( expectedBytes[i] + expectedSizeBytes[i], 1, rand() & 0xFF, streams[i] );
+            }
+            assert( state == STREAM_STATE_OPEN_EOF );
+            assert( expectedSizeBytes[i] > 0 );
+        }
+
+        // then both at once with readBatch()
+        for (int i=0; i < 2; ++i)
+            FileIoReadStream_seek(streams[i], 0);
+
+        static char batchBytes[2][65536];
+        size_t batchSizeBytes[2] = { 0, 0 };
+        int activeCount = 2;
+        while (activeCount > 0) {
+            FileIoReadStreamBatchRead reads[2];
+            for (int i=0; i < 2; ++i) {
+                assert( batchSizeBytes[i] + 0xFF <= sizeof(batchBytes[i]) );
+                reads[i].stream = streams[i];
+                reads[i].dest = batchBytes[i] + batchSizeBytes[i];
+                reads[i].itemSize = 1;
+                reads[i].itemCount = rand() & 0xFF;
+            }
+            FileIoReadStream_readBatch(reads, 2);
+
+            activeCount = 0;
+            for (int i=0; i < 2; ++i) {
+                batchSizeBytes[i] += reads[i].itemsRead;
+
+                FileIoStreamState state = FileIoReadStream_pollState(streams[i]);
+                assert( state != STREAM_STATE_ERROR );
+                if (state == STREAM_STATE_OPEN_STREAMING || state == STREAM_STATE_OPEN_BUFFERING)
+                    ++activeCount;
+            }
+        }
+
+        for (int i=0; i < 2; ++i) {
+            assert( FileIoReadStream_pollState(streams[i]) == STREAM_STATE_OPEN_EOF );
+            assert( batchSizeBytes[i] == expectedSizeBytes[i] );
+            assert( std::memcmp(batchBytes[i], expectedBytes[i], expectedSizeBytes[i]) == 0 );
+            FileIoReadStream_close(streams[i]);
+
+            FileIoServerStats stats;
+            getFileIoServerStats(i, &stats);
+            assert( stats.requestLatency[FileIoRequest::READ_BLOCK].count > 0 ); // (each worker read one of the files)
+        }
+
+        shutDownFileIoServer();
+        startFileIoServer();
+    }
+
+    // Small io_uring ring: the initial seek requests more blocks than the submission queue holds.
+    // The server is restarted with a two entry ring, then with the default configuration
+
+    printf( "small io_uring ring\n" );
+
+    {
+        static char fileBytes[65536];
+        FILE *file = std::fopen(pathString, "rb");
+        assert( file != 0 );
+        size_t fileSizeBytes = std::fread(fileBytes, 1, sizeof(fileBytes), file);
+        std::fclose(file);
+        assert( fileSizeBytes > 4*IO_MIN_DATA_BLOCK_CAPACITY_BYTES );
+
+        shutDownFileIoServer();
+        FileIoServerConfig config;
+        config.ioUringQueueDepth = 2;
+        startFileIoServer(config);
+
+        path = SharedBufferAllocator::alloc(pathString);
+        fp = FileIoReadStream_open(path, FileIoRequest::READ_ONLY_OPEN_MODE, sizeof(fileBytes), 1.0, IO_MIN_DATA_BLOCK_CAPACITY_BYTES); // (prefetch the whole file)
+        path->release();
+        assert( fp != 0 );
+
+        while (FileIoReadStream_pollState(fp) == STREAM_STATE_OPENING)
+            Sleep(10);
+
+        FileIoReadStream_seek(fp, 0);
+        size_t bytesRead = 0;
+        FileIoStreamState state;
+        while ((state = FileIoReadStream_pollState(fp)) == STREAM_STATE_OPEN_STREAMING || state == STREAM_STATE_OPEN_BUFFERING) {
+            char c[512];
+            size_t n = FileIoReadStream_read( c, 1, rand() & 0xFF, fp );
+            for (size_t j=0; j < n; ++j, ++bytesRead)
+                assert( c[j] == fileBytes[bytesRead] );
+        }
+        assert( state == STREAM_STATE_OPEN_EOF );
+        assert( bytesRead == fileSizeBytes );
+
+        FileIoReadStream_close(fp);
+
+        shutDownFileIoServer();
+        startFileIoServer();
+    }
+
     printf( "< FileIoReadStream_test()\n" );
 }
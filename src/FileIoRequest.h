@@ -23,15 +23,25 @@
 #define INCLUDED_FILEIOREQUEST_H
 
 #include <cstdlib> // size_t
+#include <stdint.h>
 
+#include "mintomic/mintomic.h"
 #include "QwSpscUnorderedResultQueue.h"
 #include "SharedBuffer.h"
+#include "AudioFileFormat.h"
 
 #define IO_INVALID_FILE_HANDLE (0)
 
 struct DataBlock;
 struct QwSharedBuffer;
 
+// Block requests are serviced by the server in earliest-deadline-first order.
+// Deadlines are absolute times on the getFileIoServerTimeMicroseconds() clock.
+typedef uint64_t FileIoDeadline;
+
+// Byte offset in a file. 64 bits on all platforms, so that files can be larger than 4GB.
+typedef uint64_t FileIoPosition;
+
 struct FileIoRequest{
     enum LinkIndices{
         TRANSIT_NEXT_LINK_INDEX = 0,
@@ -56,11 +66,26 @@ struct FileIoRequest{
 
     enum OpenMode {
         READ_ONLY_OPEN_MODE,
-        READ_WRITE_OVERWRITE_OPEN_MODE
+        READ_WRITE_OVERWRITE_OPEN_MODE,
+
+        // Read-only. The server memory-maps the file and READ_BLOCK returns blocks that point 
+        // into the mapping. Falls back to READ_ONLY_OPEN_MODE behavior if the file can't be mapped, 
+        // and for compressed files, which are decoded into pool blocks.
+        READ_ONLY_MAPPED_OPEN_MODE,
+
+        // As READ_WRITE_OVERWRITE_OPEN_MODE, but the server bypasses the OS page cache 
+        // (O_DIRECT, F_NOCACHE, FILE_FLAG_NO_BUFFERING) and writes whole aligned blocks, 
+        // padding the final block. The file is truncated to its written length when it is closed.
+        // Falls back to buffered I/O if the file system doesn't support unbuffered I/O.
+        // Intended for recording streams.
+        READ_WRITE_OVERWRITE_DIRECT_OPEN_MODE
     };
 
     int resultStatus; // an ERRNO value
 
+    int serverWorkerIndex; /* SERVER INTERNAL USE ONLY */ // routing: stamped on a result queue when its OPEN_FILE is sent
+    uint64_t issueTimeMicroseconds; /* SERVER INTERNAL USE ONLY */ // stamped when the request is posted to the server (see FileIoServerStats)
+
     union {
         size_t clientInt;
         void *clientPtr;
@@ -77,8 +102,17 @@ struct FileIoRequest{
         struct {
             SharedBuffer *path;         // IN NOTE: request owns a ref to path (use addRef and release)
             OpenMode openMode;          // IN
+            // IN if true, the file is opened by the worker that handles resultQueue (the worker of 
+            // the stream's first file) rather than routed by path. Used by sequence streams, whose
+            // files must all be handled by one worker because they share a result queue.
+            bool usesResultQueueWorker;
+            std::size_t blockSizeBytes; // IN  capacity of the file's data blocks. one of the sizes supported by dataBlockSizeClassForCapacity()
             void *fileHandle;           // OUT
             FileIoRequest *resultQueue; // IN
+            // Read modes: OUT, the container format parsed from the file's header.
+            // Write modes: IN, a WAV format selects a WAV file (see AudioFileFormat.h), 
+            // CONTAINER_TYPE_NONE a headerless file. dataOffsetBytes is OUT.
+            FileIoAudioFormat format;
         } openFile;
 
         /* CLOSE_FILE */ 
@@ -89,7 +123,8 @@ struct FileIoRequest{
         /* READ_BLOCK */ 
         struct {
             void *fileHandle;           // IN
-            std::size_t filePosition;   // IN
+            FileIoPosition filePosition; // IN
+            FileIoDeadline deadline;    // IN
             DataBlock *dataBlock;       // OUT
             bool isAtEof;               // OUT
             FileIoRequest *resultQueue; // IN
@@ -104,7 +139,8 @@ struct FileIoRequest{
         /* ALLOCATE_WRITE_BLOCK */ 
         struct {
             void *fileHandle;           // IN
-            std::size_t filePosition;   // IN
+            FileIoPosition filePosition; // IN
+            FileIoDeadline deadline;    // IN
             DataBlock *dataBlock;       // OUT
             FileIoRequest *resultQueue; // IN
         } allocateWriteBlock;
@@ -112,7 +148,7 @@ struct FileIoRequest{
         /* COMMIT_MODIFIED_WRITE_BLOCK */ 
         struct {
             void *fileHandle;           // IN
-            std::size_t filePosition;   // IN
+            FileIoPosition filePosition; // IN
             DataBlock *dataBlock;       // IN
         } commitModifiedWriteBlock;
 
@@ -124,6 +160,24 @@ struct FileIoRequest{
 
         /* CLEANUP_RESULT_QUEUE */
         result_queue_t resultQueue;
+
+        /* (client use only, never sent to the server) per-stream state. see FileIoStreams.cpp */
+        struct {
+            std::size_t waitingForBlocksCount;
+            std::size_t bytesPerSecond;
+            std::size_t prefetchQueueLength;        // number of blocks in the prefetch queue
+            std::size_t prefetchBlockCount;         // target prefetch queue length
+            std::size_t minPrefetchBlockCount;      // (the maximum is derived from the minimum)
+            std::size_t blockSizeBytes;
+            std::size_t slackBlockCount;            // consecutive blocks retired without the stream getting close to an underrun
+            std::size_t resultPollingBudget;        // maximum results retired per read/write call, 0 if unbounded
+
+            // statistics (see FileIoStreamStats). only written by the client, may be read by any thread
+            mint_atomic32_t underrunCount;
+            mint_atomic32_t minPrefetchSlackBlockCount;
+            mint_atomic32_t maxResultQueueDepth;
+            mint_atomic32_t maxResultsRetiredPerCall;
+        } streamExtension;
     };
 };
 
@@ -19,21 +19,50 @@
     OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
     SOFTWARE.
 */
+#if defined(__linux__)
+#define _FILE_OFFSET_BITS 64 // 64-bit off_t (pread, pwrite) on 32-bit Linux too
+#endif
+
 #include "FileIoServer.h"
+#include "AudioFileFormat.h"
+#include "FlacDecoder.h"
 
-#include <cstdio>
+#include <cstring>
 #include <cerrno>
 
-#ifdef WIN32
+#include <algorithm>
+#include <functional> // less
+#include <new> // nothrow
+
+#if defined(WIN32)
 #define NOMINMAX // suppress windows.h min/max
 #include <Windows.h>
 #include <process.h>
 #include <errno.h>
-#else
+#elif defined(__APPLE__)
 #include <pthread.h>
+#include <sched.h>
 #include <mach/mach_init.h>
 #include <mach/task.h> // semaphore_create/destroy
 #include <mach/semaphore.h> // semaphore_signal, semaphore_wait
+#include <mach/mach_time.h> // mach_absolute_time
+#include <unistd.h> // sysconf, pread, pwrite, close
+#include <sys/mman.h> // mmap
+#include <sys/stat.h> // fstat
+#include <fcntl.h> // open, F_NOCACHE
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h> // read, write, pread, pwrite, close, sysconf
+#include <sys/eventfd.h>
+#include <time.h> // clock_gettime
+#include <poll.h>
+#include <sys/uio.h> // preadv, pwritev
+#include <sys/mman.h> // mmap
+#include <sys/stat.h> // fstat
+#include <fcntl.h> // open, O_DIRECT
+#else
+#error "FileIoServer.cpp: unsupported platform. Supported platforms are Windows, OS X and Linux."
 #endif
 
 #ifndef NOERROR
@@ -42,34 +71,205 @@
 
 #include "QwMpscFifoQueue.h"
 #include "QwNodePool.h"
+#include "QwSList.h"
 #include "QwSpscUnorderedResultQueue.h"
 #include "SharedBuffer.h"
 #include "DataBlock.h"
+#include "DataBlockCache.h"
+#include "DataBlockPool.h"
 
 #include "FileIoRequest.h"
 
+// Unbuffered I/O transfer sizes and file positions must be multiples of the device's logical 
+// sector size. 4k satisfies both 512-byte and 4k sector devices. All data block sizes are 
+// multiples of this, and pool blocks are page aligned.
+#define IO_DIRECT_IO_ALIGNMENT_BYTES    (4096)
+
+// Sequential COMMIT_MODIFIED_WRITE_BLOCKs are written with a single gather write (pwritev) where 
+// available. This is the maximum number of blocks per write.
+#define IO_MAX_COALESCED_WRITE_BLOCK_COUNT  (64)
+
+// Queued READ_BLOCKs for consecutive blocks of the same file are read with a single scatter 
+// read (preadv) where available. The run is started at the earliest 
+// deadline, so this also bounds how long other streams' requests can be held up by a run.
+#define IO_MAX_COALESCED_READ_BLOCK_COUNT   (16)
+
+#if defined(__linux__)
+#define IO_USE_PWRITEV
+#define IO_USE_PREADV
+#endif
+
+#if defined(__linux__) && !defined(IO_DISABLE_IO_URING)
+#define IO_USE_IO_URING
+#include "LinuxIoUring.h"
+#endif
+
+// Data that is written by more than one thread is padded by this much on either side, so that it 
+// doesn't share a cache line with unrelated data (false sharing), whatever its alignment.
+#define IO_CACHE_LINE_SIZE_BYTES    (64)
+
 ///////////////////////////////////////////////////////////////////////////////
 // FileIoRequest allocation
 
-static QwNodePool<FileIoRequest> *globalRequestPool_ = 0; // managed by startFileIoServer/shutDownFileIoServer
+namespace {
+    // The pool's free list is written by every client and server thread
+    struct PaddedRequestPool {
+        char padBegin_[IO_CACHE_LINE_SIZE_BYTES];
+        QwNodePool<FileIoRequest> pool;
+        char padEnd_[IO_CACHE_LINE_SIZE_BYTES];
+
+        explicit PaddedRequestPool( std::size_t fileIoRequestCount )
+            : pool( fileIoRequestCount ) {}
+    };
+} // end anonymous namespace
+
+static PaddedRequestPool *globalRequestPool_ = 0; // managed by startFileIoServer/shutDownFileIoServer
 
 FileIoRequest *allocFileIoRequest()
 {
-    return globalRequestPool_->allocate();
+    return globalRequestPool_->pool.allocate();
 }
 
 void freeFileIoRequest( FileIoRequest *r )
 {
-    globalRequestPool_->deallocate(r);
+    globalRequestPool_->pool.deallocate(r);
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Server workers
+
+/*
+    The server runs one or more worker threads. Each worker has its own mailbox,
+    data block pool and I/O engine. Every file is handled by exactly one worker:
+    OPEN_FILE is routed by path (see workerIndexForPath()), and every later request
+    for the file or its result queue goes to the same worker. (The later files of a 
+    sequence stream are opened by the worker of its first file, see usesResultQueueWorker.)
+    So FileRecords, result queues and the result queue cleanup protocol are still only 
+    ever touched by a single server thread, and a slow device ties up only its own worker.
+*/
+
+namespace {
+    struct FileRecord;
+
+    struct FileIoServerWorker {
+        // The mailbox is written by clients. It is padded so that it doesn't share a cache line 
+        // with the worker's private state, or with the mailboxes of the workers next to it in workers_.
+        char mailboxPadBegin_[IO_CACHE_LINE_SIZE_BYTES];
+        QwMpscFifoQueue<FileIoRequest*, FileIoRequest::TRANSIT_NEXT_LINK_INDEX> mailboxQueue;
+#if defined(WIN32)
+        HANDLE mailboxEvent;
+#elif defined(__APPLE__)
+        // google "mach semaphores amit singh" http://books.google.com.au/books?id=K8vUkpOXhN4C&pg=PA1219
+        // and "OS X Kernel Programming Guide semaphores" https://developer.apple.com/library/mac/documentation/Darwin/Conceptual/KernelProgramming/synchronization/synchronization.html
+        semaphore_t mailboxSemaphore;
+#else
+        // Linux: the mailbox is signaled with an eventfd. Reading the eventfd blocks until it has been
+        // signaled at least once, and resets it. This gives us auto-reset event semantics, which is all
+        // that we need because the worker drains the whole mailbox after every wakeup.
+        int mailboxEventFd;
+#endif
+        // Written by the worker, read by clients. 1 while the worker is (about to be) blocked in 
+        // waitServerMailbox(), and clients have to signal it. Always 1 if spinning is disabled.
+        mint_atomic32_t isSleeping;
+        char mailboxPadEnd_[IO_CACHE_LINE_SIZE_BYTES];
+
+        int index;
+#if defined(WIN32)
+        HANDLE threadHandle;
+#else
+        pthread_t thread;
+#endif
+
+        // Requests freed by the worker. They are returned to the global request pool together at 
+        // the end of each mailbox drain, rather than touching the pool's free list for each one.
+        QwSList<FileIoRequest*, FileIoRequest::TRANSIT_NEXT_LINK_INDEX> freedRequests;
+
+        // READ_BLOCK and ALLOCATE_WRITE_BLOCK requests that have been received but not yet started.
+        // A binary min-heap ordered by deadline. Capacity is the size of the global request pool,
+        // so it never overflows.
+        FileIoRequest **pendingBlockRequests;
+        std::size_t pendingBlockRequestCount;
+
+        // COMMIT_MODIFIED_WRITE_BLOCK requests that are waiting to be written (see flushPendingCommits()).
+        // In arrival order. Capacity is the size of the global request pool.
+        FileIoRequest **pendingCommits;
+        std::size_t pendingCommitCount;
+        uint64_t oldestPendingCommitTimeMicroseconds;
+        uint64_t commitFlushIntervalMicroseconds;
+        uint64_t spinMicroseconds; // see FileIoServerConfig::serverSpinMicroseconds
+
+        DataBlockPool *dataBlockPools[IO_DATA_BLOCK_SIZE_CLASS_COUNT]; // indexed by size class
+        QwSList<DataBlock*, 0> freeMappedDataBlocks; // header-only blocks for mapped files (see allocMappedDataBlock())
+        DataBlockCache *blockCache; // blocks of read-only files, shared between streams
+        FileRecord *cacheFileRecords; // open files that have a cache file id (see linkCacheFileRecord())
+#if defined(IO_USE_IO_URING)
+        LinuxIoUring *ioUring; // 0 if the synchronous engine is in use
+#endif
+
+        // instrumentation (see getFileIoServerStats()). only written by the worker thread
+        FileIoHistogramCounter requestLatency[IO_STATS_REQUEST_TYPE_COUNT];
+        FileIoHistogramCounter blockDeadlineSlack;
+        FileIoHistogramCounter readCallDuration;
+        FileIoHistogramCounter writeCallDuration;
+        FileIoHistogramCounter mailboxDepth;
+    };
+
+    struct VolumeRoute {
+        char *pathPrefix;
+        std::size_t pathPrefixLength;
+        int workerIndex;
+    };
+} // end anonymous namespace
+
+// managed by startFileIoServer/shutDownFileIoServer
+static FileIoServerWorker *workers_ = 0;
+static int workerCount_ = 0;
+static VolumeRoute *volumeRoutes_ = 0;
+static std::size_t volumeRouteCount_ = 0;
+static std::size_t pageSizeBytes_ = 4096;
+
 ///////////////////////////////////////////////////////////////////////////////
 // Server thread routines
 
-static void cleanupOneRequestResult( FileIoRequest *r ); // forward reference
+static void cleanupOneRequestResult( FileIoServerWorker *worker, FileIoRequest *r ); // forward reference
+
+static void freeServerRequest( FileIoServerWorker *worker, FileIoRequest *r )
+{
+    worker->freedRequests.push_front(r);
+}
+
+static void returnFreedRequestsToPool( FileIoServerWorker *worker )
+{
+    while (!worker->freedRequests.empty()) {
+        FileIoRequest *r = worker->freedRequests.front();
+        worker->freedRequests.pop_front();
+        freeFileIoRequest(r);
+    }
+}
+
+static void recordRequestLatency( FileIoServerWorker *worker, FileIoRequest *r )
+{
+    uint64_t now = getFileIoServerTimeMicroseconds();
+    worker->requestLatency[r->requestType].record( (now > r->issueTimeMicroseconds) ? now - r->issueTimeMicroseconds : 0 );
+
+    FileIoDeadline deadline;
+    switch (r->requestType) {
+    case FileIoRequest::READ_BLOCK:
+        deadline = r->readBlock.deadline;
+        break;
+    case FileIoRequest::ALLOCATE_WRITE_BLOCK:
+        deadline = r->allocateWriteBlock.deadline;
+        break;
+    default:
+        return;
+    }
+    worker->blockDeadlineSlack.record( (deadline > now) ? deadline - now : 0 );
+}
 
-static void completeRequestToClientResultQueue( FileIoRequest *clientResultQueueContainer, FileIoRequest *r )
+static void completeRequestToClientResultQueue( FileIoServerWorker *worker, FileIoRequest *clientResultQueueContainer, FileIoRequest *r )
 {
+    recordRequestLatency(worker, r);
+
     // Poll the state of the result queue *before* posting result back to client
     // because if the result queue is not being cleaned up the server doesn't own it
     // and can't use it after returning the result.
@@ -77,9 +277,9 @@ static void completeRequestToClientResultQueue( FileIoRequest *clientResultQueue
 
     if (resultQueueIsAwaitingCleanup) {
         // Option A:
-        cleanupOneRequestResult(r);
+        cleanupOneRequestResult(worker, r);
         if (clientResultQueueContainer->resultQueue.expectedResultCount() == 0)
-            freeFileIoRequest(clientResultQueueContainer);
+            freeServerRequest(worker, clientResultQueueContainer);
         
         /*
         // Option B:
@@ -100,442 +300,2110 @@ static void completeRequestToClientResultQueue( FileIoRequest *clientResultQueue
 
 ///
 
-static DataBlock* allocDataBlock()
+static DataBlock* allocDataBlock( FileIoServerWorker *worker, int sizeClass )
 {
-    DataBlock *result = new DataBlock;
-    assert( result );
-    result->capacityBytes = IO_DATA_BLOCK_DATA_CAPACITY_BYTES;
-    result->validCountBytes = 0;
-    result->data = new int8_t[ IO_DATA_BLOCK_DATA_CAPACITY_BYTES ];
-    assert( result->data );
-    return result;
+    DataBlockPool *pool = worker->dataBlockPools[sizeClass];
+    if (pool->isArenaExhausted())
+        worker->blockCache->evictLeastRecentlyUsed(sizeClass); // reclaim a block that the cache is retaining
+
+    return pool->allocate(); // returns 0 if the pool is exhausted and the policy is to fail
+}
+
+static void freeDataBlock( FileIoServerWorker *worker, DataBlock *b )
+{
+    worker->dataBlockPools[ dataBlockSizeClassForCapacity(b->capacityBytes) ]->deallocate(b);
+}
+
+// Blocks of mapped files only need a header, their data points into the mapping.
+// Headers are recycled through a per-worker free list, which only grows.
+
+static DataBlock* allocMappedDataBlock( FileIoServerWorker *worker )
+{
+    if (!worker->freeMappedDataBlocks.empty()) {
+        DataBlock *result = worker->freeMappedDataBlocks.front();
+        worker->freeMappedDataBlocks.pop_front();
+        return result;
+    }
+
+    return new (std::nothrow) DataBlock;
 }
 
-static void freeDataBlock( DataBlock *b )
+static void freeMappedDataBlock( FileIoServerWorker *worker, DataBlock *b )
 {
-    delete [] (int8_t*)b->data;
-    delete b;
+    b->data = 0;
+    worker->freeMappedDataBlocks.push_front(b);
 }
 
 namespace {
     struct FileRecord{
-        FILE *fp;
+        // All I/O is positional: there is no file position, and no stdio buffering.
+#if defined(WIN32)
+        HANDLE handle;
+#else
+        int fd;
+#endif
+
+        // READ_WRITE_OVERWRITE_DIRECT_OPEN_MODE: the file was opened for unbuffered I/O.
+        // directFileSizeBytes is the logical size of the file. The final block is padded 
+        // when it is written, so the file is truncated to this size when it is closed.
+        bool isDirect;
+        FileIoPosition directFileSizeBytes;
+
+        // Reads are clamped to the end of the sample data of audio files (see AudioFileFormat.h).
+        // (FileIoPosition)-1 for headerless files.
+        FileIoPosition dataEndPosition;
+
+        // Write modes with a WAV format: the header, which is written when the file is opened
+        // and rewritten with the final sizes when it is closed (see finalizeWaveFileHeader()).
+        // 0 for headerless files. The header block comes from the worker's smallest size class.
+        DataBlock *headerBlock;
+        FileIoAudioFormat headerFormat;
+
+        // Compressed files: READ_BLOCK decodes the block (see FlacDecoder.h). 0 for PCM files.
+        FlacDecoder *decoder;
+
         int dependentClientCount;
+        int workerIndex; // the worker that handles all requests for this file
+        int dataBlockSizeClass;
+
+        // READ_ONLY_OPEN_MODE: blocks are shared with other streams reading the same file (see DataBlockCache.h).
+        // If the cache doesn't retain blocks, a file that only one stream has open doesn't use it.
+        bool hasCacheFileId;
+        bool usesBlockCache;
+        DataBlockCacheFileId cacheFileId;
+        FileRecord *cacheFilePrev, *cacheFileNext; // links the worker's cacheFileRecords
+
+        // READ_ONLY_MAPPED_OPEN_MODE: the whole file is mapped read-only.
+        // mappedData is 0 if the file isn't mapped, in which case blocks are read into pool blocks.
+        const int8_t *mappedData;
+        std::size_t mappedSizeBytes;
+#if defined(WIN32)
+        HANDLE fileMapping;
+#endif
+#if defined(IO_USE_IO_URING)
+        // extent of the writes that are in flight
+        int inFlightWriteCount;
+        FileIoPosition inFlightWriteBegin, inFlightWriteEnd;
+#endif
     };
 } // end anonymous namespace
 
-static void handleOpenFileRequest( FileIoRequest *r )
+// Memory-mapped files.
+//
+// Mapping can fail (e.g. for empty files, or for large files in a 32-bit address space).
+// Then the file is read normally.
+
+static bool mapFile( FileRecord *fileRecord )
 {
-    assert( r->requestType == FileIoRequest::OPEN_FILE );
+#if defined(WIN32)
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(fileRecord->handle, &fileSize) || fileSize.QuadPart == 0 || (uint64_t)fileSize.QuadPart > (std::size_t)-1)
+        return false;
+
+    HANDLE fileMapping = CreateFileMapping(fileRecord->handle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!fileMapping)
+        return false;
+
+    void *p = MapViewOfFile(fileMapping, FILE_MAP_READ, 0, 0, 0);
+    if (!p) {
+        CloseHandle(fileMapping);
+        return false;
+    }
 
-    FileRecord *fileRecord = new FileRecord;
-    if (fileRecord) {
-        const char *fopenMode = (r->openFile.openMode == FileIoRequest::READ_WRITE_OVERWRITE_OPEN_MODE)
-            ? "wb+"
-            : "rb"; // default to read-only
+    fileRecord->fileMapping = fileMapping;
+    fileRecord->mappedData = static_cast<const int8_t*>(p);
+    fileRecord->mappedSizeBytes = (std::size_t)fileSize.QuadPart;
+#else
+    struct stat fileStat;
+    if (fstat(fileRecord->fd, &fileStat) != 0 || fileStat.st_size == 0 || (uint64_t)fileStat.st_size > (std::size_t)-1)
+        return false;
 
-        if (FILE *fp = std::fopen(r->openFile.path->data, fopenMode)) {
-            fileRecord->fp = fp;
-            fileRecord->dependentClientCount = 1;
-            r->openFile.fileHandle = fileRecord;
-            r->resultStatus = NOERROR;
-        } else {
-            delete fileRecord;
-            r->openFile.fileHandle = 0;
-            r->resultStatus = (errno==NOERROR) ? EIO : errno;
-        }
-    } else {
-        r->openFile.fileHandle = 0;
-        r->resultStatus = ENOMEM;
-    }
-    
-    completeRequestToClientResultQueue(r->openFile.resultQueue, r);
+    void *p = mmap(0, (std::size_t)fileStat.st_size, PROT_READ, MAP_SHARED, fileRecord->fd, 0);
+    if (p == MAP_FAILED)
+        return false;
+
+    fileRecord->mappedData = static_cast<const int8_t*>(p);
+    fileRecord->mappedSizeBytes = (std::size_t)fileStat.st_size;
+#endif
+    return true;
 }
 
-static void releaseFileRecordClientRef( FileRecord *fileRecord )
+static void unmapFile( FileRecord *fileRecord )
 {
-    if (--fileRecord->dependentClientCount == 0) {
-        std::fclose(fileRecord->fp);
-        delete fileRecord;
-    }
+#if defined(WIN32)
+    UnmapViewOfFile(fileRecord->mappedData);
+    CloseHandle(fileRecord->fileMapping);
+#else
+    munmap(const_cast<int8_t*>(fileRecord->mappedData), fileRecord->mappedSizeBytes);
+#endif
+    fileRecord->mappedData = 0;
+    fileRecord->mappedSizeBytes = 0;
 }
 
-static void handleCloseFileRequest( FileIoRequest *r )
+// Ask the OS to start reading [begin, end) of the mapping into the page cache
+static void adviseMappedFileReadahead( FileRecord *fileRecord, std::size_t begin, std::size_t end )
 {
-    assert( r->requestType == FileIoRequest::CLOSE_FILE );
-
-    releaseFileRecordClientRef( static_cast<FileRecord*>(r->closeFile.fileHandle) );
-    freeFileIoRequest(r);
+    end = std::min(end, fileRecord->mappedSizeBytes);
+    begin = begin - (begin % pageSizeBytes_); // page align
+    if (begin >= end)
+        return;
+
+#if defined(WIN32)
+#if (_WIN32_WINNT >= 0x0602) // PrefetchVirtualMemory is available from Windows 8
+    WIN32_MEMORY_RANGE_ENTRY range;
+    range.VirtualAddress = const_cast<int8_t*>(fileRecord->mappedData + begin);
+    range.NumberOfBytes = end - begin;
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#endif
+#else
+    madvise(const_cast<int8_t*>(fileRecord->mappedData + begin), end - begin, MADV_WILLNEED);
+#endif
 }
 
-static void handleReadBlockRequest( FileIoRequest *r )
+// Fault the pages in on the server thread, so that the client doesn't take page faults on the real-time thread
+static void touchMappedPages( const int8_t *data, std::size_t sizeBytes )
 {
-    assert( r->requestType == FileIoRequest::READ_BLOCK );
-    // Allocate the block, perform the fread, return the block to the client, 
-    // increment the file record dependent count.
-
-    FileRecord *fileRecord = static_cast<FileRecord*>(r->readBlock.fileHandle);
-    if (fileRecord) {
-        DataBlock *dataBlock = allocDataBlock();
-        if (dataBlock) {
-
-            // FIXME: we're only supporting 32 bit file positions here
-            if (std::fseek(fileRecord->fp, r->readBlock.filePosition, SEEK_SET) != 0) {
-                // seek failed
-                r->resultStatus = (errno==NOERROR) ? EIO : errno;
-                r->readBlock.dataBlock = 0;
-                r->readBlock.isAtEof = false;
-                freeDataBlock(dataBlock);
-                dataBlock = 0;
-            }else{
-
-                dataBlock->validCountBytes = std::fread(dataBlock->data, 1, dataBlock->capacityBytes, fileRecord->fp);
-            
-                if (dataBlock->validCountBytes==dataBlock->capacityBytes) {
-                    // normal case: read a whole block
-                    r->resultStatus = NOERROR;
-                    r->readBlock.dataBlock = dataBlock; // return the block
-                    r->readBlock.isAtEof = false;
-                } else {
-                    // only return a partial block *if* we're at EOF, otherwise free the block and return an error.
-                
-                    if (feof(fileRecord->fp) != 0) {
-                        // Note: this may return a block with zero valid bytes. Could maybe optimise this away.
-                        r->resultStatus = NOERROR;
-                        r->readBlock.dataBlock = dataBlock; // return the block
-                        r->readBlock.isAtEof = true;
-                    } else {
-                        r->resultStatus = (errno==NOERROR) ? EIO : errno;
-                        r->readBlock.dataBlock = 0;
-                        r->readBlock.isAtEof = false;
-                        freeDataBlock(dataBlock);
-                        dataBlock = 0;
-                    }
-                }
-            }
-        }else{
-            r->resultStatus = ENOMEM;
-        }
-    }else{
-        r->resultStatus = EBADF;
-    }
+    volatile int8_t sink = 0;
+    for (std::size_t i=0; i < sizeBytes; i += pageSizeBytes_)
+        sink += data[i];
+    if (sizeBytes > 0)
+        sink += data[sizeBytes - 1];
+}
 
-    if (r->readBlock.dataBlock)
-        ++fileRecord->dependentClientCount;
+// Opening and closing files.
+//
+// Files are opened as OS descriptors (handles on Windows), which are only ever accessed
+// with positional reads and writes. READ_WRITE_OVERWRITE_DIRECT_OPEN_MODE files are also 
+// opened for unbuffered I/O: positions of block requests are always block aligned, and so, 
+// sector aligned. Reads are clamped to the logical file size, because the file may extend 
+// past it (padding) until it is closed.
 
-    completeRequestToClientResultQueue(r->readBlock.resultQueue, r);
+#if defined(WIN32)
+static int errnoForLastError()
+{
+    switch (GetLastError()) {
+    case ERROR_INVALID_PARAMETER: return EINVAL;
+    case ERROR_ACCESS_DENIED: // fall through
+    case ERROR_SHARING_VIOLATION: return EACCES;
+    case ERROR_FILE_NOT_FOUND: // fall through
+    case ERROR_PATH_NOT_FOUND: return ENOENT;
+    default: return EIO;
+    }
 }
+#endif
 
-static void handleReleaseReadBlockRequest( FileIoRequest *r )
+static int openFileDescriptor( FileRecord *fileRecord, const char *path, bool isWrite, bool isDirect ) // returns an errno value
 {
-    assert( r->requestType == FileIoRequest::RELEASE_READ_BLOCK );
-    // Free the data block, decrement file record dependent client count
+#if defined(WIN32)
+    HANDLE h = CreateFileA(path, (isWrite) ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ, 
+            (isWrite) ? FILE_SHARE_READ : (FILE_SHARE_READ | FILE_SHARE_WRITE), NULL, 
+            (isWrite) ? CREATE_ALWAYS : OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL | ((isDirect) ? FILE_FLAG_NO_BUFFERING : 0), NULL);
+    if (h == INVALID_HANDLE_VALUE)
+        return errnoForLastError();
+    fileRecord->handle = h;
+#else
+    int flags = ((isWrite) ? (O_RDWR | O_CREAT | O_TRUNC) : O_RDONLY) | O_CLOEXEC;
+#if defined(__linux__)
+    if (isDirect)
+        flags |= O_DIRECT;
+#endif
+    int fd = open(path, flags, 0666);
+    if (fd == -1)
+        return (errno==NOERROR) ? EIO : errno; // EINVAL if the file system doesn't support O_DIRECT
+#if defined(__APPLE__)
+    if (isDirect)
+        fcntl(fd, F_NOCACHE, 1);
+#endif
+    fileRecord->fd = fd;
+#endif
 
-    assert( r->releaseReadBlock.dataBlock != 0 );
-    freeDataBlock(r->releaseReadBlock.dataBlock);
-    releaseFileRecordClientRef( static_cast<FileRecord*>(r->releaseReadBlock.fileHandle) );
-    freeFileIoRequest(r);
+    fileRecord->isDirect = isDirect;
+    return NOERROR;
 }
 
-static void handleAllocateWriteBlockRequest( FileIoRequest *r )
+static void closeFileDescriptor( FileRecord *fileRecord )
 {
-    assert( r->requestType == FileIoRequest::ALLOCATE_WRITE_BLOCK );
-    // Allocate the block, read existing data (if any), return the block to the client,
-    // increment the file record dependent count
-    
-    FileRecord *fileRecord = static_cast<FileRecord*>(r->allocateWriteBlock.fileHandle);
-    if (fileRecord) {
-        DataBlock *dataBlock = allocDataBlock();
-        if (dataBlock) {
-
-            // FIXME: we're only supporting 32 bit file positions here
-            if (std::fseek(fileRecord->fp, r->allocateWriteBlock.filePosition, SEEK_SET) != 0) {
-                // seek failed
-                r->resultStatus = (errno==NOERROR) ? EIO : errno;
-                r->allocateWriteBlock.dataBlock = 0;
-                freeDataBlock(dataBlock);
-                dataBlock = 0;
-            }else{
-
-                dataBlock->validCountBytes = std::fread(dataBlock->data, 1, dataBlock->capacityBytes, fileRecord->fp);
-
-                // irrespective of how many bytes are read, return the block to the client
-                r->resultStatus = NOERROR;
-                r->allocateWriteBlock.dataBlock = dataBlock; // return the block
-            }
-        }else{
-            r->resultStatus = ENOMEM;
+#if defined(WIN32)
+    if (fileRecord->isDirect) {
+        // Remove the padding written with the final block
+        LARGE_INTEGER fileSize;
+        fileSize.QuadPart = fileRecord->directFileSizeBytes;
+        if (SetFilePointerEx(fileRecord->handle, fileSize, NULL, FILE_BEGIN))
+            SetEndOfFile(fileRecord->handle);
+    }
+    CloseHandle(fileRecord->handle);
+#else
+    if (fileRecord->isDirect) {
+        // Remove the padding written with the final block
+        if (ftruncate(fileRecord->fd, (off_t)fileRecord->directFileSizeBytes) != 0) {
+            // silently ignore errors, as for writes
         }
-    }else{
-        r->resultStatus = EBADF;
     }
-
-    if (r->allocateWriteBlock.dataBlock)
-        ++fileRecord->dependentClientCount;
-
-    completeRequestToClientResultQueue(r->allocateWriteBlock.resultQueue, r);
+    close(fileRecord->fd);
+#endif
 }
 
-static void handleCommitModifiedWriteBlockRequest( FileIoRequest *r )
+static int openFileRecord( FileRecord *fileRecord, const char *path, FileIoRequest::OpenMode openMode ) // returns an errno value
 {
-    assert( r->requestType == FileIoRequest::COMMIT_MODIFIED_WRITE_BLOCK );
-    // Write valid data to the file, free the data block, decrement file record dependent client count
-
-    FileRecord *fileRecord = static_cast<FileRecord*>(r->commitModifiedWriteBlock.fileHandle);
-    if (fileRecord) {
-        // FIXME: we're only supporting 32 bit file positions here
-        if (std::fseek(fileRecord->fp, r->commitModifiedWriteBlock.filePosition, SEEK_SET)==0) {
-            DataBlock *dataBlock = r->commitModifiedWriteBlock.dataBlock;
-            std::fwrite(dataBlock->data, 1, dataBlock->validCountBytes, fileRecord->fp); // silently ignore errors
-        }else{
-            // couldn't seek to position, silently fail
-        }
+    fileRecord->isDirect = false;
+    fileRecord->directFileSizeBytes = 0;
+    fileRecord->dataEndPosition = (FileIoPosition)-1;
+    fileRecord->headerBlock = 0;
+    fileRecord->decoder = 0;
+
+    bool isWrite = (openMode == FileIoRequest::READ_WRITE_OVERWRITE_OPEN_MODE 
+            || openMode == FileIoRequest::READ_WRITE_OVERWRITE_DIRECT_OPEN_MODE); // default to read-only
+
+    if (openMode == FileIoRequest::READ_WRITE_OVERWRITE_DIRECT_OPEN_MODE) {
+        int result = openFileDescriptor(fileRecord, path, isWrite, true);
+        if (result != EINVAL)
+            return result;
+        // The file system doesn't support unbuffered I/O. Fall back to buffered I/O.
     }
 
-    freeDataBlock(r->commitModifiedWriteBlock.dataBlock);
-    releaseFileRecordClientRef( static_cast<FileRecord*>(r->commitModifiedWriteBlock.fileHandle) );
-    freeFileIoRequest(r);
+    return openFileDescriptor(fileRecord, path, isWrite, false);
 }
 
-static void handleReleaseUnmodifiedWriteBlockRequest( FileIoRequest *r )
+// ioResult is the number of bytes read at filePosition, or a negative errno value.
+// Clamp it to the logical size of a direct file, and to the end of an audio file's sample data.
+static int clampReadResult( FileRecord *fileRecord, FileIoPosition filePosition, int ioResult )
 {
-    assert( r->requestType == FileIoRequest::RELEASE_UNMODIFIED_WRITE_BLOCK );
-    // Free the data block, decrement file record dependent client count
+    if (ioResult <= 0)
+        return ioResult;
 
-    freeDataBlock(r->releaseUnmodifiedWriteBlock.dataBlock);
-    releaseFileRecordClientRef( static_cast<FileRecord*>(r->releaseUnmodifiedWriteBlock.fileHandle) );
-    freeFileIoRequest(r);
+    FileIoPosition endPosition = fileRecord->dataEndPosition;
+    if (fileRecord->isDirect)
+        endPosition = std::min(endPosition, fileRecord->directFileSizeBytes);
+    
+    FileIoPosition validBytes = (filePosition < endPosition) ? endPosition - filePosition : 0;
+    return (int)std::min<FileIoPosition>((FileIoPosition)ioResult, validBytes);
 }
 
-static void cleanupOneRequestResult( FileIoRequest *r )
+// Returns the number of bytes to write. The padding past the valid bytes is zeroed, except  
+// where it covers existing file data, which is still in the block from when it was allocated.
+static std::size_t prepareDirectWriteBlock( FileRecord *fileRecord, FileIoPosition filePosition, DataBlock *dataBlock )
 {
-    switch (r->requestType) // we only need to handle requests that return results here
-    {
-    case FileIoRequest::OPEN_FILE:
-        {
-            // in any case, release the path
-            r->openFile.path->release();
-            r->openFile.path = 0;
-
-            if (r->openFile.fileHandle != 0) { // the open was successful, close the handle
-                // convert the open file request into a close request
-                void *fileHandle = r->openFile.fileHandle;
-
-                r->requestType = FileIoRequest::CLOSE_FILE;
-                r->closeFile.fileHandle = fileHandle;
-                handleCloseFileRequest(r);
-            } else {
-                freeFileIoRequest(r);
-            }
-        }
-        break;
+    std::size_t writeSizeBytes = ((dataBlock->validCountBytes + IO_DIRECT_IO_ALIGNMENT_BYTES - 1) / IO_DIRECT_IO_ALIGNMENT_BYTES) * IO_DIRECT_IO_ALIGNMENT_BYTES;
+    assert( writeSizeBytes <= dataBlock->capacityBytes );
 
-    case FileIoRequest::READ_BLOCK:
-        {
-            if (r->readBlock.dataBlock) { // the read was successful, release the block
-                // convert the read block request into a release read block request
-                void *fileHandle = r->readBlock.fileHandle;
-                DataBlock *dataBlock = r->readBlock.dataBlock;
+    std::size_t existingBytes = (filePosition < fileRecord->directFileSizeBytes) 
+            ? (std::size_t)std::min<FileIoPosition>(fileRecord->directFileSizeBytes - filePosition, dataBlock->capacityBytes) : 0;
+    std::size_t zeroBegin = std::max(dataBlock->validCountBytes, existingBytes);
+    if (zeroBegin < writeSizeBytes)
+        std::memset(static_cast<int8_t*>(dataBlock->data) + zeroBegin, 0, writeSizeBytes - zeroBegin);
 
-                r->requestType = FileIoRequest::RELEASE_READ_BLOCK;
-                r->releaseReadBlock.fileHandle = fileHandle;
-                r->releaseReadBlock.dataBlock = dataBlock;
-                handleReleaseReadBlockRequest(r);
-            } else {
-                freeFileIoRequest(r);
-            }
-        }
-        break;
+    fileRecord->directFileSizeBytes = std::max<FileIoPosition>(fileRecord->directFileSizeBytes, filePosition + dataBlock->validCountBytes);
+    return writeSizeBytes;
+}
 
-    case FileIoRequest::ALLOCATE_WRITE_BLOCK:
-        {
-            if (r->allocateWriteBlock.dataBlock) { // the allocation was successful, release the block
-                // convert the allocate write block request into a release write block request
-                void *fileHandle = r->allocateWriteBlock.fileHandle;
-                DataBlock *dataBlock = r->allocateWriteBlock.dataBlock;
+// Synchronous block I/O. Return the number of bytes transferred, or a negative errno value.
 
-                r->requestType = FileIoRequest::RELEASE_UNMODIFIED_WRITE_BLOCK;
-                r->releaseUnmodifiedWriteBlock.fileHandle = fileHandle;
-                r->releaseUnmodifiedWriteBlock.dataBlock = dataBlock;
-                handleReleaseUnmodifiedWriteBlockRequest(r);
-            } else {
-                freeFileIoRequest(r);
-            }
-        }
-        break;
-    
-    default:
-        assert(false); // only requests that have results should be encountered
-    }
+static int readBlockSynchronously( FileRecord *fileRecord, FileIoPosition filePosition, DataBlock *dataBlock )
+{
+#if defined(WIN32)
+    OVERLAPPED overlapped;
+    std::memset(&overlapped, 0, sizeof(overlapped));
+    overlapped.Offset = (DWORD)(filePosition & 0xFFFFFFFF);
+    overlapped.OffsetHigh = (DWORD)(filePosition >> 32);
+    DWORD bytesRead = 0;
+    if (!ReadFile(fileRecord->handle, dataBlock->data, (DWORD)dataBlock->capacityBytes, &bytesRead, &overlapped)
+            && GetLastError() != ERROR_HANDLE_EOF)
+        return -EIO;
+    return (int)bytesRead;
+#else
+    ssize_t bytesRead = pread(fileRecord->fd, dataBlock->data, dataBlock->capacityBytes, (off_t)filePosition);
+    if (bytesRead < 0)
+        return -((errno==NOERROR) ? EIO : errno);
+    return (int)bytesRead; // (for a regular file, a short read is at EOF)
+#endif
 }
 
-static void handleCleanupResultQueueRequest( FileIoRequest *clientResultQueueContainer )
+static std::size_t writeSizeForBlock( FileRecord *fileRecord, FileIoPosition filePosition, DataBlock *dataBlock )
 {
-    // Cleanup any results that are in the queue, either free the queue now, or mark it for cleanup later.
-
-    assert( clientResultQueueContainer->requestType == FileIoRequest::CLEANUP_RESULT_QUEUE );
+    if (fileRecord->isDirect)
+        return prepareDirectWriteBlock(fileRecord, filePosition, dataBlock);
 
-    if (clientResultQueueContainer->resultQueue.expectedResultCount() > 0)
-    {
-        while (FileIoRequest *r = clientResultQueueContainer->resultQueue.pop())
-        {
-            cleanupOneRequestResult(r);
-        }
+    return dataBlock->validCountBytes;
+}
 
-        if (clientResultQueueContainer->resultQueue.expectedResultCount() == 0) {
-            freeFileIoRequest(clientResultQueueContainer);
-        } else {
-            // mark the queue for cleanup. 
-            // cleanup is resumed by completeRequestToClientResultQueue() the next time that a request completes
-            clientResultQueueContainer->requestType = FileIoRequest::RESULT_QUEUE_IS_AWAITING_CLEANUP_;
-        }
-    } else {
-        freeFileIoRequest(clientResultQueueContainer);
+static void writeBlockSynchronously( FileRecord *fileRecord, FileIoPosition filePosition, DataBlock *dataBlock )
+{
+    std::size_t writeSizeBytes = writeSizeForBlock(fileRecord, filePosition, dataBlock);
+
+    // (silently ignore errors)
+#if defined(WIN32)
+    OVERLAPPED overlapped;
+    std::memset(&overlapped, 0, sizeof(overlapped));
+    overlapped.Offset = (DWORD)(filePosition & 0xFFFFFFFF);
+    overlapped.OffsetHigh = (DWORD)(filePosition >> 32);
+    DWORD bytesWritten = 0;
+    WriteFile(fileRecord->handle, dataBlock->data, (DWORD)writeSizeBytes, &bytesWritten, &overlapped);
+#else
+    if (pwrite(fileRecord->fd, dataBlock->data, writeSizeBytes, (off_t)filePosition) < 0) {
+        // silently fail
     }
+#endif
 }
 
+static bool getCacheFileId( FileRecord *fileRecord, DataBlockCacheFileId *result )
+{
+#if defined(WIN32)
+    BY_HANDLE_FILE_INFORMATION info;
+    if (!GetFileInformationByHandle(fileRecord->handle, &info))
+        return false;
+
+    result->device = info.dwVolumeSerialNumber;
+    result->file = ((uint64_t)info.nFileIndexHigh << 32) | info.nFileIndexLow;
+    result->sizeBytes = ((uint64_t)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+    result->modificationTime = ((uint64_t)info.ftLastWriteTime.dwHighDateTime << 32) | info.ftLastWriteTime.dwLowDateTime;
+#else
+    struct stat st;
+    if (fstat(fileRecord->fd, &st) != 0)
+        return false;
+
+    result->device = (uint64_t)st.st_dev;
+    result->file = (uint64_t)st.st_ino;
+    result->sizeBytes = (uint64_t)st.st_size;
+#if defined(__APPLE__)
+    result->modificationTime = (uint64_t)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    result->modificationTime = (uint64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+#endif
+    return true;
+}
 
-///////////////////////////////////////////////////////////////////////////////
-// Server thread setup and teardown
-
-mint_atomic32_t shutdownFlag_;
-#ifdef WIN32
-HANDLE serverMailboxEvent_;
-HANDLE serverThreadHandle_;
+static bool getFileSizeBytes( FileRecord *fileRecord, FileIoPosition *result )
+{
+#if defined(WIN32)
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(fileRecord->handle, &fileSize))
+        return false;
+    *result = (FileIoPosition)fileSize.QuadPart;
 #else
-// google "mach semaphores amit singh" http://books.google.com.au/books?id=K8vUkpOXhN4C&pg=PA1219
-// and "OS X Kernel Programming Guide semaphores" https://developer.apple.com/library/mac/documentation/Darwin/Conceptual/KernelProgramming/synchronization/synchronization.html
-semaphore_t serverMailboxSemaphore_;
-pthread_t serverThread_;
+    struct stat fileStat;
+    if (fstat(fileRecord->fd, &fileStat) != 0)
+        return false;
+    *result = (FileIoPosition)fileStat.st_size;
 #endif
+    return true;
+}
 
-QwMpscFifoQueue<FileIoRequest*, FileIoRequest::TRANSIT_NEXT_LINK_INDEX> serverMailboxQueue_;
+// Audio file headers (see AudioFileFormat.h).
+//
+// Headers are parsed and written synchronously while handling OPEN_FILE, and rewritten 
+// when the file is closed. These, and the reads of compressed files' decoders, are the 
+// only non-block I/O operations on files.
 
-static void handleAllPendingRequests()
+static int readFileRecordBytes( void *context, uint64_t position, void *dest, std::size_t sizeBytes )
 {
-    while (FileIoRequest *r = serverMailboxQueue_.pop()) {
-        switch (r->requestType) {
-        case FileIoRequest::OPEN_FILE:
-            handleOpenFileRequest(r);
-            break;
-        case FileIoRequest::CLOSE_FILE:
-            handleCloseFileRequest(r);
-            break;
-        case FileIoRequest::READ_BLOCK:
-            handleReadBlockRequest(r);
-            break;
-        case FileIoRequest::RELEASE_READ_BLOCK:
-            handleReleaseReadBlockRequest(r);
-            break;
-        case FileIoRequest::ALLOCATE_WRITE_BLOCK:
-            handleAllocateWriteBlockRequest(r);
-            break;
-        case FileIoRequest::COMMIT_MODIFIED_WRITE_BLOCK:
-            handleCommitModifiedWriteBlockRequest(r);
-            break;
-        case FileIoRequest::RELEASE_UNMODIFIED_WRITE_BLOCK:
-            handleReleaseUnmodifiedWriteBlockRequest(r);
-            break;
-        case FileIoRequest::CLEANUP_RESULT_QUEUE:
-            handleCleanupResultQueueRequest(r);
-            break;
+    FileRecord *fileRecord = static_cast<FileRecord*>(context);
+#if defined(WIN32)
+    OVERLAPPED overlapped;
+    std::memset(&overlapped, 0, sizeof(overlapped));
+    overlapped.Offset = (DWORD)(position & 0xFFFFFFFF);
+    overlapped.OffsetHigh = (DWORD)(position >> 32);
+    DWORD bytesRead = 0;
+    if (!ReadFile(fileRecord->handle, dest, (DWORD)sizeBytes, &bytesRead, &overlapped) && GetLastError() != ERROR_HANDLE_EOF)
+        return -1;
+    return (int)bytesRead;
+#else
+    ssize_t bytesRead = pread(fileRecord->fd, dest, sizeBytes, (off_t)position);
+    return (bytesRead < 0) ? -1 : (int)bytesRead;
+#endif
+}
+
+// Read modes. Returns an errno value.
+static int readAudioFileHeader( FileRecord *fileRecord, FileIoAudioFormat *format )
+{
+    FileIoPosition fileSizeBytes = 0;
+    if (!getFileSizeBytes(fileRecord, &fileSizeBytes))
+        return EIO;
+
+    int result = parseAudioFileHeader(readFileRecordBytes, fileRecord, fileSizeBytes, format);
+    if (result == NOERROR && format->containerType == CONTAINER_TYPE_FLAC) {
+        fileRecord->decoder = new (std::nothrow) FlacDecoder(readFileRecordBytes, fileRecord);
+        result = (fileRecord->decoder) ? fileRecord->decoder->open(fileSizeBytes, format) : ENOMEM;
+        if (result != NOERROR) {
+            delete fileRecord->decoder;
+            fileRecord->decoder = 0;
         }
     }
+    if (result == NOERROR && format->containerType != CONTAINER_TYPE_NONE)
+        fileRecord->dataEndPosition = format->dataOffsetBytes + format->dataSizeBytes;
+    return result;
 }
 
+// Write modes. Writes the header for a recording of unknown size. Returns an errno value.
+static int writeWaveFileHeader( FileIoServerWorker *worker, FileRecord *fileRecord, FileIoAudioFormat *format )
+{
+    if (!canWriteWaveFileHeader(*format))
+        return EINVAL;
+
+    // Pad the header so that the sample data, and so every block, is sector aligned
+    std::size_t headerSizeBytes = waveFileHeaderSizeBytes((fileRecord->isDirect) ? IO_DIRECT_IO_ALIGNMENT_BYTES : 1);
+
+    DataBlock *headerBlock = allocDataBlock(worker, 0); // (page aligned, for unbuffered I/O)
+    if (!headerBlock)
+        return ENOMEM;
+    assert( headerSizeBytes <= headerBlock->capacityBytes );
+
+    buildWaveFileHeader(headerBlock->data, headerSizeBytes, *format, IO_UNKNOWN_DATA_SIZE);
+    headerBlock->validCountBytes = headerSizeBytes;
+    writeBlockSynchronously(fileRecord, 0, headerBlock);
+
+    format->dataOffsetBytes = headerSizeBytes;
+    format->dataSizeBytes = IO_UNKNOWN_DATA_SIZE;
+    fileRecord->headerBlock = headerBlock;
+    fileRecord->headerFormat = *format;
+    return NOERROR;
+}
 
-#ifdef WIN32
-static unsigned int __stdcall serverThreadProc( void * )
+// Called when the file is closed: rewrite the header with the size of the data that was written.
+static void finalizeWaveFileHeader( FileRecord *fileRecord )
 {
+    FileIoPosition fileSizeBytes = fileRecord->directFileSizeBytes; // (the file is still padded)
+    if (!fileRecord->isDirect && !getFileSizeBytes(fileRecord, &fileSizeBytes))
+        fileSizeBytes = 0; // (silently ignore errors, as for writes)
+
+    DataBlock *headerBlock = fileRecord->headerBlock;
+    std::size_t headerSizeBytes = headerBlock->validCountBytes;
+    FileIoPosition dataSizeBytes = (fileSizeBytes > headerSizeBytes) ? fileSizeBytes - headerSizeBytes : 0;
+    if (fileSizeBytes != 0) {
+        buildWaveFileHeader(headerBlock->data, headerSizeBytes, fileRecord->headerFormat, dataSizeBytes);
+        writeBlockSynchronously(fileRecord, 0, headerBlock);
+    }
+
+    freeDataBlock(&workers_[fileRecord->workerIndex], headerBlock);
+    fileRecord->headerBlock = 0;
+}
+
+static int openAudioFile( FileIoServerWorker *worker, FileRecord *fileRecord, FileIoRequest *r ) // returns an errno value
+{
+    FileIoAudioFormat *format = &r->openFile.format;
+    switch (r->openFile.openMode) {
+    case FileIoRequest::READ_ONLY_OPEN_MODE:
+    case FileIoRequest::READ_ONLY_MAPPED_OPEN_MODE:
+        return readAudioFileHeader(fileRecord, format);
+
+    case FileIoRequest::READ_WRITE_OVERWRITE_OPEN_MODE:
+    case FileIoRequest::READ_WRITE_OVERWRITE_DIRECT_OPEN_MODE:
+        if (format->containerType == CONTAINER_TYPE_NONE) {
+            initHeaderlessAudioFormat(format);
+            return NOERROR;
+        }
+        return writeWaveFileHeader(worker, fileRecord, format); // (only WAV files can be written)
+    }
+
+    return NOERROR;
+}
+
+// A cache that doesn't retain blocks only saves reads when two streams hold the same block, 
+// which needs two streams with the same file open. Until then the file's blocks come straight 
+// from the pools, without the cache's lookups.
+static void linkCacheFileRecord( FileIoServerWorker *worker, FileRecord *fileRecord )
+{
+    fileRecord->usesBlockCache = (worker->blockCache->capacityBytes() > 0);
+    for (FileRecord *other = worker->cacheFileRecords; other; other = other->cacheFileNext) {
+        if (other->dataBlockSizeClass == fileRecord->dataBlockSizeClass && isSameCacheFile(other->cacheFileId, fileRecord->cacheFileId)) {
+            other->usesBlockCache = true; // (blocks that it already holds are freed to the pools, see freeReadDataBlock())
+            fileRecord->usesBlockCache = true;
+        }
+    }
+
+    fileRecord->cacheFilePrev = 0;
+    fileRecord->cacheFileNext = worker->cacheFileRecords;
+    if (worker->cacheFileRecords)
+        worker->cacheFileRecords->cacheFilePrev = fileRecord;
+    worker->cacheFileRecords = fileRecord;
+}
+
+static void unlinkCacheFileRecord( FileIoServerWorker *worker, FileRecord *fileRecord )
+{
+    if (fileRecord->cacheFilePrev)
+        fileRecord->cacheFilePrev->cacheFileNext = fileRecord->cacheFileNext;
+    else
+        worker->cacheFileRecords = fileRecord->cacheFileNext;
+
+    if (fileRecord->cacheFileNext)
+        fileRecord->cacheFileNext->cacheFilePrev = fileRecord->cacheFilePrev;
+}
+
+static void handleOpenFileRequest( FileIoServerWorker *worker, FileIoRequest *r )
+{
+    assert( r->requestType == FileIoRequest::OPEN_FILE );
+
+    FileRecord *fileRecord = new FileRecord;
+    if (fileRecord) {
+        int openResult = openFileRecord(fileRecord, r->openFile.path->data, r->openFile.openMode);
+        if (openResult == NOERROR) {
+            fileRecord->workerIndex = worker->index;
+            openResult = openAudioFile(worker, fileRecord, r);
+            if (openResult != NOERROR)
+                closeFileDescriptor(fileRecord);
+        }
+        if (openResult == NOERROR) {
+            fileRecord->dependentClientCount = 1;
+            fileRecord->dataBlockSizeClass = dataBlockSizeClassForCapacity(r->openFile.blockSizeBytes);
+            fileRecord->mappedData = 0;
+            fileRecord->mappedSizeBytes = 0;
+            if (r->openFile.openMode == FileIoRequest::READ_ONLY_MAPPED_OPEN_MODE && !fileRecord->decoder) {
+                if (mapFile(fileRecord)) // (if mapping fails the file is read normally)
+                    adviseMappedFileReadahead(fileRecord, 0, dataBlockCapacityForSizeClass(fileRecord->dataBlockSizeClass));
+            }
+            fileRecord->hasCacheFileId = (r->openFile.openMode == FileIoRequest::READ_ONLY_OPEN_MODE 
+                    && getCacheFileId(fileRecord, &fileRecord->cacheFileId));
+            fileRecord->usesBlockCache = false;
+            if (fileRecord->hasCacheFileId)
+                linkCacheFileRecord(worker, fileRecord);
+#if defined(IO_USE_IO_URING)
+            fileRecord->inFlightWriteCount = 0;
+            fileRecord->inFlightWriteBegin = 0;
+            fileRecord->inFlightWriteEnd = 0;
+#endif
+            r->openFile.fileHandle = fileRecord;
+            r->resultStatus = NOERROR;
+        } else {
+            delete fileRecord;
+            r->openFile.fileHandle = 0;
+            r->resultStatus = openResult;
+        }
+    } else {
+        r->openFile.fileHandle = 0;
+        r->resultStatus = ENOMEM;
+    }
+    
+    completeRequestToClientResultQueue(worker, r->openFile.resultQueue, r);
+}
+
+static void releaseFileRecordClientRef( FileRecord *fileRecord )
+{
+    if (--fileRecord->dependentClientCount == 0) {
+        if (fileRecord->headerBlock)
+            finalizeWaveFileHeader(fileRecord);
+        if (fileRecord->mappedData)
+            unmapFile(fileRecord);
+        if (fileRecord->hasCacheFileId)
+            unlinkCacheFileRecord(&workers_[fileRecord->workerIndex], fileRecord);
+        delete fileRecord->decoder;
+        closeFileDescriptor(fileRecord);
+        delete fileRecord;
+    }
+}
+
+static void handleCloseFileRequest( FileIoServerWorker *worker, FileIoRequest *r )
+{
+    assert( r->requestType == FileIoRequest::CLOSE_FILE );
+
+    releaseFileRecordClientRef( static_cast<FileRecord*>(r->closeFile.fileHandle) );
+    freeServerRequest(worker, r);
+}
+
+#if defined(IO_USE_IO_URING)
+static void handleIoUringCompletion( FileIoServerWorker *worker, FileIoRequest *r, int ioResult ); // forward reference
+
+static void processIoUringCompletions( FileIoServerWorker *worker )
+{
+    void *userData;
+    int ioResult;
+    while (worker->ioUring->popCompletion(&userData, &ioResult))
+        handleIoUringCompletion(worker, static_cast<FileIoRequest*>(userData), ioResult);
+}
+
+static void waitForIoUringCompletions( FileIoServerWorker *worker )
+{
+    worker->ioUring->waitForCompletion();
+    processIoUringCompletions(worker);
+}
+
+// Make room in the ring for another operation: submit the prepared operations if the submission 
+// queue is full, otherwise wait for completions (they're processed while waiting). Returns false 
+// if there's still no room because the prepared operations couldn't be submitted.
+static bool reserveIoUringSubmission( FileIoServerWorker *worker )
+{
+    while (!worker->ioUring->canPrepare()) {
+        if (worker->ioUring->isSubmissionQueueFull()) {
+            worker->ioUring->submit();
+            if (worker->ioUring->isSubmissionQueueFull())
+                return false;
+        } else {
+            waitForIoUringCompletions(worker);
+        }
+    }
+
+    return true;
+}
+
+// Writes are issued asynchronously, so a subsequent request could overtake an overlapping 
+// write that is still in flight. Block until all in-flight writes to the file have completed 
+// if [begin, end) overlaps any of them. Non-overlapping requests (e.g. sequential commits and 
+// allocations from a recording stream) are never serialized.
+static void waitForOverlappingInFlightWrites( FileIoServerWorker *worker, FileRecord *fileRecord, FileIoPosition begin, FileIoPosition end )
+{
+    if (fileRecord->inFlightWriteCount > 0 
+            && begin < fileRecord->inFlightWriteEnd && fileRecord->inFlightWriteBegin < end) {
+        while (fileRecord->inFlightWriteCount > 0)
+            waitForIoUringCompletions(worker);
+    }
+}
+#endif /* IO_USE_IO_URING */
+
+// Read consecutive blocks starting at filePosition. (see startReadBlockRun())
+// Stores the per-block result of readBlockSynchronously() in ioResults.
+static void readBlocksSynchronously( FileRecord *fileRecord, FileIoPosition filePosition, DataBlock **dataBlocks, std::size_t blockCount, int *ioResults )
+{
+#if defined(IO_USE_PREADV)
+    struct iovec iov[IO_MAX_COALESCED_READ_BLOCK_COUNT];
+    for (std::size_t i=0; i < blockCount; ++i) {
+        iov[i].iov_base = dataBlocks[i]->data;
+        iov[i].iov_len = dataBlocks[i]->capacityBytes;
+    }
+
+    ssize_t bytesRead = preadv(fileRecord->fd, iov, (int)blockCount, (off_t)filePosition);
+    if (bytesRead < 0) {
+        int error = (errno==NOERROR) ? EIO : errno;
+        for (std::size_t i=0; i < blockCount; ++i)
+            ioResults[i] = -error;
+        return;
+    }
+
+    // A short read ends at EOF. Blocks after the end of the data are returned empty.
+    std::size_t remainingBytes = (std::size_t)bytesRead;
+    for (std::size_t i=0; i < blockCount; ++i) {
+        std::size_t blockBytes = std::min(remainingBytes, dataBlocks[i]->capacityBytes);
+        ioResults[i] = (int)blockBytes;
+        remainingBytes -= blockBytes;
+    }
+#else
+    for (std::size_t i=0; i < blockCount; ++i) {
+        ioResults[i] = readBlockSynchronously(fileRecord, filePosition, dataBlocks[i]);
+        filePosition += dataBlocks[i]->capacityBytes;
+    }
+#endif
+}
+
+static int readExistingWriteBlockDataSynchronously( FileRecord *fileRecord, FileIoPosition filePosition, DataBlock *dataBlock )
+{
+    // irrespective of how many bytes are read (including none, if the read fails), the block is returned to the client
+    return std::max(readBlockSynchronously(fileRecord, filePosition, dataBlock), 0);
+}
+
+// Write the blocks of a run of commits to consecutive file positions. (see writeCommitRun())
+static void writeBlocksSynchronously( FileRecord *fileRecord, FileIoRequest **commits, std::size_t commitCount )
+{
+#if defined(IO_USE_PWRITEV)
+    struct iovec iov[IO_MAX_COALESCED_WRITE_BLOCK_COUNT];
+    for (std::size_t i=0; i < commitCount; ++i) {
+        DataBlock *dataBlock = commits[i]->commitModifiedWriteBlock.dataBlock;
+        iov[i].iov_base = dataBlock->data;
+        iov[i].iov_len = writeSizeForBlock(fileRecord, commits[i]->commitModifiedWriteBlock.filePosition, dataBlock);
+    }
+
+    if (pwritev(fileRecord->fd, iov, (int)commitCount, (off_t)commits[0]->commitModifiedWriteBlock.filePosition) < 0) {
+        // silently fail
+    }
+#else
+    for (std::size_t i=0; i < commitCount; ++i)
+        writeBlockSynchronously(fileRecord, commits[i]->commitModifiedWriteBlock.filePosition, commits[i]->commitModifiedWriteBlock.dataBlock);
+#endif
+}
+
+// Read blocks come from one of three places: the block cache (read-only files), headers that 
+// point into the mapping (mapped files, see handleMappedReadBlockRequest()), or the data block pools.
+
+static uint64_t cacheBlockIndex( FileRecord *fileRecord, FileIoPosition filePosition )
+{
+    return filePosition / dataBlockCapacityForSizeClass(fileRecord->dataBlockSizeClass); // (block requests are block-size aligned)
+}
+
+static bool isCachedReadBlock( FileIoServerWorker *worker, FileRecord *fileRecord, FileIoPosition filePosition )
+{
+    return (fileRecord->usesBlockCache 
+            && worker->blockCache->contains(fileRecord->cacheFileId, fileRecord->dataBlockSizeClass, cacheBlockIndex(fileRecord, filePosition)));
+}
+
+static DataBlock *allocReadDataBlock( FileIoServerWorker *worker, FileRecord *fileRecord, FileIoPosition filePosition )
+{
+    if (fileRecord->usesBlockCache)
+        return worker->blockCache->allocate(fileRecord->cacheFileId, fileRecord->dataBlockSizeClass, cacheBlockIndex(fileRecord, filePosition));
+
+    return allocDataBlock(worker, fileRecord->dataBlockSizeClass);
+}
+
+static void freeReadDataBlock( FileIoServerWorker *worker, FileRecord *fileRecord, DataBlock *dataBlock )
+{
+    if (fileRecord->mappedData)
+        freeMappedDataBlock(worker, dataBlock); // unpin. the mapping stays until the file is closed
+    else if (worker->blockCache->owns(dataBlock)) // (not usesBlockCache, which may have been set since the block was allocated)
+        worker->blockCache->release(dataBlock); // unpin. the block may be retained by the cache
+    else
+        freeDataBlock(worker, dataBlock);
+}
+
+// If the requested block is cached, return it to the client (no I/O) and return true.
+static bool completeReadBlockRequestFromCache( FileIoServerWorker *worker, FileRecord *fileRecord, FileIoRequest *r )
+{
+    if (!fileRecord->usesBlockCache)
+        return false;
+
+    DataBlock *dataBlock = worker->blockCache->acquire(fileRecord->cacheFileId, fileRecord->dataBlockSizeClass, cacheBlockIndex(fileRecord, r->readBlock.filePosition));
+    if (!dataBlock)
+        return false;
+
+    // (the block is shared, don't write to it)
+    r->resultStatus = NOERROR;
+    r->readBlock.dataBlock = dataBlock;
+    r->readBlock.isAtEof = (dataBlock->validCountBytes < dataBlock->capacityBytes);
+    completeRequestToClientResultQueue(worker, r->readBlock.resultQueue, r);
+    return true;
+}
+
+// Block requests are handled in two phases: handle*() validates the request, allocates the block
+// and starts the I/O; complete*() is called with the I/O result. With the synchronous engine
+// complete*() is called immediately. With the io_uring engine it is called when the completion arrives.
+//
+// From the time that a READ_BLOCK or ALLOCATE_WRITE_BLOCK is queued (see enqueueBlockRequest()) 
+// until it completes, the request holds a reference to the file record. If the request succeeds 
+// the reference is transferred to the returned block. Otherwise it is released.
+
+static void completeReadBlockRequest( FileIoServerWorker *worker, FileIoRequest *r, DataBlock *dataBlock, int ioResult )
+{
+    FileRecord *fileRecord = static_cast<FileRecord*>(r->readBlock.fileHandle);
+    ioResult = clampReadResult( fileRecord, r->readBlock.filePosition, ioResult );
+
+    if (ioResult >= 0) {
+        dataBlock->validCountBytes = ioResult;
+        if (worker->blockCache->owns(dataBlock))
+            worker->blockCache->insert(dataBlock); // share the block with other streams
+
+        // A partial block is only returned at EOF.
+        // Note: this may return a block with zero valid bytes. Could maybe optimise this away.
+        r->resultStatus = NOERROR;
+        r->readBlock.dataBlock = dataBlock; // return the block
+        r->readBlock.isAtEof = (dataBlock->validCountBytes < dataBlock->capacityBytes);
+    } else {
+        r->resultStatus = -ioResult;
+        r->readBlock.dataBlock = 0;
+        r->readBlock.isAtEof = false;
+        freeReadDataBlock(worker, fileRecord, dataBlock);
+        releaseFileRecordClientRef(fileRecord);
+    }
+
+    completeRequestToClientResultQueue(worker, r->readBlock.resultQueue, r);
+}
+
+// READ_BLOCK for a mapped file: return a block that points into the mapping. 
+static void handleMappedReadBlockRequest( FileIoServerWorker *worker, FileRecord *fileRecord, FileIoRequest *r )
+{
+    DataBlock *dataBlock = allocMappedDataBlock(worker);
+    if (!dataBlock) {
+        r->resultStatus = ENOMEM;
+        r->readBlock.dataBlock = 0;
+        r->readBlock.isAtEof = false;
+        releaseFileRecordClientRef(fileRecord);
+        completeRequestToClientResultQueue(worker, r->readBlock.resultQueue, r);
+        return;
+    }
+
+    std::size_t capacityBytes = dataBlockCapacityForSizeClass(fileRecord->dataBlockSizeClass);
+    std::size_t filePosition = (std::size_t)std::min<FileIoPosition>(r->readBlock.filePosition, fileRecord->mappedSizeBytes);
+    std::size_t validCountBytes = std::min(capacityBytes, fileRecord->mappedSizeBytes - filePosition);
+
+    dataBlock->capacityBytes = capacityBytes;
+    dataBlock->data = const_cast<int8_t*>(fileRecord->mappedData + filePosition); // read streams never write to block data
+
+    touchMappedPages(fileRecord->mappedData + filePosition, validCountBytes);
+
+    // The prefetch queue will request the next block soon. Start reading it now.
+    adviseMappedFileReadahead(fileRecord, filePosition + capacityBytes, filePosition + 2*capacityBytes);
+
+    completeReadBlockRequest(worker, r, dataBlock, (int)validCountBytes);
+}
+
+static void handleReadBlockRequest( FileIoServerWorker *worker, FileIoRequest *r )
+{
+    assert( r->requestType == FileIoRequest::READ_BLOCK );
+    // Allocate the block, perform the read, return the block to the client.
+    // (The file record dependent count was incremented when the request was queued)
+
+    FileRecord *fileRecord = static_cast<FileRecord*>(r->readBlock.fileHandle);
+    if (!fileRecord) {
+        r->resultStatus = EBADF;
+        r->readBlock.dataBlock = 0;
+        r->readBlock.isAtEof = false;
+        completeRequestToClientResultQueue(worker, r->readBlock.resultQueue, r);
+        return;
+    }
+
+    if (fileRecord->mappedData) {
+        handleMappedReadBlockRequest(worker, fileRecord, r);
+        return;
+    }
+
+    if (completeReadBlockRequestFromCache(worker, fileRecord, r))
+        return;
+
+    DataBlock *dataBlock = allocReadDataBlock(worker, fileRecord, r->readBlock.filePosition);
+    if (!dataBlock) {
+        // the data block pool is exhausted (see DataBlockPoolExhaustedPolicy)
+        r->resultStatus = ENOMEM;
+        r->readBlock.dataBlock = 0;
+        r->readBlock.isAtEof = false;
+        releaseFileRecordClientRef(fileRecord);
+        completeRequestToClientResultQueue(worker, r->readBlock.resultQueue, r);
+        return;
+    }
+
+    if (fileRecord->decoder) { // (with either engine, decoding is synchronous)
+        uint64_t decodeBeginTime = getFileIoServerTimeMicroseconds();
+        int ioResult = fileRecord->decoder->decode(r->readBlock.filePosition, dataBlock->data, dataBlock->capacityBytes);
+        worker->readCallDuration.record(getFileIoServerTimeMicroseconds() - decodeBeginTime);
+
+        completeReadBlockRequest(worker, r, dataBlock, ioResult);
+        return;
+    }
+
+#if defined(IO_USE_IO_URING)
+    if (worker->ioUring) {
+        waitForOverlappingInFlightWrites(worker, fileRecord, r->readBlock.filePosition, r->readBlock.filePosition + dataBlock->capacityBytes);
+
+        r->readBlock.dataBlock = dataBlock; // retained here until the read completes
+        if (!reserveIoUringSubmission(worker)
+                || !worker->ioUring->prepareRead(fileRecord->fd, dataBlock->data, (unsigned)dataBlock->capacityBytes, r->readBlock.filePosition, r))
+            completeReadBlockRequest(worker, r, dataBlock, -EIO); // (frees the block and the file reference)
+        return;
+    }
+#endif
+
+    uint64_t callBeginTime = getFileIoServerTimeMicroseconds();
+    int ioResult = readBlockSynchronously(fileRecord, r->readBlock.filePosition, dataBlock);
+    worker->readCallDuration.record(getFileIoServerTimeMicroseconds() - callBeginTime);
+
+    completeReadBlockRequest(worker, r, dataBlock, ioResult);
+}
+
+static void handleReleaseReadBlockRequest( FileIoServerWorker *worker, FileIoRequest *r )
+{
+    assert( r->requestType == FileIoRequest::RELEASE_READ_BLOCK );
+    // Free the data block, decrement file record dependent client count
+
+    assert( r->releaseReadBlock.dataBlock != 0 );
+    FileRecord *fileRecord = static_cast<FileRecord*>(r->releaseReadBlock.fileHandle);
+    freeReadDataBlock(worker, fileRecord, r->releaseReadBlock.dataBlock);
+    releaseFileRecordClientRef(fileRecord);
+    freeServerRequest(worker, r);
+}
+
+static void completeAllocateWriteBlockRequest( FileIoServerWorker *worker, FileIoRequest *r, DataBlock *dataBlock, int ioResult )
+{
+    ioResult = clampReadResult( static_cast<FileRecord*>(r->allocateWriteBlock.fileHandle), r->allocateWriteBlock.filePosition, ioResult );
+
+    if (ioResult >= 0) {
+        dataBlock->validCountBytes = ioResult;
+
+        r->resultStatus = NOERROR;
+        r->allocateWriteBlock.dataBlock = dataBlock; // return the block
+    } else {
+        r->resultStatus = -ioResult;
+        r->allocateWriteBlock.dataBlock = 0;
+        freeDataBlock(worker, dataBlock);
+        releaseFileRecordClientRef( static_cast<FileRecord*>(r->allocateWriteBlock.fileHandle) );
+    }
+
+    completeRequestToClientResultQueue(worker, r->allocateWriteBlock.resultQueue, r);
+}
+
+static void handleAllocateWriteBlockRequest( FileIoServerWorker *worker, FileIoRequest *r )
+{
+    assert( r->requestType == FileIoRequest::ALLOCATE_WRITE_BLOCK );
+    // Allocate the block, read existing data (if any), return the block to the client.
+    // (The file record dependent count was incremented when the request was queued)
+    
+    FileRecord *fileRecord = static_cast<FileRecord*>(r->allocateWriteBlock.fileHandle);
+    if (!fileRecord) {
+        r->resultStatus = EBADF;
+        r->allocateWriteBlock.dataBlock = 0;
+        completeRequestToClientResultQueue(worker, r->allocateWriteBlock.resultQueue, r);
+        return;
+    }
+
+    DataBlock *dataBlock = allocDataBlock(worker, fileRecord->dataBlockSizeClass);
+    if (!dataBlock) {
+        // the data block pool is exhausted (see DataBlockPoolExhaustedPolicy)
+        r->resultStatus = ENOMEM;
+        r->allocateWriteBlock.dataBlock = 0;
+        releaseFileRecordClientRef(fileRecord);
+        completeRequestToClientResultQueue(worker, r->allocateWriteBlock.resultQueue, r);
+        return;
+    }
+
+#if defined(IO_USE_IO_URING)
+    if (worker->ioUring) {
+        waitForOverlappingInFlightWrites(worker, fileRecord, r->allocateWriteBlock.filePosition, r->allocateWriteBlock.filePosition + dataBlock->capacityBytes);
+
+        r->allocateWriteBlock.dataBlock = dataBlock; // retained here until the read completes
+        if (!reserveIoUringSubmission(worker)
+                || !worker->ioUring->prepareRead(fileRecord->fd, dataBlock->data, (unsigned)dataBlock->capacityBytes, r->allocateWriteBlock.filePosition, r))
+            completeAllocateWriteBlockRequest(worker, r, dataBlock, -EIO); // (frees the block and the file reference)
+        return;
+    }
+#endif
+
+    uint64_t callBeginTime = getFileIoServerTimeMicroseconds();
+    int ioResult = readExistingWriteBlockDataSynchronously(fileRecord, r->allocateWriteBlock.filePosition, dataBlock);
+    worker->readCallDuration.record(getFileIoServerTimeMicroseconds() - callBeginTime);
+
+    completeAllocateWriteBlockRequest(worker, r, dataBlock, ioResult);
+}
+
+static void completeCommitModifiedWriteBlockRequest( FileIoServerWorker *worker, FileIoRequest *r )
+{
+    recordRequestLatency(worker, r);
+    freeDataBlock(worker, r->commitModifiedWriteBlock.dataBlock);
+    releaseFileRecordClientRef( static_cast<FileRecord*>(r->commitModifiedWriteBlock.fileHandle) );
+    freeServerRequest(worker, r);
+}
+
+#if defined(IO_USE_IO_URING)
+static void startIoUringWrite( FileIoServerWorker *worker, FileRecord *fileRecord, FileIoRequest *r )
+{
+    DataBlock *dataBlock = r->commitModifiedWriteBlock.dataBlock;
+
+    FileIoPosition begin = r->commitModifiedWriteBlock.filePosition;
+    FileIoPosition end = begin + dataBlock->validCountBytes;
+    waitForOverlappingInFlightWrites(worker, fileRecord, begin, begin + dataBlock->capacityBytes); // (covers any padding)
+
+    std::size_t writeSizeBytes = writeSizeForBlock(fileRecord, begin, dataBlock);
+    end = begin + writeSizeBytes;
+
+    // (errors and short writes are silently ignored, as in the synchronous case)
+    if (!reserveIoUringSubmission(worker)
+            || !worker->ioUring->prepareWrite(fileRecord->fd, dataBlock->data, (unsigned)writeSizeBytes, begin, r)) {
+        completeCommitModifiedWriteBlockRequest(worker, r); // (frees the block and the file reference)
+        return;
+    }
+
+    if (fileRecord->inFlightWriteCount++ == 0) {
+        fileRecord->inFlightWriteBegin = begin;
+        fileRecord->inFlightWriteEnd = end;
+    } else {
+        fileRecord->inFlightWriteBegin = std::min(fileRecord->inFlightWriteBegin, begin);
+        fileRecord->inFlightWriteEnd = std::max(fileRecord->inFlightWriteEnd, end);
+    }
+}
+#endif
+
+// Write a run of commits to consecutive positions of one file, free the data blocks, 
+// decrement file record dependent client counts.
+static void writeCommitRun( FileIoServerWorker *worker, FileIoRequest **commits, std::size_t commitCount )
+{
+    FileRecord *fileRecord = static_cast<FileRecord*>(commits[0]->commitModifiedWriteBlock.fileHandle);
+    if (fileRecord) {
+#if defined(IO_USE_IO_URING)
+        if (worker->ioUring) {
+            // One write per block. They're submitted to the kernel together with the rest of the batch.
+            // (a commit that fails to start is completed immediately, but the later commits 
+            // in the run still hold references to fileRecord)
+            for (std::size_t i=0; i < commitCount; ++i)
+                startIoUringWrite(worker, fileRecord, commits[i]);
+            return;
+        }
+#endif
+
+        uint64_t callBeginTime = getFileIoServerTimeMicroseconds();
+        writeBlocksSynchronously(fileRecord, commits, commitCount);
+        worker->writeCallDuration.record(getFileIoServerTimeMicroseconds() - callBeginTime);
+    }
+
+    for (std::size_t i=0; i < commitCount; ++i)
+        completeCommitModifiedWriteBlockRequest(worker, commits[i]); // (may delete fileRecord)
+}
+
+// Write coalescing.
+//
+// COMMIT_MODIFIED_WRITE_BLOCK requests are queued as they arrive, and written by 
+// flushPendingCommits() at the end of a mailbox drain, once the oldest has waited for 
+// commitFlushIntervalMicroseconds. Pending commits are sorted by file and position, and each
+// run of consecutive blocks is written with one call. A READ_BLOCK or ALLOCATE_WRITE_BLOCK 
+// that overlaps a pending commit to the same file flushes the pending commits first.
+
+static bool commitPrecedes( const FileIoRequest *a, const FileIoRequest *b ) // order by file, then position
+{
+    if (a->commitModifiedWriteBlock.fileHandle != b->commitModifiedWriteBlock.fileHandle)
+        return std::less<void*>()(a->commitModifiedWriteBlock.fileHandle, b->commitModifiedWriteBlock.fileHandle);
+    return a->commitModifiedWriteBlock.filePosition < b->commitModifiedWriteBlock.filePosition;
+}
+
+static void sortCommits( FileIoRequest **commits, std::size_t commitCount )
+{
+    // Insertion sort: stable, so a later commit to the same position is still written after an earlier one.
+    // Commits usually arrive in order, making this linear.
+    for (std::size_t i=1; i < commitCount; ++i) {
+        FileIoRequest *r = commits[i];
+        std::size_t j = i;
+        for ( ; j > 0 && commitPrecedes(r, commits[j-1]); --j)
+            commits[j] = commits[j-1];
+        commits[j] = r;
+    }
+}
+
+static std::size_t commitRunLength( FileIoRequest **commits, std::size_t commitCount )
+{
+    std::size_t runLength = 1;
+    while (runLength < commitCount && runLength < IO_MAX_COALESCED_WRITE_BLOCK_COUNT) {
+        const FileIoRequest *previous = commits[runLength-1];
+        const FileIoRequest *next = commits[runLength];
+        if (next->commitModifiedWriteBlock.fileHandle != previous->commitModifiedWriteBlock.fileHandle
+                || next->commitModifiedWriteBlock.filePosition != previous->commitModifiedWriteBlock.filePosition + previous->commitModifiedWriteBlock.dataBlock->validCountBytes)
+            break;
+        ++runLength;
+    }
+    return runLength;
+}
+
+static void flushPendingCommits( FileIoServerWorker *worker )
+{
+    FileIoRequest **commits = worker->pendingCommits;
+    std::size_t commitCount = worker->pendingCommitCount;
+    worker->pendingCommitCount = 0;
+
+    sortCommits(commits, commitCount);
+
+    std::size_t i = 0;
+    while (i < commitCount) {
+        std::size_t runLength = commitRunLength(commits + i, commitCount - i);
+        writeCommitRun(worker, commits + i, runLength);
+        i += runLength;
+    }
+}
+
+static void flushPendingCommitsIfOverlapping( FileIoServerWorker *worker, void *fileHandle, FileIoPosition begin, FileIoPosition end )
+{
+    for (std::size_t i=0; i < worker->pendingCommitCount; ++i) {
+        const FileIoRequest *r = worker->pendingCommits[i];
+        FileIoPosition commitBegin = r->commitModifiedWriteBlock.filePosition;
+        FileIoPosition commitEnd = commitBegin + r->commitModifiedWriteBlock.dataBlock->capacityBytes; // (covers any padding)
+        if (r->commitModifiedWriteBlock.fileHandle == fileHandle && commitBegin < end && begin < commitEnd) {
+            flushPendingCommits(worker);
+            return;
+        }
+    }
+}
+
+static uint64_t microsecondsUntilPendingCommitsAreDue( FileIoServerWorker *worker )
+{
+    assert( worker->pendingCommitCount > 0 );
+    uint64_t waitedMicroseconds = getFileIoServerTimeMicroseconds() - worker->oldestPendingCommitTimeMicroseconds;
+    return (waitedMicroseconds >= worker->commitFlushIntervalMicroseconds) ? 0 : worker->commitFlushIntervalMicroseconds - waitedMicroseconds;
+}
+
+static void handleCommitModifiedWriteBlockRequest( FileIoServerWorker *worker, FileIoRequest *r )
+{
+    assert( r->requestType == FileIoRequest::COMMIT_MODIFIED_WRITE_BLOCK );
+    // Queue the commit. It is written by flushPendingCommits()
+
+    if (worker->pendingCommitCount == 0)
+        worker->oldestPendingCommitTimeMicroseconds = getFileIoServerTimeMicroseconds();
+    worker->pendingCommits[worker->pendingCommitCount++] = r;
+}
+
+static void handleReleaseUnmodifiedWriteBlockRequest( FileIoServerWorker *worker, FileIoRequest *r )
+{
+    assert( r->requestType == FileIoRequest::RELEASE_UNMODIFIED_WRITE_BLOCK );
+    // Free the data block, decrement file record dependent client count
+
+    freeDataBlock(worker, r->releaseUnmodifiedWriteBlock.dataBlock);
+    releaseFileRecordClientRef( static_cast<FileRecord*>(r->releaseUnmodifiedWriteBlock.fileHandle) );
+    freeServerRequest(worker, r);
+}
+
+#if defined(IO_USE_IO_URING)
+static void handleIoUringCompletion( FileIoServerWorker *worker, FileIoRequest *r, int ioResult )
+{
+    switch (r->requestType) {
+    case FileIoRequest::READ_BLOCK:
+        completeReadBlockRequest(worker, r, r->readBlock.dataBlock, ioResult);
+        break;
+    case FileIoRequest::ALLOCATE_WRITE_BLOCK:
+        completeAllocateWriteBlockRequest(worker, r, r->allocateWriteBlock.dataBlock, ioResult);
+        break;
+    case FileIoRequest::COMMIT_MODIFIED_WRITE_BLOCK:
+        {
+            FileRecord *fileRecord = static_cast<FileRecord*>(r->commitModifiedWriteBlock.fileHandle);
+            --fileRecord->inFlightWriteCount;
+            completeCommitModifiedWriteBlockRequest(worker, r); // may delete fileRecord
+        }
+        break;
+    default:
+        assert(false); // only block I/O requests are submitted to the ring
+    }
+}
+#endif /* IO_USE_IO_URING */
+
+static void cleanupOneRequestResult( FileIoServerWorker *worker, FileIoRequest *r )
+{
+    switch (r->requestType) // we only need to handle requests that return results here
+    {
+    case FileIoRequest::OPEN_FILE:
+        {
+            // in any case, release the path
+            r->openFile.path->release();
+            r->openFile.path = 0;
+
+            if (r->openFile.fileHandle != 0) { // the open was successful, close the handle
+                // convert the open file request into a close request
+                void *fileHandle = r->openFile.fileHandle;
+
+                r->requestType = FileIoRequest::CLOSE_FILE;
+                r->closeFile.fileHandle = fileHandle;
+                handleCloseFileRequest(worker, r);
+            } else {
+                freeServerRequest(worker, r);
+            }
+        }
+        break;
+
+    case FileIoRequest::READ_BLOCK:
+        {
+            if (r->readBlock.dataBlock) { // the read was successful, release the block
+                // convert the read block request into a release read block request
+                void *fileHandle = r->readBlock.fileHandle;
+                DataBlock *dataBlock = r->readBlock.dataBlock;
+
+                r->requestType = FileIoRequest::RELEASE_READ_BLOCK;
+                r->releaseReadBlock.fileHandle = fileHandle;
+                r->releaseReadBlock.dataBlock = dataBlock;
+                handleReleaseReadBlockRequest(worker, r);
+            } else {
+                freeServerRequest(worker, r);
+            }
+        }
+        break;
+
+    case FileIoRequest::ALLOCATE_WRITE_BLOCK:
+        {
+            if (r->allocateWriteBlock.dataBlock) { // the allocation was successful, release the block
+                // convert the allocate write block request into a release write block request
+                void *fileHandle = r->allocateWriteBlock.fileHandle;
+                DataBlock *dataBlock = r->allocateWriteBlock.dataBlock;
+
+                r->requestType = FileIoRequest::RELEASE_UNMODIFIED_WRITE_BLOCK;
+                r->releaseUnmodifiedWriteBlock.fileHandle = fileHandle;
+                r->releaseUnmodifiedWriteBlock.dataBlock = dataBlock;
+                handleReleaseUnmodifiedWriteBlockRequest(worker, r);
+            } else {
+                freeServerRequest(worker, r);
+            }
+        }
+        break;
+    
+    default:
+        assert(false); // only requests that have results should be encountered
+    }
+}
+
+static void handleCleanupResultQueueRequest( FileIoServerWorker *worker, FileIoRequest *clientResultQueueContainer )
+{
+    // Cleanup any results that are in the queue, either free the queue now, or mark it for cleanup later.
+
+    assert( clientResultQueueContainer->requestType == FileIoRequest::CLEANUP_RESULT_QUEUE );
+
+    if (clientResultQueueContainer->resultQueue.expectedResultCount() > 0)
+    {
+        while (FileIoRequest *r = clientResultQueueContainer->resultQueue.pop())
+        {
+            cleanupOneRequestResult(worker, r);
+        }
+
+        if (clientResultQueueContainer->resultQueue.expectedResultCount() == 0) {
+            freeServerRequest(worker, clientResultQueueContainer);
+        } else {
+            // mark the queue for cleanup. 
+            // cleanup is resumed by completeRequestToClientResultQueue() the next time that a request completes
+            clientResultQueueContainer->requestType = FileIoRequest::RESULT_QUEUE_IS_AWAITING_CLEANUP_;
+        }
+    } else {
+        freeServerRequest(worker, clientResultQueueContainer);
+    }
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Deadline scheduling of block requests
+
+/*
+    Requests that don't perform block I/O are handled as soon as they are popped 
+    from the mailbox. COMMIT_MODIFIED_WRITE_BLOCKs are coalesced (see flushPendingCommits()),
+    but are written before any block request is started in the same drain.
+
+    READ_BLOCK and ALLOCATE_WRITE_BLOCK are queued and started in earliest-deadline-first 
+    order. A stream that is about to underrun is served before one that has plenty 
+    of data buffered. The mailbox is re-drained before each block request is started 
+    (or, with io_uring, before each batch), so newly arrived urgent requests are not 
+    stuck behind a backlog.
+*/
+
+static FileIoDeadline blockRequestDeadline( const FileIoRequest *r )
+{
+    return (r->requestType == FileIoRequest::READ_BLOCK) ? r->readBlock.deadline : r->allocateWriteBlock.deadline;
+}
+
+namespace {
+    struct LaterDeadline { // heap ordering. the heap front is the earliest deadline
+        bool operator()( const FileIoRequest *a, const FileIoRequest *b ) const
+        {
+            return blockRequestDeadline(a) > blockRequestDeadline(b);
+        }
+    };
+} // end anonymous namespace
+
+static void enqueueBlockRequest( FileIoServerWorker *worker, FileIoRequest *r )
+{
+    // Take a reference to the file record while the request is queued. Otherwise a 
+    // CLOSE_FILE that arrives later (and is handled sooner) could delete the record.
+    void *fileHandle = (r->requestType == FileIoRequest::READ_BLOCK) ? r->readBlock.fileHandle : r->allocateWriteBlock.fileHandle;
+    if (FileRecord *fileRecord = static_cast<FileRecord*>(fileHandle))
+        ++fileRecord->dependentClientCount;
+
+    worker->pendingBlockRequests[worker->pendingBlockRequestCount++] = r;
+    std::push_heap(worker->pendingBlockRequests, worker->pendingBlockRequests + worker->pendingBlockRequestCount, LaterDeadline());
+}
+
+static bool canStartBlockRequest( FileIoServerWorker *worker )
+{
+    if (worker->pendingBlockRequestCount == 0)
+        return false;
+
+#if defined(IO_USE_IO_URING)
+    if (worker->ioUring && !worker->ioUring->canPrepare())
+        return false; // the ring is full. the worker is woken when an operation completes.
+#endif
+
+    return true;
+}
+
+// Remove queued READ_BLOCKs that continue first's file position (same file, consecutive 
+// blocks) from the heap, and store them in run after first. Returns the run length.
+static std::size_t takeSequentialReadBlockRequests( FileIoServerWorker *worker, FileIoRequest *first, FileIoRequest **run )
+{
+    FileRecord *fileRecord = static_cast<FileRecord*>(first->readBlock.fileHandle);
+    std::size_t capacityBytes = dataBlockCapacityForSizeClass(fileRecord->dataBlockSizeClass);
+    FileIoPosition firstPosition = first->readBlock.filePosition;
+
+    run[0] = first;
+    for (std::size_t i=1; i < IO_MAX_COALESCED_READ_BLOCK_COUNT; ++i)
+        run[i] = 0;
+
+    // Bucket candidates by block offset from first
+    bool foundAny = false;
+    for (std::size_t i=0; i < worker->pendingBlockRequestCount; ++i) {
+        FileIoRequest *r = worker->pendingBlockRequests[i];
+        if (r->requestType != FileIoRequest::READ_BLOCK || r->readBlock.fileHandle != first->readBlock.fileHandle 
+                || r->readBlock.filePosition <= firstPosition)
+            continue;
+
+        if (isCachedReadBlock(worker, fileRecord, r->readBlock.filePosition))
+            continue; // don't read it again. (the run ends before it)
+
+        FileIoPosition offset = r->readBlock.filePosition - firstPosition;
+        if (offset % capacityBytes != 0)
+            continue;
+
+        std::size_t index = (std::size_t)(offset / capacityBytes);
+        if (index < IO_MAX_COALESCED_READ_BLOCK_COUNT && !run[index]) {
+            run[index] = r;
+            foundAny = true;
+        }
+    }
+
+    if (!foundAny)
+        return 1;
+
+    // The run ends at the first gap. Requests beyond the gap stay queued.
+    std::size_t runLength = 1;
+    while (runLength < IO_MAX_COALESCED_READ_BLOCK_COUNT && run[runLength])
+        ++runLength;
+
+    if (runLength == 1)
+        return 1;
+
+    // Remove the run from the heap. (O(n), but so was the scan above)
+    std::size_t count = 0;
+    for (std::size_t i=0; i < worker->pendingBlockRequestCount; ++i) {
+        FileIoRequest *r = worker->pendingBlockRequests[i];
+        bool isInRun = false;
+        for (std::size_t j=1; j < runLength; ++j) {
+            if (run[j] == r) {
+                isInRun = true;
+                break;
+            }
+        }
+        if (!isInRun)
+            worker->pendingBlockRequests[count++] = r;
+    }
+    assert( count == worker->pendingBlockRequestCount - (runLength - 1) );
+    worker->pendingBlockRequestCount = count;
+    std::make_heap(worker->pendingBlockRequests, worker->pendingBlockRequests + worker->pendingBlockRequestCount, LaterDeadline());
+
+    return runLength;
+}
+
+// Synchronous engine: start the earliest-deadline READ_BLOCK, and read any queued requests 
+// for the following blocks of the same file along with it. Streams usually have several 
+// blocks queued at once (e.g. the initial prefetch after an open or seek), and reading them 
+// together saves a seek (or a system call) per block.
+static void startReadBlockRun( FileIoServerWorker *worker, FileIoRequest *first )
+{
+    FileRecord *fileRecord = static_cast<FileRecord*>(first->readBlock.fileHandle);
+    if (!fileRecord || fileRecord->mappedData || fileRecord->decoder) { // (mapped files don't perform I/O, decoded files are decoded block by block)
+        handleReadBlockRequest(worker, first);
+        return;
+    }
+
+    if (completeReadBlockRequestFromCache(worker, fileRecord, first))
+        return;
+
+    FileIoRequest *run[IO_MAX_COALESCED_READ_BLOCK_COUNT];
+    std::size_t runLength = takeSequentialReadBlockRequests(worker, first, run);
+    std::size_t capacityBytes = dataBlockCapacityForSizeClass(fileRecord->dataBlockSizeClass);
+
+    FileIoPosition begin = first->readBlock.filePosition;
+    flushPendingCommitsIfOverlapping(worker, fileRecord, begin, begin + runLength*capacityBytes);
+
+    if (runLength == 1) {
+        handleReadBlockRequest(worker, first);
+        return;
+    }
+
+    DataBlock *dataBlocks[IO_MAX_COALESCED_READ_BLOCK_COUNT];
+    std::size_t blockCount = 0;
+    while (blockCount < runLength) {
+        dataBlocks[blockCount] = allocReadDataBlock(worker, fileRecord, run[blockCount]->readBlock.filePosition);
+        if (!dataBlocks[blockCount])
+            break; // the pool is exhausted. the remaining requests fail individually below
+        ++blockCount;
+    }
+
+    if (blockCount > 0) {
+        int ioResults[IO_MAX_COALESCED_READ_BLOCK_COUNT];
+        uint64_t callBeginTime = getFileIoServerTimeMicroseconds();
+        readBlocksSynchronously(fileRecord, begin, dataBlocks, blockCount, ioResults);
+        worker->readCallDuration.record(getFileIoServerTimeMicroseconds() - callBeginTime);
+        for (std::size_t i=0; i < blockCount; ++i)
+            completeReadBlockRequest(worker, run[i], dataBlocks[i], ioResults[i]);
+    }
+
+    for (std::size_t i=blockCount; i < runLength; ++i)
+        handleReadBlockRequest(worker, run[i]);
+}
+
+static void startEarliestDeadlineBlockRequest( FileIoServerWorker *worker )
+{
+    std::pop_heap(worker->pendingBlockRequests, worker->pendingBlockRequests + worker->pendingBlockRequestCount, LaterDeadline());
+    FileIoRequest *r = worker->pendingBlockRequests[--worker->pendingBlockRequestCount];
+
+    if (r->requestType == FileIoRequest::READ_BLOCK) {
+#if defined(IO_USE_IO_URING)
+        if (worker->ioUring) {
+            // (no coalescing here: the ring submits all started requests as a single batch)
+            if (FileRecord *fileRecord = static_cast<FileRecord*>(r->readBlock.fileHandle)) {
+                FileIoPosition begin = r->readBlock.filePosition;
+                flushPendingCommitsIfOverlapping(worker, fileRecord, begin, begin + dataBlockCapacityForSizeClass(fileRecord->dataBlockSizeClass));
+            }
+            handleReadBlockRequest(worker, r);
+            return;
+        }
+#endif
+        startReadBlockRun(worker, r);
+    } else {
+        if (FileRecord *fileRecord = static_cast<FileRecord*>(r->allocateWriteBlock.fileHandle)) {
+            FileIoPosition begin = r->allocateWriteBlock.filePosition;
+            flushPendingCommitsIfOverlapping(worker, fileRecord, begin, begin + dataBlockCapacityForSizeClass(fileRecord->dataBlockSizeClass));
+        }
+        handleAllocateWriteBlockRequest(worker, r);
+    }
+}
+
+static void startBlockRequests( FileIoServerWorker *worker )
+{
+#if defined(IO_USE_IO_URING)
+    if (worker->ioUring) {
+        // Start as many as will fit in the ring, they are submitted as a single batch
+        while (canStartBlockRequest(worker))
+            startEarliestDeadlineBlockRequest(worker);
+        return;
+    }
+#endif
+
+    // Synchronous I/O. Only perform one request, so that the mailbox is checked again before the next one.
+    if (canStartBlockRequest(worker))
+        startEarliestDeadlineBlockRequest(worker);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Server thread setup and teardown
+
+mint_atomic32_t shutdownFlag_;
+
+static void handleAllPendingRequests( FileIoServerWorker *worker )
+{
+#if defined(IO_USE_IO_URING)
+    if (worker->ioUring)
+        processIoUringCompletions(worker);
+#endif
+
+    std::size_t receivedCount = 0;
+    while (FileIoRequest *r = worker->mailboxQueue.pop()) {
+        ++receivedCount;
+        switch (r->requestType) {
+        case FileIoRequest::OPEN_FILE:
+            handleOpenFileRequest(worker, r);
+            break;
+        case FileIoRequest::CLOSE_FILE:
+            recordRequestLatency(worker, r); // (handled immediately)
+            handleCloseFileRequest(worker, r);
+            break;
+        case FileIoRequest::READ_BLOCK:
+            enqueueBlockRequest(worker, r);
+            break;
+        case FileIoRequest::RELEASE_READ_BLOCK:
+            recordRequestLatency(worker, r);
+            handleReleaseReadBlockRequest(worker, r);
+            break;
+        case FileIoRequest::ALLOCATE_WRITE_BLOCK:
+            enqueueBlockRequest(worker, r);
+            break;
+        case FileIoRequest::COMMIT_MODIFIED_WRITE_BLOCK:
+            handleCommitModifiedWriteBlockRequest(worker, r);
+            break;
+        case FileIoRequest::RELEASE_UNMODIFIED_WRITE_BLOCK:
+            recordRequestLatency(worker, r);
+            handleReleaseUnmodifiedWriteBlockRequest(worker, r);
+            break;
+        case FileIoRequest::CLEANUP_RESULT_QUEUE:
+            recordRequestLatency(worker, r);
+            handleCleanupResultQueueRequest(worker, r);
+            break;
+        }
+    }
+
+    if (receivedCount > 0) {
+        worker->mailboxDepth.record(receivedCount);
+        SharedBufferAllocator::reclaimMemory(); // (paths released by clients and by the server are freed here, in batches)
+    }
+
+    if (worker->pendingCommitCount > 0 && microsecondsUntilPendingCommitsAreDue(worker) == 0)
+        flushPendingCommits(worker);
+
+    startBlockRequests(worker);
+
+#if defined(IO_USE_IO_URING)
+    // Submit all of the block I/O that was started above as a single batch
+    if (worker->ioUring)
+        worker->ioUring->submit();
+#endif
+
+    returnFreedRequestsToPool(worker);
+}
+
+
+static void signalServerMailbox( FileIoServerWorker *worker )
+{
+#if defined(WIN32)
+    SetEvent(worker->mailboxEvent);
+#elif defined(__APPLE__)
+    semaphore_signal(worker->mailboxSemaphore);
+#else
+    uint64_t one = 1;
+    ssize_t bytesWritten = write(worker->mailboxEventFd, &one, sizeof(one));
+    (void)bytesWritten; // the only possible failure is counter overflow, in which case the worker is awake anyway
+#endif
+}
+
+static void waitServerMailbox( FileIoServerWorker *worker )
+{
+    // note: only wait when the incoming queue is empty
+
+    // If commits are pending, wake up in time to write them
+    bool hasTimeout = (worker->pendingCommitCount > 0);
+    uint64_t timeoutMicroseconds = (hasTimeout) ? microsecondsUntilPendingCommitsAreDue(worker) : 0;
+    if (hasTimeout && timeoutMicroseconds == 0)
+        return;
+
+#if defined(WIN32)
+    DWORD timeoutMilliseconds = (hasTimeout) ? (DWORD)std::min<uint64_t>((timeoutMicroseconds + 999) / 1000, 1000) : 1000;
+    WaitForSingleObject(worker->mailboxEvent, timeoutMilliseconds);
+#elif defined(__APPLE__)
+    if (hasTimeout) {
+        mach_timespec_t timeout;
+        timeout.tv_sec = (unsigned int)(timeoutMicroseconds / 1000000);
+        timeout.tv_nsec = (clock_res_t)((timeoutMicroseconds % 1000000) * 1000);
+        semaphore_timedwait(worker->mailboxSemaphore, timeout);
+    } else {
+        semaphore_wait(worker->mailboxSemaphore);
+    }
+#else
+    if (hasTimeout) {
+        struct pollfd pfd;
+        pfd.fd = worker->mailboxEventFd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        int timeoutMilliseconds = (int)std::min<uint64_t>((timeoutMicroseconds + 999) / 1000, 1000000);
+        if (poll(&pfd, 1, timeoutMilliseconds) <= 0)
+            return; // timed out (or interrupted)
+    }
+
+    uint64_t count;
+    while (read(worker->mailboxEventFd, &count, sizeof(count)) < 0 && errno == EINTR)
+        /* retry if interrupted by a signal */ ;
+#endif
+}
+
+static inline void spinPause()
+{
+#if defined(WIN32)
+    YieldProcessor();
+#elif defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+static bool hasWorkToDo( FileIoServerWorker *worker )
+{
+    if (!worker->mailboxQueue.empty())
+        return true;
+#if defined(IO_USE_IO_URING)
+    if (worker->ioUring && worker->ioUring->hasCompletion())
+        return true; // (completions signal the mailbox eventfd, which we don't read while spinning)
+#endif
+    return false;
+}
+
+// Wait until there is something to do. If spinning is enabled, spin for a while first.
+//
+// The isSleeping handshake (worker: store isSleeping=1, fence, check the mailbox; client: push, 
+// fence, load isSleeping) guarantees that either the worker sees the new request before 
+// it sleeps, or the client sees that the worker is sleeping and signals it. At worst
+// the worker gets an extra signal, which makes its next wait return immediately.
+static void waitForWork( FileIoServerWorker *worker )
+{
+    if (worker->spinMicroseconds == 0) {
+        waitServerMailbox(worker); // (isSleeping is always 1)
+        return;
+    }
+
+    uint64_t spinMicroseconds = worker->spinMicroseconds;
+    if (worker->pendingCommitCount > 0) // don't spin past the time that the commits are due
+        spinMicroseconds = std::min(spinMicroseconds, microsecondsUntilPendingCommitsAreDue(worker));
+    uint64_t spinEndTime = getFileIoServerTimeMicroseconds() + spinMicroseconds;
+    do {
+        for (int i=0; i < 64; ++i) { // (pause between checks, read the clock less often)
+            if (hasWorkToDo(worker))
+                return;
+            spinPause();
+        }
+    } while (getFileIoServerTimeMicroseconds() < spinEndTime);
+
+    mint_store_32_relaxed(&worker->isSleeping, 1);
+    mint_thread_fence_seq_cst();
+    if (!hasWorkToDo(worker))
+        waitServerMailbox(worker);
+    mint_store_32_relaxed(&worker->isSleeping, 0);
+}
+
+
+#if defined(WIN32)
+static unsigned int __stdcall serverThreadProc( void *arg )
+{
+    FileIoServerWorker *worker = static_cast<FileIoServerWorker*>(arg);
+
     while (mint_load_32_relaxed(&shutdownFlag_) == 0) {
-        WaitForSingleObject(serverMailboxEvent_, 1000); // note: only wait when the incoming queue is empty
-        handleAllPendingRequests();
+        if (!canStartBlockRequest(worker))
+            waitForWork(worker);
+        handleAllPendingRequests(worker);
     }
 
+    flushPendingCommits(worker);
+    returnFreedRequestsToPool(worker);
+
     return 0;
 }
 #else
-static void* serverThreadProc( void * )
+static void* serverThreadProc( void *arg )
 {
+    FileIoServerWorker *worker = static_cast<FileIoServerWorker*>(arg);
+
     while (mint_load_32_relaxed(&shutdownFlag_) == 0) {
-        semaphore_wait(serverMailboxSemaphore_); // note: only wait when the incoming queue is empty
-        handleAllPendingRequests();
+        if (!canStartBlockRequest(worker))
+            waitForWork(worker); // (with io_uring, the mailbox event is also signaled when I/O completes)
+        handleAllPendingRequests(worker);
+    }
+
+    flushPendingCommits(worker);
+
+#if defined(IO_USE_IO_URING)
+    // Don't let the ring or the data blocks go away while I/O is in progress
+    if (worker->ioUring) {
+        while (worker->ioUring->inFlightCount() > 0)
+            waitForIoUringCompletions(worker);
     }
+#endif
+
+    returnFreedRequestsToPool(worker);
     
     return 0;
 }
+
+static void createServerThread( FileIoServerWorker *worker, const FileIoServerConfig& config )
+{
+    if (config.serverThreadSchedulingClass != FILE_IO_SERVER_THREAD_SCHED_NORMAL) {
+        int policy = (config.serverThreadSchedulingClass == FILE_IO_SERVER_THREAD_SCHED_REALTIME_RR) ? SCHED_RR : SCHED_FIFO;
+
+        sched_param param;
+        param.sched_priority = config.serverThreadPriority;
+        if (param.sched_priority == 0) // use the default priority: midway between the minimum and maximum realtime priority
+            param.sched_priority = (sched_get_priority_min(policy) + sched_get_priority_max(policy)) / 2;
+        param.sched_priority = std::max(sched_get_priority_min(policy), std::min(param.sched_priority, sched_get_priority_max(policy)));
+
+        pthread_attr_t threadAttrs;
+        pthread_attr_init(&threadAttrs);
+        pthread_attr_setinheritsched(&threadAttrs, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&threadAttrs, policy);
+        pthread_attr_setschedparam(&threadAttrs, &param);
+
+        int err = pthread_create(&worker->thread, &threadAttrs, serverThreadProc, worker);
+        pthread_attr_destroy(&threadAttrs);
+        if (err == 0)
+            return;
+
+        // Most likely EPERM: the process is not allowed to use realtime scheduling 
+        // (e.g. RLIMIT_RTPRIO is zero on Linux). Fall back to normal scheduling.
+    }
+
+    pthread_attr_t threadAttrs;
+    pthread_attr_init(&threadAttrs);
+    
+    pthread_create(&worker->thread, &threadAttrs, serverThreadProc, worker);
+    pthread_attr_destroy(&threadAttrs);
+}
+#endif
+
+
+static void startServerWorker( FileIoServerWorker *worker, const FileIoServerConfig& config )
+{
+    worker->pendingBlockRequests = new FileIoRequest*[config.fileIoRequestCount];
+    worker->pendingBlockRequestCount = 0;
+    worker->pendingCommits = new FileIoRequest*[config.fileIoRequestCount];
+    worker->pendingCommitCount = 0;
+    worker->oldestPendingCommitTimeMicroseconds = 0;
+    worker->commitFlushIntervalMicroseconds = config.commitFlushIntervalMicroseconds;
+    worker->spinMicroseconds = config.serverSpinMicroseconds;
+    mint_store_32_relaxed(&worker->isSleeping, 1);
+    for (int i=0; i < IO_DATA_BLOCK_SIZE_CLASS_COUNT; ++i)
+        worker->dataBlockPools[i] = new DataBlockPool( config.dataBlockCounts[i], dataBlockCapacityForSizeClass(i), config.dataBlockPoolExhaustedPolicy );
+    // (every pinned block is held by a request, so there are at most fileIoRequestCount pinned blocks)
+    worker->blockCache = new DataBlockCache( worker->dataBlockPools, config.blockCacheCapacityBytes, config.fileIoRequestCount );
+    worker->cacheFileRecords = 0;
+
+#if defined(WIN32)
+    worker->mailboxEvent = CreateEvent( NULL, /*bManualReset=*/FALSE, /*bInitialState=*/FALSE, NULL ); // auto-reset event
+
+    unsigned threadId;
+    worker->threadHandle = (HANDLE)_beginthreadex( NULL, 0, serverThreadProc, worker, 0, &threadId );
+    SetThreadPriority(worker->threadHandle, 
+            (config.serverThreadSchedulingClass == FILE_IO_SERVER_THREAD_SCHED_NORMAL) ? THREAD_PRIORITY_NORMAL : THREAD_PRIORITY_TIME_CRITICAL);
+#elif defined(__APPLE__)
+    semaphore_create(mach_task_self(), &worker->mailboxSemaphore, SYNC_POLICY_FIFO, 0);
+    
+    createServerThread(worker, config);
+#else
+    worker->mailboxEventFd = eventfd(0, EFD_CLOEXEC);
+
+#if defined(IO_USE_IO_URING)
+    worker->ioUring = 0;
+    if (config.ioEngine == FILE_IO_SERVER_IO_ENGINE_IO_URING) {
+        // I/O completions signal the mailbox eventfd, so the worker only ever has one thing to wait on
+        worker->ioUring = new LinuxIoUring;
+        if (!worker->ioUring->init(config.ioUringQueueDepth, worker->mailboxEventFd)) {
+            // io_uring isn't available. Fall back to the synchronous engine.
+            delete worker->ioUring;
+            worker->ioUring = 0;
+        }
+    }
+#endif
+
+    createServerThread(worker, config);
+#endif
+}
+
+
+static void shutDownServerWorker( FileIoServerWorker *worker )
+{
+    // (shutdownFlag_ has already been set)
+
+#if defined(WIN32)
+    SetEvent(worker->mailboxEvent);
+
+    WaitForSingleObject( worker->threadHandle, 2000 );
+    CloseHandle( worker->threadHandle );
+
+    CloseHandle( worker->mailboxEvent );
+#elif defined(__APPLE__)
+    semaphore_signal(worker->mailboxSemaphore);
+    
+    pthread_join(worker->thread, 0);
+    semaphore_destroy(mach_task_self(), worker->mailboxSemaphore);
+#else
+    signalServerMailbox(worker);
+
+    pthread_join(worker->thread, 0);
+
+#if defined(IO_USE_IO_URING)
+    delete worker->ioUring;
+    worker->ioUring = 0;
+#endif
+    close(worker->mailboxEventFd);
+#endif
+
+    delete worker->blockCache; // (returns retained blocks to the pools)
+    worker->blockCache = 0;
+    for (int i=0; i < IO_DATA_BLOCK_SIZE_CLASS_COUNT; ++i) {
+        delete worker->dataBlockPools[i];
+        worker->dataBlockPools[i] = 0;
+    }
+    while (!worker->freeMappedDataBlocks.empty()) {
+        DataBlock *b = worker->freeMappedDataBlocks.front();
+        worker->freeMappedDataBlocks.pop_front();
+        delete b;
+    }
+    delete [] worker->pendingBlockRequests;
+    worker->pendingBlockRequests = 0;
+    delete [] worker->pendingCommits;
+    worker->pendingCommits = 0;
+}
+
+
+#if defined(WIN32)
+static LARGE_INTEGER performanceFrequency_;
+#elif defined(__APPLE__)
+static mach_timebase_info_data_t timebaseInfo_;
+#endif
+
+static void initServerClock()
+{
+#if defined(WIN32)
+    QueryPerformanceFrequency(&performanceFrequency_);
+#elif defined(__APPLE__)
+    mach_timebase_info(&timebaseInfo_);
+#endif
+}
+
+uint64_t getFileIoServerTimeMicroseconds()
+{
+#if defined(WIN32)
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    // split the conversion to avoid overflow
+    uint64_t f = performanceFrequency_.QuadPart;
+    uint64_t c = counter.QuadPart;
+    return (c / f) * 1000000 + ((c % f) * 1000000) / f;
+#elif defined(__APPLE__)
+    return (mach_absolute_time() / 1000) * timebaseInfo_.numer / timebaseInfo_.denom;
+#else
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
 #endif
+}
 
 
 void startFileIoServer( std::size_t fileIoRequestCount )
 {
-    globalRequestPool_ = new QwNodePool<FileIoRequest>( fileIoRequestCount );
+    FileIoServerConfig config;
+    config.fileIoRequestCount = fileIoRequestCount;
+    startFileIoServer( config );
+}
+
+
+void startFileIoServer( const FileIoServerConfig& config )
+{
+    globalRequestPool_ = new PaddedRequestPool( config.fileIoRequestCount );
     
     shutdownFlag_._nonatomic = 0;
 
-#ifdef WIN32
-    serverMailboxEvent_ = CreateEvent( NULL, /*bManualReset=*/FALSE, /*bInitialState=*/FALSE, NULL ); // auto-reset event
+    initServerClock();
 
-    unsigned threadId;
-    serverThreadHandle_ = (HANDLE)_beginthreadex( NULL, 0, serverThreadProc, NULL, 0, &threadId );
-    SetThreadPriority(serverThreadHandle_, THREAD_PRIORITY_TIME_CRITICAL);
+#if defined(WIN32)
+    SYSTEM_INFO systemInfo;
+    GetSystemInfo(&systemInfo);
+    pageSizeBytes_ = systemInfo.dwPageSize;
 #else
-    semaphore_create(mach_task_self(), &serverMailboxSemaphore_, SYNC_POLICY_FIFO, 0);
-    
-    pthread_attr_t threadAttrs;
-    pthread_attr_init(&threadAttrs);
-    
-    pthread_create(&serverThread_, &threadAttrs, serverThreadProc, 0);
+    pageSizeBytes_ = (std::size_t)sysconf(_SC_PAGESIZE);
 #endif
+
+    workerCount_ = std::max(config.workerCount, 1);
+
+    // Copy the volume routing table, the caller's strings only need to live until we return
+    volumeRouteCount_ = 0;
+    volumeRoutes_ = new VolumeRoute[ std::max(config.volumeCount, (std::size_t)1) ];
+    for (std::size_t i=0; i < config.volumeCount; ++i) {
+        const FileIoServerVolume& volume = config.volumes[i];
+        if (!volume.pathPrefix || volume.workerIndex < 0 || volume.workerIndex >= workerCount_)
+            continue; // ignore malformed entries
+
+        VolumeRoute& route = volumeRoutes_[volumeRouteCount_++];
+        route.pathPrefixLength = std::strlen(volume.pathPrefix);
+        route.pathPrefix = new char[route.pathPrefixLength + 1];
+        std::memcpy(route.pathPrefix, volume.pathPrefix, route.pathPrefixLength + 1);
+        route.workerIndex = volume.workerIndex;
+    }
+
+    workers_ = new FileIoServerWorker[workerCount_];
+    for (int i=0; i < workerCount_; ++i) {
+        workers_[i].index = i;
+        startServerWorker(&workers_[i], config);
+    }
 }
 
 
 void shutDownFileIoServer()
 {
     mint_store_32_relaxed(&shutdownFlag_, 1);
-    
-#ifdef WIN32
-    SetEvent(serverMailboxEvent_);
 
-    WaitForSingleObject( serverThreadHandle_, 2000 );
-    CloseHandle( serverThreadHandle_ );
+    for (int i=0; i < workerCount_; ++i)
+        shutDownServerWorker(&workers_[i]);
 
-    CloseHandle( serverMailboxEvent_ );
-#else
-    semaphore_signal(serverMailboxSemaphore_);
-    
-    pthread_join(serverThread_, 0);
-    semaphore_destroy(mach_task_self(), serverMailboxSemaphore_);
-#endif
+    delete [] workers_;
+    workers_ = 0;
+    workerCount_ = 0;
+
+    for (std::size_t i=0; i < volumeRouteCount_; ++i)
+        delete [] volumeRoutes_[i].pathPrefix;
+    delete [] volumeRoutes_;
+    volumeRoutes_ = 0;
+    volumeRouteCount_ = 0;
     
     delete globalRequestPool_;
 }
 
 
+static void accumulateDataBlockPoolStats( int firstSizeClass, int lastSizeClass, DataBlockPoolStats *result )
+{
+    // Sum over all workers. (highWaterMarkBlockCount is the sum of the per-pool high water marks)
+    std::memset(result, 0, sizeof(DataBlockPoolStats));
+    for (int i=0; i < workerCount_; ++i) {
+        for (int j=firstSizeClass; j <= lastSizeClass; ++j) {
+            DataBlockPoolStats poolStats;
+            workers_[i].dataBlockPools[j]->getStats(&poolStats);
+
+            result->capacityBlockCount += poolStats.capacityBlockCount;
+            result->allocatedBlockCount += poolStats.allocatedBlockCount;
+            result->highWaterMarkBlockCount += poolStats.highWaterMarkBlockCount;
+            result->heapFallbackCount += poolStats.heapFallbackCount;
+            result->failedAllocationCount += poolStats.failedAllocationCount;
+        }
+    }
+}
+
+void getFileIoServerDataBlockPoolStats( DataBlockPoolStats *result )
+{
+    accumulateDataBlockPoolStats(0, IO_DATA_BLOCK_SIZE_CLASS_COUNT - 1, result);
+}
+
+void getFileIoServerDataBlockPoolStats( std::size_t blockSizeBytes, DataBlockPoolStats *result )
+{
+    int sizeClass = dataBlockSizeClassForCapacity(blockSizeBytes);
+    accumulateDataBlockPoolStats(sizeClass, sizeClass, result);
+}
+
+
+static void accumulateWorkerStats( FileIoServerWorker *worker, FileIoServerStats *result )
+{
+    for (int i=0; i < IO_STATS_REQUEST_TYPE_COUNT; ++i)
+        worker->requestLatency[i].accumulate(&result->requestLatency[i]);
+    worker->blockDeadlineSlack.accumulate(&result->blockDeadlineSlack);
+    worker->readCallDuration.accumulate(&result->readCallDuration);
+    worker->writeCallDuration.accumulate(&result->writeCallDuration);
+    worker->mailboxDepth.accumulate(&result->mailboxDepth);
+}
+
+static void clearFileIoServerStats( FileIoServerStats *result )
+{
+    for (int i=0; i < IO_STATS_REQUEST_TYPE_COUNT; ++i)
+        clearFileIoHistogram(&result->requestLatency[i]);
+    clearFileIoHistogram(&result->blockDeadlineSlack);
+    clearFileIoHistogram(&result->readCallDuration);
+    clearFileIoHistogram(&result->writeCallDuration);
+    clearFileIoHistogram(&result->mailboxDepth);
+}
+
+void getFileIoServerStats( FileIoServerStats *result )
+{
+    clearFileIoServerStats(result);
+    for (int i=0; i < workerCount_; ++i)
+        accumulateWorkerStats(&workers_[i], result);
+}
+
+void getFileIoServerStats( int workerIndex, FileIoServerStats *result )
+{
+    assert( workerIndex >= 0 && workerIndex < workerCount_ );
+    clearFileIoServerStats(result);
+    accumulateWorkerStats(&workers_[workerIndex], result);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Request routing (called by clients, must be real-time safe)
+
+static int workerIndexForPath( const char *path )
+{
+    // Use the worker of the longest matching volume path prefix
+    int result = -1;
+    std::size_t matchLength = 0;
+    for (std::size_t i=0; i < volumeRouteCount_; ++i) {
+        const VolumeRoute& route = volumeRoutes_[i];
+        if (route.pathPrefixLength >= matchLength && std::strncmp(path, route.pathPrefix, route.pathPrefixLength) == 0) {
+            result = route.workerIndex;
+            matchLength = route.pathPrefixLength;
+        }
+    }
+
+    if (result == -1) {
+        // No matching volume. Spread files over all workers by hashing the path (FNV-1a)
+        unsigned int hash = 2166136261u;
+        for (const char *p = path; *p; ++p)
+            hash = (hash ^ (unsigned char)*p) * 16777619u;
+        result = (int)(hash % (unsigned int)workerCount_);
+    }
+
+    return result;
+}
+
+static int workerIndexForFileHandle( void *fileHandle )
+{
+    // The client received fileHandle in an OPEN_FILE result, so it can see workerIndex. workerIndex is never modified.
+    return static_cast<FileRecord*>(fileHandle)->workerIndex;
+}
+
+static int workerIndexForRequest( FileIoRequest *r )
+{
+    switch (r->requestType) {
+    case FileIoRequest::OPEN_FILE:
+        {
+            if (r->openFile.usesResultQueueWorker)
+                return r->openFile.resultQueue->serverWorkerIndex; // (a sequence stream's next file)
+
+            int workerIndex = workerIndexForPath(r->openFile.path->data);
+
+            // All of the stream's results are posted to this result queue, so its cleanup 
+            // must be handled by the same worker. Remember which worker that is.
+            r->openFile.resultQueue->serverWorkerIndex = workerIndex;
+            return workerIndex;
+        }
+    case FileIoRequest::CLOSE_FILE:
+        return workerIndexForFileHandle(r->closeFile.fileHandle);
+    case FileIoRequest::READ_BLOCK:
+        return r->readBlock.resultQueue->serverWorkerIndex;
+    case FileIoRequest::RELEASE_READ_BLOCK:
+        return workerIndexForFileHandle(r->releaseReadBlock.fileHandle);
+    case FileIoRequest::ALLOCATE_WRITE_BLOCK:
+        return r->allocateWriteBlock.resultQueue->serverWorkerIndex;
+    case FileIoRequest::COMMIT_MODIFIED_WRITE_BLOCK:
+        return workerIndexForFileHandle(r->commitModifiedWriteBlock.fileHandle);
+    case FileIoRequest::RELEASE_UNMODIFIED_WRITE_BLOCK:
+        return workerIndexForFileHandle(r->releaseUnmodifiedWriteBlock.fileHandle);
+    case FileIoRequest::CLEANUP_RESULT_QUEUE:
+        return r->serverWorkerIndex;
+    }
+
+    assert(false); // unknown request type
+    return 0;
+}
+
+
+// call after pushing to an empty mailbox
+static void wakeServerWorker( FileIoServerWorker *worker )
+{
+    mint_thread_fence_seq_cst(); // order the push before the load of isSleeping (see waitForWork())
+    if (mint_load_32_relaxed(&worker->isSleeping))
+        signalServerMailbox(worker);
+}
+
+static void stampIssueTime( FileIoRequest *front )
+{
+    uint64_t now = getFileIoServerTimeMicroseconds(); // (one clock read per send)
+    for (FileIoRequest *r = front; r; r = r->links_[FileIoRequest::TRANSIT_NEXT_LINK_INDEX])
+        r->issueTimeMicroseconds = now;
+}
+
 void sendFileIoRequestToServer( FileIoRequest *r )
 {
+    r->issueTimeMicroseconds = getFileIoServerTimeMicroseconds();
+    FileIoServerWorker *worker = &workers_[ workerIndexForRequest(r) ];
+
     bool wasEmpty=false;
-    serverMailboxQueue_.push(r, wasEmpty);
-    if (wasEmpty) {
-#ifdef WIN32        
-        SetEvent(serverMailboxEvent_);
-#else
-        semaphore_signal(serverMailboxSemaphore_);
-#endif
-    }
+    worker->mailboxQueue.push(r, wasEmpty);
+    if (wasEmpty)
+        wakeServerWorker(worker);
 }
 
 
 void sendFileIoRequestsToServer( FileIoRequest *front, FileIoRequest *back )
 {
+    stampIssueTime(front);
+
+    // All requests in the list are for the same file, route them all with the first one to be processed
+    FileIoServerWorker *worker = &workers_[ workerIndexForRequest(back) ];
+
     bool wasEmpty=false;
-    serverMailboxQueue_.push_multiple(front, back, wasEmpty);
-    if (wasEmpty) {
-#ifdef WIN32
-        SetEvent(serverMailboxEvent_);
-#else
-        semaphore_signal(serverMailboxSemaphore_);
-#endif
+    worker->mailboxQueue.push_multiple(front, back, wasEmpty);
+    if (wasEmpty)
+        wakeServerWorker(worker);
+}
+
+void sendFileIoRequestBatchToServer( FileIoRequest *front, FileIoRequest *back )
+{
+    if (workerCount_ == 1) {
+        sendFileIoRequestsToServer(front, back);
+        return;
+    }
+
+    stampIssueTime(front);
+
+    // Split off the requests for the worker of the front request, preserving their order, and 
+    // post them. Repeat with the remaining requests. O(n) per worker that the batch addresses.
+    while (front) {
+        int workerIndex = workerIndexForRequest(front);
+
+        FileIoRequest *workerFront = 0, *workerBack = 0;
+        FileIoRequest *remainingFront = 0, *remainingBack = 0;
+        for (FileIoRequest *r = front; r; ) {
+            FileIoRequest *next = r->links_[FileIoRequest::TRANSIT_NEXT_LINK_INDEX];
+            r->links_[FileIoRequest::TRANSIT_NEXT_LINK_INDEX] = 0;
+
+            bool isForWorker = (workerIndexForRequest(r) == workerIndex);
+            FileIoRequest *&listFront = (isForWorker) ? workerFront : remainingFront;
+            FileIoRequest *&listBack = (isForWorker) ? workerBack : remainingBack;
+            if (listBack)
+                listBack->links_[FileIoRequest::TRANSIT_NEXT_LINK_INDEX] = r;
+            else
+                listFront = r;
+            listBack = r;
+
+            r = next;
+        }
+
+        FileIoServerWorker *worker = &workers_[workerIndex];
+        bool wasEmpty=false;
+        worker->mailboxQueue.push_multiple(workerFront, workerBack, wasEmpty);
+        if (wasEmpty)
+            wakeServerWorker(worker);
+
+        front = remainingFront;
     }
 }
 
@@ -544,7 +2412,7 @@ void sendFileIoRequestsToServer( FileIoRequest *front, FileIoRequest *back )
 /*
 TODO:
     
-    o- ensure server mailbox is cache-line aligned and that the server-local queue is separated from the global lifo
+    x- ensure server mailbox is cache-line aligned and that the server-local queue is separated from the global lifo
 
 
     x- example read stream routines (all asynchronous O(1) or near to)
@@ -573,10 +2441,9 @@ TODO:
 
 
 
-    // TODO: handle requests at two priority levels: 0 and 1 (0 is higher?)
-    // lower priority requests go onto a secondary FIFO and only get processed after
-    // the higher priority requests. 
-    // always process COMMIT_MODIFIED_WRITE_BLOCK at highest priority to avoid issues
-    // with file length extending writes
+    x- handle requests in priority order. 
+        block requests are ordered by client-supplied deadline (earliest deadline first).
+        always process COMMIT_MODIFIED_WRITE_BLOCK at highest priority to avoid issues
+        with file length extending writes
 
 */
\ No newline at end of file
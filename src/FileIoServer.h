@@ -23,22 +23,151 @@
 #define INCLUDED_FILEIOSERVER_H
 
 #include <cstddef>
+#include <stdint.h>
+
+#include "DataBlockPool.h"
+#include "FileIoRequest.h"
+#include "FileIoStats.h"
 
 #define MAX_FILE_IO_REQUESTS    (1024)
+#define MAX_DATA_BLOCKS         (256) // default arena size for the default block size (IO_DATA_BLOCK_DATA_CAPACITY_BYTES)
+
+enum FileIoServerThreadSchedulingClass {
+    FILE_IO_SERVER_THREAD_SCHED_NORMAL,         // default OS scheduling
+    FILE_IO_SERVER_THREAD_SCHED_REALTIME_FIFO,  // POSIX SCHED_FIFO. Windows THREAD_PRIORITY_TIME_CRITICAL
+    FILE_IO_SERVER_THREAD_SCHED_REALTIME_RR     // POSIX SCHED_RR. Windows THREAD_PRIORITY_TIME_CRITICAL
+};
+
+enum FileIoServerIoEngine {
+    FILE_IO_SERVER_IO_ENGINE_SYNCHRONOUS,   // blocking positional reads/writes, performed by the server thread
+    FILE_IO_SERVER_IO_ENGINE_IO_URING       // Linux only: block I/O drained from the mailbox is submitted to io_uring
+                                            // as a batch, and completes asynchronously. Elsewhere (or if the kernel 
+                                            // doesn't support io_uring) the synchronous engine is used.
+};
+
+// assigns files whose paths begin with pathPrefix to a server worker
+struct FileIoServerVolume {
+    const char *pathPrefix;             // e.g. "/mnt/nas/" or "D:\\". compared case-sensitively
+    int workerIndex;                    // 0 to workerCount-1
+};
+
+// server configuration. the defaults are used by startFileIoServer(fileIoRequestCount)
+struct FileIoServerConfig {
+    std::size_t fileIoRequestCount;     // capacity of the global request pool. (each open stream caches a few free requests, see FileIoStreams.cpp)
+    // Number of blocks preallocated in each worker's data block arenas, indexed by size class 
+    // (see dataBlockSizeClassForCapacity()). By default only the default block size is preallocated.
+    // Size the other classes for the block sizes that your streams use.
+    std::size_t dataBlockCounts[IO_DATA_BLOCK_SIZE_CLASS_COUNT];
+    DataBlockPoolExhaustedPolicy dataBlockPoolExhaustedPolicy; // what to do when an arena runs out
+
+    // Server thread scheduling. On POSIX systems serverThreadPriority is the realtime 
+    // sched_priority (0 selects a priority midway through the valid range). It is ignored on Windows.
+    // If realtime scheduling is not permitted (e.g. on Linux without CAP_SYS_NICE or RLIMIT_RTPRIO) 
+    // the server thread runs with normal scheduling.
+    FileIoServerThreadSchedulingClass serverThreadSchedulingClass;
+    int serverThreadPriority;
+
+    // Server workers. Each worker is a separate server thread with its own mailbox. Assigning files
+    // on different devices to different workers stops a slow device (e.g. a network mount) from holding
+    // up streams on a fast one. A file is handled by the worker of the longest pathPrefix in volumes[] 
+    // that matches its path. Files that match no volume are distributed over all workers by path hash.
+    int workerCount;
+    const FileIoServerVolume *volumes;  // copied by startFileIoServer()
+    std::size_t volumeCount;
+
+    FileIoServerIoEngine ioEngine;
+    unsigned int ioUringQueueDepth;     // maximum number of block I/O operations in flight (io_uring engine only)
+
+    // COMMIT_MODIFIED_WRITE_BLOCK requests are held for up to this long before they are written, so 
+    // that sequential blocks can be coalesced into fewer, larger writes. 0 writes the commits at the 
+    // end of every mailbox drain (commits that arrive together are still coalesced). Held commits 
+    // keep their data blocks allocated, so keep the interval short compared to the data block pool.
+    uint64_t commitFlushIntervalMicroseconds;
+
+    // Streams that read the same file with READ_ONLY_OPEN_MODE share its blocks (see DataBlockCache.h).
+    // Blocks that no stream holds are retained for reuse, up to this many bytes per worker, and evicted 
+    // least recently used first. 0 shares blocks while they are held but doesn't retain them (and files 
+    // that only one stream has open bypass the cache). Retained blocks come from the data block pools, 
+    // and are evicted whenever a pool's arena runs out. The cache's block headers are allocated when 
+    // the server starts: one per request, plus one per 4k of capacity.
+    std::size_t blockCacheCapacityBytes;
 
-struct FileIoRequest;
+    // Hybrid wakeup. When the mailbox is empty, a worker spins for up to this long (checking the 
+    // mailbox, with a pause instruction between checks) before it sleeps. While a worker is awake, 
+    // clients skip the wakeup signal, which is a system call. This cuts the request round trip when 
+    // requests arrive closer together than the spin time, at the cost of burning a core while 
+    // spinning. 0 disables spinning: the worker always sleeps, and clients always signal it.
+    uint64_t serverSpinMicroseconds;
+
+    FileIoServerConfig()
+        : fileIoRequestCount( MAX_FILE_IO_REQUESTS )
+        , dataBlockPoolExhaustedPolicy( DATA_BLOCK_POOL_EXHAUSTED_FALLBACK_TO_HEAP )
+        , serverThreadSchedulingClass( FILE_IO_SERVER_THREAD_SCHED_REALTIME_FIFO )
+        , serverThreadPriority( 0 )
+        , workerCount( 1 )
+        , volumes( 0 )
+        , volumeCount( 0 )
+        , ioEngine( FILE_IO_SERVER_IO_ENGINE_IO_URING )
+        , ioUringQueueDepth( 256 )
+        , commitFlushIntervalMicroseconds( 0 )
+        , blockCacheCapacityBytes( 0 )
+        , serverSpinMicroseconds( 0 )
+    {
+        for (int i=0; i < IO_DATA_BLOCK_SIZE_CLASS_COUNT; ++i)
+            dataBlockCounts[i] = 0;
+        dataBlockCounts[ dataBlockSizeClassForCapacity(IO_DATA_BLOCK_DATA_CAPACITY_BYTES) ] = MAX_DATA_BLOCKS;
+    }
+};
 
 // public interface to the file I/O server:
 
 // initialize and terminate the server
-void startFileIoServer( std::size_t fileIoRequestCount=MAX_FILE_IO_REQUESTS);
+void startFileIoServer( std::size_t fileIoRequestCount=MAX_FILE_IO_REQUESTS );
+void startFileIoServer( const FileIoServerConfig& config );
 void shutDownFileIoServer();
 
+// retrieve data block arena usage counters, summed over all workers (may be called from any thread)
+void getFileIoServerDataBlockPoolStats( DataBlockPoolStats *result ); // all size classes
+void getFileIoServerDataBlockPoolStats( std::size_t blockSizeBytes, DataBlockPoolStats *result ); // one size class
+
+#define IO_STATS_REQUEST_TYPE_COUNT (FileIoRequest::CLEANUP_RESULT_QUEUE + 1)
+
+// Server instrumentation (see FileIoStats.h). Times are in microseconds.
+struct FileIoServerStats {
+    // Time from a request being posted to the server until it completed, indexed by request type. 
+    // Requests with a result complete when the result is posted to the client (for READ_BLOCK this 
+    // includes the time spent queued behind earlier deadlines), COMMIT_MODIFIED_WRITE_BLOCK 
+    // completes when the block has been written, other requests when they have been handled.
+    FileIoHistogram requestLatency[IO_STATS_REQUEST_TYPE_COUNT];
+
+    // READ_BLOCK and ALLOCATE_WRITE_BLOCK: time from the result being posted until the request's 
+    // deadline. Blocks that missed their deadline are recorded as 0 (i.e. in bin 0).
+    FileIoHistogram blockDeadlineSlack;
+
+    // Synchronous I/O engine: time spent in each read or write call. One call may transfer a run 
+    // of blocks. (With io_uring, I/O time is included in the request latencies.) Decoding a block of 
+    // a compressed file is recorded as one read call, with either engine.
+    FileIoHistogram readCallDuration;
+    FileIoHistogram writeCallDuration;
+
+    FileIoHistogram mailboxDepth; // number of requests received per mailbox drain (empty drains aren't recorded)
+};
+
+// snapshot the server instrumentation (any thread, lock-free)
+void getFileIoServerStats( FileIoServerStats *result ); // all workers
+void getFileIoServerStats( int workerIndex, FileIoServerStats *result ); // one worker, e.g. to find a slow volume
+
+// monotonic clock used for stamping block request deadlines, in microseconds (real-time safe)
+uint64_t getFileIoServerTimeMicroseconds();
+
 // allocate and release requests from the global request pool (real-time safe)
 FileIoRequest *allocFileIoRequest();
 void freeFileIoRequest( FileIoRequest *r );
 
-// post a request to the server (real-time safe) 
+// post a request to the server (real-time safe). 
+// READ_BLOCK and ALLOCATE_WRITE_BLOCK requests are serviced in order of their deadline field. 
+// COMMIT_MODIFIED_WRITE_BLOCK requests are coalesced (see FileIoServerConfig::commitFlushIntervalMicroseconds).
+// All other requests are serviced as soon as they are received.
 void sendFileIoRequestToServer( FileIoRequest *r );
 
 // post multiple requests to the server (real-time safe).
@@ -46,4 +175,9 @@ void sendFileIoRequestToServer( FileIoRequest *r );
 // Back will be the first processed by the server.
 void sendFileIoRequestsToServer( FileIoRequest *front, FileIoRequest *back );
 
+// post multiple requests, for any number of files, to the server (real-time safe).
+// requests are linked as for sendFileIoRequestsToServer(). The requests for each server worker 
+// are posted with a single push, and each worker is woken at most once.
+void sendFileIoRequestBatchToServer( FileIoRequest *front, FileIoRequest *back );
+
 #endif /* INCLUDED_STREAMINGFILEIO_H */
\ No newline at end of file
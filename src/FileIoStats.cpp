@@ -0,0 +1,85 @@
+/* 
+    Real Time File Streaming copyright (c) 2014 Ross Bencina
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+#include "FileIoStats.h"
+
+#include <algorithm>
+#include <cstring>
+
+static std::size_t histogramBinForValue( uint64_t value )
+{
+    std::size_t bin = 0;
+    while (value != 0 && bin < IO_STATS_HISTOGRAM_BIN_COUNT - 1) {
+        value >>= 1;
+        ++bin;
+    }
+    return bin;
+}
+
+void clearFileIoHistogram( FileIoHistogram *result )
+{
+    std::memset(result, 0, sizeof(FileIoHistogram));
+}
+
+uint64_t fileIoHistogramPercentile( const FileIoHistogram& histogram, double fraction )
+{
+    if (histogram.count == 0)
+        return 0;
+
+    std::size_t target = (std::size_t)(fraction * histogram.count);
+    std::size_t countSoFar = 0;
+    for (std::size_t i=0; i < IO_STATS_HISTOGRAM_BIN_COUNT - 1; ++i) {
+        countSoFar += histogram.binCounts[i];
+        if (countSoFar > target)
+            return std::min<uint64_t>((uint64_t)1 << i, histogram.max); // (upper bound of bin i is 2^i)
+    }
+    return histogram.max;
+}
+
+void FileIoHistogramCounter::clear()
+{
+    mint_store_32_relaxed(&count_, 0);
+    mint_store_64_relaxed(&total_, 0);
+    mint_store_64_relaxed(&max_, 0);
+    for (std::size_t i=0; i < IO_STATS_HISTOGRAM_BIN_COUNT; ++i)
+        mint_store_32_relaxed(&binCounts_[i], 0);
+}
+
+void FileIoHistogramCounter::record( uint64_t value )
+{
+    // single writer: plain read-modify-write, no atomic RMW needed
+    mint_store_32_relaxed(&count_, mint_load_32_relaxed(&count_) + 1);
+    mint_store_64_relaxed(&total_, mint_load_64_relaxed(&total_) + value);
+    if (value > mint_load_64_relaxed(&max_))
+        mint_store_64_relaxed(&max_, value);
+
+    mint_atomic32_t *bin = &binCounts_[histogramBinForValue(value)];
+    mint_store_32_relaxed(bin, mint_load_32_relaxed(bin) + 1);
+}
+
+void FileIoHistogramCounter::accumulate( FileIoHistogram *result )
+{
+    result->count += mint_load_32_relaxed(&count_);
+    result->total += mint_load_64_relaxed(&total_);
+    result->max = std::max<uint64_t>(result->max, mint_load_64_relaxed(&max_));
+    for (std::size_t i=0; i < IO_STATS_HISTOGRAM_BIN_COUNT; ++i)
+        result->binCounts[i] += mint_load_32_relaxed(&binCounts_[i]);
+}
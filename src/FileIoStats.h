@@ -0,0 +1,78 @@
+/* 
+    Real Time File Streaming copyright (c) 2014 Ross Bencina
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+#ifndef INCLUDED_FILEIOSTATS_H
+#define INCLUDED_FILEIOSTATS_H
+
+#include <cstddef> // size_t
+#include <stdint.h>
+
+#include "mintomic/mintomic.h"
+
+/*
+    Lock-free instrumentation. A counter is written by a single thread (a server 
+    worker, or the thread that owns a stream) and may be read by any thread at any 
+    time. Each field of a snapshot is read atomically, but the fields are not a 
+    consistent set: a snapshot taken while the writer is active may be off by one 
+    record between fields.
+
+    Histogram bin 0 counts values of 0, bin i counts values in [2^(i-1), 2^i). The 
+    last bin also counts all larger values. For microsecond latencies the last bin 
+    starts at about 4 seconds.
+*/
+
+#define IO_STATS_HISTOGRAM_BIN_COUNT    (24)
+
+// a snapshot of one or more FileIoHistogramCounters
+struct FileIoHistogram {
+    std::size_t count;      // number of values recorded
+    uint64_t total;         // sum of the values recorded (mean is total/count)
+    uint64_t max;
+    std::size_t binCounts[IO_STATS_HISTOGRAM_BIN_COUNT];
+};
+
+void clearFileIoHistogram( FileIoHistogram *result );
+
+// approximate value below which fraction (0 to 1) of the values lie: the upper bound of the bin that contains it
+uint64_t fileIoHistogramPercentile( const FileIoHistogram& histogram, double fraction );
+
+class FileIoHistogramCounter {
+    mint_atomic32_t count_;
+    mint_atomic64_t total_;
+    mint_atomic64_t max_;
+    mint_atomic32_t binCounts_[IO_STATS_HISTOGRAM_BIN_COUNT];
+
+    FileIoHistogramCounter( const FileIoHistogramCounter& ); // not copyable
+    FileIoHistogramCounter& operator=( const FileIoHistogramCounter& );
+
+public:
+    FileIoHistogramCounter() { clear(); }
+
+    void clear(); // writer thread only, or before the counter is shared
+
+    void record( uint64_t value ); // writer thread only
+
+    // add the recorded values to result (any thread). result must have been cleared,
+    // or hold a snapshot of other counters.
+    void accumulate( FileIoHistogram *result );
+};
+
+#endif /* INCLUDED_FILEIOSTATS_H */
@@ -25,6 +25,8 @@
 #undef max
 #include <algorithm>
 #include <cassert>
+#include <cerrno>
+#include <cstring>
 #include <functional>
 
 #include "QwSpscUnorderedResultQueue.h"
@@ -38,7 +40,23 @@
 #define NOERROR (0)
 #endif
 
-//#define IO_USE_CONSTANT_TIME_RESULT_POLLING
+// Stream data rate and prefetch queue length used if the client doesn't specify them when 
+// opening the stream (16-bit stereo at 44.1k, as used by the example program)
+#define IO_DEFAULT_STREAM_DATA_RATE_BYTES_PER_SECOND    (44100*2*2)
+#define IO_DEFAULT_PREFETCH_QUEUE_BLOCK_COUNT           (20)
+
+// Bounds for the adaptive prefetch queue length. The queue may grow to 
+// IO_PREFETCH_QUEUE_GROWTH_FACTOR times the length requested at open time.
+#define IO_MIN_PREFETCH_QUEUE_BLOCK_COUNT           (2)
+#define IO_MAX_PREFETCH_QUEUE_BLOCK_COUNT           (256)
+#define IO_PREFETCH_QUEUE_GROWTH_FACTOR             (4)
+
+// Each stream keeps a small cache of free requests, so that advancing to the next block doesn't 
+// touch the global request pool's free list (and bounce its cache line between the client and 
+// server threads) every time. An empty cache is refilled with several requests at once. Allow 
+// for IO_STREAM_REQUEST_CACHE_CAPACITY requests per open stream when sizing the request pool.
+#define IO_STREAM_REQUEST_CACHE_CAPACITY            (8)
+#define IO_STREAM_REQUEST_CACHE_REFILL_COUNT        (4)
 
 
 struct BlockRequestBehavior { // behavior with implementation common to read and write requests
@@ -65,17 +83,19 @@ struct ReadBlockRequestBehavior : public BlockRequestBehavior {
         BLOCK_STATE_PENDING = FileIoRequest::READ_BLOCK,
         BLOCK_STATE_READY = FileIoRequest::CLIENT_USE_BASE_,
         BLOCK_STATE_READY_MODIFIED, // not used for read streams
-        BLOCK_STATE_ERROR
+        BLOCK_STATE_ERROR,
+        BLOCK_STATE_READY_RESIDENT // a sample handle's head block. owned by the handle, not returned to the server
     };
 
     // fields and predicates
 
     static DataBlock *dataBlock(FileIoRequest *r) { return r->readBlock.dataBlock; }
-    static size_t filePosition(FileIoRequest *r) { return r->readBlock.filePosition; }
+    static FileIoPosition filePosition(FileIoRequest *r) { return r->readBlock.filePosition; }
+    static void *fileHandle(FileIoRequest *r) { return r->readBlock.fileHandle; }
 
     static bool hasDataBlock(FileIoRequest *r) { return (dataBlock(r) != 0); }
     
-    static bool isReady(FileIoRequest *r) { return (state_(r) == BLOCK_STATE_READY); }
+    static bool isReady(FileIoRequest *r) { return (state_(r) == BLOCK_STATE_READY || state_(r) == BLOCK_STATE_READY_RESIDENT); }
     
     // request initialization and transformation
 
@@ -86,7 +106,7 @@ struct ReadBlockRequestBehavior : public BlockRequestBehavior {
     // For write-only streams ALLOCATE_WRITE_BLOCK is acquire and
     // (RELEASE_UNMODIFIED_WRITE_BLOCK or COMMIT_MODIFIED_WRITE_BLOCK) is release.
 
-    static void initAcquire( FileIoRequest *blockReq, void *fileHandle, size_t pos, FileIoRequest *resultQueueReq )
+    static void initAcquire( FileIoRequest *blockReq, void *fileHandle, FileIoPosition pos, FileIoDeadline deadline, FileIoRequest *resultQueueReq )
     {
         next_(blockReq) = 0;
         blockReq->resultStatus = 0;
@@ -95,6 +115,7 @@ struct ReadBlockRequestBehavior : public BlockRequestBehavior {
 
         blockReq->readBlock.fileHandle = fileHandle;
         blockReq->readBlock.filePosition = pos;
+        blockReq->readBlock.deadline = deadline;
         blockReq->readBlock.dataBlock = 0;
         blockReq->readBlock.isAtEof = false;
         blockReq->readBlock.resultQueue = resultQueueReq;
@@ -119,41 +140,92 @@ struct ReadBlockRequestBehavior : public BlockRequestBehavior {
 
     typedef void* user_items_ptr_t; // this is const for write streams
 
-    enum CopyStatus { CAN_CONTINUE, AT_BLOCK_END, AT_FINAL_BLOCK_END };
-    /*
-        NOTE if we wanted to support items that span multiple blocks we could
-        introduce an extra status: NEED_NEXT_BLOCK that we would return if the
-        next block is pending but we needed data from it to copy an item.
-        NEED_NEXT_BLOCK would cause the wrapper to go into the buffering state.
-    */
+    // The item transfer functor moves itemCount items between the block and the client.
+    // CopyItems is the plain memcpy transfer used by read(). Other transfers (e.g. sample 
+    // format conversion) can be passed to copyBlockData() in its place.
+
+    struct CopyItems {
+        int8_t *userBytesPtr;
+        size_t itemSizeBytes;
+
+        CopyItems( user_items_ptr_t userItemsPtr, size_t itemSizeBytes_ )
+            : userBytesPtr( static_cast<int8_t*>(userItemsPtr) ), itemSizeBytes( itemSizeBytes_ ) {}
+
+        void operator()( const int8_t *blockBytes, size_t itemCount )
+        {
+            size_t bytesToCopy = itemCount*itemSizeBytes;
+            std::memcpy(userBytesPtr, blockBytes, bytesToCopy);
+            userBytesPtr += bytesToCopy;
+        }
+    };
+
+    // SkipItems is used by advance(), after the client has read the block data in-place (see peek()).
+
+    struct SkipItems {
+        void operator()( const int8_t *, size_t ) {}
+    };
+
+    typedef const void* block_data_ptr_t; // type of the pointer returned by peek()
+
+    static size_t blockBytesAvailable( FileIoRequest *blockReq ) // bytes remaining to be read
+    {
+        return dataBlock(blockReq)->validCountBytes - bytesCopied_(blockReq);
+    }
+
+    // NEED_NEXT_BLOCK: the next item straddles the end of the block. The wrapper transfers 
+    // it with copyStraddlingItem() once the next block is ready.
+    enum CopyStatus { CAN_CONTINUE, AT_BLOCK_END, AT_FINAL_BLOCK_END, NEED_NEXT_BLOCK };
 
-    static CopyStatus copyBlockData( FileIoRequest *blockReq, user_items_ptr_t userItemsPtr, 
+    template< typename ItemTransfer >
+    static CopyStatus copyBlockData( FileIoRequest *blockReq, ItemTransfer& transferItems, 
             size_t maxItemsToCopy, size_t itemSizeBytes, size_t *itemsCopiedResult )
     {
         size_t blockBytesCopiedSoFar = bytesCopied_(blockReq);
         size_t bytesRemainingInBlock = dataBlock(blockReq)->validCountBytes - blockBytesCopiedSoFar;
         size_t wholeItemsRemainingInBlock = bytesRemainingInBlock / itemSizeBytes;
 
-        // Assume that itemSize divides block size, otherwise we need to deal with items overlapping blocks 
-        // and that wouldn't be time-efficient (see NOTE earlier for possible implementation).
-        assert( wholeItemsRemainingInBlock*itemSizeBytes == bytesRemainingInBlock ); 
-
         size_t itemsToCopy = std::min<size_t>(wholeItemsRemainingInBlock, maxItemsToCopy);
         
-        size_t bytesToCopy = itemsToCopy*itemSizeBytes;
-        std::memcpy(userItemsPtr, static_cast<int8_t*>(dataBlock(blockReq)->data)+blockBytesCopiedSoFar, bytesToCopy);
-        bytesCopied_(blockReq) += bytesToCopy;
+        transferItems(static_cast<const int8_t*>(dataBlock(blockReq)->data)+blockBytesCopiedSoFar, itemsToCopy);
+        bytesCopied_(blockReq) += itemsToCopy*itemSizeBytes;
 
         *itemsCopiedResult = itemsToCopy;
 
         if (itemsToCopy==wholeItemsRemainingInBlock) {
             if (blockReq->readBlock.isAtEof)
-                return AT_FINAL_BLOCK_END;
-            else
-               return AT_BLOCK_END;
-        } else {
-            return CAN_CONTINUE;
+                return AT_FINAL_BLOCK_END; // (a partial item at the end of the file is never returned)
+            else if (bytesCopied_(blockReq) == dataBlock(blockReq)->validCountBytes)
+                return AT_BLOCK_END;
+            else if (itemsToCopy < maxItemsToCopy)
+                return NEED_NEXT_BLOCK;
         }
+        
+        return CAN_CONTINUE;
+    }
+
+    // Transfer the item that begins in blockReq and ends in nextBlockReq. Both blocks must be ready.
+    // Returns AT_BLOCK_END, blockReq has been consumed. Or AT_FINAL_BLOCK_END if the file 
+    // ends part way through the item.
+    template< typename ItemTransfer >
+    static CopyStatus copyStraddlingItem( FileIoRequest *blockReq, FileIoRequest *nextBlockReq, 
+            ItemTransfer& transferItems, size_t itemSizeBytes )
+    {
+        size_t headBytes = blockBytesAvailable(blockReq);
+        size_t tailBytes = itemSizeBytes - headBytes;
+        assert( headBytes > 0 && headBytes < itemSizeBytes && itemSizeBytes <= IO_MAX_STRADDLING_ITEM_SIZE_BYTES );
+
+        if (blockBytesAvailable(nextBlockReq) < tailBytes)
+            return AT_FINAL_BLOCK_END; // (only the final block can be short)
+
+        int8_t itemBytes[IO_MAX_STRADDLING_ITEM_SIZE_BYTES];
+        std::memcpy(itemBytes, static_cast<const int8_t*>(dataBlock(blockReq)->data)+bytesCopied_(blockReq), headBytes);
+        std::memcpy(itemBytes+headBytes, static_cast<const int8_t*>(dataBlock(nextBlockReq)->data)+bytesCopied_(nextBlockReq), tailBytes);
+        
+        transferItems(itemBytes, 1);
+        bytesCopied_(blockReq) += headBytes;
+        bytesCopied_(nextBlockReq) += tailBytes;
+
+        return AT_BLOCK_END;
     }
 };
 
@@ -166,13 +238,15 @@ struct WriteBlockRequestBehavior : public BlockRequestBehavior {
         BLOCK_STATE_PENDING = FileIoRequest::ALLOCATE_WRITE_BLOCK,
         BLOCK_STATE_READY = FileIoRequest::CLIENT_USE_BASE_,
         BLOCK_STATE_READY_MODIFIED,
-        BLOCK_STATE_ERROR
+        BLOCK_STATE_ERROR,
+        BLOCK_STATE_READY_RESIDENT // not used for write streams
     };
 
     // fields and predicates
 
     static DataBlock *dataBlock(FileIoRequest *r) { return r->allocateWriteBlock.dataBlock; }
-    static size_t filePosition(FileIoRequest *r) { return r->allocateWriteBlock.filePosition; }
+    static FileIoPosition filePosition(FileIoRequest *r) { return r->allocateWriteBlock.filePosition; }
+    static void *fileHandle(FileIoRequest *r) { return r->allocateWriteBlock.fileHandle; }
 
     static bool hasDataBlock(FileIoRequest *r) { return (dataBlock(r) != 0); }
 
@@ -180,7 +254,7 @@ struct WriteBlockRequestBehavior : public BlockRequestBehavior {
 
     // request initialization and transformation
 
-    static void initAcquire( FileIoRequest *blockReq, void *fileHandle, size_t pos, FileIoRequest *resultQueueReq )
+    static void initAcquire( FileIoRequest *blockReq, void *fileHandle, FileIoPosition pos, FileIoDeadline deadline, FileIoRequest *resultQueueReq )
     {
         next_(blockReq) = 0;
         blockReq->resultStatus = 0;
@@ -189,6 +263,7 @@ struct WriteBlockRequestBehavior : public BlockRequestBehavior {
         blockReq->requestType = FileIoRequest::ALLOCATE_WRITE_BLOCK;
         blockReq->allocateWriteBlock.fileHandle = fileHandle;
         blockReq->allocateWriteBlock.filePosition = pos;
+        blockReq->allocateWriteBlock.deadline = deadline;
         blockReq->allocateWriteBlock.dataBlock = 0;
         blockReq->allocateWriteBlock.resultQueue = resultQueueReq;
     }
@@ -206,7 +281,7 @@ struct WriteBlockRequestBehavior : public BlockRequestBehavior {
     static void transformToCommitModified( FileIoRequest *blockReq )
     {
         void *fileHandle = blockReq->allocateWriteBlock.fileHandle;
-        std::size_t filePosition = blockReq->allocateWriteBlock.filePosition;
+        FileIoPosition filePosition = blockReq->allocateWriteBlock.filePosition;
         DataBlock *dataBlock = blockReq->allocateWriteBlock.dataBlock;
 
         blockReq->requestType = FileIoRequest::COMMIT_MODIFIED_WRITE_BLOCK;
@@ -219,33 +294,60 @@ struct WriteBlockRequestBehavior : public BlockRequestBehavior {
 
     typedef const void* user_items_ptr_t;
 
-    enum CopyStatus { CAN_CONTINUE, AT_BLOCK_END, AT_FINAL_BLOCK_END };
+    struct CopyItems { // (see ReadBlockRequestBehavior::CopyItems)
+        const int8_t *userBytesPtr;
+        size_t itemSizeBytes;
 
-    static CopyStatus copyBlockData( FileIoRequest *blockReq, user_items_ptr_t userItemsPtr, 
-        size_t maxItemsToCopy, size_t itemSizeBytes, size_t *itemsCopiedResult )
+        CopyItems( user_items_ptr_t userItemsPtr, size_t itemSizeBytes_ )
+            : userBytesPtr( static_cast<const int8_t*>(userItemsPtr) ), itemSizeBytes( itemSizeBytes_ ) {}
+
+        void operator()( int8_t *blockBytes, size_t itemCount )
+        {
+            size_t bytesToCopy = itemCount*itemSizeBytes;
+            std::memcpy(blockBytes, userBytesPtr, bytesToCopy);
+            userBytesPtr += bytesToCopy;
+        }
+    };
+
+    struct SkipItems { // the client has written the block data in-place. (see ReadBlockRequestBehavior::SkipItems)
+        void operator()( int8_t *, size_t ) {}
+    };
+
+    typedef void* block_data_ptr_t;
+
+    static size_t blockBytesAvailable( FileIoRequest *blockReq ) // bytes remaining to be written
     {
-        size_t blockBytesCopiedSoFar = bytesCopied_(blockReq);
-        size_t bytesRemainingInBlock = IO_DATA_BLOCK_DATA_CAPACITY_BYTES - blockBytesCopiedSoFar;
-        size_t wholeItemsRemainingInBlock = bytesRemainingInBlock / itemSizeBytes;
+        return dataBlock(blockReq)->capacityBytes - bytesCopied_(blockReq);
+    }
 
-        // Assume that itemSize divides block size, otherwise we need to deal with items overlapping blocks 
-        // and that wouldn't be time-efficient (see NOTE earlier for possible implementation).
-        assert( wholeItemsRemainingInBlock*itemSizeBytes == bytesRemainingInBlock ); 
+    enum CopyStatus { CAN_CONTINUE, AT_BLOCK_END, AT_FINAL_BLOCK_END, NEED_NEXT_BLOCK }; // (see ReadBlockRequestBehavior::CopyStatus)
 
-        if (dataBlock(blockReq)->validCountBytes < blockBytesCopiedSoFar) {
+    static void zeroSkippedBytes( FileIoRequest *blockReq )
+    {
+        if (dataBlock(blockReq)->validCountBytes < bytesCopied_(blockReq)) {
             // if bytesCopied_ is manipulated to start writing somewhere other than the start of the block
             // we may have a situation where we need to zero the first part of the block.
 
             std::memset(static_cast<int8_t*>(dataBlock(blockReq)->data)+dataBlock(blockReq)->validCountBytes, 
-                    0, blockBytesCopiedSoFar-dataBlock(blockReq)->validCountBytes);
-            dataBlock(blockReq)->validCountBytes = blockBytesCopiedSoFar;
+                    0, bytesCopied_(blockReq)-dataBlock(blockReq)->validCountBytes);
+            dataBlock(blockReq)->validCountBytes = bytesCopied_(blockReq);
         }
+    }
+
+    template< typename ItemTransfer >
+    static CopyStatus copyBlockData( FileIoRequest *blockReq, ItemTransfer& transferItems, 
+        size_t maxItemsToCopy, size_t itemSizeBytes, size_t *itemsCopiedResult )
+    {
+        size_t blockBytesCopiedSoFar = bytesCopied_(blockReq);
+        size_t bytesRemainingInBlock = dataBlock(blockReq)->capacityBytes - blockBytesCopiedSoFar;
+        size_t wholeItemsRemainingInBlock = bytesRemainingInBlock / itemSizeBytes;
+
+        zeroSkippedBytes(blockReq);
 
         size_t itemsToCopy = std::min<size_t>(wholeItemsRemainingInBlock, maxItemsToCopy);
 
-        size_t bytesToCopy = itemsToCopy*itemSizeBytes;
-        std::memcpy(static_cast<int8_t*>(dataBlock(blockReq)->data)+blockBytesCopiedSoFar, userItemsPtr, bytesToCopy);
-        bytesCopied_(blockReq) += bytesToCopy;
+        transferItems(static_cast<int8_t*>(dataBlock(blockReq)->data)+blockBytesCopiedSoFar, itemsToCopy);
+        bytesCopied_(blockReq) += itemsToCopy*itemSizeBytes;
 
         dataBlock(blockReq)->validCountBytes = bytesCopied_(blockReq);
         state_(blockReq) = BLOCK_STATE_READY_MODIFIED;
@@ -253,14 +355,67 @@ struct WriteBlockRequestBehavior : public BlockRequestBehavior {
         *itemsCopiedResult = itemsToCopy;
 
         if (itemsToCopy==wholeItemsRemainingInBlock) {
-            return AT_BLOCK_END;
-        } else {
-            return CAN_CONTINUE;
+            if (bytesCopied_(blockReq) == dataBlock(blockReq)->capacityBytes)
+                return AT_BLOCK_END;
+            else if (itemsToCopy < maxItemsToCopy)
+                return NEED_NEXT_BLOCK;
         }
+        
+        return CAN_CONTINUE;
+    }
+
+    // Transfer an item into the end of blockReq and the start of nextBlockReq. Both blocks 
+    // must be ready. Returns AT_BLOCK_END, blockReq is full.
+    template< typename ItemTransfer >
+    static CopyStatus copyStraddlingItem( FileIoRequest *blockReq, FileIoRequest *nextBlockReq, 
+            ItemTransfer& transferItems, size_t itemSizeBytes )
+    {
+        size_t headBytes = blockBytesAvailable(blockReq);
+        size_t tailBytes = itemSizeBytes - headBytes;
+        assert( headBytes > 0 && headBytes < itemSizeBytes && itemSizeBytes <= IO_MAX_STRADDLING_ITEM_SIZE_BYTES );
+
+        int8_t itemBytes[IO_MAX_STRADDLING_ITEM_SIZE_BYTES];
+        transferItems(itemBytes, 1);
+
+        std::memcpy(static_cast<int8_t*>(dataBlock(blockReq)->data)+bytesCopied_(blockReq), itemBytes, headBytes);
+        bytesCopied_(blockReq) += headBytes;
+        dataBlock(blockReq)->validCountBytes = bytesCopied_(blockReq);
+        state_(blockReq) = BLOCK_STATE_READY_MODIFIED;
+
+        zeroSkippedBytes(nextBlockReq);
+        std::memcpy(static_cast<int8_t*>(dataBlock(nextBlockReq)->data)+bytesCopied_(nextBlockReq), itemBytes+headBytes, tailBytes);
+        bytesCopied_(nextBlockReq) += tailBytes;
+        dataBlock(nextBlockReq)->validCountBytes = bytesCopied_(nextBlockReq);
+        state_(nextBlockReq) = BLOCK_STATE_READY_MODIFIED;
+
+        return AT_BLOCK_END;
+    }
+};
+
+
+// Read stream item transfer that converts frames as they are copied out of the block (see readFrames())
+struct ConvertSamplesToFloat32 {
+    float *const *dest;
+    FileIoChannelLayout destLayout;
+    FileIoSampleFormat srcFormat;
+    size_t channelCount;
+    size_t framesConvertedSoFar;
+
+    ConvertSamplesToFloat32( float *const *dest_, FileIoChannelLayout destLayout_, FileIoSampleFormat srcFormat_, size_t channelCount_ )
+        : dest( dest_ ), destLayout( destLayout_ ), srcFormat( srcFormat_ ), channelCount( channelCount_ ), framesConvertedSoFar( 0 ) {}
+
+    void operator()( const int8_t *blockBytes, size_t frameCount )
+    {
+        convertSamplesToFloat32(dest, destLayout, framesConvertedSoFar, blockBytes, srcFormat, channelCount, frameCount);
+        framesConvertedSoFar += frameCount;
     }
 };
 
 
+// A list of requests to be sent to the server with a single operation
+typedef QwSTailList<FileIoRequest*, FileIoRequest::TRANSIT_NEXT_LINK_INDEX> transit_list_t;
+
+
 template< typename BlockReq, typename StreamType >
 class FileIoStreamWrapper { // Object-oriented wrapper for a read and write streams
 
@@ -268,6 +423,15 @@ class FileIoStreamWrapper { // Object-oriented wrapper for a read and write stre
 
     FileIoRequest *resultQueueReq_; // The data structure is represented by a linked structure of FileIoRequest objects
 
+    // If non-zero, block requests issued while transferring data are collected here instead of 
+    // being sent to the server. (see FileIoReadStream_readBatch())
+    transit_list_t *requestBatch_;
+
+    // Per-call result polling state (see FileIoReadStream_setResultPollingBudget()). The wrapper is 
+    // constructed for each call, so these count from the start of the current call.
+    size_t resultsToPoll_;      // remaining budget. set by beginTransfer(), (size_t)-1 if unbounded
+    size_t resultsRetired_;
+
     /*
         The stream data structure is composed of linked request nodes.
         OpenFileReq is linked by the result queue's transit link. This works because
@@ -278,7 +442,10 @@ class FileIoStreamWrapper { // Object-oriented wrapper for a read and write stre
                  | (resultQueueReq_)
                  V 
          [ result queue ] -> [ OPEN_FILE ] ------------------
-                 |         (openFileReq)                    |
+                 |  \      (openFileReq)                    |
+                 |   \                                      |
+                 |    -> [ stream extension ] (streamExtReq) |
+                 |                                          |
           (head) |                                   (tail) | 
                  V                                          V
           [ READ_BLOCK ] -> [ READ_BLOCK ] -> ... -> [ READ_BLOCK ] -> NULL    } (prefetchQueue)
@@ -287,6 +454,24 @@ class FileIoStreamWrapper { // Object-oriented wrapper for a read and write stre
        "[ ... ]" indicates a FileIoRequest structure.
 
        For a write stream, the prefetch queue contains ALLOCATE_WRITE_BLOCK requests.
+
+       The stream extension request is linked by the result queue's clientPtr. It holds
+       state that doesn't fit in the other requests. It is never sent to the server.
+
+       A read stream opened from a sample handle borrows the handle's file: its OPEN_FILE 
+       request is never sent, and the file is closed with the handle, not the stream. 
+       The front of its prefetch queue holds the handle's head blocks (BLOCK_STATE_READY_RESIDENT).
+
+       A read stream may also be a sequence stream (see setNextFile()). The OPEN_FILE request 
+       of the next file is linked by the open file request's transit link, which is unused once 
+       the current file is open:
+
+         [ OPEN_FILE ] -> [ OPEN_FILE ]
+         (openFileReq)    (nextFileReq)
+
+       Once the final block of the current file is in the prefetch queue, the blocks that follow 
+       it are requested from the next file. When the front block belongs to the next file, the 
+       current file is closed and nextFileReq becomes openFileReq.
     */
 
     // Stream field lvalue aliases. Map/alias request fields to fields of our pseudo-class.
@@ -297,11 +482,131 @@ class FileIoStreamWrapper { // Object-oriented wrapper for a read and write stre
     int& error_() { return resultQueueReq_->resultStatus; }
     FileIoRequest*& prefetchQueueHead_() { return resultQueueReq_->links_[FileIoRequest::CLIENT_NEXT_LINK_INDEX]; }
     FileIoRequest*& prefetchQueueTail_() { return openFileReq()->links_[FileIoRequest::CLIENT_NEXT_LINK_INDEX]; }
-    size_t& waitingForBlocksCount_() { return resultQueueReq_->clientInt; }
+    FileIoRequest* streamExtReq() { return static_cast<FileIoRequest*>(resultQueueReq_->clientPtr); }
+    void freeStreamExtReq() { flushRequestCache(); freeFileIoRequest(streamExtReq()); resultQueueReq_->clientPtr = 0; }
+    size_t& waitingForBlocksCount_() { return streamExtReq()->streamExtension.waitingForBlocksCount; }
+    size_t& bytesPerSecond_() { return streamExtReq()->streamExtension.bytesPerSecond; }
+    size_t& prefetchQueueLength_() { return streamExtReq()->streamExtension.prefetchQueueLength; }
+    size_t& prefetchBlockCount_() { return streamExtReq()->streamExtension.prefetchBlockCount; }
+    size_t& minPrefetchBlockCount_() { return streamExtReq()->streamExtension.minPrefetchBlockCount; }
+    size_t& slackBlockCount_() { return streamExtReq()->streamExtension.slackBlockCount; }
+    size_t& blockSizeBytes_() { return streamExtReq()->streamExtension.blockSizeBytes; }
+    mint_atomic32_t& underrunCount_() { return streamExtReq()->streamExtension.underrunCount; }
+    mint_atomic32_t& minPrefetchSlackBlockCount_() { return streamExtReq()->streamExtension.minPrefetchSlackBlockCount; }
+    mint_atomic32_t& maxResultQueueDepth_() { return streamExtReq()->streamExtension.maxResultQueueDepth; }
+    mint_atomic32_t& maxResultsRetiredPerCall_() { return streamExtReq()->streamExtension.maxResultsRetiredPerCall; }
+    size_t& resultPollingBudget_() { return streamExtReq()->streamExtension.resultPollingBudget; }
+    // The request cache is linked through the requests' client links, from the stream extension 
+    // request's client link. (The stream extension request is never linked into a list.)
+    FileIoRequest*& requestCacheHead_() { return streamExtReq()->links_[FileIoRequest::CLIENT_NEXT_LINK_INDEX]; }
+    size_t& requestCacheCount_() { return streamExtReq()->clientInt; }
+    // Read streams. The step, in blocks, from each block in the prefetch queue to the next (see 
+    // FileIoReadStream_setBlockStride()). (The stream extension request is never sent, so its result status is free.)
+    int& blockStride_() { return streamExtReq()->resultStatus; }
+    size_t& borrowsFileHandle_() { return openFileReq()->clientInt; } // non-zero if the file belongs to a sample handle
+    FileIoRequest*& nextFileReqLink_() { return openFileReq()->links_[FileIoRequest::TRANSIT_NEXT_LINK_INDEX]; }
+    FileIoRequest* nextFileReq() { return nextFileReqLink_(); }
+    // Non-zero while the next file's OPEN_FILE is in flight. (Zero once it becomes the current file: it doesn't borrow its handle.)
+    size_t& nextFileIsOpening_() { return nextFileReq()->clientInt; }
+    // Stream positions are relative to the start of the sample data (see AudioFileFormat.h). 0 for headerless files.
+    FileIoPosition dataOffset_() { return openFileReq()->openFile.format.dataOffsetBytes; }
     FileIoRequest::result_queue_t& resultQueue() { return resultQueueReq_->resultQueue; }
 
     FileIoStreamWrapper( FileIoRequest *resultQueueReq )
-        : resultQueueReq_( resultQueueReq ) {}
+        : resultQueueReq_( resultQueueReq ), requestBatch_( 0 ), resultsToPoll_( (size_t)-1 ), resultsRetired_( 0 ) {}
+
+    // Request allocation for the stream's block requests. (see IO_STREAM_REQUEST_CACHE_CAPACITY)
+
+    FileIoRequest* allocRequest()
+    {
+        if (!requestCacheHead_()) {
+            for (size_t i=0; i < IO_STREAM_REQUEST_CACHE_REFILL_COUNT; ++i) {
+                FileIoRequest *r = ::allocFileIoRequest();
+                if (!r)
+                    break; // the pool is exhausted
+                r->links_[FileIoRequest::CLIENT_NEXT_LINK_INDEX] = requestCacheHead_();
+                requestCacheHead_() = r;
+                ++requestCacheCount_();
+            }
+
+            if (!requestCacheHead_())
+                return 0;
+        }
+
+        FileIoRequest *result = requestCacheHead_();
+        requestCacheHead_() = result->links_[FileIoRequest::CLIENT_NEXT_LINK_INDEX];
+        result->links_[FileIoRequest::CLIENT_NEXT_LINK_INDEX] = 0;
+        --requestCacheCount_();
+        return result;
+    }
+
+    void freeRequest( FileIoRequest *r )
+    {
+        if (requestCacheCount_() < IO_STREAM_REQUEST_CACHE_CAPACITY) {
+            r->links_[FileIoRequest::CLIENT_NEXT_LINK_INDEX] = requestCacheHead_();
+            requestCacheHead_() = r;
+            ++requestCacheCount_();
+        } else {
+            ::freeFileIoRequest(r);
+        }
+    }
+
+    void flushRequestCache()
+    {
+        while (FileIoRequest *r = requestCacheHead_()) {
+            requestCacheHead_() = r->links_[FileIoRequest::CLIENT_NEXT_LINK_INDEX];
+            ::freeFileIoRequest(r);
+        }
+        requestCacheCount_() = 0;
+    }
+
+    // The deadline of a block request is the time at which the client will need the block: 
+    // the time that it takes to consume the blocks ahead of it in the prefetch queue.
+    FileIoDeadline blockRequestDeadline( FileIoDeadline now, size_t blocksAhead )
+    {
+        const uint64_t blockDurationMicroseconds = 
+                ((uint64_t)blockSizeBytes_() * 1000000) / bytesPerSecond_();
+        return now + blocksAhead * blockDurationMicroseconds;
+    }
+
+    // Adaptive prefetch queue length. 
+    //
+    // The queue starts at the length requested at open time (the minimum). When the stream
+    // underruns (goes from STREAMING to BUFFERING) the length is increased, up to 
+    // IO_PREFETCH_QUEUE_GROWTH_FACTOR times the minimum. When the stream retires a queue's 
+    // worth of blocks twice over without ever waiting on more than the most recently 
+    // requested block, the length is decreased by one, back towards the minimum.
+
+    size_t maxPrefetchBlockCount()
+    {
+        return std::min<size_t>(minPrefetchBlockCount_() * IO_PREFETCH_QUEUE_GROWTH_FACTOR, IO_MAX_PREFETCH_QUEUE_BLOCK_COUNT);
+    }
+
+    void growPrefetchQueueAfterUnderrun()
+    {
+        size_t increment = std::max<size_t>(prefetchBlockCount_() / 2, 1);
+        prefetchBlockCount_() = std::min(prefetchBlockCount_() + increment, maxPrefetchBlockCount());
+        slackBlockCount_() = 0;
+    }
+
+    void updatePrefetchQueueSlack()
+    {
+        // Called each time a block is retired
+
+        uint32_t readyBlockCount = (uint32_t)(prefetchQueueLength_() - 1 - waitingForBlocksCount_()); // (not counting the front block)
+        if (readyBlockCount < mint_load_32_relaxed(&minPrefetchSlackBlockCount_()))
+            mint_store_32_relaxed(&minPrefetchSlackBlockCount_(), readyBlockCount);
+
+        if (waitingForBlocksCount_() <= 1) {
+            if (++slackBlockCount_() >= prefetchBlockCount_() * 2) {
+                if (prefetchBlockCount_() > minPrefetchBlockCount_())
+                    --prefetchBlockCount_();
+                slackBlockCount_() = 0;
+            }
+        } else {
+            slackBlockCount_() = 0;
+        }
+    }
 
     FileIoRequest* prefetchQueue_front()
     {
@@ -313,6 +618,7 @@ class FileIoStreamWrapper { // Object-oriented wrapper for a read and write stre
         FileIoRequest *x = prefetchQueueHead_();
         prefetchQueueHead_() = BlockReq::next_(x);
         BlockReq::next_(x) = 0;
+        --prefetchQueueLength_();
     }
 
     void prefetchQueue_push_back( FileIoRequest *blockReq )
@@ -320,13 +626,31 @@ class FileIoStreamWrapper { // Object-oriented wrapper for a read and write stre
         assert( prefetchQueueTail_() != 0 ); // doesn't deal with an empty queue, doesn't need to
         BlockReq::next_(prefetchQueueTail_()) = blockReq;
         prefetchQueueTail_() = blockReq;
+        ++prefetchQueueLength_();
+    }
+
+    void sendBlockRequestToServer( FileIoRequest *blockReq )
+    {
+        if (requestBatch_)
+            requestBatch_->push_front(blockReq); // (the back of the list is processed first)
+        else
+            ::sendFileIoRequestToServer(blockReq);
+    }
+
+    void updateMaxResultQueueDepth()
+    {
+        // (stats are only written by the client thread, so this needn't be atomic)
+        uint32_t depth = (uint32_t)resultQueue().expectedResultCount();
+        if (depth > mint_load_32_relaxed(&maxResultQueueDepth_()))
+            mint_store_32_relaxed(&maxResultQueueDepth_(), depth);
     }
 
     void sendAcquireBlockRequestToServer( FileIoRequest *blockReq )
     {
-        ::sendFileIoRequestToServer(blockReq);
+        sendBlockRequestToServer(blockReq);
         resultQueue().incrementExpectedResultCount();
         ++waitingForBlocksCount_();
+        updateMaxResultQueueDepth();
     }
 
     void sendAcquireBlockRequestsToServer( FileIoRequest *front, FileIoRequest *back, size_t count )
@@ -334,24 +658,170 @@ class FileIoStreamWrapper { // Object-oriented wrapper for a read and write stre
         ::sendFileIoRequestsToServer(front, back);
         resultQueue().incrementExpectedResultCount(count);
         waitingForBlocksCount_() += count;
+        updateMaxResultQueueDepth();
     }
 
     // Init, link and send sequential block request
-    void initAndLinkSequentialAcquireBlockRequest( FileIoRequest *blockReq )
+    void initAndLinkSequentialAcquireBlockRequest( FileIoRequest *blockReq, FileIoDeadline deadline )
     {
         // Init, link, and send a sequential data block acquire request (READ_BLOCK or ALLOCATE_WRITE_BLOCK).
-        // Init the block request so that it's file position directly follows the tail block in the prefetch queue;
-        // link the request onto the back of the prefetch queue; send the request to the server.
+        // Init the block request so that it's file position is one stride on from the tail block in the 
+        // prefetch queue (by default directly after it); link the request onto the back of the prefetch 
+        // queue; send the request to the server.
 
         // precondition: prefetch queue is non-empty
         assert( prefetchQueueHead_() !=0 && prefetchQueueTail_() !=0 );
 
-        BlockReq::initAcquire( blockReq, openFileReq()->openFile.fileHandle,
-                BlockReq::filePosition(prefetchQueueTail_()) + IO_DATA_BLOCK_DATA_CAPACITY_BYTES, resultQueueReq_ );
+        FileIoRequest *tailBlockReq = prefetchQueueTail_();
+        if (nextFileIsOpen() && BlockReq::fileHandle(tailBlockReq) == openFileReq()->openFile.fileHandle 
+                && isFinalBlockOfCurrentFile(tailBlockReq)) {
+            // Sequence stream: the block after the final block of the current file is the first block of the next file
+            BlockReq::initAcquire( blockReq, nextFileReq()->openFile.fileHandle,
+                    nextFileReq()->openFile.format.dataOffsetBytes, deadline, resultQueueReq_ );
+        } else {
+            BlockReq::initAcquire( blockReq, BlockReq::fileHandle(tailBlockReq),
+                    BlockReq::filePosition(tailBlockReq) + blockStrideBytes(), deadline, resultQueueReq_ );
+        }
 
         prefetchQueue_push_back(blockReq);
     }
 
+    // Prefetch stride. The prefetch queue holds blocks one stride apart, in the order that they 
+    // are read. (A negative stride wraps, as unsigned position arithmetic requires.)
+    FileIoPosition blockStrideBytes()
+    {
+        return (FileIoPosition)((int64_t)blockStride_() * (int64_t)blockSizeBytes_());
+    }
+
+    // Reading backwards, the prefetch queue ends with the first block of the sample data. 
+    // True if there is a block to request after the tail.
+    bool canRequestNextSequentialBlock()
+    {
+        if (blockStride_() > 0)
+            return true;
+
+        const FileIoPosition strideBytes = (FileIoPosition)(-blockStride_()) * blockSizeBytes_();
+        return (BlockReq::filePosition(prefetchQueueTail_()) >= dataOffset_() + strideBytes);
+    }
+
+    // Sequence streams
+
+    bool nextFileIsOpen()
+    {
+        return (nextFileReq() != 0 && nextFileIsOpening_() == 0 && nextFileReq()->resultStatus == NOERROR);
+    }
+
+    // Read streams. True if blockReq (a block of the current file) is known to be the final block 
+    // of the file: it has arrived and is at EOF, or the next block in stride order is past the end 
+    // of the file's sample data. Headerless files are only known to end when their final block 
+    // arrives. (Every block past the end of the file is also a final block.) Reading backwards 
+    // there is no final block: the stream ends at the start of the file.
+    bool isFinalBlockOfCurrentFile( FileIoRequest *blockReq )
+    {
+        if (blockStride_() < 0)
+            return false;
+
+        if (BlockReq::isReady(blockReq) && blockReq->readBlock.isAtEof)
+            return true;
+
+        const FileIoAudioFormat& format = openFileReq()->openFile.format;
+        return (format.dataSizeBytes != IO_UNKNOWN_DATA_SIZE 
+                && BlockReq::filePosition(blockReq) + blockStrideBytes() >= format.dataOffsetBytes + format.dataSizeBytes);
+    }
+
+    // Blocks of the current file may have been requested past its end before the next file was 
+    // open, or before the end of the file was known. Once the final block is in the prefetch 
+    // queue, release the blocks that follow it, so that the next file's blocks are requested 
+    // in their place (see initAndLinkSequentialAcquireBlockRequest()).
+    void releaseBlocksAfterFinalBlock()
+    {
+        if (!nextFileIsOpen())
+            return;
+
+        FileIoRequest *tailBlockReq = prefetchQueueTail_();
+        if (BlockReq::fileHandle(tailBlockReq) != openFileReq()->openFile.fileHandle)
+            return; // the next file's blocks have already been requested
+
+        // (only search for the final block when it must be in the queue: if it's the front or 
+        // the tail. a final block that arrived in between is found once the tail has arrived.)
+        if (!isFinalBlockOfCurrentFile(prefetchQueueHead_()) && !isFinalBlockOfCurrentFile(tailBlockReq))
+            return;
+
+        FileIoRequest *finalBlockReq = prefetchQueueHead_();
+        while (!isFinalBlockOfCurrentFile(finalBlockReq))
+            finalBlockReq = BlockReq::next_(finalBlockReq);
+
+        transit_list_t releasedBlockRequests;
+
+        FileIoRequest *blockReq = BlockReq::next_(finalBlockReq);
+        BlockReq::next_(finalBlockReq) = 0;
+        prefetchQueueTail_() = finalBlockReq;
+        while (blockReq) {
+            FileIoRequest *next = BlockReq::next_(blockReq);
+            BlockReq::next_(blockReq) = 0;
+            --prefetchQueueLength_();
+            flushBlock(blockReq,
+                    std::bind1st(std::mem_fun(&transit_list_t::push_front), &releasedBlockRequests));
+            blockReq = next;
+        }
+
+        if (!releasedBlockRequests.empty())
+            ::sendFileIoRequestsToServer(releasedBlockRequests.front(), releasedBlockRequests.back());
+    }
+
+    // Close the file of an OPEN_FILE request, and dispose the request
+    void closeFileOfOpenFileRequest( FileIoRequest *fileReq )
+    {
+        if (fileReq->openFile.fileHandle != IO_INVALID_FILE_HANDLE && fileReq->clientInt == 0) { // (see borrowsFileHandle_())
+            // Transform the request to CLOSE_FILE and send to server
+            void *fileHandle = fileReq->openFile.fileHandle;
+
+            FileIoRequest *closeFileReq = fileReq;
+            closeFileReq->requestType = FileIoRequest::CLOSE_FILE;
+            closeFileReq->closeFile.fileHandle = fileHandle;
+            ::sendFileIoRequestToServer(closeFileReq);
+        } else {
+            freeFileIoRequest(fileReq);
+        }
+    }
+
+    // Called once the front block belongs to the next file: close the current file, the next file becomes current
+    void switchToNextFile()
+    {
+        FileIoRequest *currentFileReq = openFileReq();
+        FileIoRequest *nextFileReq = nextFileReqLink_();
+        assert( nextFileReq != 0 && BlockReq::fileHandle(prefetchQueueHead_()) == nextFileReq->openFile.fileHandle );
+
+        nextFileReq->links_[FileIoRequest::CLIENT_NEXT_LINK_INDEX] = prefetchQueueTail_();
+        nextFileReq->links_[FileIoRequest::TRANSIT_NEXT_LINK_INDEX] = 0; // (no next file)
+        openFileReqLink_() = nextFileReq;
+
+        closeFileOfOpenFileRequest(currentFileReq);
+    }
+
+    // The front block is the final block of the current file, and has been consumed. Move on to 
+    // the first block of the next file. Returns false if the stream can't continue yet 
+    // (buffering: the next file is still opening) or if there was an error.
+    bool advanceToNextFile()
+    {
+        assert( nextFileReq() != 0 );
+
+        if (nextFileIsOpening_()) {
+            state_() = STREAM_STATE_OPEN_BUFFERING;
+            return false;
+        }
+
+        if (nextFileReq()->resultStatus != NOERROR) {
+            error_() = nextFileReq()->resultStatus;
+            state_() = STREAM_STATE_ERROR;
+            return false;
+        }
+
+        // Any final blocks that remain between the front block and the first block of the next 
+        // file are empty. They are advanced past in turn.
+        return advanceToNextBlock();
+    }
+
     template< typename ReturnToServerFunc >
     void flushBlock( FileIoRequest *blockReq, ReturnToServerFunc returnToServer )
     {
@@ -382,7 +852,12 @@ class FileIoStreamWrapper { // Object-oriented wrapper for a read and write stre
 
         case BlockReq::BLOCK_STATE_ERROR:
             assert( !BlockReq::hasDataBlock(blockReq) );
-            freeFileIoRequest( blockReq );
+            freeRequest( blockReq );
+            break;
+
+        case BlockReq::BLOCK_STATE_READY_RESIDENT:
+            // The block belongs to the sample handle. Only the request is ours.
+            freeRequest( blockReq );
             break;
         }
     }
@@ -390,7 +865,6 @@ class FileIoStreamWrapper { // Object-oriented wrapper for a read and write stre
     void flushPrefetchQueue()
     {
         // Accumulate requests to return to server in a list and send them using a single operation.
-        typedef QwSTailList<FileIoRequest*, FileIoRequest::TRANSIT_NEXT_LINK_INDEX> transit_list_t;
         transit_list_t blockRequests;
 
         // For each block in the prefetch queue, pop the block from the
@@ -404,15 +878,16 @@ class FileIoStreamWrapper { // Object-oriented wrapper for a read and write stre
 
         prefetchQueueTail_() = 0;
         assert( waitingForBlocksCount_() == 0 );
+        assert( prefetchQueueLength_() == 0 );
 
         if (!blockRequests.empty())
             ::sendFileIoRequestsToServer(blockRequests.front(), blockRequests.back());
     }
 
-    static size_t roundDownToBlockSizeAlignedPosition( size_t pos )
+    FileIoPosition roundDownToBlockSizeAlignedPosition( FileIoPosition pos )
     {
-        size_t blockNumber = pos / IO_DATA_BLOCK_DATA_CAPACITY_BYTES;
-        return blockNumber * IO_DATA_BLOCK_DATA_CAPACITY_BYTES;
+        FileIoPosition blockNumber = pos / blockSizeBytes_();
+        return blockNumber * blockSizeBytes_();
     }
 
     // Should only be called after the stream has been opened and before it is closed.
@@ -420,6 +895,19 @@ class FileIoStreamWrapper { // Object-oriented wrapper for a read and write stre
     bool receiveOneBlock()
     {
         if (FileIoRequest *r=resultQueue().pop()) {
+            if (++resultsRetired_ > mint_load_32_relaxed(&maxResultsRetiredPerCall_()))
+                mint_store_32_relaxed(&maxResultsRetiredPerCall_(), (uint32_t)resultsRetired_);
+
+            if (r->requestType == FileIoRequest::OPEN_FILE) {
+                // The next file of a sequence stream has been opened (or failed to open). 
+                // Its blocks are requested once the final block of the current file is in the prefetch queue.
+                assert( r == nextFileReq() );
+                r->openFile.path->release();
+                r->openFile.path = 0;
+                nextFileIsOpening_() = 0;
+                return true;
+            }
+
             assert( BlockReq::state_(r) == BlockReq::BLOCK_STATE_PENDING );
 
             if (BlockReq::isDiscarded(r)) {
@@ -427,10 +915,10 @@ class FileIoStreamWrapper { // Object-oriented wrapper for a read and write stre
 
                 if (r->resultStatus==NOERROR) {
                     BlockReq::transformToReleaseUnmodified(r);
-                    ::sendFileIoRequestToServer(r);
+                    sendBlockRequestToServer(r);
                 } else {
                     assert( BlockReq::hasDataBlock(r) );
-                    ::freeFileIoRequest(r);
+                    freeRequest(r);
                     // (errors on discarded blocks don't affect the stream state)
                 }
                 // (discarded blocks do not count against waitingForBlocksCount_
@@ -454,39 +942,76 @@ class FileIoStreamWrapper { // Object-oriented wrapper for a read and write stre
         return false;
     }
 
+    // As receiveOneBlock(), but returns false once the polling budget for the current call is spent
+    bool receiveOneBlockWithinBudget()
+    {
+        if (resultsToPoll_ == 0)
+            return false;
+
+        if (resultsToPoll_ != (size_t)-1)
+            --resultsToPoll_;
+        return receiveOneBlock();
+    }
+
     bool advanceToNextBlock()
     {
-        // issue next block request, link it on to the tail of the prefetch queue...
-        
-        FileIoRequest *newBlockReq = allocFileIoRequest();
-        if (!newBlockReq) {
-            // Fail. couldn't allocate request
-            state_() = STREAM_STATE_ERROR;
+        // issue block requests to bring the prefetch queue up to its target length (not counting
+        // the old block), link them on to the tail of the prefetch queue...
+        // Usually this is one request. More if the target length has grown, none if it has shrunk.
+
+        releaseBlocksAfterFinalBlock(); // (sequence streams)
+
+        const FileIoDeadline now = getFileIoServerTimeMicroseconds();
+        while (prefetchQueueLength_() < prefetchBlockCount_() + 1 && canRequestNextSequentialBlock()) {
+            FileIoRequest *newBlockReq = allocRequest();
+            if (!newBlockReq) {
+                // Fail. couldn't allocate request
+                state_() = STREAM_STATE_ERROR;
+                return false;
+            }
+            // The new block will be needed after all of the other blocks in the prefetch queue have been consumed.
+            initAndLinkSequentialAcquireBlockRequest(newBlockReq, blockRequestDeadline(now, prefetchQueueLength_() - 1));
+            sendAcquireBlockRequestToServer(newBlockReq);
+        }
+
+        if (!BlockReq::next_(prefetchQueue_front())) {
+            // Reading backwards, the front block is the first block of the sample data. Keep it at the front.
+            state_() = STREAM_STATE_OPEN_EOF;
             return false;
         }
-        initAndLinkSequentialAcquireBlockRequest(newBlockReq);
-        sendAcquireBlockRequestToServer(newBlockReq);
+
+        updatePrefetchQueueSlack();
 
         // unlink and flush the old block...
 
-        // Notice that we link the new request on the back of the prefetch queue before unlinking
-        // the old one off the front, so there is no chance of having to deal with the special case of
-        // linking to an empty queue.
+        // Notice that we link the new request(s) on the back of the prefetch queue before unlinking
+        // the old one off the front. Since the target length is at least IO_MIN_PREFETCH_QUEUE_BLOCK_COUNT
+        // there is no chance of having to deal with the special case of linking to an empty queue.
+        // (Reading backwards, the queue runs down at the start of the file, and the first block stays at the front at EOF.)
 
         FileIoRequest *oldBlockReq = prefetchQueue_front();
         prefetchQueue_pop_front(); // advance head to next block
-        flushBlock(oldBlockReq, ::sendFileIoRequestToServer);
+        flushBlock(oldBlockReq, 
+                std::bind1st(std::mem_fun(&FileIoStreamWrapper::sendBlockRequestToServer), this));
+
+        if (BlockReq::fileHandle(prefetchQueue_front()) != openFileReq()->openFile.fileHandle)
+            switchToNextFile(); // (sequence streams)
         
         return true;
     }
 
 public:
     FileIoStreamWrapper( STREAMTYPE *fp )
-        : resultQueueReq_( static_cast<FileIoRequest*>(fp) ) {}
+        : resultQueueReq_( static_cast<FileIoRequest*>(fp) ), requestBatch_( 0 ), resultsToPoll_( (size_t)-1 ), resultsRetired_( 0 ) {}
+
+    FileIoStreamWrapper( STREAMTYPE *fp, transit_list_t *requestBatch )
+        : resultQueueReq_( static_cast<FileIoRequest*>(fp) ), requestBatch_( requestBatch ), resultsToPoll_( (size_t)-1 ), resultsRetired_( 0 ) {}
     
-    static STREAMTYPE* open( SharedBuffer *path, FileIoRequest::OpenMode openMode )
+    // Allocate and initialise the result queue, open file and stream extension requests. 
+    // Returns the result queue request, or 0 if allocation fails.
+    static FileIoRequest* allocStreamStructure( size_t bytesPerSecond, size_t prefetchBlockCount, size_t blockSizeBytes )
     {
-        // Allocate two requests. Return 0 if allocation fails.
+        // Allocate three requests. Return 0 if allocation fails.
 
         FileIoRequest *resultQueueReq = allocFileIoRequest();
         if (!resultQueueReq)
@@ -498,6 +1023,13 @@ public:
             return 0;
         }
 
+        FileIoRequest *streamExtReq = allocFileIoRequest();
+        if (!streamExtReq) {
+            freeFileIoRequest(openFileReq);
+            freeFileIoRequest(resultQueueReq);
+            return 0;
+        }
+
         // Initialise the stream data structure
 
         FileIoStreamWrapper stream(resultQueueReq);
@@ -505,12 +1037,42 @@ public:
         stream.resultQueue().init();
 
         stream.openFileReqLink_() = openFileReq;
+        resultQueueReq->clientPtr = streamExtReq;
         stream.state_() = STREAM_STATE_OPENING;
         stream.error_() = 0;
         stream.prefetchQueueHead_() = 0;
         stream.prefetchQueueTail_() = 0;
         stream.waitingForBlocksCount_() = 0;
-        
+        stream.bytesPerSecond_() = std::max<size_t>(bytesPerSecond, 1);
+        stream.prefetchQueueLength_() = 0;
+        stream.minPrefetchBlockCount_() = std::min<size_t>(
+                std::max<size_t>(prefetchBlockCount, IO_MIN_PREFETCH_QUEUE_BLOCK_COUNT), IO_MAX_PREFETCH_QUEUE_BLOCK_COUNT);
+        stream.prefetchBlockCount_() = stream.minPrefetchBlockCount_();
+        stream.slackBlockCount_() = 0;
+        stream.blockSizeBytes_() = blockSizeBytes;
+        stream.borrowsFileHandle_() = 0;
+        stream.requestCacheHead_() = 0;
+        stream.requestCacheCount_() = 0;
+        stream.blockStride_() = 1;
+        mint_store_32_relaxed(&stream.underrunCount_(), 0);
+        mint_store_32_relaxed(&stream.minPrefetchSlackBlockCount_(), 0xFFFFFFFFu);
+        mint_store_32_relaxed(&stream.maxResultQueueDepth_(), 0);
+        mint_store_32_relaxed(&stream.maxResultsRetiredPerCall_(), 0);
+        stream.resultPollingBudget_() = 0;
+
+        return resultQueueReq;
+    }
+
+    static STREAMTYPE* openWithPrefetchBlockCount( SharedBuffer *path, FileIoRequest::OpenMode openMode, 
+            size_t bytesPerSecond, size_t prefetchBlockCount, size_t blockSizeBytes, const FileIoAudioFormat *format=0 )
+    {
+        FileIoRequest *resultQueueReq = allocStreamStructure(bytesPerSecond, prefetchBlockCount, blockSizeBytes);
+        if (!resultQueueReq)
+            return 0;
+
+        FileIoStreamWrapper stream(resultQueueReq);
+        FileIoRequest *openFileReq = stream.openFileReq();
+
         // Issue the OPEN_FILE request
 
         openFileReq->resultStatus = 0;
@@ -518,8 +1080,14 @@ public:
         path->addRef();
         openFileReq->openFile.path = path;
         openFileReq->openFile.openMode = openMode;
+        openFileReq->openFile.usesResultQueueWorker = false;
+        openFileReq->openFile.blockSizeBytes = blockSizeBytes;
         openFileReq->openFile.fileHandle = IO_INVALID_FILE_HANDLE;
         openFileReq->openFile.resultQueue = resultQueueReq;
+        if (format)
+            openFileReq->openFile.format = *format;
+        else
+            initHeaderlessAudioFormat(&openFileReq->openFile.format); // (read modes: returned by the server)
 
         ::sendFileIoRequestToServer(openFileReq);
         stream.resultQueue().incrementExpectedResultCount();
@@ -527,92 +1095,386 @@ public:
         return static_cast<STREAMTYPE*>(resultQueueReq);
     }
 
-    void close()
+    static STREAMTYPE* open( SharedBuffer *path, FileIoRequest::OpenMode openMode )
     {
-        // (Don't poll state, just dispose current state)
-
-        if (state_()==STREAM_STATE_OPENING) {
-            // Still waiting for OPEN_FILE to return. Send the result queue to the server for cleanup.
-            openFileReqLink_() = 0;
+        return openWithPrefetchBlockCount(path, openMode, IO_DEFAULT_STREAM_DATA_RATE_BYTES_PER_SECOND, 
+                IO_DEFAULT_PREFETCH_QUEUE_BLOCK_COUNT, IO_DATA_BLOCK_DATA_CAPACITY_BYTES);
+    }
 
-            resultQueueReq_->requestType = FileIoRequest::CLEANUP_RESULT_QUEUE;
-            ::sendFileIoRequestToServer(resultQueueReq_);
-            resultQueueReq_ = 0;
-        } else {
-            // Stream is open. The prefetch queue may contain requests.
+    // The prefetch queue length needed to buffer bufferingSeconds of data (rounded up)
+    static size_t blockCountForDuration( size_t bytesPerSecond, double bufferingSeconds, size_t blockSizeBytes )
+    {
+        double blockCount = ((double)bytesPerSecond * bufferingSeconds) / blockSizeBytes;
+        size_t result = (size_t)blockCount;
+        if ((double)result < blockCount)
+            ++result;
+        return result;
+    }
 
-            // Dispose the prefetch queue, if it's populated
+    static STREAMTYPE* open( SharedBuffer *path, FileIoRequest::OpenMode openMode,
+            size_t bytesPerSecond, double bufferingSeconds, size_t blockSizeBytes, const FileIoAudioFormat *format=0 )
+    {
+        // Use the smallest supported block size that is at least as large as requested
+        blockSizeBytes = dataBlockCapacityForSizeClass(dataBlockSizeClassForCapacity(blockSizeBytes));
 
-            flushPrefetchQueue();
+        return openWithPrefetchBlockCount(path, openMode, bytesPerSecond, 
+                blockCountForDuration(bytesPerSecond, bufferingSeconds, blockSizeBytes), blockSizeBytes, format);
+    }
 
-            // Clean up the open file request
+    // Sample handles (read streams only).
+    //
+    // A sample handle is a read stream that only ever holds its head blocks: the first 
+    // prefetch queue's worth of blocks of the file. The handle is never read. Streams opened 
+    // from the handle start with the head blocks in their prefetch queue, so they can be read 
+    // immediately, while the blocks that follow the head are requested behind them.
 
-            {
-                FileIoRequest *openFileReq = openFileReqLink_();
-                openFileReqLink_() = 0;
-                if (openFileReq->openFile.fileHandle != IO_INVALID_FILE_HANDLE) {
-                    // Transform openFileReq to CLOSE_FILE and send to server
-                    void *fileHandle = openFileReq->openFile.fileHandle;
-                    
-                    FileIoRequest *closeFileReq = openFileReq;
-                    closeFileReq->requestType = FileIoRequest::CLOSE_FILE;
-                    closeFileReq->closeFile.fileHandle = fileHandle;
-                    ::sendFileIoRequestToServer(closeFileReq);
-                } else {
-                    freeFileIoRequest(openFileReq);
-                }
-            }
+    // Drive the handle from OPENING to STREAMING (the head is resident). Returns the handle state.
+    FileIoStreamState pollSampleHandleState()
+    {
+        if (pollState() == STREAM_STATE_OPEN_IDLE)
+            seek(0); // request the head blocks
 
-            // Clean up the result queue
+        if (state_() == STREAM_STATE_OPEN_BUFFERING) {
+            while (receiveOneBlock())
+                /* loop until all replies have been processed */ ;
+        }
 
-            if (resultQueue().expectedResultCount() > 0) {
-                // Send the result queue to the server for cleanup
-                resultQueueReq_->requestType = FileIoRequest::CLEANUP_RESULT_QUEUE;
-                ::sendFileIoRequestToServer(resultQueueReq_);
-                resultQueueReq_ = 0;
-            } else {
-                freeFileIoRequest(resultQueueReq_);
-                resultQueueReq_ = 0;
+        if (state_() == STREAM_STATE_OPEN_STREAMING) {
+            // Every head block has arrived. Streams can't be opened from a head that is missing a block.
+            for (FileIoRequest *blockReq = prefetchQueueHead_(); blockReq; blockReq = BlockReq::next_(blockReq)) {
+                if (BlockReq::state_(blockReq) == BlockReq::BLOCK_STATE_ERROR) {
+                    error_() = blockReq->resultStatus;
+                    state_() = STREAM_STATE_ERROR;
+                    break;
+                }
             }
         }
+
+        return (FileIoStreamState)state_();
     }
 
-    int seek( size_t pos )
+    static STREAMTYPE* openFromSampleHandle( STREAMTYPE *sampleHandle, size_t bytesPerSecond, double bufferingSeconds )
     {
-        assert( pos >= 0 );
+        FileIoStreamWrapper handle(sampleHandle);
+        if (handle.state_() != STREAM_STATE_OPEN_STREAMING)
+            return 0; // the head isn't resident (see pollSampleHandleState())
 
-        if (state_() == STREAM_STATE_OPENING || state_() == STREAM_STATE_ERROR)
-            return -1;
+        const size_t blockSizeBytes = handle.blockSizeBytes_();
+        const size_t prefetchBlockCount = blockCountForDuration(bytesPerSecond, bufferingSeconds, blockSizeBytes);
 
-        // Straight-forward implementation of seek: dump all blocks from the prefetch queue, 
-        // then request the needed blocks.
-        // A more optimised version would retain any needed blocks from the current prefetch queue.
+        FileIoRequest *resultQueueReq = allocStreamStructure(bytesPerSecond, prefetchBlockCount, blockSizeBytes);
+        if (!resultQueueReq)
+            return 0;
 
-        flushPrefetchQueue();
+        FileIoStreamWrapper stream(resultQueueReq);
 
-        // HACK: Hardcode the prefetch queue length.
-        // The prefetch queue length should be computed from the stream data rate and the 
-        // desired prefetch buffering length (in seconds).
-        
-        const int prefetchQueueBlockCount = 20;
+        // Borrow the handle's file. Block requests are routed with the result queue, to the handle's worker.
+        FileIoRequest *openFileReq = stream.openFileReq();
+        openFileReq->resultStatus = 0;
+        openFileReq->requestType = FileIoRequest::OPEN_FILE;
+        openFileReq->openFile.path = 0;
+        openFileReq->openFile.openMode = FileIoRequest::READ_ONLY_OPEN_MODE;
+        openFileReq->openFile.usesResultQueueWorker = false;
+        openFileReq->openFile.blockSizeBytes = blockSizeBytes;
+        openFileReq->openFile.fileHandle = handle.openFileReq()->openFile.fileHandle;
+        openFileReq->openFile.resultQueue = resultQueueReq;
+        openFileReq->openFile.format = handle.openFileReq()->openFile.format;
+        stream.borrowsFileHandle_() = 1;
+        stream.nextFileReqLink_() = 0;
+        resultQueueReq->serverWorkerIndex = handle.resultQueueReq_->serverWorkerIndex;
 
-        // Request blocks on block-size-aligned boundaries
-        size_t blockFilePositionBytes = roundDownToBlockSizeAlignedPosition(pos);
+        // Allocate requests for the head blocks and for the prefetch blocks that follow them. 
+        // If the head includes the end of the file there is nothing to prefetch.
 
-        // request the first block 
+        bool headIsAtEof = handle.prefetchQueueTail_()->readBlock.isAtEof;
+        size_t requestCount = handle.prefetchQueueLength_() + ((headIsAtEof) ? 0 : stream.prefetchBlockCount_());
 
-        FileIoRequest *firstBlockReq = allocFileIoRequest();
-        if (!firstBlockReq) {
-            state_() = STREAM_STATE_ERROR;
-            return -1;
-        }
+        QwSList<FileIoRequest*, FileIoRequest::TRANSIT_NEXT_LINK_INDEX> newBlockRequests;
+        for (size_t i=0; i < requestCount; ++i) {
+            FileIoRequest *blockReq = allocFileIoRequest();
+            if (!blockReq) {
+                // Fail. couldn't allocate request. Rollback.
+                while (!newBlockRequests.empty()) {
+                    FileIoRequest *r = newBlockRequests.front();
+                    newBlockRequests.pop_front();
+                    freeFileIoRequest(r);
+                }
+                stream.freeStreamExtReq();
+                freeFileIoRequest(openFileReq);
+                freeFileIoRequest(resultQueueReq);
+                return 0;
+            }
+            newBlockRequests.push_front(blockReq);
+        }
+
+        // Link the head blocks. They are ready now.
+
+        for (FileIoRequest *headBlockReq = handle.prefetchQueueHead_(); headBlockReq; headBlockReq = BlockReq::next_(headBlockReq)) {
+            FileIoRequest *blockReq = newBlockRequests.front();
+            newBlockRequests.pop_front();
+
+            BlockReq::initAcquire( blockReq, openFileReq->openFile.fileHandle, BlockReq::filePosition(headBlockReq), 0, resultQueueReq );
+            blockReq->readBlock.dataBlock = headBlockReq->readBlock.dataBlock;
+            blockReq->readBlock.isAtEof = headBlockReq->readBlock.isAtEof;
+            BlockReq::state_(blockReq) = BlockReq::BLOCK_STATE_READY_RESIDENT;
+
+            if (!stream.prefetchQueueHead_()) {
+                stream.prefetchQueueHead_() = blockReq;
+                stream.prefetchQueueTail_() = blockReq;
+                stream.prefetchQueueLength_() = 1;
+            } else {
+                stream.prefetchQueue_push_back(blockReq);
+            }
+        }
+
+        // Request the blocks after the head. They are needed once the head has been consumed.
+
+        if (!newBlockRequests.empty()) {
+            const FileIoDeadline now = getFileIoServerTimeMicroseconds();
+            const size_t headBlockCount = stream.prefetchQueueLength_();
+
+            QwSList<FileIoRequest*, FileIoRequest::TRANSIT_NEXT_LINK_INDEX> blockRequests;
+            FileIoRequest *firstNewBlockReq = 0;
+            size_t newBlockCount = 0;
+            while (!newBlockRequests.empty()) {
+                FileIoRequest *blockReq = newBlockRequests.front();
+                newBlockRequests.pop_front();
+
+                stream.initAndLinkSequentialAcquireBlockRequest(blockReq, stream.blockRequestDeadline(now, headBlockCount + newBlockCount));
+                blockRequests.push_front(blockReq);
+                if (!firstNewBlockReq)
+                    firstNewBlockReq = blockReq;
+                ++newBlockCount;
+            }
+
+            stream.sendAcquireBlockRequestsToServer(blockRequests.front(), firstNewBlockReq, newBlockCount);
+        }
+
+        stream.state_() = STREAM_STATE_OPEN_STREAMING;
+
+        return static_cast<STREAMTYPE*>(resultQueueReq);
+    }
+
+    void close()
+    {
+        // (Don't poll state, just dispose current state)
+
+        if (state_()==STREAM_STATE_OPENING) {
+            // Still waiting for OPEN_FILE to return. Send the result queue to the server for cleanup.
+            openFileReqLink_() = 0;
+            freeStreamExtReq();
+
+            resultQueueReq_->requestType = FileIoRequest::CLEANUP_RESULT_QUEUE;
+            ::sendFileIoRequestToServer(resultQueueReq_);
+            resultQueueReq_ = 0;
+        } else {
+            // Stream is open. The prefetch queue may contain requests.
+
+            // Dispose the prefetch queue, if it's populated
+
+            flushPrefetchQueue();
+
+            freeStreamExtReq();
+
+            // Clean up the next file's open file request (sequence streams). If it's still in 
+            // flight, it is cleaned up with the result queue.
+
+            if (FileIoRequest *nextFileReq = nextFileReqLink_()) {
+                nextFileReqLink_() = 0;
+                if (nextFileReq->clientInt == 0) // (see nextFileIsOpening_())
+                    closeFileOfOpenFileRequest(nextFileReq);
+            }
+
+            // Clean up the open file request
 
-        BlockReq::initAcquire( firstBlockReq, openFileReq()->openFile.fileHandle, blockFilePositionBytes, resultQueueReq_ );
+            {
+                FileIoRequest *openFileReq = openFileReqLink_();
+                openFileReqLink_() = 0;
+                closeFileOfOpenFileRequest(openFileReq);
+            }
+
+            // Clean up the result queue
+
+            if (resultQueue().expectedResultCount() > 0) {
+                // Send the result queue to the server for cleanup
+                resultQueueReq_->requestType = FileIoRequest::CLEANUP_RESULT_QUEUE;
+                ::sendFileIoRequestToServer(resultQueueReq_);
+                resultQueueReq_ = 0;
+            } else {
+                freeFileIoRequest(resultQueueReq_);
+                resultQueueReq_ = 0;
+            }
+        }
+    }
+
+    // Seek optimisation: when the block containing the new position is already in the prefetch 
+    // queue, keep it and the blocks that follow it (READY or PENDING). Only the blocks before 
+    // it are released, and only the missing blocks at the tail are requested. A seek within 
+    // the front block performs no I/O at all.
+
+    bool canSeekWithinPrefetchQueue( FileIoPosition blockFilePositionBytes )
+    {
+        if (!prefetchQueueHead_())
+            return false;
+
+        // A sequence stream's prefetch queue may continue into the next file. Positions are positions in the current file.
+        if (BlockReq::fileHandle(prefetchQueueTail_()) != openFileReq()->openFile.fileHandle)
+            return false;
 
-        BlockReq::bytesCopied_(firstBlockReq) = pos - blockFilePositionBytes; // compensate for block-size-aligned request
+        return (prefetchQueueIndexOf(blockFilePositionBytes) >= 0);
+    }
+
+    // The prefetch queue holds blocks one stride apart, so the index of the block at
+    // blockFilePositionBytes follows from its distance from the head. Returns -1 if the block isn't in the queue.
+    int64_t prefetchQueueIndexOf( FileIoPosition blockFilePositionBytes )
+    {
+        const int64_t strideBytes = (int64_t)blockStride_() * (int64_t)blockSizeBytes_();
+        const int64_t offsetBytes = (int64_t)(blockFilePositionBytes - BlockReq::filePosition(prefetchQueueHead_()));
+        if (offsetBytes % strideBytes != 0)
+            return -1;
+
+        const int64_t index = offsetBytes / strideBytes;
+        return (index >= 0 && index < (int64_t)prefetchQueueLength_()) ? index : -1;
+    }
+
+    int seekWithinPrefetchQueue( FileIoPosition pos, FileIoPosition blockFilePositionBytes )
+    {
+        // Allocate requests for the missing tail blocks first, so that failure leaves the stream unchanged.
+        // (Reading backwards, fewer blocks may remain before the start of the file. The excess requests are freed.)
+
+        size_t retainedBlockCount = prefetchQueueLength_() - (size_t)prefetchQueueIndexOf(blockFilePositionBytes);
+        size_t missingBlockCount = (retainedBlockCount < prefetchBlockCount_()) ? prefetchBlockCount_() - retainedBlockCount : 0;
+
+        QwSList<FileIoRequest*, FileIoRequest::TRANSIT_NEXT_LINK_INDEX> newBlockRequests;
+        for (size_t i=0; i < missingBlockCount; ++i) {
+            FileIoRequest *blockReq = allocRequest();
+            if (!blockReq) {
+                // Fail. couldn't allocate request. Rollback.
+                while (!newBlockRequests.empty()) {
+                    FileIoRequest *r = newBlockRequests.front();
+                    newBlockRequests.pop_front();
+                    freeRequest(r);
+                }
+
+                state_() = STREAM_STATE_ERROR;
+                return -1;
+            }
+            newBlockRequests.push_front(blockReq);
+        }
+
+        // Release the blocks before the new front block, and any blocks past the target length 
+        // (the target may have shrunk). Send them to the server in a single operation.
+
+        transit_list_t releasedBlockRequests;
+
+        while (BlockReq::filePosition(prefetchQueue_front()) != blockFilePositionBytes) {
+            FileIoRequest *blockReq = prefetchQueue_front();
+            prefetchQueue_pop_front();
+            flushBlock(blockReq,
+                    std::bind1st(std::mem_fun(&transit_list_t::push_front), &releasedBlockRequests));
+        }
+
+        // Rewind the retained blocks. Copying resumes at pos.
+        {
+            FileIoRequest *blockReq = prefetchQueue_front();
+            FileIoRequest *lastRetainedBlockReq = 0;
+            for (size_t i=0; blockReq && i < prefetchBlockCount_(); ++i) {
+                BlockReq::bytesCopied_(blockReq) = 0;
+                lastRetainedBlockReq = blockReq;
+                blockReq = BlockReq::next_(blockReq);
+            }
+
+            // blockReq is now the first excess block (if any)
+            if (blockReq) {
+                BlockReq::next_(lastRetainedBlockReq) = 0;
+                prefetchQueueTail_() = lastRetainedBlockReq;
+                while (blockReq) {
+                    FileIoRequest *next = BlockReq::next_(blockReq);
+                    BlockReq::next_(blockReq) = 0;
+                    --prefetchQueueLength_();
+                    flushBlock(blockReq,
+                            std::bind1st(std::mem_fun(&transit_list_t::push_front), &releasedBlockRequests));
+                    blockReq = next;
+                }
+            }
+
+            BlockReq::bytesCopied_(prefetchQueue_front()) = (size_t)(pos - blockFilePositionBytes);
+        }
+
+        if (!releasedBlockRequests.empty())
+            ::sendFileIoRequestsToServer(releasedBlockRequests.front(), releasedBlockRequests.back());
+
+        // Request the missing tail blocks
+
+        if (missingBlockCount > 0) {
+            const FileIoDeadline now = getFileIoServerTimeMicroseconds();
+
+            QwSList<FileIoRequest*, FileIoRequest::TRANSIT_NEXT_LINK_INDEX> blockRequests;
+            FileIoRequest *firstNewBlockReq = 0;
+            size_t newBlockCount = 0;
+            while (!newBlockRequests.empty() && canRequestNextSequentialBlock()) {
+                FileIoRequest *blockReq = newBlockRequests.front();
+                newBlockRequests.pop_front();
+
+                initAndLinkSequentialAcquireBlockRequest(blockReq, blockRequestDeadline(now, prefetchQueueLength_()));
+                blockRequests.push_front(blockReq);
+                if (!firstNewBlockReq)
+                    firstNewBlockReq = blockReq;
+                ++newBlockCount;
+            }
+
+            while (!newBlockRequests.empty()) {
+                FileIoRequest *r = newBlockRequests.front();
+                newBlockRequests.pop_front();
+                freeRequest(r);
+            }
+
+            if (newBlockCount > 0)
+                sendAcquireBlockRequestsToServer(blockRequests.front(), firstNewBlockReq, newBlockCount);
+        }
+
+        state_() = (waitingForBlocksCount_() == 0) ? STREAM_STATE_OPEN_STREAMING : STREAM_STATE_OPEN_BUFFERING;
+
+        return 0;
+    }
+
+    int seek( FileIoPosition pos )
+    {
+        if (state_() == STREAM_STATE_OPENING || state_() == STREAM_STATE_ERROR)
+            return -1;
+
+        // Request blocks on block-size-aligned boundaries, relative to the start of the sample data.
+        // From here on positions are file positions.
+        FileIoPosition blockFilePositionBytes = dataOffset_() + roundDownToBlockSizeAlignedPosition(pos);
+        pos += dataOffset_();
+
+        if (canSeekWithinPrefetchQueue(blockFilePositionBytes))
+            return seekWithinPrefetchQueue(pos, blockFilePositionBytes);
+
+        // Otherwise: dump all blocks from the prefetch queue, then request the needed blocks.
+
+        flushPrefetchQueue();
+
+        const size_t prefetchQueueBlockCount = prefetchBlockCount_();
+
+        // The first block is needed immediately. Subsequent blocks are needed one block duration apart.
+        const FileIoDeadline now = getFileIoServerTimeMicroseconds();
+
+        // request the first block 
+
+        FileIoRequest *firstBlockReq = allocRequest();
+        if (!firstBlockReq) {
+            state_() = STREAM_STATE_ERROR;
+            return -1;
+        }
+
+        BlockReq::initAcquire( firstBlockReq, openFileReq()->openFile.fileHandle, blockFilePositionBytes, now, resultQueueReq_ );
+
+        BlockReq::bytesCopied_(firstBlockReq) = (size_t)(pos - blockFilePositionBytes); // compensate for block-size-aligned request
         
         prefetchQueueHead_() = firstBlockReq;
         prefetchQueueTail_() = firstBlockReq;
+        prefetchQueueLength_() = 1;
 
         // Optimisation: enqueue all block requests at once. First link them into a list, then enqueue them.
         // This minimises contention on the communication queue by only invoking a single push operation.
@@ -623,8 +1485,9 @@ public:
         BlockReq::transitNext_(firstBlockReq) = 0;
         blockRequests.push_front(firstBlockReq);
     
-        for (int i=1; i < prefetchQueueBlockCount; ++i) {
-            FileIoRequest *blockReq = allocFileIoRequest();
+        size_t blockCount = 1;
+        for (; blockCount < prefetchQueueBlockCount && canRequestNextSequentialBlock(); ++blockCount) {
+            FileIoRequest *blockReq = allocRequest();
             if (!blockReq) {
                 // Fail. couldn't allocate request.
 
@@ -632,18 +1495,21 @@ public:
                 while (!blockRequests.empty()) {
                     FileIoRequest *r = blockRequests.front();
                     blockRequests.pop_front();
-                    freeFileIoRequest(r);
+                    freeRequest(r);
                 }
+                prefetchQueueHead_() = 0;
+                prefetchQueueTail_() = 0;
+                prefetchQueueLength_() = 0;
 
                 state_() = STREAM_STATE_ERROR;
                 return -1;
             }
 
-            initAndLinkSequentialAcquireBlockRequest(blockReq);
+            initAndLinkSequentialAcquireBlockRequest(blockReq, blockRequestDeadline(now, blockCount));
             blockRequests.push_front(blockReq);
         }
 
-        sendAcquireBlockRequestsToServer(blockRequests.front(), firstBlockReq, prefetchQueueBlockCount);
+        sendAcquireBlockRequestsToServer(blockRequests.front(), firstBlockReq, blockCount);
         
         state_() = STREAM_STATE_OPEN_BUFFERING;
 
@@ -653,6 +1519,185 @@ public:
     typedef typename BlockReq::user_items_ptr_t user_items_ptr_t;
 
     size_t read_or_write( user_items_ptr_t userItemsPtr, size_t itemSizeBytes, size_t itemCount ) // for a read stream this is read(), for a write stream this is write()
+    {
+        typename BlockReq::CopyItems copyItems(userItemsPtr, itemSizeBytes);
+        return transferItems(copyItems, itemSizeBytes, itemCount);
+    }
+
+    // Read stream only. Converts interleaved frames out of the data blocks directly into the client's float buffers.
+    size_t readFrames( float *const *dest, FileIoChannelLayout destLayout, 
+            FileIoSampleFormat srcFormat, size_t channelCount, size_t frameCount )
+    {
+        ConvertSamplesToFloat32 convertSamples(dest, destLayout, srcFormat, channelCount);
+        return transferItems(convertSamples, bytesPerSample(srcFormat)*channelCount, frameCount);
+    }
+
+    void countUnderrunIfBuffering()
+    {
+        if (state_() == STREAM_STATE_OPEN_BUFFERING)
+            mint_store_32_relaxed(&underrunCount_(), mint_load_32_relaxed(&underrunCount_()) + 1);
+    }
+
+    template< typename ItemTransfer >
+    size_t transferItems( ItemTransfer& transfer, size_t itemSizeBytes, size_t itemCount )
+    {
+        if (!beginTransfer())
+            return 0;
+
+        const size_t maxItemsToCopy = itemCount;
+        size_t itemsCopiedSoFar = 0;
+
+        while (itemsCopiedSoFar < maxItemsToCopy) {
+            FileIoRequest *frontBlockReq = readyFrontBlock();
+            if (!frontBlockReq) {
+                countUnderrunIfBuffering();
+                return itemsCopiedSoFar; // buffering or error
+            }
+
+            // copy data to/from the client (via transfer) and the front block in the prefetch queue
+
+            size_t itemsRemainingToCopy = maxItemsToCopy - itemsCopiedSoFar;
+
+            size_t itemsCopied = 0;
+            typename BlockReq::CopyStatus copyStatus = BlockReq::copyBlockData(frontBlockReq, transfer, itemsRemainingToCopy, itemSizeBytes, &itemsCopied);
+
+            itemsCopiedSoFar += itemsCopied;
+
+            switch (copyStatus) {
+            case BlockReq::AT_BLOCK_END:
+                if (!advanceToNextBlock())
+                    return itemsCopiedSoFar; // advance failed
+
+#if 0
+                // To reduce latency on streaming reads we could check for new results here.
+                // This is especially useful if itemCount > items per block or if the server
+                // can run faster than the stream.
+                receiveOneBlock();
+#endif
+                break;
+            case BlockReq::AT_FINAL_BLOCK_END:
+                if (blockStride_() < 0) {
+                    // Reading backwards, the final block of the file is followed by the block before it
+                    if (!advanceToNextBlock())
+                        return itemsCopiedSoFar; // advance failed, or at the start of the file
+                    break;
+                }
+
+                if (nextFileReq()) {
+                    // Sequence stream: continue with the next file
+                    if (!advanceToNextFile()) {
+                        countUnderrunIfBuffering();
+                        return itemsCopiedSoFar; // buffering or error
+                    }
+                    break;
+                }
+
+                state_() = STREAM_STATE_OPEN_EOF;
+                return itemsCopiedSoFar;
+                break;
+            case BlockReq::CAN_CONTINUE:
+                /* NOTHING */
+                break;
+            case BlockReq::NEED_NEXT_BLOCK:
+                {
+                    // The next item straddles the front block and the block after it.
+                    // (With a stride other than 1 the next block doesn't follow the front block in the file.)
+                    if (itemSizeBytes > IO_MAX_STRADDLING_ITEM_SIZE_BYTES || blockStride_() != 1) {
+                        error_() = EINVAL;
+                        state_() = STREAM_STATE_ERROR;
+                        return itemsCopiedSoFar;
+                    }
+
+                    if (BlockReq::fileHandle(BlockReq::next_(frontBlockReq)) != BlockReq::fileHandle(frontBlockReq)) {
+                        // Sequence stream: the front block is the (full) final block of the current 
+                        // file, and the next block belongs to the next file. Drop the partial item.
+                        if (!advanceToNextBlock())
+                            return itemsCopiedSoFar; // advance failed
+                        break;
+                    }
+
+                    FileIoRequest *nextBlockReq = readyBlock(BlockReq::next_(frontBlockReq));
+                    if (!nextBlockReq) {
+                        countUnderrunIfBuffering();
+                        return itemsCopiedSoFar; // buffering or error
+                    }
+
+                    if (BlockReq::copyStraddlingItem(frontBlockReq, nextBlockReq, transfer, itemSizeBytes) == BlockReq::AT_FINAL_BLOCK_END) {
+                        if (nextFileReq()) {
+                            // Sequence stream: the file ends part way through the item. Drop the partial 
+                            // item, the stream continues with the next file once the final block is consumed.
+                            BlockReq::bytesCopied_(nextBlockReq) += BlockReq::blockBytesAvailable(nextBlockReq);
+                            if (!advanceToNextBlock())
+                                return itemsCopiedSoFar; // advance failed
+                            break;
+                        }
+
+                        state_() = STREAM_STATE_OPEN_EOF;
+                        return itemsCopiedSoFar;
+                    }
+                    ++itemsCopiedSoFar;
+
+                    if (!advanceToNextBlock())
+                        return itemsCopiedSoFar; // advance failed
+                }
+                break;
+            }
+        }
+
+        assert( itemsCopiedSoFar == maxItemsToCopy );
+        return maxItemsToCopy;
+    }
+
+    // Zero-copy access to the front block. peek() returns a pointer to the unconsumed part of
+    // the front block, advance() consumes bytes from it. For a read stream the data is
+    // read-only. For a write stream the client writes into the block then calls advance() to
+    // commit what was written.
+
+    void peek( typename BlockReq::block_data_ptr_t *data, size_t *byteCount )
+    {
+        *data = 0;
+        *byteCount = 0;
+
+        if (!beginTransfer())
+            return;
+
+        FileIoRequest *frontBlockReq = readyFrontBlock();
+        if (!frontBlockReq)
+            return;
+
+        while ((*byteCount = BlockReq::blockBytesAvailable(frontBlockReq)) == 0) {
+            // Only an empty final block has no bytes available. (All other blocks are 
+            // advanced past as soon as they are consumed, except for the first block of the 
+            // file when reading backwards: it stays at the front at EOF, until the stride changes.)
+            if (blockStride_() < 0 || !frontBlockReq->readBlock.isAtEof) {
+                // Continue with the next block in stride order
+                if (!advanceToNextBlock())
+                    return;
+            } else if (!nextFileReq()) {
+                state_() = STREAM_STATE_OPEN_EOF;
+                return;
+            } else if (!advanceToNextFile()) { // Sequence stream: continue with the next file
+                return;
+            }
+
+            frontBlockReq = readyFrontBlock();
+            if (!frontBlockReq)
+                return;
+        }
+
+        *data = static_cast<int8_t*>(BlockReq::dataBlock(frontBlockReq)->data) + BlockReq::bytesCopied_(frontBlockReq);
+    }
+
+    size_t advance( size_t byteCount )
+    {
+        // The data was already transferred by the client, via the pointer returned by peek(). 
+        // Account for it with a transfer that doesn't copy anything.
+        typename BlockReq::SkipItems skipItems;
+        return transferItems(skipItems, 1, byteCount);
+    }
+
+    // Common to all transfers: process server replies and decide whether data can be transferred.
+    bool beginTransfer()
     {
         // Always process at least one expected reply from the server per read/write call by calling pollState().
         // If read_or_write() reads at most N bytes, and (IO_DATA_BLOCK_DATA_CAPACITY_BYTES/N)
@@ -664,13 +1709,17 @@ public:
 
         pollState(); // Updates state based on received replies. e.g. from BUFFERING to STREAMING
 
+        // The poll above counts against the budget for this call
+        const size_t budget = resultPollingBudget_();
+        resultsToPoll_ = (budget == 0) ? (size_t)-1 : budget - 1;
+
         switch (state_())
         {
         case STREAM_STATE_OPENING:
         case STREAM_STATE_OPEN_IDLE:
         case STREAM_STATE_OPEN_EOF:
         case STREAM_STATE_ERROR:
-            return 0;
+            return false;
             break;
 
         case STREAM_STATE_OPEN_BUFFERING:
@@ -679,94 +1728,62 @@ public:
             // pause while the stream is buffering they need to poll the state and
             // implement their own pause logic.
             {
-#if defined(IO_USE_CONSTANT_TIME_RESULT_POLLING)
-                // fall through
-#else
                 // The call to pollState() above only deals with at most one pending block.
-                // To reduce the latency of transitioning from  BUFFERING to STREAMING we can drain the result queue here.
-                // This is O(N) in the number of expected results.
+                // To reduce the latency of transitioning from  BUFFERING to STREAMING we drain the result queue here.
+                // This is O(N) in the number of expected results, unless the stream has a polling budget.
                 
-                while (receiveOneBlock()) 
+                while (receiveOneBlockWithinBudget()) 
                     /* loop until all replies have been processed */ ;
 
                 if (state_() != STREAM_STATE_OPEN_STREAMING && state_() != STREAM_STATE_OPEN_BUFFERING)
-                    return 0;
-#endif         
+                    return false;
             }
             /* FALLS THROUGH */
 
         case STREAM_STATE_OPEN_STREAMING:
-            {
-                int8_t *userBytesPtr = (int8_t*)userItemsPtr;
-                const size_t maxItemsToCopy = itemCount;
-                size_t itemsCopiedSoFar = 0;
-
-                while (itemsCopiedSoFar < maxItemsToCopy) {
-                    FileIoRequest *frontBlockReq = prefetchQueue_front();
-                    assert( frontBlockReq != 0 );
-
-#if !defined(IO_USE_CONSTANT_TIME_RESULT_POLLING)
-                    // Last-ditch effort to determine whether the front block has been returned.
-                    // O(n) in the maximum number of expected replies.
-                    // Since we always poll at least one block per read/write operation (call to
-                    // pollState() above), the following loop is not strictly necessary.
-                    // It lessens the likelihood of a buffer underrun.
-
-                    // Process replies until the front block is not pending or there are no more replies
-                    while (BlockReq::state_(frontBlockReq) == BlockReq::BLOCK_STATE_PENDING) {
-                        if (!receiveOneBlock())
-                            break;
-                    }
-#endif
-                    
-                    if (BlockReq::isReady(frontBlockReq)) {
-                        // copy data to/from userItemsPtr and the front block in the prefetch queue
-
-                        size_t itemsRemainingToCopy = maxItemsToCopy - itemsCopiedSoFar;
-
-                        size_t itemsCopied = 0;
-                        typename BlockReq::CopyStatus copyStatus = BlockReq::copyBlockData(frontBlockReq, userBytesPtr, itemsRemainingToCopy, itemSizeBytes, &itemsCopied);
-
-                        userBytesPtr += itemsCopied * itemSizeBytes;
-                        itemsCopiedSoFar += itemsCopied;
+            return true;
+            break;
+        }
 
-                        switch (copyStatus) {
-                        case BlockReq::AT_BLOCK_END:
-                            if (!advanceToNextBlock())
-                                return itemsCopiedSoFar; // advance failed
+        return false;
+    }
 
-#if 0
-                            // To reduce latency on streaming reads we could check for new results here.
-                            // This is especially useful if itemCount > items per block or if the server
-                            // can run faster than the stream.
-                            receiveOneBlock();
-#endif
-                            break;
-                        case BlockReq::AT_FINAL_BLOCK_END:
-                            state_() = STREAM_STATE_OPEN_EOF;
-                            return itemsCopiedSoFar;
-                            break;
-                        case BlockReq::CAN_CONTINUE:
-                            /* NOTHING */
-                            break;
-                        }
-                    } else if(BlockReq::state_(frontBlockReq) == BlockReq::BLOCK_STATE_PENDING) {
-                        state_() = STREAM_STATE_OPEN_BUFFERING;
-                        return itemsCopiedSoFar;
-                    } else {
-                        assert( BlockReq::state_(frontBlockReq) == BlockReq::BLOCK_STATE_ERROR );
-                        state_() = STREAM_STATE_ERROR;
-                        return itemsCopiedSoFar;
-                    }
-                }
+    // Returns the front block of the prefetch queue if it is ready to transfer data. 
+    // Otherwise updates the stream state (BUFFERING or ERROR) and returns 0.
+    FileIoRequest *readyFrontBlock()
+    {
+        return readyBlock(prefetchQueue_front());
+    }
 
-                assert( itemsCopiedSoFar == maxItemsToCopy );
-                return maxItemsToCopy;
-            }
-            break;
+    // As readyFrontBlock(), for any block in the prefetch queue
+    FileIoRequest *readyBlock( FileIoRequest *blockReq )
+    {
+        assert( blockReq != 0 );
+
+        // Last-ditch effort to determine whether the block has been returned.
+        // O(n) in the maximum number of expected replies, unless the stream has a polling budget.
+        // Since we always poll at least one block per read/write operation (call to
+        // pollState() in beginTransfer()), the following loop is not strictly necessary.
+        // It lessens the likelihood of a buffer underrun.
+
+        // Process replies until the block is not pending or there are no more replies
+        while (BlockReq::state_(blockReq) == BlockReq::BLOCK_STATE_PENDING) {
+            if (!receiveOneBlockWithinBudget())
+                break;
         }
 
-        return 0;
+        if (BlockReq::isReady(blockReq)) {
+            return blockReq;
+        } else if(BlockReq::state_(blockReq) == BlockReq::BLOCK_STATE_PENDING) {
+            if (state_() == STREAM_STATE_OPEN_STREAMING)
+                growPrefetchQueueAfterUnderrun(); // underrun. buffer more in future
+            state_() = STREAM_STATE_OPEN_BUFFERING;
+            return 0;
+        } else {
+            assert( BlockReq::state_(blockReq) == BlockReq::BLOCK_STATE_ERROR );
+            state_() = STREAM_STATE_ERROR;
+            return 0;
+        }
     }
 
     FileIoStreamState pollState()
@@ -778,6 +1795,7 @@ public:
                     
                     r->openFile.path->release();
                     r->openFile.path = 0;
+                    nextFileReqLink_() = 0; // (the transit link links the next file of a sequence stream from here on)
 
                     if (r->resultStatus==NOERROR) {
                         assert( r->openFile.fileHandle != 0 );
@@ -809,6 +1827,194 @@ public:
     {
         return error_();
     }
+
+    int getAudioFormat( FileIoAudioFormat *result )
+    {
+        if (state_() == STREAM_STATE_OPENING || openFileReq()->openFile.fileHandle == IO_INVALID_FILE_HANDLE)
+            return -1;
+
+        *result = openFileReq()->openFile.format;
+        return 0;
+    }
+
+    // Read streams. Issue the OPEN_FILE request for the file that follows the current file 
+    // (see FileIoReadStream_setNextFile()).
+    int setNextFile( SharedBuffer *path )
+    {
+        if (state_() == STREAM_STATE_OPENING || state_() == STREAM_STATE_ERROR || nextFileReq() != 0)
+            return -1;
+
+        FileIoRequest *nextFileReq = allocFileIoRequest();
+        if (!nextFileReq)
+            return -1;
+
+        nextFileReq->links_[FileIoRequest::CLIENT_NEXT_LINK_INDEX] = 0;
+        nextFileReq->resultStatus = 0;
+        nextFileReq->requestType = FileIoRequest::OPEN_FILE;
+        path->addRef();
+        nextFileReq->openFile.path = path;
+        nextFileReq->openFile.openMode = (openFileReq()->openFile.openMode == FileIoRequest::READ_ONLY_MAPPED_OPEN_MODE)
+                ? FileIoRequest::READ_ONLY_MAPPED_OPEN_MODE : FileIoRequest::READ_ONLY_OPEN_MODE;
+        nextFileReq->openFile.usesResultQueueWorker = true; // (the stream's results are posted by a single worker)
+        nextFileReq->openFile.blockSizeBytes = blockSizeBytes_();
+        nextFileReq->openFile.fileHandle = IO_INVALID_FILE_HANDLE;
+        nextFileReq->openFile.resultQueue = resultQueueReq_;
+        initHeaderlessAudioFormat(&nextFileReq->openFile.format); // (returned by the server)
+
+        nextFileReqLink_() = nextFileReq;
+        nextFileIsOpening_() = 1;
+
+        ::sendFileIoRequestToServer(nextFileReq);
+        resultQueue().incrementExpectedResultCount();
+
+        // If the stream has already reached the end of the current file, it buffers until the next file's blocks arrive
+        if (state_() == STREAM_STATE_OPEN_EOF && blockStride_() > 0)
+            state_() = STREAM_STATE_OPEN_BUFFERING;
+
+        return 0;
+    }
+
+    // Read streams. Change the prefetch stride (see FileIoReadStream_setBlockStride()). The front 
+    // block is kept, along with the queued blocks that lie on the new stride from it, in their 
+    // new order. The other blocks are released and the missing blocks are requested.
+    int setBlockStride( int blockStride )
+    {
+        if (blockStride == 0 || state_() == STREAM_STATE_ERROR)
+            return -1;
+
+        if (blockStride == blockStride_())
+            return 0;
+
+        if (!prefetchQueueHead_()) { // (opening, or not seeked yet)
+            blockStride_() = blockStride;
+            return 0;
+        }
+
+        // Index the blocks that follow the front block by their distance from it, in old strides.
+        // A sequence stream's queue may continue into the next file, its blocks are all requested again.
+
+        FileIoRequest *oldBlockReqs[IO_MAX_PREFETCH_QUEUE_BLOCK_COUNT + 1];
+        const size_t oldBlockCount = prefetchQueueLength_() - 1;
+        assert( oldBlockCount <= IO_MAX_PREFETCH_QUEUE_BLOCK_COUNT + 1 );
+        FileIoRequest *frontBlockReq = prefetchQueue_front();
+        {
+            FileIoRequest *blockReq = BlockReq::next_(frontBlockReq);
+            for (size_t i=0; i < oldBlockCount; ++i) {
+                oldBlockReqs[i] = blockReq;
+                blockReq = BlockReq::next_(blockReq);
+            }
+        }
+        const bool canKeepBlocks = (nextFileReq() == 0);
+
+        const int64_t frontOffsetBytes = (int64_t)(BlockReq::filePosition(frontBlockReq) - dataOffset_());
+        const int64_t oldStrideBytes = (int64_t)blockStride_() * (int64_t)blockSizeBytes_();
+        const int64_t newStrideBytes = (int64_t)blockStride * (int64_t)blockSizeBytes_();
+
+        // Plan the new queue: the front block, then up to the target length of blocks one new stride 
+        // apart (reading backwards, the queue ends at the start of the file). oldBlockIndex[k] is the 
+        // index in oldBlockReqs of the block kept as block k, or -1 if block k must be requested.
+        
+        int oldBlockIndex[IO_MAX_PREFETCH_QUEUE_BLOCK_COUNT];
+        size_t blockCount = 1;
+        size_t missingBlockCount = 0;
+        for (; blockCount < prefetchBlockCount_(); ++blockCount) {
+            const int64_t offsetBytes = (int64_t)blockCount * newStrideBytes;
+            if (frontOffsetBytes + offsetBytes < 0)
+                break;
+
+            oldBlockIndex[blockCount] = -1;
+            if (canKeepBlocks && offsetBytes % oldStrideBytes == 0) {
+                const int64_t i = offsetBytes / oldStrideBytes - 1;
+                if (i >= 0 && i < (int64_t)oldBlockCount)
+                    oldBlockIndex[blockCount] = (int)i;
+            }
+
+            if (oldBlockIndex[blockCount] == -1)
+                ++missingBlockCount;
+        }
+
+        // Allocate requests for the missing blocks first, so that failure leaves the stream unchanged.
+
+        QwSList<FileIoRequest*, FileIoRequest::TRANSIT_NEXT_LINK_INDEX> newBlockRequests;
+        for (size_t i=0; i < missingBlockCount; ++i) {
+            FileIoRequest *blockReq = allocRequest();
+            if (!blockReq) {
+                // Fail. couldn't allocate request. Rollback.
+                while (!newBlockRequests.empty()) {
+                    FileIoRequest *r = newBlockRequests.front();
+                    newBlockRequests.pop_front();
+                    freeRequest(r);
+                }
+
+                return -1;
+            }
+            newBlockRequests.push_front(blockReq);
+        }
+
+        // Relink the queue in the new order
+
+        blockStride_() = blockStride;
+
+        BlockReq::next_(frontBlockReq) = 0;
+        prefetchQueueTail_() = frontBlockReq;
+        prefetchQueueLength_() = 1;
+
+        const FileIoDeadline now = getFileIoServerTimeMicroseconds();
+        QwSList<FileIoRequest*, FileIoRequest::TRANSIT_NEXT_LINK_INDEX> blockRequests;
+        FileIoRequest *firstNewBlockReq = 0;
+        for (size_t k=1; k < blockCount; ++k) {
+            if (oldBlockIndex[k] != -1) {
+                FileIoRequest *blockReq = oldBlockReqs[oldBlockIndex[k]];
+                oldBlockReqs[oldBlockIndex[k]] = 0;
+                BlockReq::next_(blockReq) = 0;
+                prefetchQueue_push_back(blockReq);
+            } else {
+                FileIoRequest *blockReq = newBlockRequests.front();
+                newBlockRequests.pop_front();
+
+                initAndLinkSequentialAcquireBlockRequest(blockReq, blockRequestDeadline(now, k));
+                blockRequests.push_front(blockReq);
+                if (!firstNewBlockReq)
+                    firstNewBlockReq = blockReq;
+            }
+        }
+
+        // Release the blocks that weren't kept. Send them to the server in a single operation.
+
+        transit_list_t releasedBlockRequests;
+        for (size_t i=0; i < oldBlockCount; ++i) {
+            if (oldBlockReqs[i]) {
+                BlockReq::next_(oldBlockReqs[i]) = 0;
+                flushBlock(oldBlockReqs[i],
+                        std::bind1st(std::mem_fun(&transit_list_t::push_front), &releasedBlockRequests));
+            }
+        }
+
+        if (!releasedBlockRequests.empty())
+            ::sendFileIoRequestsToServer(releasedBlockRequests.front(), releasedBlockRequests.back());
+
+        if (missingBlockCount > 0)
+            sendAcquireBlockRequestsToServer(blockRequests.front(), firstNewBlockReq, missingBlockCount);
+
+        // (A stream at EOF may have more blocks to read in the new direction.)
+        state_() = (waitingForBlocksCount_() == 0) ? STREAM_STATE_OPEN_STREAMING : STREAM_STATE_OPEN_BUFFERING;
+
+        return 0;
+    }
+
+    void setResultPollingBudget( size_t maxResultsPerCall )
+    {
+        resultPollingBudget_() = maxResultsPerCall;
+    }
+
+    void getStats( FileIoStreamStats *result ) // (any thread)
+    {
+        result->underrunCount = mint_load_32_relaxed(&underrunCount_());
+        uint32_t minPrefetchSlackBlockCount = mint_load_32_relaxed(&minPrefetchSlackBlockCount_());
+        result->minPrefetchSlackBlockCount = (minPrefetchSlackBlockCount == 0xFFFFFFFFu) ? (size_t)-1 : minPrefetchSlackBlockCount;
+        result->maxResultQueueDepth = mint_load_32_relaxed(&maxResultQueueDepth_());
+        result->maxResultsRetiredPerCall = mint_load_32_relaxed(&maxResultsRetiredPerCall_());
+    }
 };
 
 
@@ -821,12 +2027,32 @@ READSTREAM *FileIoReadStream_open( SharedBuffer *path, FileIoRequest::OpenMode o
     return FileIoReadStreamWrapper::open(path, openMode);
 }
 
+READSTREAM *FileIoReadStream_open( SharedBuffer *path, FileIoRequest::OpenMode openMode, size_t bytesPerSecond, double bufferingSeconds, size_t blockSizeBytes )
+{
+    return FileIoReadStreamWrapper::open(path, openMode, bytesPerSecond, bufferingSeconds, blockSizeBytes);
+}
+
 void FileIoReadStream_close( READSTREAM *fp )
 {
     FileIoReadStreamWrapper(fp).close();
 }
 
-int FileIoReadStream_seek( READSTREAM *fp, size_t pos )
+int FileIoReadStream_getAudioFormat( READSTREAM *fp, FileIoAudioFormat *result )
+{
+    return FileIoReadStreamWrapper(fp).getAudioFormat(result);
+}
+
+int FileIoReadStream_setNextFile( READSTREAM *fp, SharedBuffer *path )
+{
+    return FileIoReadStreamWrapper(fp).setNextFile(path);
+}
+
+int FileIoReadStream_setBlockStride( READSTREAM *fp, int blockStride )
+{
+    return FileIoReadStreamWrapper(fp).setBlockStride(blockStride);
+}
+
+int FileIoReadStream_seek( READSTREAM *fp, FileIoPosition pos )
 {
     return FileIoReadStreamWrapper(fp).seek(pos);
 }
@@ -836,6 +2062,35 @@ size_t FileIoReadStream_read( void *dest, size_t itemSize, size_t itemCount, REA
     return FileIoReadStreamWrapper(fp).read_or_write(dest, itemSize, itemCount);
 }
 
+size_t FileIoReadStream_readFrames( float *const *dest, FileIoChannelLayout destLayout, 
+        FileIoSampleFormat srcFormat, size_t channelCount, size_t frameCount, READSTREAM *fp )
+{
+    return FileIoReadStreamWrapper(fp).readFrames(dest, destLayout, srcFormat, channelCount, frameCount);
+}
+
+void FileIoReadStream_readBatch( FileIoReadStreamBatchRead *reads, size_t readCount )
+{
+    transit_list_t requestBatch;
+
+    for (size_t i=0; i < readCount; ++i) {
+        FileIoReadStreamBatchRead& read = reads[i];
+        read.itemsRead = FileIoReadStreamWrapper(read.stream, &requestBatch).read_or_write(read.dest, read.itemSize, read.itemCount);
+    }
+
+    if (!requestBatch.empty())
+        ::sendFileIoRequestBatchToServer(requestBatch.front(), requestBatch.back());
+}
+
+void FileIoReadStream_peek( READSTREAM *fp, const void **data, size_t *byteCount )
+{
+    FileIoReadStreamWrapper(fp).peek(data, byteCount);
+}
+
+size_t FileIoReadStream_advance( READSTREAM *fp, size_t byteCount )
+{
+    return FileIoReadStreamWrapper(fp).advance(byteCount);
+}
+
 FileIoStreamState FileIoReadStream_pollState( READSTREAM *fp )
 {
     return FileIoReadStreamWrapper(fp).pollState();
@@ -846,6 +2101,47 @@ int FileIoReadStream_getError( READSTREAM *fp )
     return FileIoReadStreamWrapper(fp).getError();
 }
 
+void FileIoReadStream_getStats( READSTREAM *fp, FileIoStreamStats *result )
+{
+    FileIoReadStreamWrapper(fp).getStats(result);
+}
+
+void FileIoReadStream_setResultPollingBudget( READSTREAM *fp, size_t maxResultsPerCall )
+{
+    FileIoReadStreamWrapper(fp).setResultPollingBudget(maxResultsPerCall);
+}
+
+
+// sample handle
+
+SAMPLEHANDLE *FileIoSampleHandle_open( SharedBuffer *path, size_t bytesPerSecond, double headSeconds, size_t blockSizeBytes )
+{
+    // The handle is a read stream whose prefetch queue is the head (see FileIoStreamWrapper::pollSampleHandleState())
+    return FileIoReadStreamWrapper::open(path, FileIoRequest::READ_ONLY_OPEN_MODE, bytesPerSecond, headSeconds, blockSizeBytes);
+}
+
+void FileIoSampleHandle_close( SAMPLEHANDLE *handle )
+{
+    FileIoReadStreamWrapper(handle).close();
+}
+
+FileIoStreamState FileIoSampleHandle_pollState( SAMPLEHANDLE *handle )
+{
+    FileIoStreamState state = FileIoReadStreamWrapper(handle).pollSampleHandleState();
+    // (the handle is buffering while it loads the head. report that as opening)
+    return (state == STREAM_STATE_OPEN_IDLE || state == STREAM_STATE_OPEN_BUFFERING) ? STREAM_STATE_OPENING : state;
+}
+
+int FileIoSampleHandle_getError( SAMPLEHANDLE *handle )
+{
+    return FileIoReadStreamWrapper(handle).getError();
+}
+
+READSTREAM *FileIoReadStream_openFromSampleHandle( SAMPLEHANDLE *handle, size_t bytesPerSecond, double bufferingSeconds )
+{
+    return FileIoReadStreamWrapper::openFromSampleHandle(handle, bytesPerSecond, bufferingSeconds);
+}
+
 
 // write stream
 
@@ -856,12 +2152,23 @@ WRITESTREAM *FileIoWriteStream_open( SharedBuffer *path, FileIoRequest::OpenMode
     return FileIoWriteStreamWrapper::open(path, openMode);
 }
 
+WRITESTREAM *FileIoWriteStream_open( SharedBuffer *path, FileIoRequest::OpenMode openMode, size_t bytesPerSecond, double bufferingSeconds, size_t blockSizeBytes )
+{
+    return FileIoWriteStreamWrapper::open(path, openMode, bytesPerSecond, bufferingSeconds, blockSizeBytes);
+}
+
+WRITESTREAM *FileIoWriteStream_openAudioFile( SharedBuffer *path, FileIoRequest::OpenMode openMode, const FileIoAudioFormat *format,
+        size_t bytesPerSecond, double bufferingSeconds, size_t blockSizeBytes )
+{
+    return FileIoWriteStreamWrapper::open(path, openMode, bytesPerSecond, bufferingSeconds, blockSizeBytes, format);
+}
+
 void FileIoWriteStream_close( WRITESTREAM *fp )
 {
     FileIoWriteStreamWrapper(fp).close();
 }
 
-int FileIoWriteStream_seek( WRITESTREAM *fp, size_t pos )
+int FileIoWriteStream_seek( WRITESTREAM *fp, FileIoPosition pos )
 {
     return FileIoWriteStreamWrapper(fp).seek(pos);
 }
@@ -871,6 +2178,16 @@ size_t FileIoWriteStream_write( const void *src, size_t itemSize, size_t itemCou
     return FileIoWriteStreamWrapper(fp).read_or_write(src, itemSize, itemCount);
 }
 
+void FileIoWriteStream_peek( WRITESTREAM *fp, void **data, size_t *byteCount )
+{
+    FileIoWriteStreamWrapper(fp).peek(data, byteCount);
+}
+
+size_t FileIoWriteStream_advance( WRITESTREAM *fp, size_t byteCount )
+{
+    return FileIoWriteStreamWrapper(fp).advance(byteCount);
+}
+
 FileIoStreamState FileIoWriteStream_pollState( WRITESTREAM *fp )
 {
     return FileIoWriteStreamWrapper(fp).pollState();
@@ -880,3 +2197,13 @@ int FileIoWriteStream_getError( WRITESTREAM *fp )
 {
     return FileIoWriteStreamWrapper(fp).getError();
 }
+
+void FileIoWriteStream_getStats( WRITESTREAM *fp, FileIoStreamStats *result )
+{
+    FileIoWriteStreamWrapper(fp).getStats(result);
+}
+
+void FileIoWriteStream_setResultPollingBudget( WRITESTREAM *fp, size_t maxResultsPerCall )
+{
+    FileIoWriteStreamWrapper(fp).setResultPollingBudget(maxResultsPerCall);
+}
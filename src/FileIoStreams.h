@@ -24,9 +24,17 @@
 
 #include "FileIoRequest.h"
 #include "SharedBuffer.h"
+#include "DataBlock.h"
+#include "SampleFormatConversion.h"
 
 // NOTE: all functions declared here are real-time safe
 
+// Items (and frames) read or written by a stream needn't divide the block size: an item that 
+// straddles two blocks is assembled in a small buffer on the stack. Items larger than this 
+// must divide the block size, otherwise the stream goes into the error state (EINVAL) when 
+// it reaches the first item that straddles two blocks.
+#define IO_MAX_STRADDLING_ITEM_SIZE_BYTES   (256)
+
 enum FileIoStreamState {
     // stream states
 
@@ -38,6 +46,14 @@ enum FileIoStreamState {
     STREAM_STATE_ERROR,
 };
 
+// Stream instrumentation, for tuning buffering. (see also getFileIoServerStats)
+struct FileIoStreamStats {
+    std::size_t underrunCount;              // reads/writes that transferred less than requested because the stream was buffering
+    std::size_t minPrefetchSlackBlockCount; // fewest ready blocks behind the front block when a block was retired. (size_t)-1 until then
+    std::size_t maxResultQueueDepth;        // most block requests that the stream has been waiting on at one time
+    std::size_t maxResultsRetiredPerCall;   // most server results retired by one call (see FileIoReadStream_setResultPollingBudget)
+};
+
 
 // read stream
 
@@ -45,35 +61,163 @@ typedef void READSTREAM;
 
 READSTREAM *FileIoReadStream_open( SharedBuffer *path, FileIoRequest::OpenMode openMode ); 
 
+// bytesPerSecond is the rate at which the client will consume data. The stream prefetches enough 
+// blocks to buffer bufferingSeconds of data. If the stream underruns it buffers more, 
+// returning to bufferingSeconds when the server is keeping up.
+// blockSizeBytes is rounded up to a power of two between IO_MIN_DATA_BLOCK_CAPACITY_BYTES and 
+// IO_MAX_DATA_BLOCK_CAPACITY_BYTES. Use large blocks for high bandwidth streams, small blocks 
+// for low rate or low latency streams. (see also FileIoServerConfig::dataBlockCounts)
+READSTREAM *FileIoReadStream_open( SharedBuffer *path, FileIoRequest::OpenMode openMode, size_t bytesPerSecond, double bufferingSeconds,
+        size_t blockSizeBytes=IO_DATA_BLOCK_DATA_CAPACITY_BYTES ); 
+
 void FileIoReadStream_close( READSTREAM *fp );
 
-int FileIoReadStream_seek( READSTREAM *fp, size_t pos ); // returns non-zero if there's a problem
+// Audio files (WAV, AIFF, CAF) are parsed when they are opened. Stream positions are relative to 
+// the start of the sample data, and the stream ends with the sample data. FLAC files are 
+// streamed as decoded PCM data (see FlacDecoder.h). Headerless files are streamed from the 
+// start of the file (CONTAINER_TYPE_NONE). Returns non-zero if the stream isn't open yet. 
+// (see AudioFileFormat.h)
+int FileIoReadStream_getAudioFormat( READSTREAM *fp, FileIoAudioFormat *result );
+
+// Sequence streams (gapless playback). Set the file that follows the current file. The next file
+// is opened straight away, and once the final block of the current file has been requested the
+// stream prefetches the start of the next file's sample data behind it. Reads continue across
+// the junction without buffering, provided the next file is set at least bufferingSeconds before
+// the end of the current file. When the read position enters the next file, the current file is
+// closed and the next file becomes the current file: getAudioFormat() and seek() refer to it, and
+// another next file may be set. A partial item at the end of a file is dropped, so the files
+// should share a frame format. If the stream is already at EOF it buffers, then continues with
+// the next file. Returns non-zero if the stream is opening, in the error state, or already has a
+// next file. The stream goes into the error state at the junction if the next file couldn't be opened.
+int FileIoReadStream_setNextFile( READSTREAM *fp, SharedBuffer *path );
+
+// Prefetch direction, for reverse playback and scrubbing. blockStride is the step, in blocks, from 
+// each block in the prefetch queue to the next: 1 (the default) reads forwards, -1 backwards, 2 
+// every other block forwards, and so on. Data within a block is still read forwards: when a read 
+// reaches the end of a block it continues at the start of the next block in stride order, so a 
+// client playing backwards consumes a block at a time (e.g. with peek() and advance()) and reverses 
+// it. Reading backwards, the stream reaches EOF after the first block of the sample data. Changing 
+// the stride keeps the front block and the queued blocks that lie on the new stride from it, and 
+// requests the rest. Seeking to any block in the prefetch queue keeps it and the blocks that follow 
+// it. With a stride other than 1 the item size must divide the block size (see 
+// IO_MAX_STRADDLING_ITEM_SIZE_BYTES), and a sequence stream only continues into its next file while 
+// the stride is positive. Returns non-zero if blockStride is 0, the stream is in the error state, or 
+// requests couldn't be allocated (the stream is unchanged).
+int FileIoReadStream_setBlockStride( READSTREAM *fp, int blockStride );
+
+int FileIoReadStream_seek( READSTREAM *fp, FileIoPosition pos ); // returns non-zero if there's a problem
 
 size_t FileIoReadStream_read( void *dest, size_t itemSize, size_t itemCount, READSTREAM *fp );
 
+// Read frameCount frames of channelCount interleaved srcFormat samples, converting them to float 
+// straight out of the stream's data blocks. With CHANNEL_LAYOUT_PLANAR, dest[i] receives channel i, 
+// with CHANNEL_LAYOUT_INTERLEAVED dest[0] receives interleaved frames. Returns the number of frames read.
+// Any frame size is supported (e.g. packed 24-bit stereo or 5.1), up to IO_MAX_STRADDLING_ITEM_SIZE_BYTES.
+size_t FileIoReadStream_readFrames( float *const *dest, FileIoChannelLayout destLayout, 
+        FileIoSampleFormat srcFormat, size_t channelCount, size_t frameCount, READSTREAM *fp );
+
+// Read from several streams in one call, e.g. all of the voices serviced by an audio callback.
+// Equivalent to calling FileIoReadStream_read() for each element of reads, except that the block
+// requests issued by the reads are collected and posted to the server together: one mailbox 
+// push and at most one wakeup per server worker, rather than one per request.
+struct FileIoReadStreamBatchRead {
+    READSTREAM *stream;
+    void *dest;
+    size_t itemSize;
+    size_t itemCount;
+    size_t itemsRead; // OUT
+};
+
+void FileIoReadStream_readBatch( FileIoReadStreamBatchRead *reads, size_t readCount );
+
+// Zero-copy reads. peek() returns a pointer to, and the size of, the data that is ready in the 
+// stream's front block. *byteCount is zero if no data is ready (e.g. when buffering). 
+// advance() consumes byteCount bytes (at most *byteCount) and returns the number consumed. 
+// The pointer is invalidated by advance(), read() and seek().
+void FileIoReadStream_peek( READSTREAM *fp, const void **data, size_t *byteCount );
+size_t FileIoReadStream_advance( READSTREAM *fp, size_t byteCount );
+
 FileIoStreamState FileIoReadStream_pollState( READSTREAM *fp );
 
 int FileIoReadStream_getError( READSTREAM *fp ); // returns the error code. only returns non-zero if pollState returns STREAM_STATE_ERROR
 
+void FileIoReadStream_getStats( READSTREAM *fp, FileIoStreamStats *result ); // may be called from any thread while the stream is open
+
+// Result polling. Every read/write call retires at least one result from the server. By default 
+// a call that finds the stream buffering, or the block it needs still pending, also retires every 
+// other result that has arrived: O(n) in the prefetch queue length, at the moment when the client 
+// can least afford it. A non-zero budget bounds the work: a call retires at most maxResultsPerCall 
+// results (but always one), however long the prefetch queue. Results that aren't retired wait for 
+// the next call, so the budget should be at least the number of blocks consumed per call.
+void FileIoReadStream_setResultPollingBudget( READSTREAM *fp, size_t maxResultsPerCall ); // 0 is unbounded (the default)
+
 void FileIoReadStream_test();
 
 
+// sample handle: a file whose head is held in memory, for streams that must start instantly 
+// (e.g. triggered sample playback).
+
+typedef void SAMPLEHANDLE;
+
+// Open path (read-only) and load the first headSeconds of data (at least two blocks). 
+// bytesPerSecond and blockSizeBytes are as for FileIoReadStream_open. Poll the handle until it 
+// is STREAM_STATE_OPEN_STREAMING (the head is resident) before opening streams from it.
+SAMPLEHANDLE *FileIoSampleHandle_open( SharedBuffer *path, size_t bytesPerSecond, double headSeconds,
+        size_t blockSizeBytes=IO_DATA_BLOCK_DATA_CAPACITY_BYTES );
+
+// Close the handle. All streams opened from the handle must be closed first.
+void FileIoSampleHandle_close( SAMPLEHANDLE *handle );
+
+// Returns STREAM_STATE_OPENING until the head is resident, then STREAM_STATE_OPEN_STREAMING, 
+// or STREAM_STATE_ERROR if the file couldn't be opened or read.
+FileIoStreamState FileIoSampleHandle_pollState( SAMPLEHANDLE *handle );
+
+int FileIoSampleHandle_getError( SAMPLEHANDLE *handle );
+
+// Open a read stream positioned at the start of the handle's file. The stream starts in 
+// STREAM_STATE_OPEN_STREAMING, reading the resident head, while it prefetches bufferingSeconds of 
+// the data that follows the head. It uses the handle's file and block size. Returns 0 if the 
+// head isn't resident yet, or if the request pool is exhausted. Close with FileIoReadStream_close.
+READSTREAM *FileIoReadStream_openFromSampleHandle( SAMPLEHANDLE *handle, size_t bytesPerSecond, double bufferingSeconds );
+
+
 // write stream
 
 typedef void WRITESTREAM;
 
 WRITESTREAM *FileIoWriteStream_open( SharedBuffer *path, FileIoRequest::OpenMode openMode ); 
 
+// bytesPerSecond is the rate at which the client will produce data. (see FileIoReadStream_open)
+WRITESTREAM *FileIoWriteStream_open( SharedBuffer *path, FileIoRequest::OpenMode openMode, size_t bytesPerSecond, double bufferingSeconds,
+        size_t blockSizeBytes=IO_DATA_BLOCK_DATA_CAPACITY_BYTES ); 
+
+// Record a WAV file. format->containerType must be CONTAINER_TYPE_WAV, with a little-endian sample 
+// format (its data offset and size are ignored). The header is written when the file is opened 
+// and its sizes are filled in when the file is closed. Stream positions are relative to the start 
+// of the sample data. The stream goes into the error state (EINVAL) if the format can't be written.
+WRITESTREAM *FileIoWriteStream_openAudioFile( SharedBuffer *path, FileIoRequest::OpenMode openMode, const FileIoAudioFormat *format,
+        size_t bytesPerSecond, double bufferingSeconds, size_t blockSizeBytes=IO_DATA_BLOCK_DATA_CAPACITY_BYTES );
+
 void FileIoWriteStream_close( WRITESTREAM *fp );
 
-int FileIoWriteStream_seek( WRITESTREAM *fp, size_t pos ); // returns non-zero if there's a problem
+int FileIoWriteStream_seek( WRITESTREAM *fp, FileIoPosition pos ); // returns non-zero if there's a problem
 
 size_t FileIoWriteStream_write( const void *src, size_t itemSize, size_t itemCount, WRITESTREAM *fp );
 
+// Zero-copy writes. peek() returns a pointer to, and the size of, the free space in the
+// stream's front block. The client writes into it, then calls advance() to commit the bytes written.
+// (see FileIoReadStream_peek)
+void FileIoWriteStream_peek( WRITESTREAM *fp, void **data, size_t *byteCount );
+size_t FileIoWriteStream_advance( WRITESTREAM *fp, size_t byteCount );
+
 FileIoStreamState FileIoWriteStream_pollState( WRITESTREAM *fp );
 
 int FileIoWriteStream_getError( WRITESTREAM *fp ); // returns the error code. only returns non-zero if pollState returns STREAM_STATE_ERROR
 
+void FileIoWriteStream_getStats( WRITESTREAM *fp, FileIoStreamStats *result ); // may be called from any thread while the stream is open
+
+void FileIoWriteStream_setResultPollingBudget( WRITESTREAM *fp, size_t maxResultsPerCall ); // (see FileIoReadStream_setResultPollingBudget)
+
 void FileIoWriteStream_test();
 
 
@@ -52,6 +52,7 @@ void FileIoWriteStream_test()
     printf( "writing:\n" );
 
     const int lineCount = 100000;
+    size_t totalBytesWritten = 0;
 
     // write 1000 integers in text from 0 to lineCount, one per line
     for (int i=0; i < lineCount; ++i) {
@@ -60,10 +61,9 @@ void FileIoWriteStream_test()
         std::sprintf(s, "%d\n", i);
         size_t bytesToWrite = std::strlen(s);
 
-        // write bytes out one at a time because the current implementation of write requires items to be block-aligned
-        for (size_t j=0; j <bytesToWrite; ++j) {
-            FileIoWriteStream_write( &s[j], 1, 1, fp );
-        }
+        // write each line as a single item. the item sizes don't divide the block size, so some lines straddle two blocks
+        FileIoWriteStream_write( s, bytesToWrite, 1, fp );
+        totalBytesWritten += bytesToWrite;
     }
 
     printf( "\nclosing.\n" );
@@ -92,6 +92,127 @@ void FileIoWriteStream_test()
         std::fclose(fp);
     }
 
+    // Read the test file back with a result polling budget. No call may retire more than the 
+    // budget, however deep the prefetch queue. Without a budget, a read that finds the whole 
+    // queue's results waiting retires them all.
+    {
+        printf( "\nbounded result polling...\n" );
+
+        const size_t budget = 2;
+        const size_t prefetchBlockCounts[] = { 4, 64, 64 };
+        const size_t budgets[] = { budget, budget, 0 };
+        for (int i=0; i < 3; ++i) {
+            path = SharedBufferAllocator::alloc(testFileName);
+            // a data rate of one block per second buffers prefetchBlockCounts[i] blocks
+            READSTREAM *rs = FileIoReadStream_open(path, FileIoRequest::READ_ONLY_OPEN_MODE, 
+                    IO_MIN_DATA_BLOCK_CAPACITY_BYTES, (double)prefetchBlockCounts[i], IO_MIN_DATA_BLOCK_CAPACITY_BYTES);
+            path->release();
+            assert( rs != 0 );
+
+            while (FileIoReadStream_pollState(rs) == STREAM_STATE_OPENING)
+                Sleep(10);
+
+            FileIoReadStream_setResultPollingBudget(rs, budgets[i]);
+            FileIoReadStream_seek(rs, 0);
+            Sleep(100); // let the results for the whole prefetch queue arrive: the worst case for one read
+
+            size_t bytesRead = 0;
+            while (FileIoReadStream_pollState(rs) == STREAM_STATE_OPEN_STREAMING || FileIoReadStream_pollState(rs) == STREAM_STATE_OPEN_BUFFERING) {
+                char c[512];
+                bytesRead += FileIoReadStream_read( c, 1, sizeof(c), rs );
+            }
+            assert( FileIoReadStream_pollState(rs) == STREAM_STATE_OPEN_EOF );
+            assert( bytesRead == totalBytesWritten );
+
+            FileIoStreamStats stats;
+            FileIoReadStream_getStats(rs, &stats);
+            if (budgets[i] != 0)
+                assert( stats.maxResultsRetiredPerCall <= budgets[i] );
+            else
+                assert( stats.maxResultsRetiredPerCall > budget );
+
+            FileIoReadStream_close(rs);
+        }
+    }
+
+    // Record a WAV file. The server writes the header when the file is opened, and its sizes when 
+    // it is closed. Read it back through a read stream: positions are relative to the sample data, 
+    // and the chunk that is appended after the data isn't returned.
+    {
+        printf( "\nWAV file...\n" );
+
+#ifdef WIN32
+        const char *wavFileName = "..\\..\\..\\FileIoWriteStream_test_output.wav";
+#else
+        const char *wavFileName = "../../../FileIoWriteStream_test_output.wav";
+#endif
+        FileIoAudioFormat format;
+        format.containerType = CONTAINER_TYPE_WAV;
+        format.sampleFormat = SAMPLE_FORMAT_INT16;
+        format.sampleRate = 44100;
+        format.channelCount = 2;
+
+        const int frameCount = 100000;
+
+        path = SharedBufferAllocator::alloc(wavFileName);
+        WRITESTREAM *ws = FileIoWriteStream_openAudioFile(path, FileIoRequest::READ_WRITE_OVERWRITE_OPEN_MODE, &format, 44100*4, 0.1);
+        path->release();
+        assert( ws != 0 );
+
+        while (FileIoWriteStream_pollState(ws) == STREAM_STATE_OPENING)
+            Sleep(10);
+        FileIoWriteStream_seek(ws, 0);
+
+        for (int i=0; i < frameCount; ) {
+            int16_t frame[2] = { (int16_t)i, (int16_t)-i };
+            if (FileIoWriteStream_write( frame, sizeof(frame), 1, ws ) == 1)
+                ++i;
+            else
+                Sleep(1); // buffering
+        }
+        FileIoWriteStream_close(ws);
+
+        Sleep(1000); // pray that file has been closed by now
+
+        // append a chunk after the sample data
+        FILE *fp = std::fopen(wavFileName, "ab");
+        assert( fp != 0 );
+        std::fwrite("LIST\4\0\0\0INFO", 1, 12, fp);
+        std::fclose(fp);
+
+        path = SharedBufferAllocator::alloc(wavFileName);
+        READSTREAM *rs = FileIoReadStream_open(path, FileIoRequest::READ_ONLY_OPEN_MODE);
+        path->release();
+        assert( rs != 0 );
+
+        while (FileIoReadStream_pollState(rs) == STREAM_STATE_OPENING)
+            Sleep(10);
+
+        FileIoAudioFormat readFormat;
+        int result = FileIoReadStream_getAudioFormat(rs, &readFormat);
+        assert( result == 0 );
+        assert( readFormat.containerType == CONTAINER_TYPE_WAV );
+        assert( readFormat.sampleFormat == SAMPLE_FORMAT_INT16 );
+        assert( readFormat.sampleRate == 44100 && readFormat.channelCount == 2 );
+        assert( readFormat.dataSizeBytes == (uint64_t)frameCount*4 );
+
+        const int seekFrame = 1000;
+        FileIoReadStream_seek(rs, seekFrame*4);
+        int i = seekFrame;
+        FileIoStreamState state;
+        while ((state = FileIoReadStream_pollState(rs)) == STREAM_STATE_OPEN_STREAMING || state == STREAM_STATE_OPEN_BUFFERING) {
+            int16_t frames[64*2];
+            size_t framesRead = FileIoReadStream_read( frames, 4, 64, rs );
+            for (size_t j=0; j < framesRead; ++j, ++i)
+                assert( frames[j*2] == (int16_t)i && frames[j*2 + 1] == (int16_t)-i );
+        }
+        assert( state == STREAM_STATE_OPEN_EOF );
+        assert( i == frameCount );
+        (void)result;
+
+        FileIoReadStream_close(rs);
+    }
+
     printf( "\ndone.\n" );
     
     printf( "< FileIoWriteStream_test()\n" );
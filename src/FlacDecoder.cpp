@@ -0,0 +1,709 @@
+/* 
+    Real Time File Streaming copyright (c) 2014 Ross Bencina
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+#include "FlacDecoder.h"
+
+#undef min
+#undef max
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <new> // nothrow
+
+#ifndef NOERROR
+#define NOERROR (0)
+#endif
+
+#define IO_FLAC_MAX_CHANNEL_COUNT       (8)
+#define IO_FLAC_MAX_BITS_PER_SAMPLE     (24) // decoded to at most SAMPLE_FORMAT_INT24
+
+// The compressed data is read in runs of frames, at least this much at a time
+#define IO_FLAC_MIN_INPUT_BUFFER_BYTES  (64*1024)
+
+#define IO_FLAC_MAX_FRAME_SIZE_BYTES    (16*1024*1024)
+
+namespace {
+    // Big-endian bit fields. Reading past the end of the data sets isOverrun() and returns 0 bits.
+    class BitReader {
+        const uint8_t *data_;
+        std::size_t sizeBytes_;
+        std::size_t position_; // of the next byte to load into the cache
+        uint64_t cache_; // the low cacheBits_ bits haven't been read
+        unsigned cacheBits_;
+        bool isOverrun_;
+
+        void loadByte()
+        {
+            uint8_t b = 0;
+            if (position_ < sizeBytes_)
+                b = data_[position_];
+            else
+                isOverrun_ = true;
+            ++position_;
+            cache_ = (cache_ << 8) | b;
+            cacheBits_ += 8;
+        }
+
+    public:
+        BitReader( const uint8_t *data, std::size_t sizeBytes )
+            : data_( data ), sizeBytes_( sizeBytes ), position_( 0 ), cache_( 0 ), cacheBits_( 0 ), isOverrun_( false ) {}
+
+        bool isOverrun() const { return isOverrun_; }
+
+        // Only valid at a byte boundary
+        std::size_t bytePosition() const { return position_ - cacheBits_ / 8; }
+
+        void alignToByte() { cacheBits_ -= cacheBits_ % 8; }
+
+        uint32_t readBits( unsigned n ) // n <= 32
+        {
+            while (cacheBits_ < n)
+                loadByte();
+            cacheBits_ -= n;
+            return (uint32_t)((cache_ >> cacheBits_) & (((uint64_t)1 << n) - 1));
+        }
+
+        int32_t readSigned( unsigned n ) // two's complement, n <= 32
+        {
+            if (n == 0)
+                return 0;
+            return (int32_t)(readBits(n) << (32 - n)) >> (32 - n);
+        }
+
+        uint32_t readUnary() // the number of 0 bits before the next 1 bit
+        {
+            uint32_t zeroCount = 0;
+            for (;;) {
+                uint64_t unread = cache_ & (((uint64_t)1 << cacheBits_) - 1);
+                if (unread != 0) {
+                    unsigned n = cacheBits_;
+                    while (!(unread >> (n - 1))) // the 1 bit is bit n - 1
+                        --n;
+                    zeroCount += cacheBits_ - n;
+                    cacheBits_ = n - 1;
+                    return zeroCount;
+                }
+
+                zeroCount += cacheBits_;
+                cacheBits_ = 0;
+                if (isOverrun_)
+                    return zeroCount;
+                loadByte();
+            }
+        }
+    };
+} // end anonymous namespace
+
+static uint8_t crc8( const uint8_t *p, std::size_t sizeBytes ) // frame headers. polynomial x^8 + x^2 + x + 1
+{
+    unsigned crc = 0;
+    for (std::size_t i=0; i < sizeBytes; ++i) {
+        crc ^= p[i];
+        for (int j=0; j < 8; ++j)
+            crc = ((crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1) & 0xFF;
+    }
+    return (uint8_t)crc;
+}
+
+// Subframes. Each channel of a frame is coded separately, as a constant, verbatim samples, or 
+// a fixed or LPC predictor followed by the Rice coded prediction residual.
+
+static bool decodeResidual( BitReader& bits, unsigned blockSize, unsigned predictorOrder, int32_t *dest )
+{
+    unsigned codingMethod = bits.readBits(2);
+    if (codingMethod > 1)
+        return false;
+    const unsigned parameterBits = (codingMethod == 0) ? 4 : 5;
+    const uint32_t escapeParameter = (codingMethod == 0) ? 15 : 31;
+
+    unsigned partitionOrder = bits.readBits(4);
+    unsigned partitionSize = blockSize >> partitionOrder;
+    if ((partitionSize << partitionOrder) != blockSize || partitionSize < predictorOrder)
+        return false;
+
+    unsigned i = predictorOrder; // (the first partition is shorter by the predictor order)
+    for (unsigned end=partitionSize; end <= blockSize; end += partitionSize) {
+        uint32_t parameter = bits.readBits(parameterBits);
+        if (parameter == escapeParameter) { // unencoded
+            unsigned sampleBits = bits.readBits(5);
+            for (; i < end; ++i)
+                dest[i] = bits.readSigned(sampleBits);
+        } else {
+            for (; i < end; ++i) {
+                uint32_t quotient = bits.readUnary();
+                uint32_t x = (quotient << parameter) | bits.readBits(parameter);
+                dest[i] = (int32_t)(x >> 1) ^ -(int32_t)(x & 1); // zigzag
+            }
+        }
+        if (bits.isOverrun())
+            return false;
+    }
+    return true;
+}
+
+// Residual plus prediction. Corrupt frames can overflow, they are rejected by the frame CRC check.
+static inline int32_t addWrapped( int32_t a, int64_t b ) { return (int32_t)((uint32_t)a + (uint32_t)b); }
+
+static void restoreFixedPrediction( int32_t *s, unsigned blockSize, unsigned order )
+{
+    switch (order) {
+    case 1:
+        for (unsigned i=1; i < blockSize; ++i)
+            s[i] = addWrapped(s[i], s[i-1]);
+        break;
+    case 2:
+        for (unsigned i=2; i < blockSize; ++i)
+            s[i] = addWrapped(s[i], 2*(int64_t)s[i-1] - s[i-2]);
+        break;
+    case 3:
+        for (unsigned i=3; i < blockSize; ++i)
+            s[i] = addWrapped(s[i], 3*((int64_t)s[i-1] - s[i-2]) + s[i-3]);
+        break;
+    case 4:
+        for (unsigned i=4; i < blockSize; ++i)
+            s[i] = addWrapped(s[i], 4*((int64_t)s[i-1] + s[i-3]) - 6*(int64_t)s[i-2] - s[i-4]);
+        break;
+    }
+}
+
+static void restoreLpcPrediction( int32_t *s, unsigned blockSize, const int32_t *coefficients, unsigned order, int shift )
+{
+    for (unsigned i=order; i < blockSize; ++i) {
+        int64_t sum = 0;
+        for (unsigned j=0; j < order; ++j)
+            sum += (int64_t)coefficients[j] * s[i - 1 - j];
+        s[i] = addWrapped(s[i], sum >> shift);
+    }
+}
+
+static bool decodeSubframe( BitReader& bits, unsigned blockSize, unsigned sampleBits, int32_t *dest )
+{
+    if (bits.readBits(1) != 0)
+        return false;
+    unsigned type = bits.readBits(6);
+    unsigned wastedBits = (bits.readBits(1)) ? bits.readUnary() + 1 : 0; // (the low bits of every sample are 0)
+    if (wastedBits >= sampleBits)
+        return false;
+    sampleBits -= wastedBits;
+
+    if (type == 0) { // constant
+        int32_t x = bits.readSigned(sampleBits);
+        for (unsigned i=0; i < blockSize; ++i)
+            dest[i] = x;
+    } else if (type == 1) { // verbatim
+        for (unsigned i=0; i < blockSize; ++i)
+            dest[i] = bits.readSigned(sampleBits);
+    } else if (type >= 8 && type <= 12) { // fixed predictor
+        unsigned order = type - 8;
+        if (order > blockSize)
+            return false;
+        for (unsigned i=0; i < order; ++i) // warm-up samples
+            dest[i] = bits.readSigned(sampleBits);
+        if (!decodeResidual(bits, blockSize, order, dest))
+            return false;
+        restoreFixedPrediction(dest, blockSize, order);
+    } else if (type >= 32) { // LPC
+        unsigned order = type - 31;
+        if (order > blockSize)
+            return false;
+        for (unsigned i=0; i < order; ++i)
+            dest[i] = bits.readSigned(sampleBits);
+        unsigned precision = bits.readBits(4) + 1;
+        int shift = bits.readSigned(5);
+        if (precision == 16 || shift < 0)
+            return false;
+        int32_t coefficients[32];
+        for (unsigned i=0; i < order; ++i)
+            coefficients[i] = bits.readSigned(precision);
+        if (!decodeResidual(bits, blockSize, order, dest))
+            return false;
+        restoreLpcPrediction(dest, blockSize, coefficients, order, shift);
+    } else {
+        return false; // reserved
+    }
+
+    if (wastedBits > 0) {
+        for (unsigned i=0; i < blockSize; ++i)
+            dest[i] = (int32_t)((uint32_t)dest[i] << wastedBits);
+    }
+    return !bits.isOverrun();
+}
+
+FlacDecoder::FlacDecoder( AudioFileHeaderReadFunc read, void *context )
+    : read_( read )
+    , context_( context )
+    , fileSizeBytes_( 0 )
+    , sampleRate_( 0 )
+    , channelCount_( 0 )
+    , bitsPerSample_( 0 )
+    , maxBlockSize_( 0 )
+    , totalSampleCount_( 0 )
+    , decodedSampleSizeBytes_( 0 )
+    , seekPoints_( 0 )
+    , seekPointCount_( 0 )
+    , seekPointCapacity_( 0 )
+    , input_( 0 )
+    , inputCapacityBytes_( 0 )
+    , inputCountBytes_( 0 )
+    , inputFilePosition_( 0 )
+    , maxFrameSizeBytes_( 0 )
+    , samples_( 0 )
+    , frameSampleNumber_( 0 )
+    , frameSampleCount_( 0 )
+    , nextFramePosition_( 0 )
+{
+    for (unsigned i=0; i < 256; ++i) { // frame CRC. polynomial x^16 + x^15 + x^2 + 1
+        unsigned crc = i << 8;
+        for (int j=0; j < 8; ++j)
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x8005 : crc << 1;
+        crc16Table_[i] = (uint16_t)crc;
+    }
+}
+
+FlacDecoder::~FlacDecoder()
+{
+    delete [] seekPoints_;
+    delete [] input_;
+    delete [] samples_;
+}
+
+// Metadata blocks: STREAMINFO (always first), SEEKTABLE, and others that are skipped.
+// The first frame follows the last metadata block.
+int FlacDecoder::readMetadata( FileIoAudioFormat *format )
+{
+    uint8_t marker[4];
+    if (read_(context_, 0, marker, 4) != 4 || std::memcmp(marker, "fLaC", 4) != 0)
+        return EINVAL;
+
+    bool hasStreamInfo = false;
+    uint64_t position = 4;
+    uint64_t seekTablePosition = 0;
+    std::size_t seekTableCount = 0;
+    bool isLastBlock = false;
+    while (!isLastBlock) {
+        uint8_t blockHeader[4];
+        if (read_(context_, position, blockHeader, 4) != 4)
+            return EINVAL;
+        isLastBlock = (blockHeader[0] & 0x80) != 0;
+        unsigned blockType = blockHeader[0] & 0x7F;
+        std::size_t blockSizeBytes = ((std::size_t)blockHeader[1] << 16) | ((std::size_t)blockHeader[2] << 8) | blockHeader[3];
+        position += 4;
+
+        if (blockType == 0) { // STREAMINFO
+            uint8_t streamInfo[34];
+            if (hasStreamInfo || blockSizeBytes < 34 || read_(context_, position, streamInfo, 34) != 34)
+                return EINVAL;
+            BitReader bits(streamInfo, 34);
+            bits.readBits(16); // min block size
+            maxBlockSize_ = bits.readBits(16);
+            bits.readBits(24); // min frame size
+            maxFrameSizeBytes_ = bits.readBits(24); // (0 if unknown)
+            sampleRate_ = bits.readBits(20);
+            channelCount_ = bits.readBits(3) + 1;
+            bitsPerSample_ = bits.readBits(5) + 1;
+            totalSampleCount_ = (uint64_t)bits.readBits(4) << 32;
+            totalSampleCount_ |= bits.readBits(32);
+            hasStreamInfo = true;
+        } else if (blockType == 3 && seekTableCount == 0) { // SEEKTABLE. 18 bytes per point
+            seekTablePosition = position;
+            seekTableCount = blockSizeBytes / 18;
+        } else if (blockType == 127) {
+            return EINVAL;
+        }
+
+        position += blockSizeBytes;
+    }
+
+    if (!hasStreamInfo || sampleRate_ == 0 || bitsPerSample_ < 4 || bitsPerSample_ > IO_FLAC_MAX_BITS_PER_SAMPLE 
+            || maxBlockSize_ == 0 || position >= fileSizeBytes_)
+        return EINVAL;
+
+    // Seek points. Offsets in the table are relative to the first frame. Placeholder points 
+    // (sample number 0xFFFFFFFFFFFFFFFF) and points that are out of order are skipped.
+    seekPointCapacity_ = seekTableCount + 64;
+    seekPoints_ = new (std::nothrow) SeekPoint[seekPointCapacity_];
+    if (!seekPoints_)
+        return ENOMEM;
+    seekPoints_[0].sampleNumber = 0;
+    seekPoints_[0].filePosition = position;
+    seekPointCount_ = 1;
+    uint8_t seekTable[64*18]; // (read 64 points at a time)
+    for (std::size_t i=0; i < seekTableCount; ++i) {
+        if (i % 64 == 0) {
+            std::size_t readSizeBytes = std::min<std::size_t>(seekTableCount - i, 64) * 18;
+            if (read_(context_, seekTablePosition + i*18, seekTable, readSizeBytes) != (int)readSizeBytes)
+                return EINVAL;
+        }
+        BitReader bits(seekTable + (i % 64)*18, 18);
+        uint64_t sampleNumber = (uint64_t)bits.readBits(32) << 32;
+        sampleNumber |= bits.readBits(32);
+        uint64_t offset = (uint64_t)bits.readBits(32) << 32;
+        offset |= bits.readBits(32);
+        if (sampleNumber > seekPoints_[seekPointCount_ - 1].sampleNumber && sampleNumber != (uint64_t)-1 && offset < fileSizeBytes_ - position) {
+            seekPoints_[seekPointCount_].sampleNumber = sampleNumber;
+            seekPoints_[seekPointCount_].filePosition = position + offset;
+            ++seekPointCount_;
+        }
+    }
+
+    decodedSampleSizeBytes_ = (bitsPerSample_ <= 16) ? 2 : 3;
+
+    format->containerType = CONTAINER_TYPE_FLAC;
+    format->sampleFormat = (decodedSampleSizeBytes_ == 2) ? SAMPLE_FORMAT_INT16 : SAMPLE_FORMAT_INT24;
+    format->sampleRate = sampleRate_;
+    format->channelCount = channelCount_;
+    format->dataOffsetBytes = 0;
+    format->dataSizeBytes = (totalSampleCount_ != 0) ? totalSampleCount_ * decodedSampleSizeBytes_ * channelCount_ : IO_UNKNOWN_DATA_SIZE;
+    return NOERROR;
+}
+
+int FlacDecoder::open( uint64_t fileSizeBytes, FileIoAudioFormat *format )
+{
+    fileSizeBytes_ = fileSizeBytes;
+    int result = readMetadata(format);
+    if (result != NOERROR)
+        return result;
+
+    // The largest frame is a frame of verbatim subframes with a side channel (bitsPerSample_ + 1 bits) 
+    // and every field of the frame header present.
+    std::size_t subframeSizeBytes = 8 + ((bitsPerSample_ + 1) * maxBlockSize_ + 7) / 8;
+    maxFrameSizeBytes_ = std::max<std::size_t>(maxFrameSizeBytes_, 16 + channelCount_ * subframeSizeBytes + 2);
+    inputCapacityBytes_ = std::max<std::size_t>(2 * maxFrameSizeBytes_, IO_FLAC_MIN_INPUT_BUFFER_BYTES);
+
+    input_ = new (std::nothrow) uint8_t[inputCapacityBytes_];
+    samples_ = new (std::nothrow) int32_t[maxBlockSize_ * channelCount_];
+    return (input_ && samples_) ? NOERROR : ENOMEM;
+}
+
+// Seek points are added while decoding, at most one per minSpacing samples.
+void FlacDecoder::addSeekPoint( uint64_t sampleNumber, uint64_t filePosition, uint64_t minSpacing )
+{
+    const SeekPoint& before = seekPointAtOrBefore(sampleNumber);
+    std::size_t i = (&before - seekPoints_) + 1; // insert here
+    if (sampleNumber - before.sampleNumber < minSpacing 
+            || (i < seekPointCount_ && seekPoints_[i].sampleNumber - sampleNumber < minSpacing))
+        return;
+
+    if (seekPointCount_ == seekPointCapacity_) {
+        SeekPoint *seekPoints = new (std::nothrow) SeekPoint[seekPointCapacity_ * 2];
+        if (!seekPoints)
+            return; // (seek points are only an optimisation)
+        std::memcpy(seekPoints, seekPoints_, seekPointCount_ * sizeof(SeekPoint));
+        delete [] seekPoints_;
+        seekPoints_ = seekPoints;
+        seekPointCapacity_ *= 2;
+    }
+
+    std::memmove(seekPoints_ + i + 1, seekPoints_ + i, (seekPointCount_ - i) * sizeof(SeekPoint));
+    seekPoints_[i].sampleNumber = sampleNumber;
+    seekPoints_[i].filePosition = filePosition;
+    ++seekPointCount_;
+}
+
+const FlacDecoder::SeekPoint& FlacDecoder::seekPointAtOrBefore( uint64_t sampleNumber ) const
+{
+    std::size_t begin = 0, end = seekPointCount_; // seekPoints_[begin].sampleNumber <= sampleNumber (seekPoints_[0] is sample 0)
+    while (end - begin > 1) {
+        std::size_t middle = begin + (end - begin) / 2;
+        if (seekPoints_[middle].sampleNumber <= sampleNumber)
+            begin = middle;
+        else
+            end = middle;
+    }
+    return seekPoints_[begin];
+}
+
+// Make sure the input buffer holds a whole frame at filePosition (or the rest of the file). 
+// Returns false if the read fails.
+bool FlacDecoder::fillInput( uint64_t filePosition )
+{
+    uint64_t inputEnd = inputFilePosition_ + inputCountBytes_;
+    uint64_t requiredEnd = std::min<uint64_t>(filePosition + maxFrameSizeBytes_, fileSizeBytes_);
+    if (filePosition >= inputFilePosition_ && requiredEnd <= inputEnd)
+        return true;
+
+    // Keep the buffered data from filePosition on, and append to it
+    std::size_t keptBytes = 0;
+    if (filePosition >= inputFilePosition_ && filePosition < inputEnd) {
+        keptBytes = (std::size_t)(inputEnd - filePosition);
+        std::memmove(input_, input_ + (filePosition - inputFilePosition_), keptBytes);
+    }
+    inputFilePosition_ = filePosition;
+    inputCountBytes_ = keptBytes;
+
+    while (inputCountBytes_ < inputCapacityBytes_ && inputFilePosition_ + inputCountBytes_ < fileSizeBytes_) {
+        std::size_t readSizeBytes = (std::size_t)std::min<uint64_t>(inputCapacityBytes_ - inputCountBytes_, fileSizeBytes_ - (inputFilePosition_ + inputCountBytes_));
+        int bytesRead = read_(context_, inputFilePosition_ + inputCountBytes_, input_ + inputCountBytes_, readSizeBytes);
+        if (bytesRead < 0)
+            return false;
+        if (bytesRead == 0)
+            break; // the file is shorter than it was
+        inputCountBytes_ += bytesRead;
+    }
+    return true;
+}
+
+static int frameError( const BitReader& bits, bool *isTruncated )
+{
+    *isTruncated = bits.isOverrun();
+    return EIO;
+}
+
+// Decode the frame at filePosition, which is in the input buffer, into samples_. 
+// Returns an errno value. Sets isTruncated if the frame extends past the buffered data.
+int FlacDecoder::decodeBufferedFrame( uint64_t filePosition, bool *isTruncated )
+{
+    const uint8_t *frame = input_ + (std::size_t)(filePosition - inputFilePosition_);
+    BitReader bits(frame, inputCountBytes_ - (std::size_t)(filePosition - inputFilePosition_));
+
+    // Frame header
+    if (bits.readBits(14) != 0x3FFE) // frame sync
+        return frameError(bits, isTruncated);
+    bits.readBits(1);
+    bool isVariableBlockSize = (bits.readBits(1) != 0);
+    unsigned blockSizeCode = bits.readBits(4);
+    unsigned sampleRateCode = bits.readBits(4);
+    unsigned channelAssignment = bits.readBits(4);
+    unsigned sampleSizeCode = bits.readBits(3);
+    bits.readBits(1);
+
+    uint64_t number = bits.readBits(8); // frame number, or sample number if isVariableBlockSize. UTF-8 coded
+    if (number & 0x80) {
+        unsigned byteCount = 1;
+        while (byteCount < 8 && (number & (0x80 >> byteCount)))
+            ++byteCount;
+        if (byteCount < 2 || byteCount > 7)
+            return frameError(bits, isTruncated);
+        number &= 0xFF >> (byteCount + 1);
+        for (unsigned i=1; i < byteCount; ++i) {
+            uint32_t b = bits.readBits(8);
+            if ((b & 0xC0) != 0x80)
+                return frameError(bits, isTruncated);
+            number = (number << 6) | (b & 0x3F);
+        }
+    }
+
+    unsigned blockSize;
+    if (blockSizeCode == 0)
+        return frameError(bits, isTruncated);
+    else if (blockSizeCode == 1)
+        blockSize = 192;
+    else if (blockSizeCode <= 5)
+        blockSize = 576 << (blockSizeCode - 2);
+    else if (blockSizeCode == 6)
+        blockSize = bits.readBits(8) + 1;
+    else if (blockSizeCode == 7)
+        blockSize = bits.readBits(16) + 1;
+    else
+        blockSize = 256 << (blockSizeCode - 8);
+
+    if (sampleRateCode == 12) // (the sample rate is taken from STREAMINFO)
+        bits.readBits(8);
+    else if (sampleRateCode == 13 || sampleRateCode == 14)
+        bits.readBits(16);
+    else if (sampleRateCode == 15)
+        return frameError(bits, isTruncated);
+
+    std::size_t headerSizeBytes = bits.bytePosition();
+    if (bits.readBits(8) != crc8(frame, headerSizeBytes) || bits.isOverrun())
+        return frameError(bits, isTruncated);
+
+    static const unsigned sampleSizes[8] = { 0, 8, 12, 0, 16, 20, 24, 32 };
+    if ((sampleSizeCode != 0 && sampleSizes[sampleSizeCode] != bitsPerSample_) || blockSize > maxBlockSize_)
+        return frameError(bits, isTruncated); // (the format can't change within the stream)
+    if ((channelAssignment < 8) ? channelAssignment + 1 != channelCount_ : (channelAssignment > 10 || channelCount_ != 2))
+        return frameError(bits, isTruncated);
+
+    // Subframes, one per channel. The side channel of a stereo pair has an extra bit
+    for (unsigned channel=0; channel < channelCount_; ++channel) {
+        bool isSideChannel = (channelAssignment == 8 && channel == 1) 
+                || (channelAssignment == 9 && channel == 0) || (channelAssignment == 10 && channel == 1);
+        if (!decodeSubframe(bits, blockSize, bitsPerSample_ + ((isSideChannel) ? 1 : 0), samples_ + channel * maxBlockSize_))
+            return frameError(bits, isTruncated);
+    }
+
+    bits.alignToByte();
+    std::size_t frameSizeBytes = bits.bytePosition() + 2;
+    unsigned crc = 0;
+    for (std::size_t i=0; i < frameSizeBytes - 2; ++i)
+        crc = ((crc << 8) ^ crc16Table_[(crc >> 8) ^ frame[i]]) & 0xFFFF;
+    if (bits.readBits(16) != crc || bits.isOverrun())
+        return frameError(bits, isTruncated);
+
+    // Stereo decorrelation
+    int32_t *left = samples_, *right = samples_ + maxBlockSize_;
+    switch (channelAssignment) {
+    case 8: // left, side
+        for (unsigned i=0; i < blockSize; ++i)
+            right[i] = addWrapped(left[i], -(int64_t)right[i]);
+        break;
+    case 9: // side, right
+        for (unsigned i=0; i < blockSize; ++i)
+            left[i] = addWrapped(left[i], right[i]);
+        break;
+    case 10: // mid, side
+        for (unsigned i=0; i < blockSize; ++i) {
+            int32_t side = right[i];
+            int32_t mid = (int32_t)(((uint32_t)left[i] << 1) | (side & 1));
+            left[i] = (int32_t)(((int64_t)mid + side) >> 1);
+            right[i] = (int32_t)(((int64_t)mid - side) >> 1);
+        }
+        break;
+    }
+
+    frameSampleNumber_ = (isVariableBlockSize) ? number : number * maxBlockSize_; // (fixed block size streams number their frames, and all but the final frame have the max block size)
+    frameSampleCount_ = blockSize;
+    if (totalSampleCount_ != 0) // (ignore padding past the end of the stream)
+        frameSampleCount_ = (unsigned)std::min<uint64_t>(blockSize, (frameSampleNumber_ < totalSampleCount_) ? totalSampleCount_ - frameSampleNumber_ : 0);
+    nextFramePosition_ = filePosition + frameSizeBytes;
+
+    addSeekPoint(frameSampleNumber_, filePosition, sampleRate_); // one per second
+    return NOERROR;
+}
+
+// Frames that are larger than the input buffer (which holds the largest frame that encoders 
+// write, see open()) are decoded after growing the buffer, up to IO_FLAC_MAX_FRAME_SIZE_BYTES.
+bool FlacDecoder::growInput()
+{
+    if (maxFrameSizeBytes_ >= IO_FLAC_MAX_FRAME_SIZE_BYTES)
+        return false;
+
+    std::size_t maxFrameSizeBytes = std::min<std::size_t>(maxFrameSizeBytes_ * 2, IO_FLAC_MAX_FRAME_SIZE_BYTES);
+    std::size_t inputCapacityBytes = std::max<std::size_t>(2 * maxFrameSizeBytes, inputCapacityBytes_);
+    uint8_t *input = new (std::nothrow) uint8_t[inputCapacityBytes];
+    if (!input)
+        return false;
+    std::memcpy(input, input_, inputCountBytes_);
+    delete [] input_;
+    input_ = input;
+    inputCapacityBytes_ = inputCapacityBytes;
+    maxFrameSizeBytes_ = maxFrameSizeBytes;
+    return true;
+}
+
+// Decode the frame at filePosition into samples_. Returns an errno value.
+int FlacDecoder::decodeFrame( uint64_t filePosition )
+{
+    frameSampleCount_ = 0;
+    for (;;) {
+        if (!fillInput(filePosition))
+            return EIO;
+
+        bool isTruncated = false;
+        int result = decodeBufferedFrame(filePosition, &isTruncated);
+        if (!isTruncated)
+            return result;
+        if (inputFilePosition_ + inputCountBytes_ >= fileSizeBytes_ || !growInput())
+            return EIO; // (truncated file)
+    }
+}
+
+// Decode the frame that contains sampleNumber, unless it is already decoded. Sets isAtEnd 
+// (and returns NOERROR) if sampleNumber is past the end of the stream. Returns an errno value.
+int FlacDecoder::prepareFrame( uint64_t sampleNumber, bool *isAtEnd )
+{
+    *isAtEnd = false;
+    if (totalSampleCount_ != 0 && sampleNumber >= totalSampleCount_) {
+        *isAtEnd = true;
+        return NOERROR;
+    }
+
+    if (frameSampleCount_ != 0 && sampleNumber >= frameSampleNumber_ && sampleNumber < frameSampleNumber_ + frameSampleCount_)
+        return NOERROR;
+
+    // Seek, unless decoding forward from the current frame gets there sooner
+    const SeekPoint& seekPoint = seekPointAtOrBefore(sampleNumber);
+    uint64_t filePosition = seekPoint.filePosition;
+    if (frameSampleCount_ != 0) {
+        uint64_t nextSampleNumber = frameSampleNumber_ + frameSampleCount_;
+        if (nextSampleNumber <= sampleNumber && nextSampleNumber >= seekPoint.sampleNumber)
+            filePosition = nextFramePosition_;
+    }
+
+    for (;;) {
+        if (filePosition >= fileSizeBytes_) {
+            *isAtEnd = true;
+            return NOERROR;
+        }
+
+        int result = decodeFrame(filePosition);
+        if (result != NOERROR)
+            return result;
+        if (sampleNumber < frameSampleNumber_)
+            return EIO; // the seek point is wrong
+        if (sampleNumber < frameSampleNumber_ + frameSampleCount_)
+            return NOERROR;
+        if (frameSampleCount_ == 0) {
+            *isAtEnd = true; // (a frame past the end of the stream)
+            return NOERROR;
+        }
+
+        filePosition = nextFramePosition_;
+    }
+}
+
+// Interleaved little-endian samples, scaled to the decoded sample size
+void FlacDecoder::packSampleFrame( unsigned index, uint8_t *dest ) const
+{
+    const unsigned shift = (unsigned)decodedSampleSizeBytes_ * 8 - bitsPerSample_;
+    for (unsigned channel=0; channel < channelCount_; ++channel) {
+        uint32_t x = (uint32_t)samples_[channel * maxBlockSize_ + index] << shift;
+        *dest++ = (uint8_t)x;
+        *dest++ = (uint8_t)(x >> 8);
+        if (decodedSampleSizeBytes_ == 3)
+            *dest++ = (uint8_t)(x >> 16);
+    }
+}
+
+int FlacDecoder::decode( uint64_t position, void *dest, std::size_t sizeBytes )
+{
+    const std::size_t sampleFrameSizeBytes = decodedSampleSizeBytes_ * channelCount_;
+    uint8_t *p = static_cast<uint8_t*>(dest);
+
+    std::size_t count = 0;
+    while (count < sizeBytes) {
+        uint64_t sampleNumber = (position + count) / sampleFrameSizeBytes;
+        std::size_t skipBytes = (std::size_t)((position + count) % sampleFrameSizeBytes); // (blocks needn't start or end on sample frames)
+
+        bool isAtEnd;
+        int result = prepareFrame(sampleNumber, &isAtEnd);
+        if (result != NOERROR)
+            return -result;
+        if (isAtEnd)
+            break;
+
+        for (unsigned i=(unsigned)(sampleNumber - frameSampleNumber_); i < frameSampleCount_ && count < sizeBytes; ++i) {
+            std::size_t n = std::min(sampleFrameSizeBytes - skipBytes, sizeBytes - count);
+            if (n == sampleFrameSizeBytes) {
+                packSampleFrame(i, p + count);
+            } else {
+                uint8_t sampleFrame[IO_FLAC_MAX_CHANNEL_COUNT * 3];
+                packSampleFrame(i, sampleFrame);
+                std::memcpy(p + count, sampleFrame + skipBytes, n);
+            }
+            count += n;
+            skipBytes = 0;
+        }
+    }
+
+    return (int)count;
+}
@@ -0,0 +1,117 @@
+/* 
+    Real Time File Streaming copyright (c) 2014 Ross Bencina
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+#ifndef INCLUDED_FLACDECODER_H
+#define INCLUDED_FLACDECODER_H
+
+#include <cstddef> // size_t
+#include <stdint.h>
+
+#include "AudioFileFormat.h"
+
+/*
+    FLAC decoder for compressed streaming.
+
+    The server decodes FLAC files opened for reading into the DataBlocks that it returns 
+    for READ_BLOCK requests, so clients see the same block protocol, and the same PCM data 
+    (SAMPLE_FORMAT_INT16 or SAMPLE_FORMAT_INT24 interleaved) as for an uncompressed file. 
+    Block positions are positions in the decoded data. Decoded blocks are shared through 
+    the block cache like any other read-only blocks.
+
+    Random access uses a seek table: the file's SEEKTABLE metadata block (if it has one), 
+    extended with the positions of frames that have been decoded since the file was opened, 
+    at most one per second of audio. A block is decoded by seeking to the nearest seek point 
+    at or before it, then decoding forward, unless the decoder is already at or just before 
+    the block (as it is for sequential reads). Without a seek table the first seek to each 
+    part of the file decodes from the start.
+
+    Supports the full FLAC format (all subframe types, stereo decorrelation, fixed and 
+    variable block sizes), 1 to 8 channels, 4 to 24 bits per sample. Frame CRCs are checked.
+
+    There is one decoder per open file. It is only used by the worker that handles the file.
+*/
+
+class FlacDecoder {
+    struct SeekPoint {
+        uint64_t sampleNumber; // first sample (frame) of the FLAC frame
+        uint64_t filePosition; // of the FLAC frame header
+    };
+
+    AudioFileHeaderReadFunc read_;
+    void *context_;
+    uint64_t fileSizeBytes_;
+
+    // STREAMINFO
+    uint32_t sampleRate_;
+    unsigned channelCount_;
+    unsigned bitsPerSample_;
+    unsigned maxBlockSize_;
+    uint64_t totalSampleCount_; // 0 if unknown
+
+    std::size_t decodedSampleSizeBytes_; // 2 or 3
+
+    SeekPoint *seekPoints_; // sorted by sample number. seekPoints_[0] is the first frame
+    std::size_t seekPointCount_;
+    std::size_t seekPointCapacity_;
+
+    // Compressed data, read from the file in runs of whole frames
+    uint8_t *input_;
+    std::size_t inputCapacityBytes_;
+    std::size_t inputCountBytes_;
+    uint64_t inputFilePosition_;
+    std::size_t maxFrameSizeBytes_; // the worst case, or larger if STREAMINFO says so
+
+    // The most recently decoded frame. Planar, maxBlockSize_ samples per channel
+    int32_t *samples_;
+    uint64_t frameSampleNumber_;
+    unsigned frameSampleCount_; // 0 if no frame has been decoded
+    uint64_t nextFramePosition_;
+    uint16_t crc16Table_[256];
+
+    int readMetadata( FileIoAudioFormat *format );
+    void addSeekPoint( uint64_t sampleNumber, uint64_t filePosition, uint64_t minSpacing );
+    const SeekPoint& seekPointAtOrBefore( uint64_t sampleNumber ) const;
+    bool fillInput( uint64_t filePosition );
+    bool growInput();
+    int decodeBufferedFrame( uint64_t filePosition, bool *isTruncated );
+    int decodeFrame( uint64_t filePosition );
+    int prepareFrame( uint64_t sampleNumber, bool *isAtEnd );
+    void packSampleFrame( unsigned index, uint8_t *dest ) const;
+
+    FlacDecoder( const FlacDecoder& ); // not copyable
+    FlacDecoder& operator=( const FlacDecoder& );
+
+public:
+    // read() reads the compressed file (see AudioFileHeaderReadFunc)
+    FlacDecoder( AudioFileHeaderReadFunc read, void *context );
+    ~FlacDecoder();
+
+    // Read the metadata. On success, format is set to the decoded format: CONTAINER_TYPE_FLAC, 
+    // dataOffsetBytes is 0 and dataSizeBytes is the size of the decoded data (or 
+    // IO_UNKNOWN_DATA_SIZE). Returns an errno value: EINVAL for unsupported or malformed files.
+    int open( uint64_t fileSizeBytes, FileIoAudioFormat *format );
+
+    // Decode sizeBytes of decoded data at position, which need not be sample aligned. 
+    // Returns the number of bytes decoded (short at the end of the data), or a negative errno value.
+    int decode( uint64_t position, void *dest, std::size_t sizeBytes );
+};
+
+#endif /* INCLUDED_FLACDECODER_H */
@@ -0,0 +1,266 @@
+/* 
+    Real Time File Streaming copyright (c) 2014 Ross Bencina
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+#include "LinuxIoUring.h"
+
+#if defined(__linux__)
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+static int io_uring_setup( unsigned entries, io_uring_params *p )
+{
+    return (int)syscall( __NR_io_uring_setup, entries, p );
+}
+
+static int io_uring_enter( int ringFd, unsigned toSubmit, unsigned minComplete, unsigned flags )
+{
+    return (int)syscall( __NR_io_uring_enter, ringFd, toSubmit, minComplete, flags, NULL, 0 );
+}
+
+static int io_uring_register( int ringFd, unsigned opcode, const void *arg, unsigned nrArgs )
+{
+    return (int)syscall( __NR_io_uring_register, ringFd, opcode, arg, nrArgs );
+}
+
+template<typename T>
+static T* offsetPtr( void *base, unsigned offset )
+{
+    return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+}
+
+
+LinuxIoUring::LinuxIoUring()
+    : ringFd_( -1 )
+    , sqRing_( 0 ), sqRingSizeBytes_( 0 ), sqHead_( 0 ), sqTail_( 0 ), sqRingMask_( 0 ), sqArray_( 0 )
+    , sqEntries_( 0 ), sqes_( 0 ), sqesSizeBytes_( 0 ), unsubmittedCount_( 0 )
+    , cqRing_( 0 ), cqRingSizeBytes_( 0 ), cqHead_( 0 ), cqTail_( 0 ), cqRingMask_( 0 ), cqes_( 0 ), cqEntries_( 0 )
+    , inFlightCount_( 0 )
+{
+}
+
+LinuxIoUring::~LinuxIoUring()
+{
+    destroy();
+}
+
+bool LinuxIoUring::init( unsigned entries, int completionEventFd )
+{
+    assert( !isInitialized() );
+
+    io_uring_params p;
+    std::memset(&p, 0, sizeof(p));
+
+    ringFd_ = io_uring_setup(entries, &p);
+    if (ringFd_ < 0) {
+        ringFd_ = -1;
+        return false;
+    }
+
+    sqRingSizeBytes_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cqRingSizeBytes_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+
+    bool singleMmap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMmap) {
+        if (cqRingSizeBytes_ > sqRingSizeBytes_)
+            sqRingSizeBytes_ = cqRingSizeBytes_;
+        cqRingSizeBytes_ = 0;
+    }
+
+    sqRing_ = mmap(0, sqRingSizeBytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_SQ_RING);
+    if (sqRing_ == MAP_FAILED) {
+        sqRing_ = 0;
+        destroy();
+        return false;
+    }
+
+    if (singleMmap) {
+        cqRing_ = sqRing_;
+    } else {
+        cqRing_ = mmap(0, cqRingSizeBytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_CQ_RING);
+        if (cqRing_ == MAP_FAILED) {
+            cqRing_ = 0;
+            destroy();
+            return false;
+        }
+    }
+
+    sqesSizeBytes_ = p.sq_entries * sizeof(io_uring_sqe);
+    void *sqes = mmap(0, sqesSizeBytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        destroy();
+        return false;
+    }
+    sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+    sqHead_ = offsetPtr<unsigned>(sqRing_, p.sq_off.head);
+    sqTail_ = offsetPtr<unsigned>(sqRing_, p.sq_off.tail);
+    sqRingMask_ = offsetPtr<unsigned>(sqRing_, p.sq_off.ring_mask);
+    sqArray_ = offsetPtr<unsigned>(sqRing_, p.sq_off.array);
+    sqEntries_ = p.sq_entries;
+
+    cqHead_ = offsetPtr<unsigned>(cqRing_, p.cq_off.head);
+    cqTail_ = offsetPtr<unsigned>(cqRing_, p.cq_off.tail);
+    cqRingMask_ = offsetPtr<unsigned>(cqRing_, p.cq_off.ring_mask);
+    cqes_ = offsetPtr<io_uring_cqe>(cqRing_, p.cq_off.cqes);
+    cqEntries_ = p.cq_entries;
+
+    if (completionEventFd != -1) {
+        if (io_uring_register(ringFd_, IORING_REGISTER_EVENTFD, &completionEventFd, 1) != 0) {
+            destroy();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void LinuxIoUring::destroy()
+{
+    // Caller is responsible for ensuring that there are no operations in flight
+
+    if (sqes_) {
+        munmap(sqes_, sqesSizeBytes_);
+        sqes_ = 0;
+    }
+
+    if (cqRing_ && cqRing_ != sqRing_)
+        munmap(cqRing_, cqRingSizeBytes_);
+    cqRing_ = 0;
+
+    if (sqRing_) {
+        munmap(sqRing_, sqRingSizeBytes_);
+        sqRing_ = 0;
+    }
+
+    if (ringFd_ != -1) {
+        close(ringFd_);
+        ringFd_ = -1;
+    }
+
+    inFlightCount_ = 0;
+    unsubmittedCount_ = 0;
+}
+
+io_uring_sqe* LinuxIoUring::getSqe()
+{
+    if (!canPrepare())
+        return 0;
+
+    unsigned tail = *sqTail_; // we're the only writer of the tail
+    unsigned head = __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+    if (tail - head >= sqEntries_)
+        return 0; // submission queue is full
+
+    unsigned index = tail & *sqRingMask_;
+    io_uring_sqe *sqe = &sqes_[index];
+    std::memset(sqe, 0, sizeof(io_uring_sqe));
+    sqArray_[index] = index;
+
+    __atomic_store_n(sqTail_, tail + 1, __ATOMIC_RELEASE);
+    ++unsubmittedCount_;
+    ++inFlightCount_;
+    return sqe;
+}
+
+bool LinuxIoUring::prepareRead( int fd, void *buffer, unsigned sizeBytes, uint64_t fileOffset, void *userData )
+{
+    io_uring_sqe *sqe = getSqe();
+    if (!sqe)
+        return false;
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->off = fileOffset;
+    sqe->addr = (uint64_t)(uintptr_t)buffer;
+    sqe->len = sizeBytes;
+    sqe->user_data = (uint64_t)(uintptr_t)userData;
+    return true;
+}
+
+bool LinuxIoUring::prepareWrite( int fd, const void *buffer, unsigned sizeBytes, uint64_t fileOffset, void *userData )
+{
+    io_uring_sqe *sqe = getSqe();
+    if (!sqe)
+        return false;
+
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = fd;
+    sqe->off = fileOffset;
+    sqe->addr = (uint64_t)(uintptr_t)buffer;
+    sqe->len = sizeBytes;
+    sqe->user_data = (uint64_t)(uintptr_t)userData;
+    return true;
+}
+
+void LinuxIoUring::submit()
+{
+    while (unsubmittedCount_ > 0) {
+        int submitted = io_uring_enter(ringFd_, unsubmittedCount_, 0, 0);
+        if (submitted < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+                continue;
+            break; // unexpected. the operations stay in the submission queue and will be retried next time
+        }
+        unsubmittedCount_ -= submitted;
+    }
+}
+
+bool LinuxIoUring::popCompletion( void **userData, int *result )
+{
+    unsigned head = *cqHead_; // we're the only writer of the head
+    unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+    if (head == tail)
+        return false;
+
+    const io_uring_cqe *cqe = &cqes_[head & *cqRingMask_];
+    *userData = (void*)(uintptr_t)cqe->user_data;
+    *result = cqe->res;
+
+    __atomic_store_n(cqHead_, head + 1, __ATOMIC_RELEASE);
+    --inFlightCount_;
+    return true;
+}
+
+bool LinuxIoUring::hasCompletion() const
+{
+    return *cqHead_ != __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+}
+
+void LinuxIoUring::waitForCompletion()
+{
+    submit();
+
+    if (inFlightCount_ == 0)
+        return;
+
+    while (io_uring_enter(ringFd_, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno == EINTR)
+        /* retry if interrupted by a signal */ ;
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,112 @@
+/* 
+    Real Time File Streaming copyright (c) 2014 Ross Bencina
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+#ifndef INCLUDED_LINUXIOURING_H
+#define INCLUDED_LINUXIOURING_H
+
+#if defined(__linux__)
+
+#include <stdint.h>
+#include <cstddef>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+/*
+    Minimal io_uring submission/completion ring.
+
+    Only what the file I/O server needs: positional reads and writes, batched
+    submission, and completion notification via an eventfd. Implemented directly
+    on the io_uring system calls so there is no dependency on liburing.
+
+    All methods must be called from a single thread (the server thread).
+*/
+
+class LinuxIoUring {
+    int ringFd_;
+
+    // submission queue
+    void *sqRing_;
+    std::size_t sqRingSizeBytes_;
+    unsigned *sqHead_;
+    unsigned *sqTail_;
+    unsigned *sqRingMask_;
+    unsigned *sqArray_;
+    unsigned sqEntries_;
+    io_uring_sqe *sqes_;
+    std::size_t sqesSizeBytes_;
+    unsigned unsubmittedCount_;
+
+    // completion queue
+    void *cqRing_;
+    std::size_t cqRingSizeBytes_;
+    unsigned *cqHead_;
+    unsigned *cqTail_;
+    unsigned *cqRingMask_;
+    io_uring_cqe *cqes_;
+    unsigned cqEntries_;
+
+    unsigned inFlightCount_; // submitted or prepared, but not yet popped
+
+    io_uring_sqe* getSqe();
+
+    LinuxIoUring( const LinuxIoUring& ); // not copyable
+    LinuxIoUring& operator=( const LinuxIoUring& );
+
+public:
+    LinuxIoUring();
+    ~LinuxIoUring();
+
+    // Returns false if io_uring is not available (old kernel, blocked by seccomp, etc.)
+    // If completionEventFd is not -1 it is signaled every time a completion is posted.
+    bool init( unsigned entries, int completionEventFd );
+    void destroy();
+
+    bool isInitialized() const { return ringFd_ != -1; }
+
+    // Prepare positional read/write operations. They are not started until submit() is called.
+    // Returns false if there is no room. In that case, submit() and/or pop completions and try again.
+    bool prepareRead( int fd, void *buffer, unsigned sizeBytes, uint64_t fileOffset, void *userData );
+    bool prepareWrite( int fd, const void *buffer, unsigned sizeBytes, uint64_t fileOffset, void *userData );
+
+    // Never overrun the completion queue, or the submission queue. (Prepared operations stay in 
+    // the submission queue until submit() is called.)
+    bool canPrepare() const { return inFlightCount_ < cqEntries_ && !isSubmissionQueueFull(); }
+    bool isSubmissionQueueFull() const { return unsubmittedCount_ >= sqEntries_; }
+
+    void submit();
+
+    // Returns false if no completion is available. result is the number of 
+    // bytes transferred, or a negative errno value.
+    bool popCompletion( void **userData, int *result );
+
+    // Returns true if popCompletion() would succeed.
+    bool hasCompletion() const;
+
+    // Block until at least one completion is available. Submits any prepared operations.
+    void waitForCompletion();
+
+    unsigned inFlightCount() const { return inFlightCount_; }
+};
+
+#endif /* __linux__ */
+
+#endif /* INCLUDED_LINUXIOURING_H */
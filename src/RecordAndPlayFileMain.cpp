@@ -145,7 +145,7 @@ static int audioCallback( const void *inputBuffer, void *outputBuffer,
             break;
         case ControlCommand::START_RECORDING:
             assert( !data->recordStream );
-            data->recordStream = FileIoWriteStream_open(cmd->filePath, FileIoRequest::READ_WRITE_OVERWRITE_OPEN_MODE);
+            data->recordStream = FileIoWriteStream_open(cmd->filePath, FileIoRequest::READ_WRITE_OVERWRITE_DIRECT_OPEN_MODE);
             break;
         case ControlCommand::STOP_RECORDING:
             if (data->recordStream) { // idempotent to simplify logic in main()
@@ -168,18 +168,9 @@ static int audioCallback( const void *inputBuffer, void *outputBuffer,
 
         } else if (streamState==STREAM_STATE_OPEN_STREAMING) { // (don't output in BUFFERING state)
 
-            short temp[FRAMES_PER_BUFFER * 2]; // stereo 16 bit file data
-            size_t framesRead = FileIoReadStream_read( temp, sizeof(short)*2, FRAMES_PER_BUFFER, data->playStream );
-
-            // Copy data to output
-            float gain = 1./32768;
-
-            out = (float*)outputBuffer;
-            const short *p = &temp[0];
-            for( size_t i=0; i < framesRead; ++i ) {
-                *out++ = *p++ * gain;
-                *out++ = *p++ * gain;
-            }
+            // Convert stereo 16 bit file data directly to the interleaved float output
+            float *dest[1] = { (float*)outputBuffer };
+            FileIoReadStream_readFrames( dest, CHANNEL_LAYOUT_INTERLEAVED, SAMPLE_FORMAT_INT16, 2, FRAMES_PER_BUFFER, data->playStream );
         }
     }
     
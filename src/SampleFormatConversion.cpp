@@ -0,0 +1,277 @@
+/* 
+    Real Time File Streaming copyright (c) 2014 Ross Bencina
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+#include "SampleFormatConversion.h"
+
+#include <cassert>
+#include <cstring>
+#include <stdint.h>
+
+#if defined(__AVX2__)
+#define IO_USE_AVX2
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define IO_USE_SSE2
+#include <emmintrin.h>
+#if defined(IO_USE_AVX2)
+#include <immintrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define IO_USE_NEON
+#include <arm_neon.h>
+#endif
+
+#define IO_INT16_TO_FLOAT_SCALE     (1.f / 32768.f)
+#define IO_INT24_TO_FLOAT_SCALE     (1.f / 2147483648.f) // int24 samples are converted via the top 24 bits of an int32
+
+
+std::size_t bytesPerSample( FileIoSampleFormat sampleFormat )
+{
+    switch (sampleFormat) {
+    case SAMPLE_FORMAT_INT16:
+    case SAMPLE_FORMAT_INT16_BIG_ENDIAN:
+        return 2;
+    case SAMPLE_FORMAT_INT24:
+    case SAMPLE_FORMAT_INT24_BIG_ENDIAN:
+        return 3;
+    case SAMPLE_FORMAT_FLOAT32:
+    case SAMPLE_FORMAT_FLOAT32_BIG_ENDIAN:
+        return 4;
+    }
+
+    assert(false);
+    return 0;
+}
+
+static inline float int24ToFloat32( const uint8_t *p )
+{
+    int32_t x = (int32_t)(((uint32_t)p[0] << 8) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 24));
+    return (float)x * IO_INT24_TO_FLOAT_SCALE;
+}
+
+static inline float int16BigEndianToFloat32( const uint8_t *p )
+{
+    int16_t x = (int16_t)(((uint16_t)p[0] << 8) | p[1]);
+    return x * IO_INT16_TO_FLOAT_SCALE;
+}
+
+static inline float int24BigEndianToFloat32( const uint8_t *p )
+{
+    int32_t x = (int32_t)(((uint32_t)p[2] << 8) | ((uint32_t)p[1] << 16) | ((uint32_t)p[0] << 24));
+    return (float)x * IO_INT24_TO_FLOAT_SCALE;
+}
+
+static inline float float32BigEndianToFloat32( const uint8_t *p )
+{
+    uint32_t x = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+    float result;
+    std::memcpy(&result, &x, sizeof(result));
+    return result;
+}
+
+// one sample of any format. used for the big-endian formats
+static inline float sampleToFloat32( const uint8_t *p, FileIoSampleFormat srcFormat )
+{
+    switch (srcFormat) {
+    case SAMPLE_FORMAT_INT16: return *(const int16_t*)p * IO_INT16_TO_FLOAT_SCALE;
+    case SAMPLE_FORMAT_INT24: return int24ToFloat32(p);
+    case SAMPLE_FORMAT_FLOAT32: return *(const float*)p;
+    case SAMPLE_FORMAT_INT16_BIG_ENDIAN: return int16BigEndianToFloat32(p);
+    case SAMPLE_FORMAT_INT24_BIG_ENDIAN: return int24BigEndianToFloat32(p);
+    case SAMPLE_FORMAT_FLOAT32_BIG_ENDIAN: return float32BigEndianToFloat32(p);
+    }
+
+    assert(false);
+    return 0.f;
+}
+
+// contiguous conversion. used for interleaved output and for mono
+
+static void int16ToFloat32( float *dest, const int16_t *src, std::size_t sampleCount )
+{
+    std::size_t i = 0;
+
+#if defined(IO_USE_AVX2)
+    const __m256 scale8 = _mm256_set1_ps(IO_INT16_TO_FLOAT_SCALE);
+    for (; i + 8 <= sampleCount; i += 8) {
+        __m256i x = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(src + i)));
+        _mm256_storeu_ps(dest + i, _mm256_mul_ps(_mm256_cvtepi32_ps(x), scale8));
+    }
+#endif
+
+#if defined(IO_USE_SSE2)
+    const __m128 scale = _mm_set1_ps(IO_INT16_TO_FLOAT_SCALE);
+    for (; i + 8 <= sampleCount; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(src + i));
+        // sign extend to 32 bits by unpacking into the high half and shifting down
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+        _mm_storeu_ps(dest + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+        _mm_storeu_ps(dest + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+    }
+#elif defined(IO_USE_NEON)
+    for (; i + 8 <= sampleCount; i += 8) {
+        int16x8_t x = vld1q_s16(src + i);
+        vst1q_f32(dest + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(x))), IO_INT16_TO_FLOAT_SCALE));
+        vst1q_f32(dest + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(x))), IO_INT16_TO_FLOAT_SCALE));
+    }
+#endif
+
+    for (; i < sampleCount; ++i)
+        dest[i] = src[i] * IO_INT16_TO_FLOAT_SCALE;
+}
+
+static void int24ToFloat32( float *dest, const uint8_t *src, std::size_t sampleCount )
+{
+    for (std::size_t i = 0; i < sampleCount; ++i, src += 3)
+        dest[i] = int24ToFloat32(src);
+}
+
+// stereo deinterleaving conversion
+
+static void int16StereoToFloat32Planar( float *destL, float *destR, const int16_t *src, std::size_t frameCount )
+{
+    std::size_t i = 0;
+
+#if defined(IO_USE_SSE2)
+    const __m128 scale = _mm_set1_ps(IO_INT16_TO_FLOAT_SCALE);
+    for (; i + 4 <= frameCount; i += 4) {
+        // each 32-bit lane holds one frame: left in the low half, right in the high half
+        __m128i x = _mm_loadu_si128((const __m128i*)(src + i*2));
+        __m128i l = _mm_srai_epi32(_mm_slli_epi32(x, 16), 16);
+        __m128i r = _mm_srai_epi32(x, 16);
+        _mm_storeu_ps(destL + i, _mm_mul_ps(_mm_cvtepi32_ps(l), scale));
+        _mm_storeu_ps(destR + i, _mm_mul_ps(_mm_cvtepi32_ps(r), scale));
+    }
+#elif defined(IO_USE_NEON)
+    for (; i + 4 <= frameCount; i += 4) {
+        int16x4x2_t x = vld2_s16(src + i*2);
+        vst1q_f32(destL + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(x.val[0])), IO_INT16_TO_FLOAT_SCALE));
+        vst1q_f32(destR + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(x.val[1])), IO_INT16_TO_FLOAT_SCALE));
+    }
+#endif
+
+    for (; i < frameCount; ++i) {
+        destL[i] = src[i*2] * IO_INT16_TO_FLOAT_SCALE;
+        destR[i] = src[i*2 + 1] * IO_INT16_TO_FLOAT_SCALE;
+    }
+}
+
+static void float32StereoToFloat32Planar( float *destL, float *destR, const float *src, std::size_t frameCount )
+{
+    std::size_t i = 0;
+
+#if defined(IO_USE_SSE2)
+    for (; i + 4 <= frameCount; i += 4) {
+        __m128 a = _mm_loadu_ps(src + i*2);     // L0 R0 L1 R1
+        __m128 b = _mm_loadu_ps(src + i*2 + 4); // L2 R2 L3 R3
+        _mm_storeu_ps(destL + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2,0,2,0)));
+        _mm_storeu_ps(destR + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3,1,3,1)));
+    }
+#elif defined(IO_USE_NEON)
+    for (; i + 4 <= frameCount; i += 4) {
+        float32x4x2_t x = vld2q_f32(src + i*2);
+        vst1q_f32(destL + i, x.val[0]);
+        vst1q_f32(destR + i, x.val[1]);
+    }
+#endif
+
+    for (; i < frameCount; ++i) {
+        destL[i] = src[i*2];
+        destR[i] = src[i*2 + 1];
+    }
+}
+
+// general case: deinterleave one channel at a time
+
+static void channelToFloat32Planar( float *dest, const uint8_t *src, FileIoSampleFormat srcFormat, 
+        std::size_t frameStrideBytes, std::size_t frameCount )
+{
+    switch (srcFormat) {
+    case SAMPLE_FORMAT_INT16:
+        for (std::size_t i = 0; i < frameCount; ++i, src += frameStrideBytes)
+            dest[i] = *(const int16_t*)src * IO_INT16_TO_FLOAT_SCALE;
+        break;
+    case SAMPLE_FORMAT_INT24:
+        for (std::size_t i = 0; i < frameCount; ++i, src += frameStrideBytes)
+            dest[i] = int24ToFloat32(src);
+        break;
+    case SAMPLE_FORMAT_FLOAT32:
+        for (std::size_t i = 0; i < frameCount; ++i, src += frameStrideBytes)
+            dest[i] = *(const float*)src;
+        break;
+    default:
+        for (std::size_t i = 0; i < frameCount; ++i, src += frameStrideBytes)
+            dest[i] = sampleToFloat32(src, srcFormat);
+        break;
+    }
+}
+
+void convertSamplesToFloat32( float *const *dest, FileIoChannelLayout destLayout, std::size_t destFrameOffset,
+        const void *src, FileIoSampleFormat srcFormat, std::size_t channelCount, std::size_t frameCount )
+{
+    assert( channelCount > 0 );
+
+    if (destLayout == CHANNEL_LAYOUT_INTERLEAVED || channelCount == 1) {
+        // output is contiguous, no need to deinterleave
+        float *d = dest[0] + destFrameOffset*channelCount;
+        std::size_t sampleCount = frameCount*channelCount;
+
+        switch (srcFormat) {
+        case SAMPLE_FORMAT_INT16:
+            int16ToFloat32(d, static_cast<const int16_t*>(src), sampleCount);
+            break;
+        case SAMPLE_FORMAT_INT24:
+            int24ToFloat32(d, static_cast<const uint8_t*>(src), sampleCount);
+            break;
+        case SAMPLE_FORMAT_FLOAT32:
+            std::memcpy(d, src, sampleCount*sizeof(float));
+            break;
+        default: {
+            std::size_t sampleSizeBytes = bytesPerSample(srcFormat);
+            const uint8_t *p = static_cast<const uint8_t*>(src);
+            for (std::size_t i = 0; i < sampleCount; ++i, p += sampleSizeBytes)
+                d[i] = sampleToFloat32(p, srcFormat);
+            } break;
+        }
+        return;
+    }
+
+    if (channelCount == 2 && srcFormat == SAMPLE_FORMAT_INT16) {
+        int16StereoToFloat32Planar(dest[0] + destFrameOffset, dest[1] + destFrameOffset, 
+                static_cast<const int16_t*>(src), frameCount);
+        return;
+    }
+
+    if (channelCount == 2 && srcFormat == SAMPLE_FORMAT_FLOAT32) {
+        float32StereoToFloat32Planar(dest[0] + destFrameOffset, dest[1] + destFrameOffset, 
+                static_cast<const float*>(src), frameCount);
+        return;
+    }
+
+    std::size_t sampleSizeBytes = bytesPerSample(srcFormat);
+    std::size_t frameSizeBytes = sampleSizeBytes*channelCount;
+    for (std::size_t c = 0; c < channelCount; ++c) {
+        channelToFloat32Planar(dest[c] + destFrameOffset, static_cast<const uint8_t*>(src) + c*sampleSizeBytes, 
+                srcFormat, frameSizeBytes, frameCount);
+    }
+}
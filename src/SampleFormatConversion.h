@@ -0,0 +1,62 @@
+/* 
+    Real Time File Streaming copyright (c) 2014 Ross Bencina
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+#ifndef INCLUDED_SAMPLEFORMATCONVERSION_H
+#define INCLUDED_SAMPLEFORMATCONVERSION_H
+
+#include <cstddef> // size_t
+
+/*
+    Conversion of interleaved file sample data to float32.
+
+    Used by FileIoReadStream_readFrames() to convert directly out of DataBlocks 
+    into the client's buffers. The conversion kernels use SSE2, AVX2 or NEON when 
+    the compiler targets them, and fall back to scalar code otherwise.
+
+    Source samples are little-endian (the byte order of all supported platforms),
+    except for the _BIG_ENDIAN formats, which are found in AIFF and CAF files 
+    (see AudioFileFormat.h). Those are converted with scalar code.
+    SAMPLE_FORMAT_INT24 is packed 3-byte samples. Integer samples are scaled 
+    to [-1, 1).
+*/
+
+enum FileIoSampleFormat {
+    SAMPLE_FORMAT_INT16,
+    SAMPLE_FORMAT_INT24,
+    SAMPLE_FORMAT_FLOAT32,
+    SAMPLE_FORMAT_INT16_BIG_ENDIAN,
+    SAMPLE_FORMAT_INT24_BIG_ENDIAN,
+    SAMPLE_FORMAT_FLOAT32_BIG_ENDIAN
+};
+
+enum FileIoChannelLayout {
+    CHANNEL_LAYOUT_INTERLEAVED, // dest[0] points to a single buffer of interleaved frames
+    CHANNEL_LAYOUT_PLANAR       // dest[i] points to the buffer for channel i
+};
+
+std::size_t bytesPerSample( FileIoSampleFormat sampleFormat );
+
+// Convert frameCount interleaved frames of channelCount channels from src.
+// Output is written starting at frame destFrameOffset of the dest buffers.
+void convertSamplesToFloat32( float *const *dest, FileIoChannelLayout destLayout, std::size_t destFrameOffset,
+        const void *src, FileIoSampleFormat srcFormat, std::size_t channelCount, std::size_t frameCount );
+
+#endif /* INCLUDED_SAMPLEFORMATCONVERSION_H */
@@ -24,6 +24,7 @@
 #include <cassert>
 #include <cstring> // strcpy
 #include <cstdlib>
+#include <stdint.h>
 
 #include "QwMpmcPopAllLifoStack.h"
 
@@ -31,6 +32,22 @@
 #define DEBUG_COUNT_SHARED_BUFFER_ALLOCATIONS
 #endif
 
+/*
+    Short paths are allocated from a fixed slab of slots, and interned: allocating a path
+    that is already live returns the existing buffer with an extra reference. Longer paths,
+    and all paths once the slab is full, are malloc'd and not interned.
+
+    The intern table is lock-free, open addressed, and only holds slab buffers. Slab memory
+    is never returned to the heap, so a lookup may safely examine a buffer that is being 
+    reclaimed or reused: it only takes a reference if the reference count is non-zero, then 
+    checks the string. (Reclaimed slots keep a zero reference count, see SlabSlot.)
+*/
+
+#define IO_SHARED_BUFFER_SLAB_SLOT_COUNT        (1024)
+#define IO_SHARED_BUFFER_SLAB_BUFFER_BYTES      (256) // includes the SharedBuffer header
+#define IO_SHARED_BUFFER_INTERN_TABLE_SIZE      (4096) // must be a power of two
+#define IO_SHARED_BUFFER_INTERN_MAX_PROBE_COUNT (16)
+
 namespace {
   
 struct MemoryBlock {
@@ -39,16 +56,128 @@ struct MemoryBlock {
 
 static QwMpmcPopAllLifoStack<MemoryBlock*,0> reclaimQueue_;
 
+// A malloc'd buffer is linked into the reclaim queue through its own memory. A slab buffer 
+// uses the slot's link, so that its reference count stays zero while it is queued.
+struct SlabSlot {
+    MemoryBlock reclaimLink; // (must be the first member)
+    mint_atomic32_t isInUse;
+    mint_atomic32_t hash; // hash of the path, set before the buffer is interned
+    union {
+        SharedBuffer buffer;
+        char bytes_[IO_SHARED_BUFFER_SLAB_BUFFER_BYTES];
+    };
+};
+
+static SlabSlot slab_[IO_SHARED_BUFFER_SLAB_SLOT_COUNT];
+static mint_atomic32_t slabCursor_ = {0}; // where to start looking for a free slot
+
+// Entries are 0 (never used, ends a probe sequence), internTableTombstone_ (removed), or a slab buffer.
+static mint_atomicPtr_t internTable_[IO_SHARED_BUFFER_INTERN_TABLE_SIZE];
+static char internTableTombstone_;
+
 #ifdef DEBUG_COUNT_SHARED_BUFFER_ALLOCATIONS
 mint_atomic32_t allocCount_ = {0};
 #endif
 
+inline bool isSlabBuffer( const void *p )
+{
+    return (p >= static_cast<const void*>(&slab_[0]) && p < static_cast<const void*>(&slab_[IO_SHARED_BUFFER_SLAB_SLOT_COUNT]));
+}
+
+inline SlabSlot *slotForBuffer( SharedBuffer *p )
+{
+    return &slab_[(reinterpret_cast<char*>(p) - reinterpret_cast<char*>(&slab_[0])) / sizeof(SlabSlot)];
+}
+
+uint32_t hashPath( const char *s ) // FNV-1a
+{
+    uint32_t h = 2166136261u;
+    for (const unsigned char *c = reinterpret_cast<const unsigned char*>(s); *c; ++c)
+        h = (h ^ *c) * 16777619u;
+    return h;
+}
+
+// Add a reference, unless the buffer has already been released for reclamation
+bool tryAddRef( SharedBuffer *p )
+{
+    uint32_t refCount = mint_load_32_relaxed(&p->refCount);
+    while (refCount != 0) {
+        uint32_t previous = mint_compare_exchange_strong_32_relaxed(&p->refCount, refCount, refCount + 1);
+        if (previous == refCount) {
+            mint_thread_fence_acquire(); // (the path was written before the reference count was set)
+            return true;
+        }
+        refCount = previous;
+    }
+    return false;
+}
+
+SharedBuffer *findInternedBuffer( const char *s, uint32_t hash )
+{
+    for (uint32_t i=0; i < IO_SHARED_BUFFER_INTERN_MAX_PROBE_COUNT; ++i) {
+        void *entry = mint_load_ptr_relaxed(&internTable_[(hash + i) & (IO_SHARED_BUFFER_INTERN_TABLE_SIZE - 1)]);
+        if (!entry)
+            return 0;
+        if (entry == &internTableTombstone_)
+            continue;
+
+        SharedBuffer *p = static_cast<SharedBuffer*>(entry);
+        if (mint_load_32_relaxed(&slotForBuffer(p)->hash) == hash && tryAddRef(p)) {
+            if (std::strcmp(p->data, s) == 0)
+                return p;
+            p->release(); // the slot was reused for another path
+        }
+    }
+
+    return 0;
+}
+
+void internBuffer( SharedBuffer *p, uint32_t hash )
+{
+    // (If the probe sequence is full the buffer isn't interned. Concurrent allocations of 
+    // the same path may both intern their buffers, later lookups find the first one.)
+    for (uint32_t i=0; i < IO_SHARED_BUFFER_INTERN_MAX_PROBE_COUNT; ++i) {
+        mint_atomicPtr_t *entry = &internTable_[(hash + i) & (IO_SHARED_BUFFER_INTERN_TABLE_SIZE - 1)];
+        void *expected = mint_load_ptr_relaxed(entry);
+        if ((expected == 0 || expected == &internTableTombstone_)
+                && mint_compare_exchange_strong_ptr_relaxed(entry, expected, p) == expected)
+            return;
+    }
+}
+
+void removeInternedBuffer( SharedBuffer *p, uint32_t hash )
+{
+    for (uint32_t i=0; i < IO_SHARED_BUFFER_INTERN_MAX_PROBE_COUNT; ++i) {
+        mint_atomicPtr_t *entry = &internTable_[(hash + i) & (IO_SHARED_BUFFER_INTERN_TABLE_SIZE - 1)];
+        if (mint_compare_exchange_strong_ptr_relaxed(entry, p, &internTableTombstone_) == p)
+            return;
+    }
+}
+
+SharedBuffer *allocSlabBuffer( uint32_t hash )
+{
+    uint32_t start = mint_fetch_add_32_relaxed(&slabCursor_, 1);
+    for (uint32_t i=0; i < IO_SHARED_BUFFER_SLAB_SLOT_COUNT; ++i) {
+        SlabSlot *slot = &slab_[(start + i) % IO_SHARED_BUFFER_SLAB_SLOT_COUNT];
+        if (mint_load_32_relaxed(&slot->isInUse) == 0
+                && mint_compare_exchange_strong_32_relaxed(&slot->isInUse, 0, 1) == 0) {
+            mint_thread_fence_acquire(); // (pairs with the release in reclaimMemory())
+            mint_store_32_relaxed(&slot->hash, hash);
+            return &slot->buffer;
+        }
+    }
+
+    return 0; // slab is full
+}
+
 } // end anonymous namespace
 
 
 void SharedBufferAllocator::enqueueForReclamation( SharedBuffer *p )
 {
-    MemoryBlock *b = reinterpret_cast<MemoryBlock*>(p);
+    mint_thread_fence_acquire(); // (pairs with the release in SharedBuffer::release())
+
+    MemoryBlock *b = (isSlabBuffer(p)) ? &slotForBuffer(p)->reclaimLink : reinterpret_cast<MemoryBlock*>(p);
     b->links_[0] = 0;
     reclaimQueue_.push(b);
 }
@@ -61,7 +190,14 @@ void SharedBufferAllocator::reclaimMemory()
         MemoryBlock *k = b;
         b = k->links_[0];
 
-        std::free(k);
+        if (isSlabBuffer(k)) {
+            SlabSlot *slot = reinterpret_cast<SlabSlot*>(k);
+            removeInternedBuffer(&slot->buffer, mint_load_32_relaxed(&slot->hash));
+            mint_thread_fence_release();
+            mint_store_32_relaxed(&slot->isInUse, 0);
+        } else {
+            std::free(k);
+        }
 
 #ifdef DEBUG_COUNT_SHARED_BUFFER_ALLOCATIONS
         mint_fetch_add_32_relaxed(&allocCount_,-1);
@@ -71,9 +207,26 @@ void SharedBufferAllocator::reclaimMemory()
 
 SharedBuffer* SharedBufferAllocator::alloc( const char *s )
 {
-    reclaimMemory();
+    size_t length = strlen(s);
+    if (sizeof(SharedBuffer) + length <= IO_SHARED_BUFFER_SLAB_BUFFER_BYTES) {
+        uint32_t hash = hashPath(s);
+        if (SharedBuffer *result = findInternedBuffer(s, hash))
+            return result;
+
+        if (SharedBuffer *result = allocSlabBuffer(hash)) {
+            std::strcpy(result->data, s);
+            mint_thread_fence_release(); // publish the path before the reference count (see tryAddRef())
+            mint_store_32_relaxed(&result->refCount, 1);
+            internBuffer(result, hash);
+
+#ifdef DEBUG_COUNT_SHARED_BUFFER_ALLOCATIONS
+            mint_fetch_add_32_relaxed(&allocCount_,1);
+#endif
+            return result;
+        }
+    }
 
-    SharedBuffer *result = (SharedBuffer*)std::malloc( sizeof(SharedBuffer) + strlen(s) );
+    SharedBuffer *result = (SharedBuffer*)std::malloc( sizeof(SharedBuffer) + length );
     if (result) {
         result->refCount._nonatomic = 1;
         std::strcpy(result->data, s);
@@ -29,7 +29,10 @@
 /*
     Reference counted shared buffer with real-time safe deallocation.
 
-    Used for path strings.
+    Used for path strings. Short paths are interned: allocating a path that is 
+    already live returns the same buffer, with an extra reference. They're 
+    allocated from a fixed slab, without calling malloc. Released buffers are 
+    queued, and reclaimed in batches by the file I/O server. 
 */
 
 struct SharedBuffer{
@@ -60,9 +63,9 @@ struct SharedBufferAllocator {
     
     static SharedBuffer* alloc( const char *s );
 
-    // Call this once at the end of the program to ensure that all paths are freed.
-    // This is called internally whenever you allocate a new shared buffer, 
-    // so you don't need to call it during program execution.
+    // Call this once at the end of the program (after shutting down the file I/O 
+    // server) to ensure that all paths are freed. While the server is running its 
+    // workers call this, so you don't need to call it during program execution.
     static void reclaimMemory();
 
     static void checkForLeaks();
@@ -75,6 +78,7 @@ private:
 
 inline void SharedBuffer::release()
 {
+    mint_thread_fence_release(); // (this reference's reads happen before the buffer is reclaimed and reused)
     if (mint_fetch_add_32_relaxed(&refCount,-1)==1)
         SharedBufferAllocator::enqueueForReclamation(this);
 }
@@ -0,0 +1,557 @@
+/* 
+    Real Time File Streaming copyright (c) 2014 Ross Bencina
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+#ifdef WIN32
+#include <Windows.h>
+#else
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#endif
+
+#include "FileIoServer.h"
+#include "FileIoStreams.h"
+#include "FileIoStats.h"
+
+/*
+    Streaming benchmark. Runs a fake audio clock (the main thread sleeps until each buffer 
+    period is due, then services every stream, like an audio callback) against N read 
+    streams and M write streams on generated files of 16-bit sample frames, then reports 
+    throughput, deadline misses, block arrival slack, server statistics and server CPU time.
+
+    Build it like RecordAndPlayFileMain.cpp, with this file in place of RecordAndPlayFileMain.cpp
+    (it doesn't need PortAudio). Run with -h for options. To compare I/O backends, run with 
+    -e sync and -e uring (Linux), with and without -m (memory-mapped reads) and -D (direct writes).
+*/
+
+struct BenchmarkOptions {
+    int readStreamCount;
+    int writeStreamCount;
+    int framesPerBuffer;
+    int sampleRate;
+    int channelCount;
+    double runSeconds;
+    double bufferingSeconds;
+    size_t blockSizeBytes;
+    int workerCount;
+    FileIoServerIoEngine ioEngine;
+    bool mappedReads;
+    bool directWrites;
+    bool batchReads;
+    size_t resultPollingBudget;
+    unsigned long serverSpinMicroseconds;
+    const char *directory;
+
+    BenchmarkOptions()
+        : readStreamCount( 8 )
+        , writeStreamCount( 2 )
+        , framesPerBuffer( 256 )
+        , sampleRate( 44100 )
+        , channelCount( 2 )
+        , runSeconds( 10. )
+        , bufferingSeconds( .5 )
+        , blockSizeBytes( IO_DATA_BLOCK_DATA_CAPACITY_BYTES )
+        , workerCount( 1 )
+        , ioEngine( FILE_IO_SERVER_IO_ENGINE_IO_URING )
+        , mappedReads( false )
+        , directWrites( false )
+        , batchReads( false )
+        , resultPollingBudget( 0 )
+        , serverSpinMicroseconds( 0 )
+        , directory( "." )
+    {}
+};
+
+static void printUsage()
+{
+    printf("usage: StreamingBenchmark [options]\n");
+    printf("  -r <count>    read streams (default 8)\n");
+    printf("  -w <count>    write streams (default 2)\n");
+    printf("  -n <frames>   frames per buffer of the fake audio clock (default 256)\n");
+    printf("  -s <rate>     sample rate (default 44100)\n");
+    printf("  -c <count>    channels of 16-bit samples per frame (default 2)\n");
+    printf("  -t <seconds>  run time (default 10)\n");
+    printf("  -p <seconds>  stream buffering time (default 0.5)\n");
+    printf("  -b <bytes>    stream block size (default %d)\n", IO_DATA_BLOCK_DATA_CAPACITY_BYTES);
+    printf("  -k <count>    server workers (default 1)\n");
+    printf("  -e sync|uring server I/O engine (default uring, falls back to sync where unavailable)\n");
+    printf("  -m            memory-mapped reads (READ_ONLY_MAPPED_OPEN_MODE)\n");
+    printf("  -D            direct writes (READ_WRITE_OVERWRITE_DIRECT_OPEN_MODE)\n");
+    printf("  -a            read all streams with one FileIoReadStream_readBatch() per buffer\n");
+    printf("  -q <count>    result polling budget per stream call (default 0, unbounded)\n");
+    printf("  -y <us>       server spin time before sleeping (default 0, always sleep)\n");
+    printf("  -d <path>     directory for the generated files (default .)\n");
+}
+
+static bool parseOptions( int argc, char *argv[], BenchmarkOptions *options )
+{
+    for (int i=1; i < argc; ++i) {
+        const char *option = argv[i];
+        const char *value = (i + 1 < argc) ? argv[i + 1] : 0;
+
+        if (strcmp(option, "-m") == 0) {
+            options->mappedReads = true;
+        } else if (strcmp(option, "-D") == 0) {
+            options->directWrites = true;
+        } else if (strcmp(option, "-a") == 0) {
+            options->batchReads = true;
+        } else if (!value || option[0] != '-' || option[1] == 0 || option[2] != 0) {
+            return false;
+        } else {
+            switch (option[1]) {
+            case 'r': options->readStreamCount = atoi(value); break;
+            case 'w': options->writeStreamCount = atoi(value); break;
+            case 'n': options->framesPerBuffer = atoi(value); break;
+            case 's': options->sampleRate = atoi(value); break;
+            case 'c': options->channelCount = atoi(value); break;
+            case 't': options->runSeconds = atof(value); break;
+            case 'p': options->bufferingSeconds = atof(value); break;
+            case 'b': options->blockSizeBytes = (size_t)atol(value); break;
+            case 'k': options->workerCount = atoi(value); break;
+            case 'q': options->resultPollingBudget = (size_t)atol(value); break;
+            case 'y': options->serverSpinMicroseconds = (unsigned long)atol(value); break;
+            case 'd': options->directory = value; break;
+            case 'e':
+                if (strcmp(value, "sync") == 0)
+                    options->ioEngine = FILE_IO_SERVER_IO_ENGINE_SYNCHRONOUS;
+                else if (strcmp(value, "uring") == 0)
+                    options->ioEngine = FILE_IO_SERVER_IO_ENGINE_IO_URING;
+                else
+                    return false;
+                break;
+            default:
+                return false;
+            }
+            ++i; // (consumed value)
+        }
+    }
+
+    return options->readStreamCount >= 0 && options->writeStreamCount >= 0 
+            && options->readStreamCount + options->writeStreamCount > 0
+            && options->framesPerBuffer > 0 && options->sampleRate > 0 && options->channelCount > 0
+            && options->runSeconds > 0. && options->bufferingSeconds > 0. && options->workerCount > 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Clock and CPU time
+
+static void sleepMicroseconds( uint64_t microseconds )
+{
+#ifdef WIN32
+    Sleep((DWORD)(microseconds / 1000));
+#else
+    usleep((useconds_t)microseconds);
+#endif
+}
+
+#ifdef WIN32
+static uint64_t fileTimeToMicroseconds( const FILETIME& t )
+{
+    ULARGE_INTEGER x;
+    x.LowPart = t.dwLowDateTime;
+    x.HighPart = t.dwHighDateTime;
+    return x.QuadPart / 10; // 100ns units
+}
+#endif
+
+static uint64_t processCpuTimeMicroseconds()
+{
+#ifdef WIN32
+    FILETIME creationTime, exitTime, kernelTime, userTime;
+    GetProcessTimes(GetCurrentProcess(), &creationTime, &exitTime, &kernelTime, &userTime);
+    return fileTimeToMicroseconds(kernelTime) + fileTimeToMicroseconds(userTime);
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (uint64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+#endif
+}
+
+static uint64_t threadCpuTimeMicroseconds()
+{
+#ifdef WIN32
+    FILETIME creationTime, exitTime, kernelTime, userTime;
+    GetThreadTimes(GetCurrentThread(), &creationTime, &exitTime, &kernelTime, &userTime);
+    return fileTimeToMicroseconds(kernelTime) + fileTimeToMicroseconds(userTime);
+#else
+    struct timespec t;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+    return (uint64_t)t.tv_sec * 1000000 + t.tv_nsec / 1000;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Generated files
+
+static void makeFilePath( char *result, size_t resultSize, const char *directory, const char *name, int index )
+{
+#ifdef WIN32
+    _snprintf(result, resultSize, "%s\\benchmark_%s_%d.dat", directory, name, index);
+    result[resultSize - 1] = 0;
+#else
+    snprintf(result, resultSize, "%s/benchmark_%s_%d.dat", directory, name, index);
+#endif
+}
+
+static bool generateReadFile( const char *path, uint64_t byteCount, int seed )
+{
+    FILE *fp = fopen(path, "wb");
+    if (!fp)
+        return false;
+
+    int16_t samples[8192];
+    uint64_t sampleIndex = 0;
+    bool ok = true;
+    while (ok && byteCount > 0) {
+        for (size_t i=0; i < 8192; ++i, ++sampleIndex)
+            samples[i] = (int16_t)(sampleIndex * 7 + seed);
+        size_t chunkBytes = (size_t)std::min<uint64_t>(byteCount, sizeof(samples));
+        ok = (fwrite(samples, 1, chunkBytes, fp) == chunkBytes);
+        byteCount -= chunkBytes;
+    }
+
+    return (fclose(fp) == 0) && ok;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Reporting
+
+static double histogramMean( const FileIoHistogram& h )
+{
+    return (h.count > 0) ? (double)h.total / (double)h.count : 0.;
+}
+
+static void printHistogram( const char *name, const char *units, const FileIoHistogram& h )
+{
+    if (h.count == 0) {
+        printf("  %-32s (none)\n", name);
+        return;
+    }
+
+    printf("  %-32s n %8lu  mean %10.1f  p50 <%8llu  p99 <%8llu  max %8llu %s\n", name, (unsigned long)h.count, histogramMean(h),
+            (unsigned long long)fileIoHistogramPercentile(h, .5), (unsigned long long)fileIoHistogramPercentile(h, .99),
+            (unsigned long long)h.max, units);
+}
+
+static const char *requestTypeName( int requestType )
+{
+    switch (requestType) {
+    case FileIoRequest::OPEN_FILE: return "OPEN_FILE";
+    case FileIoRequest::CLOSE_FILE: return "CLOSE_FILE";
+    case FileIoRequest::READ_BLOCK: return "READ_BLOCK";
+    case FileIoRequest::RELEASE_READ_BLOCK: return "RELEASE_READ_BLOCK";
+    case FileIoRequest::ALLOCATE_WRITE_BLOCK: return "ALLOCATE_WRITE_BLOCK";
+    case FileIoRequest::COMMIT_MODIFIED_WRITE_BLOCK: return "COMMIT_MODIFIED_WRITE_BLOCK";
+    case FileIoRequest::RELEASE_UNMODIFIED_WRITE_BLOCK: return "RELEASE_UNMODIFIED_WRITE_BLOCK";
+    case FileIoRequest::CLEANUP_RESULT_QUEUE: return "CLEANUP_RESULT_QUEUE";
+    }
+    return "?";
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char *argv[]);
+int main(int argc, char *argv[])
+{
+    BenchmarkOptions options;
+    if (!parseOptions(argc, argv, &options)) {
+        printUsage();
+        return 1;
+    }
+
+    const size_t bytesPerFrame = options.channelCount * sizeof(int16_t);
+    const size_t bytesPerSecond = bytesPerFrame * options.sampleRate;
+    const int streamCount = options.readStreamCount + options.writeStreamCount;
+    const uint64_t callbackCount = (uint64_t)(options.runSeconds * options.sampleRate / options.framesPerBuffer);
+    const double periodMicroseconds = (options.framesPerBuffer * 1000000.) / options.sampleRate;
+
+    // generate the read files: enough data for the whole run, with a margin for prefetching
+
+    printf("generating %d files of %.1f MB...\n", options.readStreamCount, 
+            ((options.runSeconds + options.bufferingSeconds * 4 + 1.) * bytesPerSecond) / (1024. * 1024.));
+
+    const uint64_t readFileBytes = (uint64_t)((options.runSeconds + options.bufferingSeconds * 4 + 1.) * bytesPerSecond);
+    char path[1024];
+    for (int i=0; i < options.readStreamCount; ++i) {
+        makeFilePath(path, sizeof(path), options.directory, "read", i);
+        if (!generateReadFile(path, readFileBytes, i)) {
+            fprintf(stderr, "error: couldn't write %s\n", path);
+            return 1;
+        }
+    }
+
+    // size the request pool and the data block arena for the streams, allowing for prefetch queue growth
+
+    const size_t blockSizeBytes = dataBlockCapacityForSizeClass(dataBlockSizeClassForCapacity(options.blockSizeBytes));
+    const size_t prefetchBlockCount = (size_t)((bytesPerSecond * options.bufferingSeconds) / blockSizeBytes) + 2;
+
+    FileIoServerConfig serverConfig;
+    serverConfig.fileIoRequestCount = std::max<size_t>(MAX_FILE_IO_REQUESTS, streamCount * (prefetchBlockCount * 4 + 8));
+    serverConfig.dataBlockCounts[ dataBlockSizeClassForCapacity(blockSizeBytes) ] = 
+            std::max<size_t>(serverConfig.dataBlockCounts[ dataBlockSizeClassForCapacity(blockSizeBytes) ], streamCount * (prefetchBlockCount * 2 + 2));
+    serverConfig.workerCount = options.workerCount;
+    serverConfig.ioEngine = options.ioEngine;
+    serverConfig.serverSpinMicroseconds = options.serverSpinMicroseconds;
+    startFileIoServer(serverConfig);
+
+    // open the streams and wait for them to buffer
+
+    std::vector<READSTREAM*> readStreams(options.readStreamCount);
+    for (int i=0; i < options.readStreamCount; ++i) {
+        makeFilePath(path, sizeof(path), options.directory, "read", i);
+        SharedBuffer *filePath = SharedBufferAllocator::alloc(path);
+        readStreams[i] = FileIoReadStream_open(filePath, 
+                (options.mappedReads) ? FileIoRequest::READ_ONLY_MAPPED_OPEN_MODE : FileIoRequest::READ_ONLY_OPEN_MODE, 
+                bytesPerSecond, options.bufferingSeconds, blockSizeBytes);
+        filePath->release();
+        if (readStreams[i])
+            FileIoReadStream_setResultPollingBudget(readStreams[i], options.resultPollingBudget);
+    }
+
+    std::vector<WRITESTREAM*> writeStreams(options.writeStreamCount);
+    for (int i=0; i < options.writeStreamCount; ++i) {
+        makeFilePath(path, sizeof(path), options.directory, "write", i);
+        SharedBuffer *filePath = SharedBufferAllocator::alloc(path);
+        writeStreams[i] = FileIoWriteStream_open(filePath, 
+                (options.directWrites) ? FileIoRequest::READ_WRITE_OVERWRITE_DIRECT_OPEN_MODE : FileIoRequest::READ_WRITE_OVERWRITE_OPEN_MODE,
+                bytesPerSecond, options.bufferingSeconds, blockSizeBytes);
+        filePath->release();
+        if (writeStreams[i])
+            FileIoWriteStream_setResultPollingBudget(writeStreams[i], options.resultPollingBudget);
+    }
+
+    bool openFailed = false;
+    for (int i=0; i < options.readStreamCount; ++i) {
+        if (!readStreams[i]) {
+            openFailed = true;
+            continue;
+        }
+        while (FileIoReadStream_pollState(readStreams[i]) == STREAM_STATE_OPENING)
+            sleepMicroseconds(1000);
+        if (FileIoReadStream_seek(readStreams[i], 0) != 0)
+            openFailed = true;
+    }
+    for (int i=0; i < options.writeStreamCount; ++i) {
+        if (!writeStreams[i]) {
+            openFailed = true;
+            continue;
+        }
+        while (FileIoWriteStream_pollState(writeStreams[i]) == STREAM_STATE_OPENING)
+            sleepMicroseconds(1000);
+        if (FileIoWriteStream_seek(writeStreams[i], 0) != 0)
+            openFailed = true;
+    }
+
+    for (int i=0; i < options.readStreamCount && !openFailed; ++i) {
+        while (FileIoReadStream_pollState(readStreams[i]) == STREAM_STATE_OPEN_BUFFERING)
+            sleepMicroseconds(1000);
+        if (FileIoReadStream_pollState(readStreams[i]) != STREAM_STATE_OPEN_STREAMING)
+            openFailed = true;
+    }
+    for (int i=0; i < options.writeStreamCount && !openFailed; ++i) {
+        while (FileIoWriteStream_pollState(writeStreams[i]) == STREAM_STATE_OPEN_BUFFERING)
+            sleepMicroseconds(1000);
+        if (FileIoWriteStream_pollState(writeStreams[i]) != STREAM_STATE_OPEN_STREAMING)
+            openFailed = true;
+    }
+
+    if (openFailed) {
+        fprintf(stderr, "error: couldn't open and buffer all streams\n");
+    } else {
+        printf("running %d read streams and %d write streams for %.1f s...\n", options.readStreamCount, options.writeStreamCount, options.runSeconds);
+
+        // the fake audio clock
+
+        std::vector<int16_t> buffer(options.framesPerBuffer * options.channelCount, 0);
+        std::vector< std::vector<int16_t> > readBuffers((options.batchReads) ? options.readStreamCount : 0, buffer);
+        std::vector<FileIoReadStreamBatchRead> batchReads(options.readStreamCount);
+
+        FileIoHistogramCounter callbackDuration;
+        uint64_t lateCallbackCount = 0;
+        uint64_t missedDeadlineCount = 0; // stream reads/writes that came up short
+        uint64_t callbacksWithMissedDeadlineCount = 0;
+        uint64_t bytesRead = 0, bytesWritten = 0;
+
+        const uint64_t processCpuTimeBegin = processCpuTimeMicroseconds();
+        const uint64_t clientCpuTimeBegin = threadCpuTimeMicroseconds();
+        const uint64_t startTime = getFileIoServerTimeMicroseconds();
+
+        for (uint64_t callback=0; callback < callbackCount; ++callback) {
+            const uint64_t dueTime = startTime + (uint64_t)(callback * periodMicroseconds);
+            uint64_t now = getFileIoServerTimeMicroseconds();
+            if (now < dueTime) {
+                sleepMicroseconds(dueTime - now);
+                now = getFileIoServerTimeMicroseconds();
+            }
+            if (now > dueTime + (uint64_t)periodMicroseconds)
+                ++lateCallbackCount; // the clock thread woke up more than a period late
+
+            uint64_t missedDeadlineCountBefore = missedDeadlineCount;
+
+            if (options.batchReads) {
+                for (int i=0; i < options.readStreamCount; ++i) {
+                    FileIoReadStreamBatchRead& read = batchReads[i];
+                    read.stream = readStreams[i];
+                    read.dest = &readBuffers[i][0];
+                    read.itemSize = bytesPerFrame;
+                    read.itemCount = options.framesPerBuffer;
+                }
+                FileIoReadStream_readBatch(&batchReads[0], options.readStreamCount);
+                for (int i=0; i < options.readStreamCount; ++i) {
+                    bytesRead += batchReads[i].itemsRead * bytesPerFrame;
+                    if (batchReads[i].itemsRead < (size_t)options.framesPerBuffer)
+                        ++missedDeadlineCount;
+                }
+            } else {
+                for (int i=0; i < options.readStreamCount; ++i) {
+                    size_t framesRead = FileIoReadStream_read(&buffer[0], bytesPerFrame, options.framesPerBuffer, readStreams[i]);
+                    bytesRead += framesRead * bytesPerFrame;
+                    if (framesRead < (size_t)options.framesPerBuffer)
+                        ++missedDeadlineCount;
+                }
+            }
+
+            for (int i=0; i < options.writeStreamCount; ++i) {
+                size_t framesWritten = FileIoWriteStream_write(&buffer[0], bytesPerFrame, options.framesPerBuffer, writeStreams[i]);
+                bytesWritten += framesWritten * bytesPerFrame;
+                if (framesWritten < (size_t)options.framesPerBuffer)
+                    ++missedDeadlineCount;
+            }
+
+            if (missedDeadlineCount != missedDeadlineCountBefore)
+                ++callbacksWithMissedDeadlineCount;
+
+            callbackDuration.record(getFileIoServerTimeMicroseconds() - now);
+        }
+
+        const double elapsedSeconds = (getFileIoServerTimeMicroseconds() - startTime) / 1000000.;
+        const uint64_t clientCpuTime = threadCpuTimeMicroseconds() - clientCpuTimeBegin;
+        const uint64_t processCpuTime = processCpuTimeMicroseconds() - processCpuTimeBegin;
+        const uint64_t serverCpuTime = (processCpuTime > clientCpuTime) ? processCpuTime - clientCpuTime : 0;
+
+        // collect the stream statistics while the streams are open
+
+        std::vector<size_t> minPrefetchSlackBlockCounts;
+        size_t underrunCount = 0;
+        size_t maxResultQueueDepth = 0;
+        size_t maxResultsRetiredPerCall = 0;
+        for (int i=0; i < streamCount; ++i) {
+            FileIoStreamStats stats;
+            if (i < options.readStreamCount)
+                FileIoReadStream_getStats(readStreams[i], &stats);
+            else
+                FileIoWriteStream_getStats(writeStreams[i - options.readStreamCount], &stats);
+            underrunCount += stats.underrunCount;
+            maxResultQueueDepth = std::max(maxResultQueueDepth, stats.maxResultQueueDepth);
+            maxResultsRetiredPerCall = std::max(maxResultsRetiredPerCall, stats.maxResultsRetiredPerCall);
+            if (stats.minPrefetchSlackBlockCount != (size_t)-1)
+                minPrefetchSlackBlockCounts.push_back(stats.minPrefetchSlackBlockCount);
+        }
+        std::sort(minPrefetchSlackBlockCounts.begin(), minPrefetchSlackBlockCounts.end());
+
+        FileIoHistogram callbackDurationHistogram;
+        clearFileIoHistogram(&callbackDurationHistogram);
+        callbackDuration.accumulate(&callbackDurationHistogram);
+
+        FileIoServerStats serverStats;
+        getFileIoServerStats(&serverStats);
+
+        // report
+
+        printf("\n%d read streams (%s), %d write streams (%s), %d workers, %s engine requested, %lu us server spin\n", 
+                options.readStreamCount, (options.mappedReads) ? "mapped" : "buffered",
+                options.writeStreamCount, (options.directWrites) ? "direct" : "buffered",
+                options.workerCount, (options.ioEngine == FILE_IO_SERVER_IO_ENGINE_IO_URING) ? "io_uring" : "synchronous",
+                options.serverSpinMicroseconds);
+        printf("%d frames per buffer (%.2f ms) at %d Hz, %d channels, %lu byte blocks, %.3f s buffering%s\n", 
+                options.framesPerBuffer, periodMicroseconds / 1000., options.sampleRate, options.channelCount,
+                (unsigned long)blockSizeBytes, options.bufferingSeconds, (options.batchReads) ? ", batched reads" : "");
+
+        printf("\nthroughput:\n");
+        printf("  read %.2f MB/s, written %.2f MB/s, total %.2f MB/s over %.2f s\n",
+                bytesRead / (1024. * 1024. * elapsedSeconds), bytesWritten / (1024. * 1024. * elapsedSeconds),
+                (bytesRead + bytesWritten) / (1024. * 1024. * elapsedSeconds), elapsedSeconds);
+
+        printf("\ndeadline misses:\n");
+        printf("  %llu of %llu stream reads/writes came up short (%llu of %llu buffers affected)\n",
+                (unsigned long long)missedDeadlineCount, (unsigned long long)(callbackCount * streamCount),
+                (unsigned long long)callbacksWithMissedDeadlineCount, (unsigned long long)callbackCount);
+        printf("  %lu stream underruns, %llu buffers started more than a period late\n", 
+                (unsigned long)underrunCount, (unsigned long long)lateCallbackCount);
+        printHistogram("buffer processing time", "us", callbackDurationHistogram);
+        printf("  most results retired by one stream call: %lu\n", (unsigned long)maxResultsRetiredPerCall);
+
+        printf("\nblock arrival slack:\n");
+        printHistogram("time to deadline", "us", serverStats.blockDeadlineSlack);
+        printf("  %lu blocks arrived after their deadline (the first block after a seek is due immediately), 1%% arrived with less than %llu us to spare\n", 
+                (unsigned long)serverStats.blockDeadlineSlack.binCounts[0],
+                (unsigned long long)fileIoHistogramPercentile(serverStats.blockDeadlineSlack, .01));
+        if (!minPrefetchSlackBlockCounts.empty()) {
+            printf("  fewest ready blocks per stream: min %lu, median %lu, max %lu; most requests in flight: %lu\n",
+                    (unsigned long)minPrefetchSlackBlockCounts.front(),
+                    (unsigned long)minPrefetchSlackBlockCounts[minPrefetchSlackBlockCounts.size() / 2],
+                    (unsigned long)minPrefetchSlackBlockCounts.back(), (unsigned long)maxResultQueueDepth);
+        }
+
+        printf("\nserver:\n");
+        for (int i=0; i < IO_STATS_REQUEST_TYPE_COUNT; ++i)
+            printHistogram(requestTypeName(i), "us", serverStats.requestLatency[i]);
+        printHistogram("read calls", "us", serverStats.readCallDuration);
+        printHistogram("write calls", "us", serverStats.writeCallDuration);
+        printHistogram("mailbox depth", "requests", serverStats.mailboxDepth);
+
+        printf("\ncpu time:\n");
+        printf("  server %.3f s (%.1f%% of one core), clock thread %.3f s\n", serverCpuTime / 1000000.,
+                (serverCpuTime / 10000.) / elapsedSeconds, clientCpuTime / 1000000.);
+    }
+
+    // clean up
+
+    for (int i=0; i < options.readStreamCount; ++i) {
+        if (readStreams[i])
+            FileIoReadStream_close(readStreams[i]);
+    }
+    for (int i=0; i < options.writeStreamCount; ++i) {
+        if (writeStreams[i])
+            FileIoWriteStream_close(writeStreams[i]);
+    }
+
+    sleepMicroseconds(100000); // let the server handle the close requests
+    shutDownFileIoServer();
+
+    for (int i=0; i < options.readStreamCount; ++i) {
+        makeFilePath(path, sizeof(path), options.directory, "read", i);
+        remove(path);
+    }
+    for (int i=0; i < options.writeStreamCount; ++i) {
+        makeFilePath(path, sizeof(path), options.directory, "write", i);
+        remove(path);
+    }
+
+    return (openFailed) ? 1 : 0;
+}